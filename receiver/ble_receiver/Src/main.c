@@ -88,11 +88,27 @@ void uint8_t_to_float( uint8_t *input, float *out );
 void reverse(char* str, int len);
 int intToStr(int x, char str[], int d);
 void ftoa(float n, char* res, int afterpoint);
+void uint8_t_to_quaternion( uint8_t *input, float *quat );
+void quaternion_to_euler( float *quat, float *euler_angles );
+void decode_sample( uint8_t *input, bool quaternion );
+void print_sample( uint32_t time, bool batched );
 
 
 #define DATA_LENGTH		12
 #define PACKET_OVERHEAD	12
 
+#define QUAT_LENGTH			6
+#define QUAT_BITS			15
+
+/* Bytes of a received frame after 0x02 0x84: length, 0x00, address (6), RSSI, payload, checksum */
+#define RX_HEADER_LENGTH	9
+#define RX_LENGTH(payload)	(RX_HEADER_LENGTH - 2 + (payload))	/* Length byte counts address (6) + RSSI + payload */
+#define RX_LENGTH_EULER		RX_LENGTH(DATA_LENGTH + 1)			/* 0x14, payload: 3 floats + battery */
+#define RX_LENGTH_QUAT		RX_LENGTH(QUAT_LENGTH + 1)			/* 0x0E, payload: smallest three quaternion + battery */
+#define RX_LENGTH_MIN		RX_LENGTH(1 + 1)					/* 0x09, count byte + battery, smallest batched frame */
+#define RX_LENGTH_BATCH(samples, record)	RX_LENGTH(1 + (samples) * (record) + 1)	/* Count byte + samples + battery */
+#define BATCH_QUATERNION	0x80		/* Flag in the count byte of a batched frame */
+
 #define START_BIT		0x02
 
 /* Buffers for interrupt based UART RX / TX */
@@ -105,16 +121,20 @@ uint8_t start_seq[START_SEQ_LENGTH] = { 0x02, 0x86, 0x07, 0x00, 0x00, 0xBC, 0x04
 
 char begin[2] = { (char) 0x02, (char) 0x84 }; //, (char) 0x13, (char) 0x00, (char) 0xBC, (char) 0x04, (char) 0x20, (char) 0xDA, (char) 0x18, (char) 0x00 };
 
-char buffer[23];
+char buffer[255 + 3];		/* Length byte can announce up to 255 bytes */
 bool test = false;
 
 float x[1];
 float y[1];
 float z[1];
+float quat[4];
+float euler[3];
 float rssi[1];
 
 float battery_percent[1];
 
+uint32_t sample_time = 0;		/* ms, sum of the deltas in batched frames */
+
 char x_send[20];
 char y_send[20];
 char z_send[20];
@@ -203,32 +223,53 @@ int main(void)
 
 	  if(IsDataAvailable())
 	  {
-		  if(Get_after(begin, 23, buffer))
+		  /* Length byte first, it tells the frame types apart */
+		  if(Get_after(begin, 1, buffer))
 		  {
-			  test = true;
-
-			  uint8_t_to_float( &buffer[9], x);
-			  uint8_t_to_float( &buffer[13], y);
-			  uint8_t_to_float( &buffer[17], z);
+			  uint8_t length = (uint8_t) buffer[0];
+			  if(length < RX_LENGTH_MIN)
+			  {
+				  continue;
+			  }
 
-			  rssi[0] = (float)(int8_t)buffer[8];
+			  for(int i = 1; i < length + 3; i++)
+			  {
+				  while(!IsDataAvailable());
+				  buffer[i] = Uart_read();
+			  }
 
-			  battery_percent[0] = (uint8_t) buffer[21];
+			  test = true;
 
-			  ftoa(x[0], x_send, 4);
-			  ftoa(y[0], y_send, 4);
-			  ftoa(z[0], z_send, 4);
+			  rssi[0] = (float)(int8_t)buffer[8];
+			  battery_percent[0] = (uint8_t) buffer[length + 1];
 
+			  if((length == RX_LENGTH_EULER) || (length == RX_LENGTH_QUAT))
+			  {
+				  /* One sample per frame */
+				  decode_sample( (uint8_t *) &buffer[RX_HEADER_LENGTH], length == RX_LENGTH_QUAT );
+				  print_sample( 0, false );
+				  continue;
+			  }
 
-			  printf("%f\t%f\t%f\t%f\t%f\r\n", x[0], y[0], z[0], battery_percent[0], rssi[0]);
+			  /* Batched frame: count, samples (ms delta + orientation), battery */
+			  uint8_t samples = (uint8_t) buffer[RX_HEADER_LENGTH] & ~BATCH_QUATERNION;
+			  bool quaternion = ((uint8_t) buffer[RX_HEADER_LENGTH] & BATCH_QUATERNION) != 0;
+			  uint8_t record = 1 + (quaternion ? QUAT_LENGTH : DATA_LENGTH);
 
-			  count++;
-			  if(count==(51*1))
+			  if(length != RX_LENGTH_BATCH(samples, record))
 			  {
-				  HAL_GPIO_TogglePin(GPIOB, GPIO_PIN_14);
-				  count=0;
+				  continue;
 			  }
 
+			  for(uint8_t i = 0; i < samples; i++)
+			  {
+				  uint8_t *p = (uint8_t *) &buffer[RX_HEADER_LENGTH + 1 + i * record];
+
+				  /* Delta is saturated when samples were lost or after a pause */
+				  sample_time += p[0];
+				  decode_sample( &p[1], quaternion );
+				  print_sample( sample_time, true );
+			  }
 		  }
 	  }
   }
@@ -464,6 +505,93 @@ void uint8_t_to_float( uint8_t *input, float *out )
 }
 
 
+/* Euler angles of one sample into x, y, z */
+void decode_sample( uint8_t *input, bool quaternion )
+{
+	if(quaternion)
+	{
+		/* Euler angles are computed here instead of on the sensor node */
+		uint8_t_to_quaternion( input, quat );
+		quaternion_to_euler( quat, euler );
+		x[0] = euler[0];
+		y[0] = euler[1];
+		z[0] = euler[2];
+	}else{
+		uint8_t_to_float( &input[0], x);
+		uint8_t_to_float( &input[4], y);
+		uint8_t_to_float( &input[8], z);
+	}
+}
+
+/* Line for visualisation_receiver.py, batched samples get their time in ms as extra column */
+void print_sample( uint32_t time, bool batched )
+{
+	if(batched)
+	{
+		printf("%f\t%f\t%f\t%f\t%f\t%lu\r\n", x[0], y[0], z[0], battery_percent[0], rssi[0], (unsigned long) time);
+	}else{
+		printf("%f\t%f\t%f\t%f\t%f\r\n", x[0], y[0], z[0], battery_percent[0], rssi[0]);
+	}
+
+	count++;
+	if(count==(51*1))
+	{
+		HAL_GPIO_TogglePin(GPIOB, GPIO_PIN_14);
+		count=0;
+	}
+}
+
+/* Unpack a smallest three encoded quaternion, see quaternion_to_uint8_t on the sensor node */
+void uint8_t_to_quaternion( uint8_t *input, float *quat )
+{
+	uint64_t packed = 0;
+	uint8_t largest;
+	float sum = 0.0f;
+
+	for( int i=QUAT_LENGTH-1; i>=0; i-- )
+	{
+		packed = (packed << 8) | input[i];
+	}
+
+	largest = (packed >> (3 * QUAT_BITS)) & 0x03;
+
+	/* Last transmitted component in the lowest bits */
+	for( int i=3; i>=0; i-- )
+	{
+		if( i == largest )
+		{
+			continue;
+		}
+
+		uint32_t value = packed & ((1 << QUAT_BITS) - 1);
+		packed >>= QUAT_BITS;
+
+		quat[i] = ( (float) value / ((1 << QUAT_BITS) - 1) * 2.0f - 1.0f ) * 0.70710678f;
+		sum += quat[i] * quat[i];
+	}
+
+	quat[largest] = (sum < 1.0f) ? sqrtf(1.0f - sum) : 0.0f;
+}
+
+/* Same conversion as QuaternionsToEulerAngles on the sensor node: roll, pitch, yaw in rad */
+void quaternion_to_euler( float *quat, float *euler_angles )
+{
+	float q0 = quat[0], q1 = quat[1], q2 = quat[2], q3 = quat[3];
+
+	// roll (x-axis rotation)
+	euler_angles[0] = atan2f(2 * (q0 * q1 + q2 * q3), 1 - 2 * (q1 * q1 + q2 * q2));
+
+	// pitch (y-axis rotation)
+	float sinp = 2 * (q0 * q2 - q3 * q1);
+	if (fabsf(sinp) >= 1)
+		euler_angles[1] = copysignf(M_PI / 2, sinp); // use 90 degrees if out of range
+	else
+		euler_angles[1] = asinf(sinp);
+
+	// yaw (z-axis rotation)
+	euler_angles[2] = atan2f(2 * (q0 * q3 + q1 * q2), 1 - 2 * (q2 * q2 + q3 * q3));
+}
+
 // Reverses a string 'str' of length 'len'
 void reverse(char* str, int len)
 {
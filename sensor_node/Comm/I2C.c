@@ -32,10 +32,13 @@
  *  	Used for interfacing with sensors.
  */
 
+#include "I2C.h"
+
+#if I2C_SIMULATOR == 0
+
 #include <i2cspm.h>
 #include <em_i2c.h>
-
-#include "I2C.h"
+#include <em_emu.h>
 
 #include "pinout.h"
 
@@ -43,6 +46,27 @@
 
 I2CSPM_Init_TypeDef i2cInit = I2CSPM_INIT_DEFAULT;
 
+/* Interrupts that advance the emlib transfer state machine, plus clock low timeout */
+#define IIC_TRANSFER_IEN	(I2C_IEN_ACK | I2C_IEN_NACK | I2C_IEN_RXDATAV | I2C_IEN_MSTOP | I2C_IEN_ARBLOST | I2C_IEN_BUSERR | I2C_IEN_CLTO)
+
+static IIC_Transfer_t * volatile activeTransfer = NULL;	/**< Transfer on the bus, NULL when idle */
+
+/* Bus frequency and clock low/high ratio of each IIC_Speed_t profile */
+static const struct
+{
+	uint32_t freq;
+	I2C_ClockHLR_TypeDef clhr;
+} busProfiles[] =
+{
+	{ I2C_FREQ_STANDARD_MAX, i2cClockHLRStandard },		/* IIC_SPEED_STANDARD */
+	{ I2C_FREQ_FAST_MAX, i2cClockHLRAsymetric },		/* IIC_SPEED_FAST */
+	{ I2C_FREQ_FASTPLUS_MAX, i2cClockHLRFast }			/* IIC_SPEED_FAST_PLUS */
+};
+
+static IIC_Speed_t busSpeed = IIC_SPEED_STANDARD;		/**< Active bus profile */
+
+static I2C_TransferReturn_TypeDef IIC_Transfer(I2C_TransferSeq_TypeDef *seq);
+
 
 /**************************************************************************//**
  * @brief
@@ -66,6 +90,16 @@ void IIC_Init(void){
 //i2cInit.i2cMaxFreq = I2C_FREQ_FAST_MAX;
 
 	I2CSPM_Init(&i2cInit);
+	busSpeed = IIC_SPEED_STANDARD;
+
+	/* Abort when a slave holds SCL low, otherwise a transfer never completes */
+	i2cInit.port->CTRL |= I2C_CTRL_CLTO_1024PPC;
+
+	activeTransfer = NULL;
+	I2C_IntDisable(i2cInit.port, IIC_TRANSFER_IEN);
+	I2C_IntClear(i2cInit.port, _I2C_IF_MASK);
+	NVIC_ClearPendingIRQ(I2C0_IRQn);
+	NVIC_EnableIRQ(I2C0_IRQn);
 }
 
 void IIC_Enable( bool enable )
@@ -74,6 +108,9 @@ void IIC_Enable( bool enable )
 	{
 		GPIO_PinModeSet(ICM_20948_SDA_PORT, ICM_20948_SDA_PIN, gpioModeWiredAndPullUp, 1);
 		GPIO_PinModeSet(ICM_20948_SCL_PORT, ICM_20948_SCL_PIN, gpioModeWiredAndPullUp, 1);
+
+		/* HF clock may have changed while disabled, recalculate the divider */
+		IIC_SpeedSet(busSpeed);
 	}
 	else
 	{
@@ -96,6 +133,38 @@ void IIC_Reset(void){
 }
 
 
+/**************************************************************************//**
+ * @brief
+ *   Select a bus timing profile
+ *
+ * @details
+ *   Divider is calculated from the current HFPER clock. Don't call
+ *   while an interrupt driven transfer is running.
+ *
+ * @param[in] speed
+ *   profile, see IIC_Speed_t
+ *
+ *****************************************************************************/
+void IIC_SpeedSet(IIC_Speed_t speed){
+	if (speed > IIC_SPEED_FAST_PLUS) {
+		speed = IIC_SPEED_STANDARD;
+	}
+
+	I2C_BusFreqSet(i2cInit.port, 0, busProfiles[speed].freq, busProfiles[speed].clhr);
+	busSpeed = speed;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Get the active bus timing profile
+ *
+ *****************************************************************************/
+IIC_Speed_t IIC_SpeedGet(void){
+	return busSpeed;
+}
+
+
 /**************************************************************************//**
  * @brief
  *   I2C write functionality
@@ -123,7 +192,7 @@ bool IIC_WriteBuffer(uint8_t iicAddress, uint8_t * wBuffer, uint8_t wLength){
 	seq.buf[1].data = i2c_read_data;
 	seq.buf[1].len  = 0;
 
-	ret = I2CSPM_Transfer(i2cInit.port, &seq);
+	ret = IIC_Transfer(&seq);
 
 	if (ret != i2cTransferDone) {
 		return false;
@@ -160,7 +229,7 @@ bool IIC_ReadBuffer(uint8_t iicAddress, uint8_t * rBuffer, uint8_t rLength){
 	seq.buf[0].data = rBuffer;
 	seq.buf[0].len  = rLength;
 
-	ret = I2CSPM_Transfer(i2cInit.port, &seq);
+	ret = IIC_Transfer(&seq);
 
 	if (ret != i2cTransferDone) {
 		*rBuffer = 0;
@@ -201,7 +270,7 @@ bool IIC_WriteReadBuffer(uint8_t iicAddress, uint8_t * wBuffer, uint8_t wLength,
 	seq.buf[1].data = rBuffer;
 	seq.buf[1].len  = rLength;
 
-	ret = I2CSPM_Transfer(i2cInit.port, &seq);
+	ret = IIC_Transfer(&seq);
 
 	if (ret != i2cTransferDone) {
 		*rBuffer = 0;
@@ -210,3 +279,193 @@ bool IIC_WriteReadBuffer(uint8_t iicAddress, uint8_t * wBuffer, uint8_t wLength,
 
 	return true;
 }
+
+
+/**************************************************************************//**
+ * @brief
+ *   Start an interrupt driven transfer
+ *
+ * @details
+ *   Write-read when both lengths are set, write or read only otherwise.
+ *   Returns immediately, the callback is called from the I2C interrupt
+ *   when the transfer is done. The next transfer can be started from
+ *   within the callback.
+ *
+ * @param[in] transfer
+ *   descriptor, has to stay valid until the transfer is done
+ *
+ * @return
+ *   'true' if the transfer was started
+ *   'false' if the bus is busy or the transfer could not be set up,
+ *   the callback is not called in that case
+ *
+ *****************************************************************************/
+bool IIC_TransferStart(IIC_Transfer_t *transfer){
+	I2C_TransferReturn_TypeDef ret;
+
+	/* One transfer on the bus at a time */
+	__disable_irq();
+	if (activeTransfer != NULL) {
+		__enable_irq();
+		return false;
+	}
+	activeTransfer = transfer;
+	__enable_irq();
+
+	transfer->seq.addr = transfer->iicAddress;
+	if (transfer->rLength == 0) {
+		transfer->seq.flags = I2C_FLAG_WRITE;
+	} else if (transfer->wLength == 0) {
+		transfer->seq.flags = I2C_FLAG_READ;
+	} else {
+		transfer->seq.flags = I2C_FLAG_WRITE_READ;
+	}
+
+	if (transfer->seq.flags == I2C_FLAG_READ) {
+		transfer->seq.buf[0].data = transfer->rBuffer;
+		transfer->seq.buf[0].len  = transfer->rLength;
+	} else {
+		transfer->seq.buf[0].data = transfer->wBuffer;
+		transfer->seq.buf[0].len  = transfer->wLength;
+		transfer->seq.buf[1].data = transfer->rBuffer;
+		transfer->seq.buf[1].len  = transfer->rLength;
+	}
+
+	transfer->status = i2cTransferInProgress;
+
+	/* Sends the START condition, the interrupt handler does the rest */
+	ret = I2C_TransferInit(i2cInit.port, &transfer->seq);
+	if (ret != i2cTransferInProgress) {
+		transfer->status = ret;
+		activeTransfer = NULL;
+		return false;
+	}
+
+	I2C_IntEnable(i2cInit.port, IIC_TRANSFER_IEN);
+
+	return true;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Check if an interrupt driven transfer is on the bus
+ *
+ *****************************************************************************/
+bool IIC_TransferBusy(void){
+	return (activeTransfer != NULL);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Sleep in EM1 until a started transfer is done
+ *
+ * @param[in] transfer
+ *   descriptor passed to IIC_TransferStart
+ *
+ * @return
+ *   i2cTransferDone or the error of the transfer
+ *
+ *****************************************************************************/
+I2C_TransferReturn_TypeDef IIC_TransferWait(IIC_Transfer_t *transfer){
+	/* Interrupts masked between the check and the sleep, a pending
+	 * interrupt still wakes the core and is handled after re-enabling */
+	__disable_irq();
+	while (transfer->status == i2cTransferInProgress) {
+		EMU_EnterEM1();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+
+	return transfer->status;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Run one transfer to completion, used by the blocking functions
+ *
+ * @param[in] seq
+ *   emlib transfer sequence
+ *
+ *****************************************************************************/
+static I2C_TransferReturn_TypeDef IIC_Transfer(I2C_TransferSeq_TypeDef *seq){
+#if I2C_INTERRUPT_DRIVEN == 1
+	IIC_Transfer_t transfer;
+
+	transfer.iicAddress = (uint8_t) seq->addr;
+	transfer.callback = NULL;
+	transfer.user = NULL;
+	if (seq->flags == I2C_FLAG_READ) {
+		transfer.wBuffer = NULL;
+		transfer.wLength = 0;
+		transfer.rBuffer = seq->buf[0].data;
+		transfer.rLength = (uint8_t) seq->buf[0].len;
+	} else {
+		transfer.wBuffer = seq->buf[0].data;
+		transfer.wLength = (uint8_t) seq->buf[0].len;
+		transfer.rBuffer = seq->buf[1].data;
+		transfer.rLength = (seq->flags == I2C_FLAG_WRITE) ? 0 : (uint8_t) seq->buf[1].len;
+	}
+
+	/* Let a running asynchronous transfer finish first */
+	transfer.status = i2cTransferInProgress;
+	while (!IIC_TransferStart(&transfer)) {
+		if (transfer.status != i2cTransferInProgress) {
+			return transfer.status;		/* Could not be set up */
+		}
+
+		IIC_Transfer_t *busy = activeTransfer;
+		if (busy != NULL) {
+			IIC_TransferWait(busy);
+		}
+	}
+
+	return IIC_TransferWait(&transfer);
+#else
+	return I2CSPM_Transfer(i2cInit.port, seq);
+#endif
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   I2C interrupt, advances the transfer state machine
+ *
+ *****************************************************************************/
+void I2C0_IRQHandler(void){
+	I2C_TransferReturn_TypeDef ret;
+	IIC_Transfer_t *transfer = activeTransfer;
+
+	if (transfer == NULL) {
+		/* Nothing on the bus */
+		I2C_IntDisable(i2cInit.port, IIC_TRANSFER_IEN);
+		return;
+	}
+
+	if (I2C_IntGet(i2cInit.port) & I2C_IF_CLTO) {
+		/* SCL held low too long, give up on this transfer */
+		i2cInit.port->CMD = I2C_CMD_ABORT;
+		I2C_IntClear(i2cInit.port, I2C_IF_CLTO);
+		ret = i2cTransferBusErr;
+	} else {
+		ret = I2C_Transfer(i2cInit.port);
+	}
+
+	if (ret == i2cTransferInProgress) {
+		return;
+	}
+
+	/* Done, free the bus before the callback so it can start the next transfer */
+	I2C_IntDisable(i2cInit.port, IIC_TRANSFER_IEN);
+	activeTransfer = NULL;
+	transfer->status = ret;
+
+	if (transfer->callback != NULL) {
+		transfer->callback(ret, transfer->user);
+	}
+}
+
+#endif /* I2C_SIMULATOR */
@@ -18,13 +18,85 @@
 
 
 
+#include <stdint.h>
 #include <stdbool.h>
 
+#include <em_i2c.h>
+
+/**************************************************************************//**
+ * @brief
+ *   Select how the blocking IIC_* functions run their transfers
+ *
+ * @details
+ *   @li 1 - interrupt driven, the core sleeps in EM1 while the bus is busy
+ *   @li 0 - I2CSPM_Transfer, the core polls the bus in EM0
+ *
+ *****************************************************************************/
+#define I2C_INTERRUPT_DRIVEN	1
+
+/**************************************************************************//**
+ * @brief
+ *   Select what is behind the IIC_* functions
+ *
+ * @details
+ *   @li 1 - I2C_sim.c, simulated ICM-20948 + AK09916 for host builds
+ *   @li 0 - I2C.c, EFM32 I2C peripheral
+ *
+ *   Host builds set it on the command line, see I2C_sim_test.c
+ *
+ *****************************************************************************/
+#ifndef I2C_SIMULATOR
+#define I2C_SIMULATOR			0
+#endif
+
+/* Bus timing profiles */
+typedef enum
+{
+	IIC_SPEED_STANDARD = 0,		/**< 100 kHz, symmetric clock */
+	IIC_SPEED_FAST,				/**< 400 kHz, asymmetric clock */
+	IIC_SPEED_FAST_PLUS			/**< 1 MHz, needs Fm+ capable slaves and pull-ups */
+} IIC_Speed_t;
+
+/**************************************************************************//**
+ * @brief
+ *   Fastest bus profile to try at startup, slower ones are tried when a slave NACKs
+ *
+ * @details
+ *   @li IIC_SPEED_STANDARD - 100 kHz
+ *   @li IIC_SPEED_FAST - 400 kHz, highest rate of the ICM-20948
+ *   @li IIC_SPEED_FAST_PLUS - 1 MHz
+ *
+ *****************************************************************************/
+#define I2C_BUS_SPEED			IIC_SPEED_FAST
+
+/* Called from the I2C interrupt when a transfer has finished */
+typedef void (*IIC_TransferCallback_t)(I2C_TransferReturn_TypeDef status, void *user);
+
+/* Descriptor of one asynchronous transfer, must stay valid until completion */
+typedef struct
+{
+	uint8_t iicAddress;						/**< I2C address, already shifted */
+	uint8_t *wBuffer;						/**< Data to write, NULL when wLength is 0 */
+	uint8_t wLength;						/**< Number of bytes to write */
+	uint8_t *rBuffer;						/**< Where to store read data, NULL when rLength is 0 */
+	uint8_t rLength;						/**< Number of bytes to read */
+	IIC_TransferCallback_t callback;		/**< Completion callback, may be NULL */
+	void *user;								/**< Passed to the callback */
+	volatile I2C_TransferReturn_TypeDef status;	/**< i2cTransferInProgress until done */
+	I2C_TransferSeq_TypeDef seq;			/**< Used by the driver */
+} IIC_Transfer_t;
+
 void IIC_Init(void);
 void IIC_Reset(void);
 bool IIC_WriteBuffer(uint8_t iicAddress, uint8_t * wBuffer, uint8_t wLength);
 bool IIC_ReadBuffer(uint8_t iicAddress, uint8_t * rBuffer, uint8_t rLength);
 bool IIC_WriteReadBuffer(uint8_t iicAddress, uint8_t * wBuffer, uint8_t wLength, uint8_t *rBuffer, uint8_t rLength);
 void IIC_Enable( bool enable );
+void IIC_SpeedSet(IIC_Speed_t speed);
+IIC_Speed_t IIC_SpeedGet(void);
+
+bool IIC_TransferStart(IIC_Transfer_t *transfer);
+bool IIC_TransferBusy(void);
+I2C_TransferReturn_TypeDef IIC_TransferWait(IIC_Transfer_t *transfer);
 
 #endif /* AMG8833_I2C_H_ */
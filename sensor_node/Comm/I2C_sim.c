@@ -0,0 +1,652 @@
+/***************************************************************************//**
+ * @file I2C_sim.c
+ * @brief Register level simulation of the ICM-20948 + AK09916 behind the IIC_* functions
+ * @details
+ *   Replaces I2C.c when I2C_SIMULATOR is 1. Simulates the register banks,
+ *   FIFO, DMP memory access, data ready timing, the I2C master slaves and the
+ *   AK09916 ST1/ST2 data lock. Simulated time advances with the bus time of
+ *   every transfer and with IIC_SimAdvance (call it from delay() on the host).
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#include "I2C.h"
+
+#if I2C_SIMULATOR == 1
+
+#include <string.h>
+
+#include "I2C_sim.h"
+#include "pinout.h"
+
+#define SIM_REG(addr)			sim.reg[(addr) >> 7][(addr) & 0x7F]	/**< Register from a driver address (bank << 7 | register) */
+
+#define SIM_DMP_MEM_SIZE		(64 * 256)			/**< DMP memory, 64 banks of 256 bytes */
+#define SIM_MAG_REGS			0x33				/**< AK09916 register space */
+#define SIM_MAG_LSB_UT			0.15f				/**< AK09916 resolution */
+#define SIM_MAG_MAX_UT			4912.0f				/**< AK09916 measurement range */
+#define SIM_SLAVES				4					/**< I2C master slaves SLV0..SLV3 */
+
+#define AK09916_REG_WIA1		0x00				/**< Company ID register */
+#define AK09916_COMPANY_ID		0x48				/**< Company ID value */
+
+static struct
+{
+	uint8_t reg[4][128];					/**< ICM-20948 register banks */
+	uint8_t bank;							/**< Selected register bank */
+	uint8_t fifo[ICM_20948_FIFO_SIZE];		/**< FIFO ring buffer */
+	uint16_t fifoHead;						/**< Oldest byte in the FIFO */
+	uint16_t fifoCount;						/**< Bytes in the FIFO */
+	uint8_t dmpMem[SIM_DMP_MEM_SIZE];		/**< DMP memory */
+
+	uint8_t mag[SIM_MAG_REGS];				/**< AK09916 registers */
+	bool magLocked;							/**< Data read started, released by reading ST2 */
+
+	uint64_t timeNs;						/**< Simulated time */
+	uint64_t nextSampleNs;					/**< Next accel/gyro sample */
+	uint64_t nextMagNs;						/**< Next magnetometer measurement */
+
+	IIC_SimMotion_t motion;					/**< Motion source, NULL = lying flat */
+	IIC_SimInterrupt_t interrupt;			/**< INT pin callback */
+
+	IIC_Speed_t speed;						/**< Selected bus profile */
+	IIC_SimStats_t stats;					/**< Bus usage */
+	uint64_t busTimeNs;						/**< Bus time, kept in ns to avoid rounding */
+} sim;
+
+static const uint32_t simBusFreq[] = { 100000, 400000, 1000000 };	/**< Bus clock of each IIC_Speed_t profile */
+
+
+/**************************************************************************//**
+ * @brief
+ *   Register reset values
+ *****************************************************************************/
+static void IIC_SimIcmReset(void)
+{
+	memset(sim.reg, 0, sizeof(sim.reg));
+	sim.bank = 0;
+	sim.fifoHead = 0;
+	sim.fifoCount = 0;
+
+	SIM_REG(ICM_20948_REG_WHO_AM_I) = ICM20948_DEVICE_ID;
+	SIM_REG(ICM_20948_REG_PWR_MGMT_1) = ICM_20948_BIT_SLEEP | ICM_20948_BIT_CLK_PLL;
+	SIM_REG(ICM_20948_REG_LP_CONFIG) = 0x40;
+	SIM_REG(ICM_20948_REG_GYRO_CONFIG_1) = ICM_20948_BIT_GYRO_FCHOICE;
+	SIM_REG(ICM_20948_REG_ACCEL_CONFIG) = 0x01;
+}
+
+static void IIC_SimMagReset(void)
+{
+	memset(sim.mag, 0, sizeof(sim.mag));
+	sim.mag[AK09916_REG_WIA1] = AK09916_COMPANY_ID;
+	sim.mag[AK09916_REG_WHO_AM_I] = AK09916_DEVICE_ID;
+	sim.magLocked = false;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Sensor frame values from the motion source
+ *****************************************************************************/
+static void IIC_SimMotionGet(float *accel, float *gyro, float *magn)
+{
+	if (sim.motion != NULL) {
+		sim.motion((float) (sim.timeNs * 1e-9), accel, gyro, magn);
+	} else {
+		accel[0] = 0.0f; accel[1] = 0.0f; accel[2] = 1.0f;
+		gyro[0] = 0.0f; gyro[1] = 0.0f; gyro[2] = 0.0f;
+		magn[0] = 20.0f; magn[1] = 0.0f; magn[2] = -40.0f;
+	}
+}
+
+static int16_t IIC_SimCounts(float value, float lsbPerUnit)
+{
+	float counts = value * lsbPerUnit;
+
+	if (counts > 32767.0f) return 32767;
+	if (counts < -32768.0f) return -32768;
+	return (int16_t) counts;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   AK09916 measurement, sets DRDY, DOR when the previous one was not read
+ *****************************************************************************/
+static void IIC_SimMagMeasure(void)
+{
+	float accel[3], gyro[3], magn[3];
+	uint8_t i;
+
+	if (sim.mag[AK09916_REG_STATUS_1] & AK09916_BIT_DRDY) {
+		sim.mag[AK09916_REG_STATUS_1] |= AK09916_BIT_DOR;
+	}
+
+	/* Data protected while the host is reading */
+	if (sim.magLocked) {
+		return;
+	}
+
+	IIC_SimMotionGet(accel, gyro, magn);
+
+	sim.mag[AK09916_REG_STATUS_2] = 0;
+	for (i = 0; i < 3; i++) {
+		int16_t counts = IIC_SimCounts(magn[i], 1.0f / SIM_MAG_LSB_UT);
+		sim.mag[AK09916_REG_HXL + 2 * i] = (uint8_t) counts;
+		sim.mag[AK09916_REG_HXL + 2 * i + 1] = (uint8_t) (counts >> 8);
+		if ( (magn[i] > SIM_MAG_MAX_UT) || (magn[i] < -SIM_MAG_MAX_UT) ) {
+			sim.mag[AK09916_REG_STATUS_2] = AK09916_BIT_HOFL;
+		}
+	}
+
+	sim.mag[AK09916_REG_STATUS_1] |= AK09916_BIT_DRDY;
+
+	/* Single measurement mode powers down afterwards */
+	if (sim.mag[AK09916_REG_CONTROL_2] == AK09916_MODE_SINGLE) {
+		sim.mag[AK09916_REG_CONTROL_2] = AK09916_BIT_MODE_POWER_DOWN;
+	}
+}
+
+/* Measurement period of the continuous modes, 0 when not measuring */
+static uint64_t IIC_SimMagPeriodNs(void)
+{
+	switch (sim.mag[AK09916_REG_CONTROL_2]) {
+		case AK09916_MODE_10HZ:		return 100000000ULL;
+		case AK09916_MODE_20HZ:		return 50000000ULL;
+		case AK09916_MODE_50HZ:		return 20000000ULL;
+		case AK09916_MODE_100HZ:	return 10000000ULL;
+		default:					return 0;
+	}
+}
+
+static uint8_t IIC_SimMagRead(uint8_t addr)
+{
+	uint8_t value = (addr < SIM_MAG_REGS) ? sim.mag[addr] : 0;
+
+	if ( (addr >= AK09916_REG_STATUS_1) && (addr < AK09916_REG_STATUS_2) ) {
+		sim.magLocked = true;
+	}
+
+	/* Reading ST2 ends the read, releases the data lock */
+	if (addr == AK09916_REG_STATUS_2) {
+		sim.mag[AK09916_REG_STATUS_1] &= ~(AK09916_BIT_DRDY | AK09916_BIT_DOR);
+		sim.magLocked = false;
+	}
+
+	return value;
+}
+
+static void IIC_SimMagWrite(uint8_t addr, uint8_t data)
+{
+	if (addr == AK09916_REG_CONTROL_3) {
+		if (data & AK09916_BIT_SRST) {
+			IIC_SimMagReset();
+		}
+		return;
+	}
+
+	if (addr == AK09916_REG_CONTROL_2) {
+		sim.mag[AK09916_REG_CONTROL_2] = data;
+		if (data == AK09916_MODE_SINGLE) {
+			IIC_SimMagMeasure();
+		}
+		sim.nextMagNs = sim.timeNs + IIC_SimMagPeriodNs();
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Push bytes in the FIFO, stream mode drops the oldest, snapshot the newest
+ *****************************************************************************/
+static void IIC_SimFifoPush(const uint8_t *data, uint8_t length)
+{
+	uint8_t i;
+
+	for (i = 0; i < length; i++) {
+		if (sim.fifoCount == ICM_20948_FIFO_SIZE) {
+			SIM_REG(ICM_20948_REG_INT_STATUS_2) |= 0x01;
+			if (SIM_REG(ICM_20948_REG_FIFO_MODE) & ICM_20948_FIFO_MODE_SNAPSHOT) {
+				return;
+			}
+			sim.fifoHead = (sim.fifoHead + 1) % ICM_20948_FIFO_SIZE;
+			sim.fifoCount--;
+		}
+		sim.fifo[(sim.fifoHead + sim.fifoCount) % ICM_20948_FIFO_SIZE] = data[i];
+		sim.fifoCount++;
+	}
+}
+
+static uint8_t IIC_SimFifoPop(void)
+{
+	uint8_t value;
+
+	if (sim.fifoCount == 0) {
+		return 0xFF;
+	}
+
+	value = sim.fifo[sim.fifoHead];
+	sim.fifoHead = (sim.fifoHead + 1) % ICM_20948_FIFO_SIZE;
+	sim.fifoCount--;
+
+	return value;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   I2C master: slaves read into EXT_SLV_SENS_DATA or write their DO byte
+ *****************************************************************************/
+static void IIC_SimMasterRun(void)
+{
+	uint8_t slave, i, ext = 0;
+
+	if ( !(SIM_REG(ICM_20948_REG_USER_CTRL) & ICM_20948_BIT_I2C_MST_EN) ) {
+		return;
+	}
+
+	for (slave = 0; slave < SIM_SLAVES; slave++) {
+		uint8_t addr = SIM_REG(ICM_20948_REG_I2C_SLV0_ADDR + 4 * slave);
+		uint8_t reg = SIM_REG(ICM_20948_REG_I2C_SLV0_REG + 4 * slave);
+		uint8_t ctrl = SIM_REG(ICM_20948_REG_I2C_SLV0_CTRL + 4 * slave);
+		uint8_t length = ctrl & 0x0F;
+
+		if ( !(ctrl & ICM_20948_BIT_I2C_SLV_EN) ) {
+			continue;
+		}
+
+		if ( (addr & 0x7F) != AK09916_BIT_I2C_SLV_ADDR ) {
+			/* Nobody answers, data is zero */
+			if (addr & ICM_20948_BIT_I2C_SLV_READ) {
+				for (i = 0; i < length; i++, ext++) {
+					SIM_REG(ICM_20948_REG_EXT_SLV_SENS_DATA_00 + ext) = 0;
+				}
+			}
+			continue;
+		}
+
+		if (addr & ICM_20948_BIT_I2C_SLV_READ) {
+			/* SIM_REG evaluates its argument twice, ext is incremented by the loop */
+			for (i = 0; i < length; i++, ext++) {
+				SIM_REG(ICM_20948_REG_EXT_SLV_SENS_DATA_00 + ext) = IIC_SimMagRead(reg + i);
+			}
+		} else {
+			IIC_SimMagWrite(reg, SIM_REG(ICM_20948_REG_I2C_SLV0_DO + 4 * slave));
+		}
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   One accel/gyro sample: data registers, FIFO, I2C master, data ready
+ *****************************************************************************/
+static void IIC_SimSample(void)
+{
+	float accel[3], gyro[3], magn[3];
+	uint8_t data[12];
+	uint8_t fifoEn2 = SIM_REG(ICM_20948_REG_FIFO_EN_2);
+	float accelLsb = 32768.0f / (2 << ( (SIM_REG(ICM_20948_REG_ACCEL_CONFIG) & ICM_20948_MASK_ACCEL_FULLSCALE) >> ICM_20948_SHIFT_ACCEL_FS));
+	float gyroLsb = 32768.0f / (250 << ( (SIM_REG(ICM_20948_REG_GYRO_CONFIG_1) & ICM_20948_MASK_GYRO_FULLSCALE) >> ICM_20948_SHIFT_GYRO_FS_SEL));
+	uint8_t i;
+
+	IIC_SimMotionGet(accel, gyro, magn);
+
+	for (i = 0; i < 3; i++) {
+		int16_t a = IIC_SimCounts(accel[i], accelLsb);
+		int16_t g = IIC_SimCounts(gyro[i], gyroLsb);
+		data[2 * i] = (uint8_t) (a >> 8);
+		data[2 * i + 1] = (uint8_t) a;
+		data[6 + 2 * i] = (uint8_t) (g >> 8);
+		data[6 + 2 * i + 1] = (uint8_t) g;
+	}
+	memcpy(&SIM_REG(ICM_20948_REG_ACCEL_XOUT_H_SH), data, sizeof(data));
+
+	IIC_SimMasterRun();
+
+	if (SIM_REG(ICM_20948_REG_USER_CTRL) & ICM_20948_BIT_FIFO_EN) {
+		if (fifoEn2 & ICM_20948_BIT_ACCEL_FIFO_EN) {
+			IIC_SimFifoPush(&data[0], 6);
+		}
+		for (i = 0; i < 3; i++) {
+			if (fifoEn2 & (0x02 << i)) {
+				IIC_SimFifoPush(&data[6 + 2 * i], 2);
+			}
+		}
+	}
+
+	SIM_REG(ICM_20948_REG_INT_STATUS_1) |= ICM_20948_BIT_RAW_DATA_0_RDY_INT;
+	SIM_REG(ICM_20948_REG_DATA_RDY_STATUS) |= ICM_20948_BIT_RAW_DATA_0_RDY;
+
+	if ( (SIM_REG(ICM_20948_REG_INT_ENABLE_1) & ICM_20948_BIT_RAW_DATA_0_RDY_EN) && (sim.interrupt != NULL) ) {
+		sim.interrupt();
+	}
+}
+
+/* Accel/gyro sample period from the gyro divider */
+static uint64_t IIC_SimSamplePeriodNs(void)
+{
+	return ( (uint64_t) SIM_REG(ICM_20948_REG_GYRO_SMPLRT_DIV) + 1) * 1000000000ULL / 1125;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Advance simulated time, runs the samples that fall in the interval
+ *
+ * @param[in] us
+ *   microseconds
+ *
+ *****************************************************************************/
+static void IIC_SimAdvanceNs(uint64_t ns)
+{
+	uint64_t end = sim.timeNs + ns;
+
+	while (true) {
+		bool awake = !(SIM_REG(ICM_20948_REG_PWR_MGMT_1) & ICM_20948_BIT_SLEEP);
+		uint64_t magPeriod = IIC_SimMagPeriodNs();
+		uint64_t next = end;
+
+		if (awake && (sim.nextSampleNs < next)) next = sim.nextSampleNs;
+		if ( (magPeriod != 0) && (sim.nextMagNs < next) ) next = sim.nextMagNs;
+		if (next >= end) break;
+
+		sim.timeNs = next;
+		if (awake && (sim.nextSampleNs == next)) {
+			IIC_SimSample();
+			sim.nextSampleNs += IIC_SimSamplePeriodNs();
+		}
+		if ( (magPeriod != 0) && (sim.nextMagNs == next) ) {
+			IIC_SimMagMeasure();
+			sim.nextMagNs += magPeriod;
+		}
+	}
+
+	sim.timeNs = end;
+	if (sim.nextSampleNs < sim.timeNs) sim.nextSampleNs = sim.timeNs + IIC_SimSamplePeriodNs();
+}
+
+void IIC_SimAdvance(uint32_t us)
+{
+	IIC_SimAdvanceNs( (uint64_t) us * 1000);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   ICM-20948 register access, auto increment except for FIFO_R_W
+ *****************************************************************************/
+static uint8_t IIC_SimIcmRead(uint8_t reg)
+{
+	uint16_t addr = ( (uint16_t) sim.bank << 7) | reg;
+	uint8_t value;
+
+	if (reg == 0x7F) {
+		return (uint8_t) (sim.bank << 4);
+	}
+
+	switch (addr) {
+		case ICM_20948_REG_FIFO_COUNT_H:
+			return (uint8_t) (sim.fifoCount >> 8);
+		case ICM_20948_REG_FIFO_COUNT_L:
+			return (uint8_t) sim.fifoCount;
+		case ICM_20948_REG_FIFO_R_W:
+			return IIC_SimFifoPop();
+		case ICM_20948_REG_MEM_R_W:
+		{
+			uint16_t mem = ( (uint16_t) SIM_REG(ICM_20948_REG_MEM_BANK_SEL) << 8) | SIM_REG(ICM_20948_REG_MEM_START_ADDR);
+			SIM_REG(ICM_20948_REG_MEM_START_ADDR)++;
+			return sim.dmpMem[mem % SIM_DMP_MEM_SIZE];
+		}
+		default:
+			break;
+	}
+
+	value = sim.reg[sim.bank][reg];
+
+	/* Interrupt status is cleared on read */
+	if ( (addr == ICM_20948_REG_INT_STATUS) || (addr == ICM_20948_REG_INT_STATUS_1) || (addr == ICM_20948_REG_INT_STATUS_2) ) {
+		sim.reg[sim.bank][reg] = 0;
+	}
+
+	return value;
+}
+
+static void IIC_SimIcmWrite(uint8_t reg, uint8_t data)
+{
+	uint16_t addr = ( (uint16_t) sim.bank << 7) | reg;
+
+	if (reg == 0x7F) {
+		sim.bank = (data >> 4) & 0x03;
+		return;
+	}
+
+	switch (addr) {
+		case ICM_20948_REG_PWR_MGMT_1:
+			if (data & ICM_20948_BIT_H_RESET) {
+				IIC_SimIcmReset();
+				return;
+			}
+			break;
+		case ICM_20948_REG_USER_CTRL:
+			/* DMP, SRAM and I2C master reset bits clear themselves */
+			data &= ~(ICM_20948_BIT_DMP_RST | 0x06);
+			break;
+		case ICM_20948_REG_FIFO_RST:
+			if (data & 0x1F) {
+				sim.fifoHead = 0;
+				sim.fifoCount = 0;
+			}
+			break;
+		case ICM_20948_REG_FIFO_R_W:
+			IIC_SimFifoPush(&data, 1);
+			return;
+		case ICM_20948_REG_GYRO_SMPLRT_DIV:
+			/* A faster rate applies from the next sample, not after the old period */
+			sim.reg[sim.bank][reg] = data;
+			if (sim.nextSampleNs > sim.timeNs + IIC_SimSamplePeriodNs()) {
+				sim.nextSampleNs = sim.timeNs + IIC_SimSamplePeriodNs();
+			}
+			return;
+		case ICM_20948_REG_MEM_R_W:
+		{
+			uint16_t mem = ( (uint16_t) SIM_REG(ICM_20948_REG_MEM_BANK_SEL) << 8) | SIM_REG(ICM_20948_REG_MEM_START_ADDR);
+			SIM_REG(ICM_20948_REG_MEM_START_ADDR)++;
+			sim.dmpMem[mem % SIM_DMP_MEM_SIZE] = data;
+			return;
+		}
+		default:
+			break;
+	}
+
+	sim.reg[sim.bank][reg] = data;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Bus accounting, time advances with the transfer
+ *****************************************************************************/
+static void IIC_SimBus(uint16_t bytes)
+{
+	/* 9 clocks per byte, plus start and stop */
+	uint64_t ns = ( (uint64_t) bytes * 9 + 2) * 1000000000ULL / simBusFreq[sim.speed];
+
+	sim.stats.transactions++;
+	sim.stats.bytes += bytes;
+	sim.busTimeNs += ns;
+	sim.stats.busTimeUs = (uint32_t) (sim.busTimeNs / 1000);
+
+	IIC_SimAdvanceNs(ns);
+}
+
+/* Device on the host bus at this address, AK09916 only in bypass mode */
+static bool IIC_SimAck(uint8_t iicAddress)
+{
+	if (iicAddress == ICM_20948_I2C_ADDRESS) {
+		return true;
+	}
+	if ( (iicAddress == (AK09916_BIT_I2C_SLV_ADDR << 1)) && (SIM_REG(ICM_20948_REG_INT_PIN_CFG) & ICM_20948_BIT_BYPASS_EN) ) {
+		return true;
+	}
+
+	sim.stats.nacks++;
+	return false;
+}
+
+static bool IIC_SimTransfer(uint8_t iicAddress, uint8_t *wBuffer, uint8_t wLength, uint8_t *rBuffer, uint8_t rLength)
+{
+	bool icm = (iicAddress == ICM_20948_I2C_ADDRESS);
+	static uint8_t pointer[2];		/* Register pointer of each device, kept between transfers */
+	uint8_t i;
+
+	/* Address byte of each phase + data */
+	IIC_SimBus( (wLength ? 1 + wLength : 0) + (rLength ? 1 + rLength : 0) );
+
+	if (!IIC_SimAck(iicAddress)) {
+		if (rLength) rBuffer[0] = 0;
+		return false;
+	}
+
+	if (wLength) {
+		pointer[icm] = wBuffer[0];
+		for (i = 1; i < wLength; i++) {
+			if (icm) {
+				IIC_SimIcmWrite(pointer[icm], wBuffer[i]);
+				if ( (pointer[icm] != (ICM_20948_REG_FIFO_R_W & 0x7F)) && (pointer[icm] != (ICM_20948_REG_MEM_R_W & 0x7F)) ) pointer[icm]++;
+			} else {
+				IIC_SimMagWrite(pointer[icm]++, wBuffer[i]);
+			}
+		}
+	}
+
+	for (i = 0; i < rLength; i++) {
+		if (icm) {
+			rBuffer[i] = IIC_SimIcmRead(pointer[icm]);
+			if ( (pointer[icm] != (ICM_20948_REG_FIFO_R_W & 0x7F)) && (pointer[icm] != (ICM_20948_REG_MEM_R_W & 0x7F)) ) pointer[icm]++;
+		} else {
+			rBuffer[i] = IIC_SimMagRead(pointer[icm]++);
+		}
+	}
+
+	return true;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   IIC_* functions of I2C.c on the simulated devices
+ *****************************************************************************/
+void IIC_Init(void){
+	IIC_SimIcmReset();
+	IIC_SimMagReset();
+	sim.speed = IIC_SPEED_STANDARD;
+	sim.nextSampleNs = sim.timeNs + IIC_SimSamplePeriodNs();
+}
+
+void IIC_Reset(void){
+}
+
+void IIC_Enable( bool enable ){
+	(void) enable;
+}
+
+void IIC_SpeedSet(IIC_Speed_t speed){
+	sim.speed = (speed > IIC_SPEED_FAST_PLUS) ? IIC_SPEED_STANDARD : speed;
+}
+
+IIC_Speed_t IIC_SpeedGet(void){
+	return sim.speed;
+}
+
+bool IIC_WriteBuffer(uint8_t iicAddress, uint8_t * wBuffer, uint8_t wLength){
+	return IIC_SimTransfer(iicAddress, wBuffer, wLength, NULL, 0);
+}
+
+bool IIC_ReadBuffer(uint8_t iicAddress, uint8_t * rBuffer, uint8_t rLength){
+	return IIC_SimTransfer(iicAddress, NULL, 0, rBuffer, rLength);
+}
+
+bool IIC_WriteReadBuffer(uint8_t iicAddress, uint8_t * wBuffer, uint8_t wLength, uint8_t *rBuffer, uint8_t rLength){
+	return IIC_SimTransfer(iicAddress, wBuffer, wLength, rBuffer, rLength);
+}
+
+/* Transfers complete immediately, the callback runs before IIC_TransferStart returns */
+bool IIC_TransferStart(IIC_Transfer_t *transfer){
+	bool ack = IIC_SimTransfer(transfer->iicAddress, transfer->wBuffer, transfer->wLength, transfer->rBuffer, transfer->rLength);
+
+	transfer->status = ack ? i2cTransferDone : i2cTransferNack;
+	if (transfer->callback != NULL) {
+		transfer->callback(transfer->status, transfer->user);
+	}
+
+	return true;
+}
+
+bool IIC_TransferBusy(void){
+	return false;
+}
+
+I2C_TransferReturn_TypeDef IIC_TransferWait(IIC_Transfer_t *transfer){
+	return transfer->status;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Simulation control
+ *****************************************************************************/
+void IIC_SimMotionSet(IIC_SimMotion_t motion)
+{
+	sim.motion = motion;
+}
+
+void IIC_SimInterruptSet(IIC_SimInterrupt_t callback)
+{
+	sim.interrupt = callback;
+}
+
+uint32_t IIC_SimTimeGet(void)
+{
+	return (uint32_t) (sim.timeNs / 1000);
+}
+
+void IIC_SimStatsGet(IIC_SimStats_t *stats)
+{
+	*stats = sim.stats;
+}
+
+void IIC_SimStatsReset(void)
+{
+	memset(&sim.stats, 0, sizeof(sim.stats));
+	sim.busTimeNs = 0;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   DMP stand-ins, the simulator does not run the DMP firmware
+ *
+ * @details
+ *   IIC_SimFifoWrite puts the frames the DMP would write in the FIFO,
+ *   IIC_SimDmpMemGet reads DMP memory without using the bus.
+ *****************************************************************************/
+void IIC_SimFifoWrite(const uint8_t *data, uint16_t length)
+{
+	uint16_t i;
+
+	for (i = 0; i < length; i++) {
+		IIC_SimFifoPush(&data[i], 1);
+	}
+}
+
+void IIC_SimDmpMemGet(uint16_t memAddr, uint16_t length, uint8_t *data)
+{
+	uint16_t i;
+
+	for (i = 0; i < length; i++) {
+		data[i] = sim.dmpMem[(memAddr + i) % SIM_DMP_MEM_SIZE];
+	}
+}
+
+#endif /* I2C_SIMULATOR */
@@ -0,0 +1,42 @@
+/***************************************************************************//**
+ * @file I2C_sim.h
+ * @brief Register level simulation of the ICM-20948 + AK09916 behind the IIC_* functions
+ * @details Selected with I2C_SIMULATOR in I2C.h, for host builds of the sensor node code
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+
+#ifndef I2C_SIM_H_
+#define I2C_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Motion source, fills sensor frame values at time t (s): accel in g, gyro in dps, magn in uT */
+typedef void (*IIC_SimMotion_t)(float t, float *accel, float *gyro, float *magn);
+
+/* Called when the simulated IMU raises its INT pin */
+typedef void (*IIC_SimInterrupt_t)(void);
+
+/* Bus usage since the last IIC_SimStatsReset */
+typedef struct
+{
+	uint32_t transactions;		/**< Transfers started on the bus, NACKed ones included */
+	uint32_t bytes;				/**< Bytes on the bus, address bytes included */
+	uint32_t busTimeUs;			/**< Time the bus was busy at the selected bus speed */
+	uint32_t nacks;				/**< Transfers to an address that did not answer */
+} IIC_SimStats_t;
+
+void IIC_SimMotionSet(IIC_SimMotion_t motion);
+void IIC_SimInterruptSet(IIC_SimInterrupt_t callback);
+void IIC_SimAdvance(uint32_t us);
+uint32_t IIC_SimTimeGet(void);
+void IIC_SimStatsGet(IIC_SimStats_t *stats);
+void IIC_SimStatsReset(void);
+
+/* DMP stand-ins: bytes the DMP writes to the FIFO, DMP memory as loaded by the driver */
+void IIC_SimFifoWrite(const uint8_t *data, uint16_t length);
+void IIC_SimDmpMemGet(uint16_t memAddr, uint16_t length, uint8_t *data);
+
+#endif /* I2C_SIM_H_ */
@@ -0,0 +1,487 @@
+/***************************************************************************//**
+ * @file I2C_sim_test.c
+ * @brief Host test of the ICM-20948 driver on the simulated bus of I2C_sim.c
+ * @details
+ *   Replays a trace of sensor frames through the simulated ICM-20948 +
+ *   AK09916 and reads it back with the driver of ICM20948.c, the same calls
+ *   the node makes: ICM_20948_Init, the data register reads, the magnetometer
+ *   read through bypass mode and the FIFO. Every value read must match the
+ *   trace row it was sampled from within the register resolution. The bus
+ *   transfers of single calls are counted: a data read with the bank cached
+ *   is one transfer, the burst read of ICM_20948_burstRawDataRead one
+ *   transfer of 26 bytes. Fails when a driver or simulator change breaks the
+ *   register access, the bank cache, the scaling or the axis mapping of the
+ *   magnetometer.
+ *
+ *   Not part of the node firmware, the file is empty without EMLIB_HOST.
+ *   Build and run on the host, from the sensor_node folder:
+ *
+ *     gcc -O2 -DEMLIB_HOST=1 -DI2C_SIMULATOR=1 -Ihost -IComm -IICM_20948 -Iinc -Idelay -Idbprint
+ *         -o i2c_sim_test Comm/I2C_sim_test.c Comm/I2C_sim.c ICM_20948/ICM20948.c host/emlib_host.c host/delay_host.c -lm
+ *     ./i2c_sim_test
+ *
+ *   With -DICM_20948_DMP_MODE=1 added the test also loads a synthetic DMP
+ *   image through ICM_20948_dmpInit and reads crafted quaternion frames
+ *   back with ICM_20948_dmpQuaternionRead. The simulator does not run the
+ *   DMP, the test writes the frames the DMP would write in the FIFO.
+ *
+ *   Exits with 0 when every check passes.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#ifdef EMLIB_HOST
+
+#include "I2C.h"
+
+#if I2C_SIMULATOR != 1
+#error "I2C_sim_test.c needs I2C_SIMULATOR 1"
+#endif
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "I2C_sim.h"
+#include "ICM20948.h"
+#include "pinout.h"
+
+#define TEST_ROW_US				100000			/**< Time each trace row is held */
+#define TEST_FIFO_US			200000			/**< FIFO filled for this long */
+#define TEST_MAGN_TOL			0.3f			/**< uT, AK09916 LSB is 0.15 uT, the driver scales with 4912 / 32767.5 */
+
+/* One trace row, units of IIC_SimMotion_t, magn in AK09916 axes */
+typedef struct
+{
+	float accel[3];
+	float gyro[3];
+	float magn[3];
+} TestFrame_t;
+
+/* 90 degree turn about z at 45 dps, then a tilt about x at 30 dps, earth field 20 uT north and 40 uT down */
+static const TestFrame_t trace[] =
+{
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {  20.000f,   0.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {  20.000f,   0.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {  20.000f,   0.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {  20.000f,   0.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {  20.000f,   0.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  20.000f,   0.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  19.938f,   1.569f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  19.754f,   3.129f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  19.447f,   4.669f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  19.021f,   6.180f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  18.478f,   7.654f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  17.820f,   9.080f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  17.053f,  10.450f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  16.180f,  11.756f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  15.208f,  12.989f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  14.142f,  14.142f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  12.989f,  15.208f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  11.756f,  16.180f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {  10.450f,  17.053f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {   9.080f,  17.820f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {   7.654f,  18.478f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {   6.180f,  19.021f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {   4.669f,  19.447f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {   3.129f,  19.754f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,  45.000f }, {   1.569f,  19.938f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {   0.000f,  20.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {   0.000f,  20.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {   0.000f,  20.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {   0.000f,  20.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {   0.000f,   0.000f,   0.000f }, {   0.000f,  20.000f,  40.000f } },
+	{ {   0.000f,   0.000f,   1.000f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  20.000f,  40.000f } },
+	{ {   0.000f,   0.052f,   0.999f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  22.066f,  38.898f } },
+	{ {   0.000f,   0.105f,   0.995f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  24.072f,  37.690f } },
+	{ {   0.000f,   0.156f,   0.988f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  26.011f,  36.379f } },
+	{ {   0.000f,   0.208f,   0.978f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  27.879f,  34.968f } },
+	{ {   0.000f,   0.259f,   0.966f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  29.671f,  33.461f } },
+	{ {   0.000f,   0.309f,   0.951f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  31.382f,  31.862f } },
+	{ {   0.000f,   0.358f,   0.934f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  33.006f,  30.176f } },
+	{ {   0.000f,   0.407f,   0.914f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  34.540f,  28.407f } },
+	{ {   0.000f,   0.454f,   0.891f }, {  30.000f,   0.000f,   0.000f }, {   0.000f,  35.980f,  26.560f } },
+};
+
+#define TEST_ROWS				(sizeof(trace) / sizeof(trace[0]))
+
+bool IMU_MEASURING = false;						/**< Referenced by ICM20948.c */
+
+static uint32_t traceStart = UINT32_MAX;		/**< us, simulated time of the first row, row 0 is held before */
+static uint32_t failures;						/**< Checks that failed */
+
+#if ICM_20948_DMP_MODE == 1
+/* Synthetic DMP image, 593 bytes from ICM_20948_DMP_LOAD_START cross two DMP memory banks */
+#define TEST_IMG_1(n)			(uint8_t) ( (n) * 151 + 7)
+#define TEST_IMG_2(n)			TEST_IMG_1(n), TEST_IMG_1( (n) + 1)
+#define TEST_IMG_4(n)			TEST_IMG_2(n), TEST_IMG_2( (n) + 2)
+#define TEST_IMG_16(n)			TEST_IMG_4(n), TEST_IMG_4( (n) + 4), TEST_IMG_4( (n) + 8), TEST_IMG_4( (n) + 12)
+#define TEST_IMG_64(n)			TEST_IMG_16(n), TEST_IMG_16( (n) + 16), TEST_IMG_16( (n) + 32), TEST_IMG_16( (n) + 48)
+#define TEST_IMG_256(n)			TEST_IMG_64(n), TEST_IMG_64( (n) + 64), TEST_IMG_64( (n) + 128), TEST_IMG_64( (n) + 192)
+
+const uint8_t ICM_20948_dmpImage[] = { TEST_IMG_256(0), TEST_IMG_256(256), TEST_IMG_64(512), TEST_IMG_16(576), TEST_IMG_1(592) };
+const uint16_t ICM_20948_dmpImageSize = sizeof(ICM_20948_dmpImage);
+
+#define TEST_DMP_FRAME_MAX		32				/**< Header, header2, gyro + bias, quaternion, accel accuracy, footer */
+#define TEST_DMP_QUAT_TOL		1e-6f			/**< Q30 resolution is 1e-9, w follows from a float sqrt */
+#endif
+
+
+/**************************************************************************//**
+ * @brief
+ *   Motion source of the simulator, holds every row for TEST_ROW_US
+ *****************************************************************************/
+static const TestFrame_t *traceRow(uint32_t us)
+{
+	uint32_t row = (us < traceStart) ? 0 : (us - traceStart) / TEST_ROW_US;
+
+	return &trace[ (row < TEST_ROWS) ? row : TEST_ROWS - 1];
+}
+
+static void traceMotion(float t, float *accel, float *gyro, float *magn)
+{
+	const TestFrame_t *frame = traceRow( (uint32_t) (t * 1e6f + 0.5f));
+	uint8_t i;
+
+	for (i = 0; i < 3; i++) {
+		accel[i] = frame->accel[i];
+		gyro[i] = frame->gyro[i];
+		magn[i] = frame->magn[i];
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Compare three axes, prints the first value out of tolerance
+ *****************************************************************************/
+static void check(const char *what, uint32_t row, const float *read, const float *expected, float tolerance)
+{
+	uint8_t i;
+
+	for (i = 0; i < 3; i++) {
+		if (fabsf(read[i] - expected[i]) > tolerance) {
+			printf("FAIL %-6s row %2u axis %u: read %9.4f, trace %9.4f\n", what, (unsigned) row, i, read[i], expected[i]);
+			failures++;
+			return;
+		}
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Compare the bus use since the previous check with the expected transfers
+ *
+ * @details
+ *   A register read is one transfer of 3 + n bytes: address, register,
+ *   address again and n data bytes. A bank change adds one transfer of
+ *   3 bytes.
+ *****************************************************************************/
+static void busCheck(const char *what, uint32_t transactions, uint32_t bytes)
+{
+	IIC_SimStats_t stats;
+
+	IIC_SimStatsGet(&stats);
+	if ( (stats.transactions != transactions) || (stats.bytes != bytes) ) {
+		printf("FAIL bus %-14s %u transactions / %u bytes, expected %u / %u\n", what,
+				(unsigned) stats.transactions, (unsigned) stats.bytes, (unsigned) transactions, (unsigned) bytes);
+		failures++;
+	}
+	IIC_SimStatsReset();
+}
+
+
+#if ICM_20948_DMP_MODE == 1
+/**************************************************************************//**
+ * @brief
+ *   Build a DMP FIFO frame: 6-axis quaternion and raw gyro,
+ *   with the accel accuracy in a second header when accuracy is set
+ *
+ * @return
+ *   frame size in bytes
+ *****************************************************************************/
+static uint16_t dmpFrame(uint8_t *frame, const float *quat, const int16_t *gyro, bool accuracy)
+{
+	uint16_t header = ICM_20948_DMP_HEADER_GYRO | ICM_20948_DMP_HEADER_QUAT6;
+	uint16_t size = 0;
+	int32_t q;
+	uint8_t i;
+
+	if (accuracy) {
+		header |= ICM_20948_DMP_HEADER_HEADER2;
+	}
+	frame[size++] = (uint8_t) (header >> 8);
+	frame[size++] = (uint8_t) header;
+	if (accuracy) {
+		frame[size++] = (uint8_t) (ICM_20948_DMP_HEADER2_ACCEL_ACCURACY >> 8);
+		frame[size++] = (uint8_t) ICM_20948_DMP_HEADER2_ACCEL_ACCURACY;
+	}
+
+	/* Gyro, then a bias the driver must skip */
+	for (i = 0; i < 3; i++) {
+		frame[size++] = (uint8_t) ( (uint16_t) gyro[i] >> 8);
+		frame[size++] = (uint8_t) gyro[i];
+	}
+	for (i = 0; i < 6; i++) {
+		frame[size++] = 0xA5;
+	}
+
+	/* x, y, z in Q30, the DMP leaves w out */
+	for (i = 1; i < 4; i++) {
+		q = (int32_t) lroundf(quat[i] * 1073741824.0f);
+		frame[size++] = (uint8_t) ( (uint32_t) q >> 24);
+		frame[size++] = (uint8_t) ( (uint32_t) q >> 16);
+		frame[size++] = (uint8_t) ( (uint32_t) q >> 8);
+		frame[size++] = (uint8_t) q;
+	}
+
+	if (accuracy) {
+		frame[size++] = 0x00;
+		frame[size++] = 0x03;
+	}
+
+	/* Footer */
+	frame[size++] = 0x00;
+	frame[size++] = 0x00;
+
+	return size;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Check one ICM_20948_dmpQuaternionRead against the frames written before
+ *****************************************************************************/
+static void dmpCheck(const char *what, uint32_t status, uint8_t frames, uint8_t expectedFrames,
+		const float *quat, const float *expectedQuat, const int16_t *gyro, const int16_t *expectedGyro)
+{
+	uint8_t i;
+
+	if ( (status != ICM_20948_OK) || (frames != expectedFrames) ) {
+		printf("FAIL dmp %s: status %u, %u frames, expected %u\n", what, (unsigned) status, frames, expectedFrames);
+		failures++;
+		return;
+	}
+	for (i = 0; i < 4; i++) {
+		if (fabsf(quat[i] - expectedQuat[i]) > TEST_DMP_QUAT_TOL) {
+			printf("FAIL dmp %s quat %u: read %9.6f, frame %9.6f\n", what, i, quat[i], expectedQuat[i]);
+			failures++;
+			return;
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		if (gyro[i] != expectedGyro[i]) {
+			printf("FAIL dmp %s gyro %u: read %d, frame %d\n", what, i, gyro[i], expectedGyro[i]);
+			failures++;
+			return;
+		}
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   DMP load and FIFO frame parsing
+ *
+ * @return
+ *   quaternions read
+ *****************************************************************************/
+static uint32_t dmpTest(void)
+{
+	/* 30 degrees about z, then a 120 degree turn about (1, 1, 1) */
+	static const float quatA[4] = { 0.96592583f, 0.0f, 0.0f, 0.25881905f };
+	static const float quatB[4] = { 0.5f, 0.5f, 0.5f, 0.5f };
+	static const int16_t gyroA[3] = { 120, -340, 5 };
+	static const int16_t gyroB[3] = { -32768, 32767, -1 };
+	uint8_t image[sizeof(ICM_20948_dmpImage)];
+	uint8_t frameA[TEST_DMP_FRAME_MAX], frameB[TEST_DMP_FRAME_MAX], reg[2];
+	uint16_t sizeA, sizeB;
+	float quat[4];
+	int16_t gyro[3];
+	uint8_t frames;
+	uint32_t status, total = 0;
+
+	/* Image at the load address, the setup of ICM_20948_dmpInit writes into it after */
+	if (ICM_20948_dmpFirmwareLoad() != ICM_20948_OK) {
+		printf("FAIL dmp image load\n");
+		failures++;
+	}
+	IIC_SimDmpMemGet(ICM_20948_DMP_LOAD_START, ICM_20948_dmpImageSize, image);
+	if (memcmp(image, ICM_20948_dmpImage, ICM_20948_dmpImageSize) != 0) {
+		printf("FAIL dmp image differs in DMP memory\n");
+		failures++;
+	}
+
+	/* Outputs and program counter start set */
+	if (ICM_20948_dmpInit() != ICM_20948_OK) {
+		printf("FAIL dmp init\n");
+		failures++;
+	}
+	IIC_SimDmpMemGet(ICM_20948_DMP_DATA_OUT_CTL1, 2, reg);
+	if ( ( ( (uint16_t) reg[0] << 8) | reg[1]) != (ICM_20948_DMP_HEADER_GYRO | ICM_20948_DMP_HEADER_QUAT6) ) {
+		printf("FAIL dmp outputs 0x%02X%02X\n", reg[0], reg[1]);
+		failures++;
+	}
+	ICM_20948_registerRead(ICM_20948_REG_PRGM_START_ADDRH, 2, reg);
+	if ( ( ( (uint16_t) reg[0] << 8) | reg[1]) != ICM_20948_DMP_START_ADDRESS) {
+		printf("FAIL dmp start address 0x%02X%02X\n", reg[0], reg[1]);
+		failures++;
+	}
+
+	ICM_20948_dmpEnable(true);
+	sizeA = dmpFrame(frameA, quatA, gyroA, false);
+	sizeB = dmpFrame(frameB, quatB, gyroB, true);
+
+	/* Two frames, the latest one is kept */
+	IIC_SimFifoWrite(frameA, sizeA);
+	IIC_SimFifoWrite(frameB, sizeB);
+	status = ICM_20948_dmpQuaternionRead(quat, gyro, &frames);
+	dmpCheck("two frames", status, frames, 2, quat, quatB, gyro, gyroB);
+	total += frames;
+
+	/* A frame split over two reads, nothing until it is complete */
+	IIC_SimFifoWrite(frameA, sizeA / 2);
+	status = ICM_20948_dmpQuaternionRead(quat, gyro, &frames);
+	dmpCheck("half frame", status, frames, 0, quat, quatB, gyro, gyroB);
+	IIC_SimFifoWrite(&frameA[sizeA / 2], sizeA - sizeA / 2);
+	status = ICM_20948_dmpQuaternionRead(quat, gyro, &frames);
+	dmpCheck("split frame", status, frames, 1, quat, quatA, gyro, gyroA);
+	total += frames;
+
+	/* Unknown header, the FIFO is reset, the next frame is read again */
+	frameB[1] |= 0x01;
+	IIC_SimFifoWrite(frameB, sizeB);
+	if (ICM_20948_dmpQuaternionRead(quat, gyro, &frames) != ERROR) {
+		printf("FAIL dmp unknown header accepted\n");
+		failures++;
+	}
+	ICM_20948_registerRead(ICM_20948_REG_FIFO_COUNT_H, 2, reg);
+	if ( (reg[0] & 0x1F) || reg[1]) {
+		printf("FAIL dmp FIFO not reset after an unknown header\n");
+		failures++;
+	}
+	IIC_SimFifoWrite(frameA, sizeA);
+	status = ICM_20948_dmpQuaternionRead(quat, gyro, &frames);
+	dmpCheck("after reset", status, frames, 1, quat, quatA, gyro, gyroA);
+	total += frames;
+
+	ICM_20948_dmpEnable(false);
+
+	return total;
+}
+#endif
+
+
+int main(void)
+{
+	IIC_SimStats_t stats;
+	float accel[3], gyro[3], magn[3], expected[3];
+	float accelRes, gyroRes;
+	int16_t fifoAccel[ICM_20948_FIFO_MAX_PACKETS][3], fifoGyro[ICM_20948_FIFO_MAX_PACKETS][3];
+	int16_t raw[5][3];
+	uint8_t packets, reg[1];
+	uint32_t row, i, j;
+
+	IIC_SimMotionSet(traceMotion);
+
+	/* Same start as the node, the probe must settle on the fastest profile */
+	ICM_20948_Init();
+	if (IIC_SpeedGet() != I2C_BUS_SPEED) {
+		printf("FAIL bus speed profile %d, expected %d\n", IIC_SpeedGet(), I2C_BUS_SPEED);
+		failures++;
+	}
+
+	ICM_20948_accelResolutionGet(&accelRes);
+	ICM_20948_gyroResolutionGet(&gyroRes);
+
+	/* Data registers, read in the middle of every row, the last sample is from the same row */
+	IIC_SimStatsReset();
+	traceStart = IIC_SimTimeGet();
+	for (row = 0; row < TEST_ROWS; row++) {
+		IIC_SimAdvance(traceStart + row * TEST_ROW_US + TEST_ROW_US / 2 - IIC_SimTimeGet());
+
+		ICM_20948_accelDataRead(accel);
+		ICM_20948_gyroDataRead(gyro);
+		ICM_20948_magDataRead(magn);
+
+		check("accel", row, accel, trace[row].accel, 2.0f * accelRes);
+		check("gyro", row, gyro, trace[row].gyro, 2.0f * gyroRes);
+
+		/* ICM20948.c maps the AK09916 axes on the accel / gyro axes */
+		expected[0] = trace[row].magn[0];
+		expected[1] = -trace[row].magn[1];
+		expected[2] = -trace[row].magn[2];
+		check("magn", row, magn, expected, TEST_MAGN_TOL);
+	}
+
+	IIC_SimStatsGet(&stats);
+	if (stats.nacks != 0) {
+		printf("FAIL %u NACKs while reading the trace\n", (unsigned) stats.nacks);
+		failures++;
+	}
+
+	/* Bus use per call, bank 0 is still selected from the trace reads */
+	IIC_SimStatsReset();
+	ICM_20948_gyroRawDataRead(raw[0]);
+	busCheck("gyro read", 1, 3 + 6);
+	ICM_20948_accelRawDataRead(raw[1]);
+	busCheck("accel read", 1, 3 + 6);
+
+	/* Bank 2 is selected once, the second read needs no bank change */
+	ICM_20948_registerRead(ICM_20948_REG_GYRO_SMPLRT_DIV, 1, reg);
+	busCheck("bank 2 read", 2, 3 + 3 + 1);
+	ICM_20948_registerRead(ICM_20948_REG_GYRO_SMPLRT_DIV, 1, reg);
+	busCheck("bank 2 again", 1, 3 + 1);
+	ICM_20948_gyroRawDataRead(raw[0]);
+	busCheck("bank 0 read", 2, 3 + 3 + 6);
+
+	/* Accel, gyro, temp and the magnetometer copy of the I2C master in one transfer */
+	ICM_20948_magAutoReadEnable(true);
+	IIC_SimAdvance(2 * TEST_ROW_US);
+	ICM_20948_accelRawDataRead(raw[1]);
+	ICM_20948_gyroRawDataRead(raw[0]);
+	IIC_SimStatsReset();
+	ICM_20948_burstRawDataRead(raw[2], raw[3], raw[4]);
+	busCheck("burst read", 1, 3 + ICM_20948_BURST_READ_SIZE);
+	for (i = 0; i < 3; i++) {
+		if ( (raw[2][i] != raw[1][i]) || (raw[3][i] != raw[0][i]) ) {
+			printf("FAIL burst axis %u: accel %d gyro %d, data registers %d %d\n", (unsigned) i,
+					raw[2][i], raw[3][i], raw[1][i], raw[0][i]);
+			failures++;
+		}
+	}
+	ICM_20948_magAutoReadEnable(false);
+
+	/* FIFO, the last row is held, every packet must hold it */
+	ICM_20948_fifoStreamEnable(true);
+	IIC_SimAdvance(TEST_FIFO_US);
+	ICM_20948_fifoRead(fifoAccel, fifoGyro, ICM_20948_FIFO_MAX_PACKETS, &packets);
+
+	/* 51.1 Hz sample rate of ICM_20948_Init2 */
+	if ( (packets < 10) || (packets > 11) ) {
+		printf("FAIL %u FIFO packets after %u ms, expected 10 or 11\n", packets, (unsigned) (TEST_FIFO_US / 1000));
+		failures++;
+	}
+	for (i = 0; i < packets; i++) {
+		for (j = 0; j < 3; j++) {
+			accel[j] = fifoAccel[i][j] * accelRes;
+			gyro[j] = fifoGyro[i][j] * gyroRes;
+		}
+		check("fifo a", TEST_ROWS - 1, accel, trace[TEST_ROWS - 1].accel, 2.0f * accelRes);
+		check("fifo g", TEST_ROWS - 1, gyro, trace[TEST_ROWS - 1].gyro, 2.0f * gyroRes);
+	}
+
+#if ICM_20948_DMP_MODE == 1
+	printf("%u DMP quaternions\n", (unsigned) dmpTest());
+#endif
+
+	IIC_SimStatsGet(&stats);
+	printf("%u trace rows, %u FIFO packets, %u transactions, %u us bus time\n", (unsigned) TEST_ROWS, packets,
+			(unsigned) stats.transactions, (unsigned) stats.busTimeUs);
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+
+	return failures ? 1 : 0;
+}
+
+#endif /* EMLIB_HOST */
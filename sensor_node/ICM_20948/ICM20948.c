@@ -23,6 +23,7 @@
 #include "debug_dbprint.h"
 #include "delay.h"
 #include <stdint.h>
+#include <math.h>
 #include "pinout.h"
 
 #include "timer.h"				/* Home brew millis() & micros() Arduino like functionality */
@@ -63,8 +64,23 @@ float magRawScaling = 32767.5f; 	/**< =(2^16-1)/2 16 bit representation of gyro
 float _magScale = (4912.0f) / (32767.5f);	/**<  Factor to calulate magn in microTesla from raw values of registers, same as magscale */
 
 // static to keep callibration values in memory
-static float _hxb = 0, _hyb = 0, _hzb = 0;			/**< Offsets of the magnetometer, DEFAULT=0 */
-static float _hxs = 1.0f, _hys = 1.0f,_hzs = 1.0f;	/**< Scale factors of the magnetometer, DEFAULT=1 */
+static float _magOffset[3] = {0, 0, 0};				/**< Hard iron offset of the magnetometer in counts, added to the transformed values, DEFAULT=0 */
+static float _magMatrix[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};	/**< Soft iron correction matrix (row major), applied after the offset, DEFAULT=identity */
+static int16_t _magOffsetCounts[3] = {0, 0, 0};		/**< _magOffset rounded, used by the fixed-point path */
+static int32_t _magMatrixQ14[9] = {1 << 14, 0, 0, 0, 1 << 14, 0, 0, 0, 1 << 14};	/**< _magMatrix in Q14, used by the fixed-point path */
+
+static void ICM_20948_magCountsCalibrate(int16_t *magn);
+
+#define ICM_20948_BANK_UNKNOWN	0xFF				/**< Bank register content not known, next access selects the bank */
+static uint8_t currentBank = ICM_20948_BANK_UNKNOWN;	/**< Last bank written to REG_BANK_SEL */
+static uint32_t transactionCount = 0;				/**< Number of I2C transactions to the IMU and magnetometer */
+
+static uint8_t gyroFullscale = ICM_20948_GYRO_FULLSCALE_250DPS;	/**< Gyro full scale as written by ICM_20948_gyroFullscaleSet, reset value */
+static uint8_t accelFullscale = ICM_20948_ACCEL_FULLSCALE_2G;	/**< Accel full scale as written by ICM_20948_accelFullscaleSet, reset value */
+
+#if ICM_20948_DMP_MODE == 1
+static bool dmpLoaded = false;						/**< DMP firmware in DMP memory, lost on reset or power down */
+#endif
 
 
 extern bool IMU_MEASURING;							/**<  Variable to check if IMU is measuring */
@@ -78,8 +94,9 @@ extern bool IMU_MEASURING;							/**<  Variable to check if IMU is measuring */
  * 		Power on IMU
  * 		Reset IMU
  * 		Init 2
- * 		Calibrate Gyro + Accel
- * 		Calibrate Magn
+ *
+ * @note
+ * 		Calibration is loaded or run by CAL_Init (calibration.c)
  *
  ******************************************************************************/
 void ICM_20948_Init ()
@@ -103,60 +120,58 @@ void ICM_20948_Init ()
 	ICM_20948_reset();
 	delay(100); // 100ms delay needed for reset sequence
 
+	/* Run the bus as fast as the IMU and magnetometer allow */
+	ICM_20948_busSpeedProbe();
 
-	ICM_20948_Init2();
-
-
-#if DIY == 0
-    BSP_LedSet(0);
-#endif
-
-    /* CALIBRATION */
-/////////////////////////////////////////////////////////////////
- 	 float accelCal[3];
- 	 float gyroCal[3];
- 	 float magOffset[3];
- 	 float magScale[3];
- 	 ICM_20948_accelGyroCalibrate( accelCal, gyroCal );
-/////////////////////////////////////////////////////////////////
-
-#if DIY == 0
- 	 BSP_LedClear(0);
-#endif
-
-#if DIY == 0
-	BSP_LedSet(1);
-#endif
 
 	ICM_20948_Init2();
 
-	////////////////////////////////////
-#if DIY == 1
-	GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModePushPull, 0);
-	GPIO_PinOutSet(LED_PORT, LED_PIN);
-#endif
-	uint8_t temp[1];
-    ICM_20948_set_mag_mode(AK09916_MODE_100HZ);
-    delay(100);
-	ICM_20948_read_mag_register(0x31, 1, temp);
-	ICM_20948_read_mag_register(0x11, 8, temp);
-
-	ICM_20948_calibrate_mag( magOffset, magScale );
-
-#if DIY == 1
-	GPIO_PinOutClear(LED_PORT, LED_PIN);
-	GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModeDisabled, 0);
-#endif
-
-////////////////////////////////////
-#if DIY == 0
-	BSP_LedClear(1);
-#endif
-
+	ICM_20948_Initialized = true;
+}
 
+/***************************************************************************//**
+ * @brief
+ *    Select the fastest I2C bus profile both the ICM20948 and AK09916 answer at
+ *
+ * @details
+ *	Starts at I2C_BUS_SPEED and steps down when a "Who am I" read NACKs or
+ *	returns a wrong ID. Bypass mode is enabled to reach the AK09916.
+ *
+ * @return
+ *	ICM_20948_OK when a profile works, ICM_20948_ERROR_INVALID_DEVICE_ID
+ *	when not even standard mode does (bus left at standard mode)
+ *
+ ******************************************************************************/
+uint32_t ICM_20948_busSpeedProbe(void)
+{
+	uint8_t whoAmI = 0;
+	IIC_Speed_t speed = I2C_BUS_SPEED;
 
+	while (true)
+	{
+		IIC_SpeedSet(speed);
+		ICM_20948_bankInvalidate();
+
+		/* A NACKed read leaves the buffer untouched, clear it before every read */
+		whoAmI = 0;
+		ICM_20948_registerRead(ICM_20948_REG_WHO_AM_I, 1, &whoAmI);
+		if (whoAmI == ICM20948_DEVICE_ID)
+		{
+			ICM_20948_registerWrite(ICM_20948_REG_INT_PIN_CFG, ICM_20948_BIT_BYPASS_EN);
+			whoAmI = 0;
+			ICM_20948_read_mag_register(AK09916_REG_WHO_AM_I, 1, &whoAmI);
+			if (whoAmI == AK09916_DEVICE_ID)
+			{
+				return ICM_20948_OK;
+			}
+		}
 
-	ICM_20948_Initialized = true;
+		if (speed == IIC_SPEED_STANDARD)
+		{
+			return ICM_20948_ERROR_INVALID_DEVICE_ID;
+		}
+		speed--;
+	}
 }
 
 /***************************************************************************//**
@@ -404,6 +419,14 @@ void ICM_20948_power (bool enable)
 		if (enable) GPIO_PinModeSet(ICM_20948_POWER_PORT, ICM_20948_POWER_PIN, gpioModePushPull, enable); /* Enable VDD pin */
 		else GPIO_PinModeSet(ICM_20948_POWER_PORT, ICM_20948_POWER_PIN, gpioModeDisabled, 0); /* Disable VDD pin */
 //	}
+
+	/* Registers are back at their reset values */
+	ICM_20948_bankInvalidate();
+	gyroFullscale = ICM_20948_GYRO_FULLSCALE_250DPS;
+	accelFullscale = ICM_20948_ACCEL_FULLSCALE_2G;
+#if ICM_20948_DMP_MODE == 1
+	dmpLoaded = false;
+#endif
 }
 
 /**************************************************************************//**
@@ -527,11 +550,53 @@ void ICM_20948_chipSelectSet(bool enable)
  *****************************************************************************/
 void ICM_20948_bankSelect(uint8_t bank)
 {
+	/* Bank is still selected, no need to write it again */
+	if(bank == currentBank)
+	{
+		return;
+	}
+
 	uint8_t wBuffer[2];
 	wBuffer[0] = ICM_20948_REG_BANK_SEL;
 	wBuffer[1] = (bank << 4);
 
-	IIC_WriteBuffer(ICM_20948_I2C_ADDRESS, wBuffer, 2);
+	transactionCount++;
+	if(IIC_WriteBuffer(ICM_20948_I2C_ADDRESS, wBuffer, 2))
+	{
+		currentBank = bank;
+	}else{
+		currentBank = ICM_20948_BANK_UNKNOWN;
+	}
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Forget the selected bank, the next register access writes REG_BANK_SEL
+ *
+ * @details
+ *   Call after the IMU was reset or powered down, or the I2C bus was disabled
+ *
+ *****************************************************************************/
+void ICM_20948_bankInvalidate(void)
+{
+	currentBank = ICM_20948_BANK_UNKNOWN;
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Number of I2C transactions to the IMU and magnetometer
+ *
+ * @details
+ *   Take the difference before and after a call to see how many
+ *   transactions it needed, bank selects included
+ *
+ * @return
+ *   transactions since boot (wraps around)
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_transactionCountGet(void)
+{
+	return transactionCount;
 }
 
 /**************************************************************************//**
@@ -670,8 +735,7 @@ void ICM_20948_registerRead(uint16_t addr, int numBytes, uint8_t *data)
 	wBuffer[0] = regAddr;
 	wBuffer[1] = 0x00;	/* 0x00 to read */
 
-	// TODO
-
+	transactionCount++;
 	IIC_WriteReadBuffer(ICM_20948_I2C_ADDRESS, wBuffer, 1, data, rLength);
 
 
@@ -708,7 +772,7 @@ void ICM_20948_registerWrite(uint16_t addr, uint8_t data)
 	wBuffer[0] = regAddr;
 	wBuffer[1] = data;
 
-
+	transactionCount++;
 	IIC_WriteBuffer(ICM_20948_I2C_ADDRESS, wBuffer, 2);
 
 	return;
@@ -767,6 +831,14 @@ uint32_t ICM_20948_reset(void)
   /* Wait 100ms to complete the reset sequence */
   delay(100);
 
+  /* Registers are back at their reset values */
+  ICM_20948_bankInvalidate();
+  gyroFullscale = ICM_20948_GYRO_FULLSCALE_250DPS;
+  accelFullscale = ICM_20948_ACCEL_FULLSCALE_2G;
+#if ICM_20948_DMP_MODE == 1
+  dmpLoaded = false;
+#endif
+
   return ICM_20948_OK;
 }
 
@@ -786,7 +858,7 @@ uint32_t ICM_20948_gyroDataRead(float *gyro)
   float gyroRes;
   int16_t temp;
 
-  /* Retrieve the current resolution */
+  /* Retrieve the current resolution, cached */
   ICM_20948_gyroResolutionGet(&gyroRes);
 
   /* Read the six raw data registers into data array */
@@ -806,24 +878,46 @@ uint32_t ICM_20948_gyroDataRead(float *gyro)
 
 /**************************************************************************//**
  * @brief
- *   Set gyro resolution
+ *   Read RAW gyroscope data from IMU
  *
+ * @details
+ *   No resolution lookup or float conversion, used by the fixed-point sensor fusion
  *
- * @param[in/out] gyroRes
- *   gyro resulution input
- *   gyro actual resolution output
+ * @param[out] gyro
+ *   pointer to store the raw register values
  *
  *****************************************************************************/
-uint32_t ICM_20948_gyroResolutionGet(float *gyroRes)
+uint32_t ICM_20948_gyroRawDataRead(int16_t *gyro)
 {
-  uint8_t reg;
+  uint8_t rawData[6];
 
-  /* Read the actual gyroscope full scale setting */
-  ICM_20948_registerRead(ICM_20948_REG_GYRO_CONFIG_1, 1, &reg);
-  reg &= ICM_20948_MASK_GYRO_FULLSCALE;
+  /* Read the six raw data registers into data array */
+  ICM_20948_registerRead(GYRO_XOUT_H, 6, &rawData[0]);
+
+  /* Convert the MSB and LSB into a signed 16-bit value */
+  gyro[0] = ( (int16_t) rawData[0] << 8) | rawData[1];
+  gyro[1] = ( (int16_t) rawData[2] << 8) | rawData[3];
+  gyro[2] = ( (int16_t) rawData[4] << 8) | rawData[5];
 
+  return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Get gyro resolution
+ *
+ * @details
+ *   Uses the full scale kept by ICM_20948_gyroFullscaleSet, no bus access
+ *
+ * @param[out] gyroRes
+ *   gyro actual resolution output
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_gyroResolutionGet(float *gyroRes)
+{
   /* Calculate the resolution */
-  switch ( reg ) {
+  switch ( gyroFullscale ) {
     case ICM_20948_GYRO_FULLSCALE_250DPS:
       *gyroRes = 250.0 / 32768.0;
       break;
@@ -1151,8 +1245,631 @@ uint32_t ICM_20948_cycleModeEnable(bool enable)
 
   ICM_20948_registerWrite(ICM_20948_REG_LP_CONFIG, reg);
 
-  return ICM_20948_OK;
+  return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Enable streaming of accelerometer and gyroscope data to the FIFO
+ *
+ * @details
+ *   The FIFO is filled at the sample rate, one packet is accel x, y, z
+ *   followed by gyro x, y, z (ICM_20948_FIFO_PACKET_SIZE bytes)
+ *
+ * @param[in] enable
+ *   @li 'true' - reset the FIFO and start streaming
+ *   @li 'false' - stop streaming and disable the FIFO
+ *
+ * @return
+ * OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_fifoStreamEnable(bool enable)
+{
+  uint8_t userCtrl;
+
+  /* Keep the other bits of the user control register */
+  ICM_20948_registerRead(ICM_20948_REG_USER_CTRL, 1, &userCtrl);
+
+  if ( enable ) {
+    /* Overwrite the oldest data when full, only accel and gyro */
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_MODE, ICM_20948_FIFO_MODE_STREAM);
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_EN_1, 0x00);
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_EN_2, ICM_20948_BIT_ACCEL_FIFO_EN | ICM_20948_BITS_GYRO_FIFO_EN);
+
+    /* Reset the FIFO */
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x0F);
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x00);
+
+    /* Enable the FIFO */
+    ICM_20948_registerWrite(ICM_20948_REG_USER_CTRL, userCtrl | ICM_20948_BIT_FIFO_EN);
+  } else {
+    /* Stop writing to the FIFO and disable it */
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_EN_2, 0x00);
+    ICM_20948_registerWrite(ICM_20948_REG_USER_CTRL, userCtrl & ~ICM_20948_BIT_FIFO_EN);
+
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x0F);
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x00);
+  }
+
+  return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Read the accel + gyro packets available in the FIFO
+ *
+ * @details
+ *   One transfer for the FIFO count and one burst transfer for the data.
+ *   If the FIFO has overflown the packets are no longer aligned, the FIFO
+ *   is reset and no packets are returned.
+ *
+ * @param[out] accel
+ *   raw accelerometer values, one row per packet
+ * @param[out] gyro
+ *   raw gyroscope values, one row per packet
+ * @param[in] maxPackets
+ *   size of the accel and gyro arrays, max ICM_20948_FIFO_MAX_PACKETS
+ * @param[out] packets
+ *   number of packets read
+ *
+ * @return
+ * OK when done, ERROR on FIFO overflow
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_fifoRead(int16_t (*accel)[3], int16_t (*gyro)[3], uint8_t maxPackets, uint8_t *packets)
+{
+  uint8_t rawData[ICM_20948_FIFO_MAX_PACKETS * ICM_20948_FIFO_PACKET_SIZE];
+  uint16_t fifoCount;
+  uint8_t i, n;
+
+  *packets = 0;
+
+  /* Read FIFO byte count */
+  ICM_20948_registerRead(ICM_20948_REG_FIFO_COUNT_H, 2, &rawData[0]);
+  fifoCount = ( (uint16_t) (rawData[0] & 0x1F) << 8) | rawData[1];
+
+  /* Full FIFO: data was overwritten, start over */
+  if ( fifoCount > ICM_20948_FIFO_SIZE - ICM_20948_FIFO_PACKET_SIZE ) {
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x0F);
+    ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x00);
+    return ERROR;
+  }
+
+  n = ( fifoCount / ICM_20948_FIFO_PACKET_SIZE > maxPackets ) ? maxPackets : fifoCount / ICM_20948_FIFO_PACKET_SIZE;
+  if ( n > ICM_20948_FIFO_MAX_PACKETS ) {
+    n = ICM_20948_FIFO_MAX_PACKETS;
+  }
+  if ( n == 0 ) {
+    return ICM_20948_OK;
+  }
+
+  /* Retrieve all complete packets in one burst */
+  ICM_20948_registerRead(ICM_20948_REG_FIFO_R_W, n * ICM_20948_FIFO_PACKET_SIZE, &rawData[0]);
+
+  /* Convert to 16 bit signed accel and gyro x, y and z values */
+  for ( i = 0; i < n; i++ ) {
+    uint8_t *packet = &rawData[i * ICM_20948_FIFO_PACKET_SIZE];
+    accel[i][0] = ( (int16_t) packet[0] << 8) | packet[1];
+    accel[i][1] = ( (int16_t) packet[2] << 8) | packet[3];
+    accel[i][2] = ( (int16_t) packet[4] << 8) | packet[5];
+    gyro[i][0] = ( (int16_t) packet[6] << 8) | packet[7];
+    gyro[i][1] = ( (int16_t) packet[8] << 8) | packet[9];
+    gyro[i][2] = ( (int16_t) packet[10] << 8) | packet[11];
+  }
+
+  *packets = n;
+
+  return ICM_20948_OK;
+}
+
+
+#if ICM_20948_DMP_MODE == 1
+/**********************************************************************/
+/**************        Digital Motion Processor       *****************/
+/**********************************************************************/
+
+static uint8_t dmpBuffer[2 * ICM_20948_DMP_FRAME_MAX];	/**< FIFO bytes not yet parsed, DMP frames have no fixed size */
+static uint16_t dmpBuffered = 0;						/**< Number of bytes in dmpBuffer */
+
+
+/**************************************************************************//**
+ * @brief
+ *   Write consecutive registers in one transfer
+ *
+ * @param[in] addr
+ *   first register (bank << 7 | register)
+ *
+ * @param[in] numBytes
+ *   number of bytes, max ICM_20948_DMP_MEM_CHUNK
+ *
+ * @param[in] data
+ *   bytes to write
+ *
+ *****************************************************************************/
+static void ICM_20948_registerWriteBurst(uint16_t addr, uint8_t numBytes, const uint8_t *data)
+{
+	uint8_t wBuffer[ICM_20948_DMP_MEM_CHUNK + 1];
+	uint8_t i;
+
+	ICM_20948_bankSelect((uint8_t) (addr >> 7));
+
+	wBuffer[0] = (uint8_t) (addr & 0x7F);
+	for (i = 0; i < numBytes; i++) {
+		wBuffer[i + 1] = data[i];
+	}
+
+	transactionCount++;
+	IIC_WriteBuffer(ICM_20948_I2C_ADDRESS, wBuffer, numBytes + 1);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Write to DMP memory
+ *
+ * @details
+ *   Split in chunks of ICM_20948_DMP_MEM_CHUNK bytes that don't cross a
+ *   memory bank
+ *
+ * @param[in] memAddr
+ *   DMP memory address
+ *
+ * @param[in] length
+ *   number of bytes
+ *
+ * @param[in] data
+ *   bytes to write
+ *
+ * @return
+ *   ICM_20948_OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_dmpMemWrite(uint16_t memAddr, uint16_t length, const uint8_t *data)
+{
+	uint16_t chunk;
+
+	while (length > 0) {
+		chunk = ICM_20948_DMP_MEM_BANK_SIZE - (memAddr & 0xFF);
+		if (chunk > ICM_20948_DMP_MEM_CHUNK) {
+			chunk = ICM_20948_DMP_MEM_CHUNK;
+		}
+		if (chunk > length) {
+			chunk = length;
+		}
+
+		ICM_20948_registerWrite(ICM_20948_REG_MEM_BANK_SEL, (uint8_t) (memAddr >> 8));
+		ICM_20948_registerWrite(ICM_20948_REG_MEM_START_ADDR, (uint8_t) (memAddr & 0xFF));
+		ICM_20948_registerWriteBurst(ICM_20948_REG_MEM_R_W, (uint8_t) chunk, data);
+
+		memAddr += chunk;
+		data += chunk;
+		length -= chunk;
+	}
+
+	return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Read from DMP memory
+ *
+ * @param[in] memAddr
+ *   DMP memory address
+ *
+ * @param[in] length
+ *   number of bytes
+ *
+ * @param[out] data
+ *   where to store the bytes
+ *
+ * @return
+ *   ICM_20948_OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_dmpMemRead(uint16_t memAddr, uint16_t length, uint8_t *data)
+{
+	uint16_t chunk;
+
+	while (length > 0) {
+		chunk = ICM_20948_DMP_MEM_BANK_SIZE - (memAddr & 0xFF);
+		if (chunk > ICM_20948_DMP_MEM_CHUNK) {
+			chunk = ICM_20948_DMP_MEM_CHUNK;
+		}
+		if (chunk > length) {
+			chunk = length;
+		}
+
+		ICM_20948_registerWrite(ICM_20948_REG_MEM_BANK_SEL, (uint8_t) (memAddr >> 8));
+		ICM_20948_registerWrite(ICM_20948_REG_MEM_START_ADDR, (uint8_t) (memAddr & 0xFF));
+		ICM_20948_registerRead(ICM_20948_REG_MEM_R_W, chunk, data);
+
+		memAddr += chunk;
+		data += chunk;
+		length -= chunk;
+	}
+
+	return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Write a 16 or 32 bit big endian value to DMP memory
+ *
+ *****************************************************************************/
+static void ICM_20948_dmpMemWrite16(uint16_t memAddr, uint16_t value)
+{
+	uint8_t data[2] = { (uint8_t) (value >> 8), (uint8_t) value };
+	ICM_20948_dmpMemWrite(memAddr, 2, data);
+}
+
+static void ICM_20948_dmpMemWrite32(uint16_t memAddr, uint32_t value)
+{
+	uint8_t data[4] = { (uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value };
+	ICM_20948_dmpMemWrite(memAddr, 4, data);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Load the DMP firmware image and check it by reading it back
+ *
+ * @details
+ *   The image (ICM_20948_dmpImage) is the DMP3 firmware from the TDK
+ *   InvenSense eMD driver package, it is not part of this repository.
+ *   The IMU has to be awake and out of low power mode.
+ *
+ * @return
+ *   ICM_20948_OK when the image was loaded and verified
+ *   ERROR on a mismatch
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_dmpFirmwareLoad(void)
+{
+	uint8_t verify[ICM_20948_DMP_MEM_CHUNK];
+	uint16_t offset, chunk, i;
+
+	ICM_20948_dmpMemWrite(ICM_20948_DMP_LOAD_START, ICM_20948_dmpImageSize, ICM_20948_dmpImage);
+
+	for (offset = 0; offset < ICM_20948_dmpImageSize; offset += chunk) {
+		chunk = ICM_20948_dmpImageSize - offset;
+		if (chunk > ICM_20948_DMP_MEM_CHUNK) {
+			chunk = ICM_20948_DMP_MEM_CHUNK;
+		}
+
+		ICM_20948_dmpMemRead(ICM_20948_DMP_LOAD_START + offset, chunk, verify);
+		for (i = 0; i < chunk; i++) {
+			if (verify[i] != ICM_20948_dmpImage[offset + i]) {
+				return ERROR;
+			}
+		}
+	}
+
+	return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Load and configure the DMP for 6-axis quaternion output
+ *
+ * @details
+ *   Sample rate is set to 56.25 Hz (divider 19), the rate the accel gain
+ *   values below are meant for. The DMP writes a 6-axis quaternion and
+ *   the raw gyro to the FIFO for every sample and raises the DMP
+ *   interrupt on the INT pin. Values follow the TDK eMD reference setup.
+ *   The firmware is only loaded once after a reset or power up.
+ *   Call ICM_20948_dmpEnable to start.
+ *
+ * @return
+ *   ICM_20948_OK when done
+ *   ERROR if the firmware could not be loaded
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_dmpInit(void)
+{
+	uint8_t reg[2];
+	uint8_t gyroLevel, accelLevel, div;
+	int8_t pll;
+	uint64_t gyroSf;
+
+	/* DMP memory is only accessible with the IMU awake */
+	ICM_20948_sleepModeEnable(false);
+	ICM_20948_lowPowerModeEnter(false, false, false);
+
+	/* DMP stopped while loading */
+	ICM_20948_dmpEnable(false);
+
+	if (!dmpLoaded) {
+		if (ICM_20948_dmpFirmwareLoad() != ICM_20948_OK) {
+			return ERROR;
+		}
+		dmpLoaded = true;
+	}
+
+	/* Program counter start address */
+	reg[0] = (uint8_t) (ICM_20948_DMP_START_ADDRESS >> 8);
+	reg[1] = (uint8_t) (ICM_20948_DMP_START_ADDRESS & 0xFF);
+	ICM_20948_registerWriteBurst(ICM_20948_REG_PRGM_START_ADDRH, 2, reg);
+
+	/* Sample rate the gains are meant for: 1125 / (1 + 19) */
+	div = 19;
+	ICM_20948_registerWrite(ICM_20948_REG_GYRO_SMPLRT_DIV, div);
+	ICM_20948_registerWrite(ICM_20948_REG_ACCEL_SMPLRT_DIV_1, 0);
+	ICM_20948_registerWrite(ICM_20948_REG_ACCEL_SMPLRT_DIV_2, div);
+
+	/* Full scale as set in the driver, 0 = 250 dps / 2 g ... 3 = 2000 dps / 16 g */
+	gyroLevel = gyroFullscale >> ICM_20948_SHIFT_GYRO_FS_SEL;
+	accelLevel = accelFullscale >> ICM_20948_SHIFT_ACCEL_FS;
+	ICM_20948_dmpMemWrite32(ICM_20948_DMP_GYRO_FULLSCALE, 1UL << (25 + gyroLevel));
+	ICM_20948_dmpMemWrite32(ICM_20948_DMP_ACC_SCALE, 1UL << (25 + accelLevel));
+	ICM_20948_dmpMemWrite32(ICM_20948_DMP_ACC_SCALE2, 1UL << (19 - accelLevel));
+
+	/* Gyro scale factor depends on the sample rate and the PLL trim (inv_set_gyro_sf) */
+	ICM_20948_registerRead(ICM_20948_REG_TIMEBASE_CORR_PLL, 1, &reg[0]);
+	pll = (int8_t) reg[0];
+	gyroSf = 264446880937391ULL * (1ULL << gyroLevel) * (1 + div);
+	if (pll < 0) {
+		gyroSf /= (uint64_t) (1270 - (pll & 0x7F) * 79);
+	} else {
+		gyroSf /= (uint64_t) (1270 + pll * 79);
+	}
+	gyroSf /= 100000ULL;
+	if (gyroSf > 0x7FFFFFFF) {
+		gyroSf = 0x7FFFFFFF;
+	}
+	ICM_20948_dmpMemWrite32(ICM_20948_DMP_GYRO_SF, (uint32_t) gyroSf);
+
+	/* Accel fusion gains for 56 Hz */
+	ICM_20948_dmpMemWrite32(ICM_20948_DMP_ACCEL_ONLY_GAIN, 0x03A49249);
+	ICM_20948_dmpMemWrite32(ICM_20948_DMP_ACCEL_ALPHA_VAR, 0x34924925);
+	ICM_20948_dmpMemWrite32(ICM_20948_DMP_ACCEL_A_VAR, 0x0B6DB6DB);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_ACCEL_CAL_RATE, 0x0000);
+
+	/* Outputs: 6-axis quaternion + raw gyro every sample, interrupt on the quaternion */
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_DATA_OUT_CTL1, ICM_20948_DMP_HEADER_QUAT6 | ICM_20948_DMP_HEADER_GYRO);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_DATA_OUT_CTL2, 0x0000);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_DATA_INTR_CTL, ICM_20948_DMP_HEADER_QUAT6);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_MOTION_EVENT_CTL, 0x0000);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_DATA_RDY_STATUS, ICM_20948_DMP_SENSOR_GYRO | ICM_20948_DMP_SENSOR_ACCEL);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_ODR_QUAT6, 0x0000);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_ODR_CNTR_QUAT6, 0x0000);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_ODR_GYRO, 0x0000);
+	ICM_20948_dmpMemWrite16(ICM_20948_DMP_ODR_CNTR_GYRO, 0x0000);
+
+	/* The DMP writes the FIFO, not the sensors */
+	ICM_20948_registerWrite(ICM_20948_REG_FIFO_EN_1, 0x00);
+	ICM_20948_registerWrite(ICM_20948_REG_FIFO_EN_2, 0x00);
+	ICM_20948_registerWrite(ICM_20948_REG_FIFO_MODE, ICM_20948_FIFO_MODE_STREAM);
+	ICM_20948_registerWrite(ICM_20948_REG_FIFO_CFG, ICM_20948_BIT_MULTI_FIFO_CFG);
+
+	return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Start or stop the DMP
+ *
+ * @param[in] enable
+ *   @li 'true' - reset FIFO and DMP, run the DMP, DMP interrupt on INT pin
+ *   @li 'false' - stop the DMP and FIFO, no interrupts
+ *
+ * @return
+ *   ICM_20948_OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_dmpEnable(bool enable)
+{
+	uint8_t userCtrl;
+
+	/* Keep the other bits of the user control register */
+	ICM_20948_registerRead(ICM_20948_REG_USER_CTRL, 1, &userCtrl);
+	userCtrl &= ~(ICM_20948_BIT_DMP_EN | ICM_20948_BIT_FIFO_EN | ICM_20948_BIT_DMP_RST);
+	ICM_20948_registerWrite(ICM_20948_REG_USER_CTRL, userCtrl);
+
+	/* Start from an empty FIFO */
+	ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x1F);
+	ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x00);
+	dmpBuffered = 0;
+
+	if (enable) {
+		ICM_20948_registerWrite(ICM_20948_REG_USER_CTRL, userCtrl | ICM_20948_BIT_DMP_RST);
+		delay(1);
+		ICM_20948_registerWrite(ICM_20948_REG_USER_CTRL, userCtrl | ICM_20948_BIT_DMP_EN | ICM_20948_BIT_FIFO_EN);
+
+		ICM_20948_registerWrite(ICM_20948_REG_INT_ENABLE, ICM_20948_BIT_DMP_INT1_EN);
+		ICM_20948_registerWrite(ICM_20948_REG_INT_ENABLE_1, 0x00);
+	} else {
+		ICM_20948_registerWrite(ICM_20948_REG_INT_ENABLE, 0x00);
+	}
+
+	return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Parse one DMP FIFO frame
+ *
+ * @param[in] frame
+ *   bytes from the FIFO, starting at a frame header
+ *
+ * @param[in] length
+ *   number of bytes available
+ *
+ * @param[out] quat
+ *   w, x, y, z when the frame has a 6-axis quaternion
+ *
+ * @param[out] gyro
+ *   raw gyro x, y, z when the frame has gyro data
+ *
+ * @param[out] outputs
+ *   header bits of the frame
+ *
+ * @return
+ *   frame size, 0 if the frame is not complete yet, -1 for an unknown header
+ *
+ *****************************************************************************/
+static int16_t ICM_20948_dmpFrameParse(const uint8_t *frame, uint16_t length, float *quat, int16_t *gyro, uint16_t *outputs)
+{
+	/* Data size of each header bit, from bit 15 down, in FIFO order */
+	static const uint8_t headerSize[16] = { 6, 12, 6, 8, 12, 14, 6, 14, 6, 12, 12, 4, 0, 0, 0, 0 };
+	static const uint8_t header2Size[16] = { 0, 2, 2, 2, 2, 2, 0, 0, 6, 2, 0, 0, 0, 0, 0, 0 };
+	const uint16_t header2Known = 0x7CC0;
+	uint16_t header, header2 = 0;
+	uint16_t size, pos, quatPos = 0, gyroPos = 0;
+	uint8_t bit;
+
+	if (length < 2) {
+		return 0;
+	}
+
+	header = ( (uint16_t) frame[0] << 8) | frame[1];
+	if (header & 0x0007) {
+		return -1;
+	}
+
+	size = 2;
+	if (header & ICM_20948_DMP_HEADER_HEADER2) {
+		if (length < 4) {
+			return 0;
+		}
+		header2 = ( (uint16_t) frame[2] << 8) | frame[3];
+		if (header2 & ~header2Known) {
+			return -1;
+		}
+		size = 4;
+	}
+
+	for (bit = 0; bit < 12; bit++) {
+		if (header & (0x8000 >> bit)) {
+			if ( (0x8000 >> bit) == ICM_20948_DMP_HEADER_GYRO ) {
+				gyroPos = size;
+			}
+			if ( (0x8000 >> bit) == ICM_20948_DMP_HEADER_QUAT6 ) {
+				quatPos = size;
+			}
+			size += headerSize[bit];
+		}
+	}
+	for (bit = 0; bit < 16; bit++) {
+		if (header2 & (0x8000 >> bit)) {
+			size += header2Size[bit];
+		}
+	}
+	size += ICM_20948_DMP_FOOTER_SIZE;
+
+	if (length < size) {
+		return 0;
+	}
+
+	if (quatPos) {
+		/* x, y, z in Q30, w follows from the unit norm */
+		float q[3], w;
+		for (pos = 0; pos < 3; pos++) {
+			const uint8_t *p = &frame[quatPos + 4 * pos];
+			int32_t v = (int32_t) ( ( (uint32_t) p[0] << 24) | ( (uint32_t) p[1] << 16) | ( (uint32_t) p[2] << 8) | p[3]);
+			q[pos] = (float) v * (1.0f / 1073741824.0f);
+		}
+		w = 1.0f - (q[0] * q[0] + q[1] * q[1] + q[2] * q[2]);
+		quat[0] = (w > 0.0f) ? sqrtf(w) : 0.0f;
+		quat[1] = q[0];
+		quat[2] = q[1];
+		quat[3] = q[2];
+	}
+
+	if (gyroPos) {
+		/* Raw gyro, the bias that follows is not used */
+		gyro[0] = ( (int16_t) frame[gyroPos] << 8) | frame[gyroPos + 1];
+		gyro[1] = ( (int16_t) frame[gyroPos + 2] << 8) | frame[gyroPos + 3];
+		gyro[2] = ( (int16_t) frame[gyroPos + 4] << 8) | frame[gyroPos + 5];
+	}
+
+	*outputs = header;
+
+	return (int16_t) size;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Read the DMP FIFO and keep the latest quaternion
+ *
+ * @details
+ *   Frames that are not complete yet stay buffered for the next call.
+ *   On an unknown header the frames are no longer aligned, the FIFO is
+ *   reset and ERROR is returned.
+ *
+ * @param[out] quat
+ *   latest w, x, y, z, unchanged when no quaternion was read
+ *
+ * @param[out] gyro
+ *   latest raw gyro x, y, z, unchanged when no gyro was read
+ *
+ * @param[out] frames
+ *   number of quaternions read
+ *
+ * @return
+ *   ICM_20948_OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_dmpQuaternionRead(float *quat, int16_t *gyro, uint8_t *frames)
+{
+	uint8_t countData[2];
+	uint16_t fifoCount, chunk, pos, outputs;
+	int16_t size;
+
+	*frames = 0;
+
+	ICM_20948_registerRead(ICM_20948_REG_FIFO_COUNT_H, 2, countData);
+	fifoCount = ( (uint16_t) (countData[0] & 0x1F) << 8) | countData[1];
+
+	do {
+		/* Top up the buffer, one transfer is max 255 bytes */
+		chunk = sizeof(dmpBuffer) - dmpBuffered;
+		if (chunk > fifoCount) {
+			chunk = fifoCount;
+		}
+		if (chunk > 255) {
+			chunk = 255;
+		}
+		if (chunk > 0) {
+			ICM_20948_registerRead(ICM_20948_REG_FIFO_R_W, chunk, &dmpBuffer[dmpBuffered]);
+			dmpBuffered += chunk;
+			fifoCount -= chunk;
+		}
+
+		/* Parse all complete frames */
+		pos = 0;
+		while ( (size = ICM_20948_dmpFrameParse(&dmpBuffer[pos], dmpBuffered - pos, quat, gyro, &outputs)) > 0 ) {
+			if (outputs & ICM_20948_DMP_HEADER_QUAT6) {
+				(*frames)++;
+			}
+			pos += size;
+		}
+
+		if (size < 0) {
+			ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x1F);
+			ICM_20948_registerWrite(ICM_20948_REG_FIFO_RST, 0x00);
+			dmpBuffered = 0;
+			return ERROR;
+		}
+
+		/* Keep the incomplete frame */
+		for (chunk = 0; pos + chunk < dmpBuffered; chunk++) {
+			dmpBuffer[chunk] = dmpBuffer[pos + chunk];
+		}
+		dmpBuffered -= pos;
+	} while (fifoCount > 0);
+
+	return ICM_20948_OK;
 }
+#endif /* ICM_20948_DMP_MODE */
 
 
 /**************************************************************************//**
@@ -1173,7 +1890,7 @@ uint32_t ICM_20948_accelDataRead(float *accel)
   float accelRes;
   int16_t temp;
 
-  /* Retrieve the current resolution */
+  /* Retrieve the current resolution, cached */
   ICM_20948_accelResolutionGet(&accelRes);
 
   /* Read the six raw data registers into data array */
@@ -1190,10 +1907,42 @@ uint32_t ICM_20948_accelDataRead(float *accel)
   return ICM_20948_OK;
 }
 
+
+/**************************************************************************//**
+ * @brief
+ *   Read RAW accelerometer data as signed 16-bit register values
+ *
+ * @details
+ *   No resolution lookup or float conversion, used by the fixed-point sensor fusion
+ *
+ * @param[out] accel
+ *   pointer to resulting memory locaion
+ *
+ * @return
+ * OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_accelRawDataRead(int16_t *accel)
+{
+  uint8_t rawData[6];
+
+  /* Read the six raw data registers into data array */
+  ICM_20948_registerRead(ICM_20948_REG_ACCEL_XOUT_H_SH, 6, &rawData[0]);
+
+  /* Convert the MSB and LSB into a signed 16-bit value */
+  accel[0] = ( (int16_t) rawData[0] << 8) | rawData[1];
+  accel[1] = ( (int16_t) rawData[2] << 8) | rawData[3];
+  accel[2] = ( (int16_t) rawData[4] << 8) | rawData[5];
+
+  return ICM_20948_OK;
+}
+
 /**************************************************************************//**
  * @brief
  *   Get accelerometer resultion
  *
+ * @details
+ *   Uses the full scale kept by ICM_20948_accelFullscaleSet, no bus access
  *
  * @param[out] accelRes
  *   pointer to accelerometer resulution
@@ -1201,14 +1950,8 @@ uint32_t ICM_20948_accelDataRead(float *accel)
  *****************************************************************************/
 uint32_t ICM_20948_accelResolutionGet(float *accelRes)
 {
-  uint8_t reg;
-
-  /* Read the actual acceleration full scale setting */
-  ICM_20948_registerRead(ICM_20948_REG_ACCEL_CONFIG, 1, &reg);
-  reg &= ICM_20948_MASK_ACCEL_FULLSCALE;
-
   /* Calculate the resolution */
-  switch ( reg ) {
+  switch ( accelFullscale ) {
     case ICM_20948_ACCEL_FULLSCALE_2G:
       *accelRes = 2.0 / 32768.0;
       break;
@@ -1249,6 +1992,9 @@ uint32_t ICM_20948_accelFullscaleSet(uint8_t accelFs)
   reg |= accelFs;
   ICM_20948_registerWrite(ICM_20948_REG_ACCEL_CONFIG, reg);
 
+  /* Keep the setting, resolution lookups don't need the bus */
+  accelFullscale = accelFs;
+
   return ICM_20948_OK;
 }
 
@@ -1272,6 +2018,9 @@ uint32_t ICM_20948_gyroFullscaleSet(uint8_t gyroFs)
   reg |= gyroFs;
   ICM_20948_registerWrite(ICM_20948_REG_GYRO_CONFIG_1, reg);
 
+  /* Keep the setting, resolution lookups don't need the bus */
+  gyroFullscale = gyroFs;
+
   return ICM_20948_OK;
 }
 
@@ -1340,6 +2089,165 @@ uint32_t ICM_20948_wakeOnMotionITEnable(bool enable, uint8_t womThreshold, float
 }
 
 
+/**************************************************************************//**
+ * @brief
+ *   Save the registers that wake on motion changes
+ *
+ * @details
+ *	 Call before ICM_20948_wakeOnMotionITEnable. The IMU stays powered while the
+ *	 MCU sleeps, so everything else (gyro full scale, bandwidths, interrupt pin,
+ *	 bypass, magnetometer calibration) is still valid when it wakes up.
+ *	 The magnetometer is read through bypass, disable the I2C master first.
+ *
+ * @param[out] state
+ *   Register values
+ *
+ * @return
+ * 	OK if successful
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_wakeStateSave(ICM_20948_WakeState_t *state)
+{
+  ICM_20948_registerRead(ICM_20948_REG_PWR_MGMT_1, 1, &state->pwrMgmt1);
+  ICM_20948_registerRead(ICM_20948_REG_PWR_MGMT_2, 1, &state->pwrMgmt2);
+  ICM_20948_registerRead(ICM_20948_REG_LP_CONFIG, 1, &state->lpConfig);
+  ICM_20948_registerRead(ICM_20948_REG_INT_ENABLE, 1, &state->intEnable);
+  ICM_20948_registerRead(ICM_20948_REG_INT_ENABLE_1, 1, &state->intEnable1);
+
+  ICM_20948_registerRead(ICM_20948_REG_GYRO_SMPLRT_DIV, 1, &state->gyroSmplrtDiv);
+  ICM_20948_registerRead(ICM_20948_REG_ACCEL_SMPLRT_DIV_1, 1, &state->accelSmplrtDiv1);
+  ICM_20948_registerRead(ICM_20948_REG_ACCEL_SMPLRT_DIV_2, 1, &state->accelSmplrtDiv2);
+  ICM_20948_registerRead(ICM_20948_REG_ACCEL_INTEL_CTRL, 1, &state->accelIntelCtrl);
+  ICM_20948_registerRead(ICM_20948_REG_ACCEL_CONFIG, 1, &state->accelConfig);
+
+  ICM_20948_read_mag_register(AK09916_REG_CONTROL_2, 1, &state->magMode);
+
+  return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Leave wake on motion, restore the registers saved by ICM_20948_wakeStateSave
+ *
+ * @details
+ *	 Replaces ICM_20948_Init2 after sleep: no PLL waits, no magnetometer reset,
+ *	 only register writes. The gyro needs its start-up time (~35 ms), the
+ *	 data ready interrupt is enabled by the caller.
+ *
+ * @param[in] state
+ *   Register values
+ *
+ * @return
+ * 	OK if successful
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_wakeStateRestore(const ICM_20948_WakeState_t *state)
+{
+  uint8_t temp[8];
+
+  /* Wake on motion off first, restoring the rates must not trigger it */
+  ICM_20948_registerWrite(ICM_20948_REG_ACCEL_INTEL_CTRL, state->accelIntelCtrl);
+  ICM_20948_registerWrite(ICM_20948_REG_INT_ENABLE, state->intEnable);
+
+  /* Continuous mode, sensors on */
+  ICM_20948_registerWrite(ICM_20948_REG_LP_CONFIG, state->lpConfig);
+  ICM_20948_registerWrite(ICM_20948_REG_PWR_MGMT_1, state->pwrMgmt1);
+  ICM_20948_registerWrite(ICM_20948_REG_PWR_MGMT_2, state->pwrMgmt2);
+
+  ICM_20948_registerWrite(ICM_20948_REG_GYRO_SMPLRT_DIV, state->gyroSmplrtDiv);
+  ICM_20948_registerWrite(ICM_20948_REG_ACCEL_SMPLRT_DIV_1, state->accelSmplrtDiv1);
+  ICM_20948_registerWrite(ICM_20948_REG_ACCEL_SMPLRT_DIV_2, state->accelSmplrtDiv2);
+  ICM_20948_registerWrite(ICM_20948_REG_ACCEL_CONFIG, state->accelConfig);
+
+  /* Wake on motion switched to 2G, keep the resolution lookups right */
+  accelFullscale = state->accelConfig & ICM_20948_MASK_ACCEL_FULLSCALE;
+
+  ICM_20948_registerWrite(ICM_20948_REG_INT_ENABLE_1, state->intEnable1);
+
+  /* Magnetometer was powered down, restart it */
+  ICM_20948_set_mag_mode(state->magMode);
+  /* Update data by reading through till ST2 register */
+  ICM_20948_read_mag_register(AK09916_REG_HXL, 8, temp);
+
+  return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Read the accel and gyro offset cancellation registers
+ *
+ * @details
+ *	 Holds the factory trim plus the result of ICM_20948_accelGyroCalibrate,
+ *	 lost when the IMU is reset or powered down.
+ *
+ * @param[out] accelOffset
+ *   XA, YA, ZA_OFFSET register values
+ *
+ * @param[out] gyroOffset
+ *   XG, YG, ZG_OFFS_USR register values
+ *
+ * @return
+ * 	OK if successful
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_offsetRegistersGet(int16_t *accelOffset, int16_t *gyroOffset)
+{
+  uint8_t data[2];
+
+  ICM_20948_registerRead(ICM_20948_REG_XA_OFFSET_H, 2, data);
+  accelOffset[0] = (int16_t) ( (data[0] << 8) | data[1]);
+  ICM_20948_registerRead(ICM_20948_REG_YA_OFFSET_H, 2, data);
+  accelOffset[1] = (int16_t) ( (data[0] << 8) | data[1]);
+  ICM_20948_registerRead(ICM_20948_REG_ZA_OFFSET_H, 2, data);
+  accelOffset[2] = (int16_t) ( (data[0] << 8) | data[1]);
+
+  ICM_20948_registerRead(ICM_20948_REG_XG_OFFS_USRH, 2, data);
+  gyroOffset[0] = (int16_t) ( (data[0] << 8) | data[1]);
+  ICM_20948_registerRead(ICM_20948_REG_YG_OFFS_USRH, 2, data);
+  gyroOffset[1] = (int16_t) ( (data[0] << 8) | data[1]);
+  ICM_20948_registerRead(ICM_20948_REG_ZG_OFFS_USRH, 2, data);
+  gyroOffset[2] = (int16_t) ( (data[0] << 8) | data[1]);
+
+  return ICM_20948_OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Write the accel and gyro offset cancellation registers
+ *
+ * @param[in] accelOffset
+ *   XA, YA, ZA_OFFSET register values, as read by ICM_20948_offsetRegistersGet
+ *
+ * @param[in] gyroOffset
+ *   XG, YG, ZG_OFFS_USR register values
+ *
+ * @return
+ * 	OK if successful
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_offsetRegistersSet(const int16_t *accelOffset, const int16_t *gyroOffset)
+{
+  ICM_20948_registerWrite(ICM_20948_REG_XA_OFFSET_H, (accelOffset[0] >> 8) & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_XA_OFFSET_L, accelOffset[0] & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_YA_OFFSET_H, (accelOffset[1] >> 8) & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_YA_OFFSET_L, accelOffset[1] & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_ZA_OFFSET_H, (accelOffset[2] >> 8) & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_ZA_OFFSET_L, accelOffset[2] & 0xFF);
+
+  ICM_20948_registerWrite(ICM_20948_REG_XG_OFFS_USRH, (gyroOffset[0] >> 8) & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_XG_OFFS_USRL, gyroOffset[0] & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_YG_OFFS_USRH, (gyroOffset[1] >> 8) & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_YG_OFFS_USRL, gyroOffset[1] & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_ZG_OFFS_USRH, (gyroOffset[2] >> 8) & 0xFF);
+  ICM_20948_registerWrite(ICM_20948_REG_ZG_OFFS_USRL, gyroOffset[2] & 0xFF);
+
+  return ICM_20948_OK;
+}
+
+
 /**************************************************************************//**
  * @brief
  *   Set gyroscope bandwidth
@@ -1596,6 +2504,7 @@ void ICM_20948_read_mag_register(uint8_t addr, uint8_t numBytes, uint8_t *data)
 	wBuffer[0] = addr;
 	wBuffer[1] = 0x00;
 
+	transactionCount++;
 	IIC_WriteReadBuffer( ( AK09916_BIT_I2C_SLV_ADDR << 1 ), wBuffer, 1, data, numBytes);
 }
 
@@ -1650,6 +2559,7 @@ void ICM_20948_write_mag_register(uint8_t addr, uint8_t data) {
 	wBuffer[0] = addr;
 	wBuffer[1] = data;
 
+	transactionCount++;
 	IIC_WriteBuffer( ( AK09916_BIT_I2C_SLV_ADDR << 1 ), wBuffer, 2);
 }
 
@@ -1752,10 +2662,202 @@ void ICM_20948_magDataRead(float *magn) {
 	_hycounts = (((int16_t) data[3] << 8) | data[2] );
 	_hzcounts = (((int16_t) data[5] << 8) | data[4] );
 
-	magn[0] = (((float)(tX[0]*_hxcounts + tX[1]*_hycounts + tX[2]*_hzcounts) * _magScale) + _hxb)*_hxs;
-	magn[1] = (((float)(tY[0]*_hxcounts + tY[1]*_hycounts + tY[2]*_hzcounts) * _magScale) + _hyb)*_hys;
-	magn[2] = (((float)(tZ[0]*_hxcounts + tZ[1]*_hycounts + tZ[2]*_hzcounts) * _magScale) + _hzb)*_hzs;
+	float v[3];
+	v[0] = (float)(tX[0]*_hxcounts + tX[1]*_hycounts + tX[2]*_hzcounts) + _magOffset[0];
+	v[1] = (float)(tY[0]*_hxcounts + tY[1]*_hycounts + tY[2]*_hzcounts) + _magOffset[1];
+	v[2] = (float)(tZ[0]*_hxcounts + tZ[1]*_hycounts + tZ[2]*_hzcounts) + _magOffset[2];
+
+	magn[0] = (_magMatrix[0]*v[0] + _magMatrix[1]*v[1] + _magMatrix[2]*v[2]) * _magScale;
+	magn[1] = (_magMatrix[3]*v[0] + _magMatrix[4]*v[1] + _magMatrix[5]*v[2]) * _magScale;
+	magn[2] = (_magMatrix[6]*v[0] + _magMatrix[7]*v[1] + _magMatrix[8]*v[2]) * _magScale;
+
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Read calibrated magnetometer values in counts
+ *
+ * @details
+ *   Integer version of ICM_20948_magDataRead for the fixed-point sensor fusion,
+ *   offsets are applied in counts and scale factors in Q14
+ *
+ * @param[out] magn
+ *   calibrated values in counts, same reference frame as gyro & accel
+ *
+ *****************************************************************************/
+void ICM_20948_magCalDataRead(int16_t *magn) {
+
+	uint8_t data[8];
+	ICM_20948_read_mag_register(0x11, 8, data);
+
+	/* Convert the LSB and MSB into a signed 16-bit value */
+	_hxcounts = (((int16_t) data[1] << 8) | data[0] );
+	_hycounts = (((int16_t) data[3] << 8) | data[2] );
+	_hzcounts = (((int16_t) data[5] << 8) | data[4] );
+
+	ICM_20948_magCountsCalibrate(magn);
+
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Transform and calibrate the last magnetometer counts
+ *
+ * @details
+ *   Uses _hxcounts, _hycounts and _hzcounts, offset in counts and correction matrix in Q14
+ *
+ * @param[out] magn
+ *   calibrated values in counts, same reference frame as gyro & accel
+ *
+ *****************************************************************************/
+static void ICM_20948_magCountsCalibrate(int16_t *magn) {
+
+	int32_t v[3];
+	int64_t temp;
+
+	v[0] = (int32_t)(tX[0]*_hxcounts + tX[1]*_hycounts + tX[2]*_hzcounts) + _magOffsetCounts[0];
+	v[1] = (int32_t)(tY[0]*_hxcounts + tY[1]*_hycounts + tY[2]*_hzcounts) + _magOffsetCounts[1];
+	v[2] = (int32_t)(tZ[0]*_hxcounts + tZ[1]*_hycounts + tZ[2]*_hzcounts) + _magOffsetCounts[2];
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		temp = (int64_t)_magMatrixQ14[3*i]*v[0] + (int64_t)_magMatrixQ14[3*i + 1]*v[1] + (int64_t)_magMatrixQ14[3*i + 2]*v[2];
+		temp /= (1 << 14);
+		if(temp > INT16_MAX) temp = INT16_MAX;
+		if(temp < INT16_MIN) temp = INT16_MIN;
+		magn[i] = (int16_t) temp;
+	}
+
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Last magnetometer counts, not calibrated
+ *
+ * @details
+ *   Transformed to the gyro & accel reference frame, input of the online
+ *   calibration (MAGCAL_Update). Updated by every magnetometer read function.
+ *
+ * @param[out] counts
+ *   magnetometer values in counts
+ *
+ *****************************************************************************/
+void ICM_20948_magCountsGet(int16_t *counts) {
+
+	counts[0] = tX[0]*_hxcounts + tX[1]*_hycounts + tX[2]*_hzcounts;
+	counts[1] = tY[0]*_hxcounts + tY[1]*_hycounts + tY[2]*_hzcounts;
+	counts[2] = tZ[0]*_hxcounts + tZ[1]*_hycounts + tZ[2]*_hzcounts;
+
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Let the I2C master of the IMU read the magnetometer
+ *
+ * @details
+ *   SLV0 copies AK09916 ST1..ST2 to EXT_SLV_SENS_DATA_00 at the sample rate,
+ *   so accel, gyro, temp and magn can be read in one burst with
+ *   ICM_20948_burstRawDataRead. Bypass mode is switched off while enabled,
+ *   the magnetometer can't be accessed directly (mag mode, calibration).
+ *
+ * @param[in] enable
+ *   @li 'true' - I2C master reads the magnetometer
+ *   @li 'false' - back to bypass mode
+ *
+ * @return
+ * OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_magAutoReadEnable(bool enable) {
+
+	uint8_t userCtrl, pinCfg;
+
+	ICM_20948_registerRead(ICM_20948_REG_USER_CTRL, 1, &userCtrl);
+	ICM_20948_registerRead(ICM_20948_REG_INT_PIN_CFG, 1, &pinCfg);
+
+	if(enable)
+	{
+		/* Disconnect the auxiliary bus from the host bus */
+		ICM_20948_registerWrite(ICM_20948_REG_INT_PIN_CFG, pinCfg & ~ICM_20948_BIT_BYPASS_EN);
+
+		/* I2C master clock, stop between reads */
+		ICM_20948_registerWrite(ICM_20948_REG_I2C_MST_CTRL, ICM_20948_I2C_MST_CTRL_CLK_400KHZ | ICM_20948_BIT_I2C_MST_P_NSR);
+
+		/* SLV0: read ST1..ST2, reading ST2 releases the data lock of the magnetometer */
+		ICM_20948_registerWrite(ICM_20948_REG_I2C_SLV0_ADDR, AK09916_BIT_I2C_SLV_ADDR | ICM_20948_BIT_I2C_SLV_READ);
+		ICM_20948_registerWrite(ICM_20948_REG_I2C_SLV0_REG, AK09916_REG_STATUS_1);
+		ICM_20948_registerWrite(ICM_20948_REG_I2C_SLV0_CTRL, ICM_20948_BIT_I2C_SLV_EN | AK09916_BURST_READ_SIZE);
+
+		ICM_20948_registerWrite(ICM_20948_REG_USER_CTRL, userCtrl | ICM_20948_BIT_I2C_MST_EN);
+	}else{
+		ICM_20948_registerWrite(ICM_20948_REG_I2C_SLV0_CTRL, 0x00);
+		ICM_20948_registerWrite(ICM_20948_REG_USER_CTRL, userCtrl & ~ICM_20948_BIT_I2C_MST_EN);
+
+		/* Let a running transfer on the auxiliary bus finish */
+		delay(1);
+
+		ICM_20948_registerWrite(ICM_20948_REG_INT_PIN_CFG, pinCfg | ICM_20948_BIT_BYPASS_EN);
+	}
+
+	return OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Read accel, gyro and magnetometer in one I2C transfer
+ *
+ * @details
+ *   Needs ICM_20948_magAutoReadEnable(true). Magnetometer values are zero
+ *   on a magnetic sensor overflow, the fusion then skips the magnetometer.
+ *
+ * @param[out] accel
+ *   raw accelerometer values
+ * @param[out] gyro
+ *   raw gyroscope values
+ * @param[out] magn
+ *   calibrated magnetometer values in counts, same reference frame as gyro & accel
+ *
+ * @return
+ * OK when done
+ *
+ *****************************************************************************/
+uint32_t ICM_20948_burstRawDataRead(int16_t *accel, int16_t *gyro, int16_t *magn) {
+
+	uint8_t rawData[ICM_20948_BURST_READ_SIZE];
+	uint8_t *mag = &rawData[ICM_20948_BURST_MAG_OFFSET];
 
+	/* ACCEL_XOUT_H up to the last byte of the magnetometer copy */
+	ICM_20948_registerRead(ICM_20948_REG_ACCEL_XOUT_H_SH, ICM_20948_BURST_READ_SIZE, &rawData[0]);
+
+	/* Convert the MSB and LSB into a signed 16-bit value */
+	accel[0] = ( (int16_t) rawData[0] << 8) | rawData[1];
+	accel[1] = ( (int16_t) rawData[2] << 8) | rawData[3];
+	accel[2] = ( (int16_t) rawData[4] << 8) | rawData[5];
+	gyro[0] = ( (int16_t) rawData[6] << 8) | rawData[7];
+	gyro[1] = ( (int16_t) rawData[8] << 8) | rawData[9];
+	gyro[2] = ( (int16_t) rawData[10] << 8) | rawData[11];
+
+	/* Magnetometer is little endian, ST1 first and ST2 last */
+	if(mag[8] & AK09916_BIT_HOFL)
+	{
+		magn[0] = 0;
+		magn[1] = 0;
+		magn[2] = 0;
+		return OK;
+	}
+
+	_hxcounts = (((int16_t) mag[2] << 8) | mag[1] );
+	_hycounts = (((int16_t) mag[4] << 8) | mag[3] );
+	_hzcounts = (((int16_t) mag[6] << 8) | mag[5] );
+
+	ICM_20948_magCountsCalibrate(magn);
+
+	return OK;
 }
 
 
@@ -2293,12 +3395,9 @@ bool ICM_20948_calibrate_mag(float *offset, float *scale) {
     int32_t dif_mx, dif_my, dif_mz, dif_m;
 
 //    /* Reset hard and soft iron correction before calibration. */
-    _hxb = 0.0f;
-    _hyb = 0.0f;
-    _hzb = 0.0f;
-    _hxs = 1.0f;
-    _hys = 1.0f;
-    _hzs = 1.0f;
+    const float noOffset[3] = {0, 0, 0};
+    const float identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    ICM_20948_magCorrectionSet(noOffset, identity);
 
 //    DEBUG_PRINTLN(F("Calibrating magnetometer. Move the device in a figure eight ..."));
 
@@ -2323,13 +3422,7 @@ bool ICM_20948_calibrate_mag(float *offset, float *scale) {
     scale[2] = (float) dif_m / dif_mz;
 
 //    Store offset values in local variables, to be accessable by magread functions
-    _hxb = offset[0];
-    _hyb = offset[1];
-    _hzb = offset[2];
-
-    _hxs = scale[0];
-    _hys = scale[1];
-    _hzs = scale[2];
+    ICM_20948_magCalibrationSet(offset, scale);
 
 
 //    DEBUG_PRINTLN(F("Hard iron correction values (center values):"));
@@ -2352,5 +3445,91 @@ bool ICM_20948_calibrate_mag(float *offset, float *scale) {
     return true;
 }
 
+/**************************************************************************//**
+ * @brief
+ *   Set the per axis hard and soft iron correction of ICM_20948_calibrate_mag
+ *
+ * @details
+ *	 Result of ICM_20948_calibrate_mag, converted to an offset in counts and
+ *	 a diagonal matrix, see ICM_20948_magCorrectionSet
+ *
+ * @param[in] offset
+ *   Hard iron offset in uT, added to the uncalibrated values
+ *
+ * @param[in] scale
+ *   Soft iron scale factors
+ *
+ *****************************************************************************/
+void ICM_20948_magCalibrationSet(const float *offset, const float *scale)
+{
+    float offsetCounts[3];
+    float matrix[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    for(uint8_t i = 0; i < 3; i++)
+    {
+        offsetCounts[i] = offset[i] / _magScale;
+        matrix[4*i] = scale[i];
+    }
+
+    ICM_20948_magCorrectionSet(offsetCounts, matrix);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Set the hard and soft iron correction used by the magnetometer read functions
+ *
+ * @details
+ *	 Calibrated = matrix * (counts + offset), counts in the gyro & accel reference frame.
+ *	 Result of the online ellipsoid fit (MAGCAL_Solve) or a stored calibration.
+ *
+ * @param[in] offset
+ *   Hard iron offset in counts
+ *
+ * @param[in] matrix
+ *   Soft iron correction, 3x3 row major
+ *
+ *****************************************************************************/
+void ICM_20948_magCorrectionSet(const float *offset, const float *matrix)
+{
+    for(uint8_t i = 0; i < 3; i++)
+    {
+        _magOffset[i] = offset[i];
+        _magOffsetCounts[i] = (int16_t) lroundf(offset[i]);
+    }
+
+//    Same correction in integer form for ICM_20948_magCalDataRead
+    for(uint8_t i = 0; i < 9; i++)
+    {
+        _magMatrix[i] = matrix[i];
+        _magMatrixQ14[i] = (int32_t) lroundf(matrix[i] * (1 << 14));
+    }
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Get the applied hard and soft iron correction
+ *
+ * @param[out] offset
+ *   Hard iron offset in counts
+ *
+ * @param[out] matrix
+ *   Soft iron correction, 3x3 row major
+ *
+ *****************************************************************************/
+void ICM_20948_magCorrectionGet(float *offset, float *matrix)
+{
+    for(uint8_t i = 0; i < 3; i++)
+    {
+        offset[i] = _magOffset[i];
+    }
+
+    for(uint8_t i = 0; i < 9; i++)
+    {
+        matrix[i] = _magMatrix[i];
+    }
+}
+
 
 
@@ -21,17 +21,53 @@
 #include <stdbool.h>
 /*********************************/
 
+/**************************************************************************//**
+ * @brief
+ *   Public definition to use the on-chip Digital Motion Processor
+ *
+ * @details
+ *   @li 1 - DMP computes a 6-axis quaternion, no sensor fusion on the MCU.
+ *           Needs the DMP3 firmware image (ICM_20948_dmpImage) from the
+ *           TDK InvenSense eMD package, which is not part of this repository.
+ *   @li 0 - Raw sensor data, sensor fusion on the MCU
+ *
+ *****************************************************************************/
+#ifndef ICM_20948_DMP_MODE
+#define ICM_20948_DMP_MODE		0
+#endif
+
+/*********************************/
+
+/* Registers changed by ICM_20948_wakeOnMotionITEnable, see ICM_20948_wakeStateSave */
+typedef struct
+{
+	uint8_t pwrMgmt1;			/**< Clock source, low power and temperature sensor */
+	uint8_t pwrMgmt2;			/**< Accel and gyro enabled */
+	uint8_t lpConfig;			/**< Duty cycle mode */
+	uint8_t gyroSmplrtDiv;		/**< Gyro sample rate divider */
+	uint8_t accelSmplrtDiv1;	/**< Accel sample rate divider, MSB */
+	uint8_t accelSmplrtDiv2;	/**< Accel sample rate divider, LSB */
+	uint8_t accelConfig;		/**< Accel full scale and bandwidth */
+	uint8_t accelIntelCtrl;		/**< Wake on motion logic */
+	uint8_t intEnable;			/**< Wake on motion interrupt */
+	uint8_t intEnable1;			/**< Data ready interrupt */
+	uint8_t magMode;			/**< AK09916 measurement mode */
+} ICM_20948_WakeState_t;
+
 /*********************************/
 
 void ICM_20948_power (bool enable);
 
 void ICM_20948_Init ();
 void ICM_20948_Init2();
+uint32_t ICM_20948_busSpeedProbe(void);
 void ICM_20948_Init_SPI ();
 void ICM_20948_enable_SPI(bool enable);
 
 void ICM_20948_chipSelectSet ( bool enable );
 void ICM_20948_bankSelect ( uint8_t bank );
+void ICM_20948_bankInvalidate(void);
+uint32_t ICM_20948_transactionCountGet(void);
 
 uint8_t ICM_20948_read ( uint16_t addr );
 void ICM_20948_registerRead(uint16_t addr, int numBytes, uint8_t *data);
@@ -46,12 +82,14 @@ uint32_t ICM_20948_reset(void);
 
 
 uint32_t ICM_20948_gyroDataRead(float *gyro);
+uint32_t ICM_20948_gyroRawDataRead(int16_t *gyro);
 uint32_t ICM_20948_gyroResolutionGet(float *gyroRes);
 uint32_t ICM_20948_gyroFullscaleSet(uint8_t gyroFs);
 uint32_t ICM_20948_gyroBandwidthSet(uint8_t gyroBw);
 float ICM_20948_gyroSampleRateSet(float sampleRate);
 
 uint32_t ICM_20948_accelDataRead(float *accel);
+uint32_t ICM_20948_accelRawDataRead(int16_t *accel);
 uint32_t ICM_20948_accelResolutionGet(float *accelRes);
 uint32_t ICM_20948_accelFullscaleSet(uint8_t accelFs);
 uint32_t ICM_20948_accelBandwidthSet(uint8_t accelBw);
@@ -61,6 +99,8 @@ float ICM_20948_accelSampleRateSet(float sampleRate);
 uint32_t ICM_20948_interruptEnable(bool dataReadyEnable, bool womEnable);
 uint32_t ICM_20948_interruptStatusRead(uint32_t *intStatus);
 uint32_t ICM_20948_wakeOnMotionITEnable(bool enable, uint8_t womThreshold, float sampleRate);
+uint32_t ICM_20948_wakeStateSave(ICM_20948_WakeState_t *state);
+uint32_t ICM_20948_wakeStateRestore(const ICM_20948_WakeState_t *state);
 uint32_t ICM_20948_latchEnable(bool enable);
 
 
@@ -70,6 +110,23 @@ uint32_t ICM_20948_lowPowerModeEnter(bool enAccel, bool enGyro, bool enTemp);
 uint32_t ICM_20948_sensorEnable(bool accel, bool gyro, bool temp);
 uint32_t ICM_20948_cycleModeEnable(bool enable);
 
+/* FIFO functions */
+uint32_t ICM_20948_fifoStreamEnable(bool enable);
+uint32_t ICM_20948_fifoRead(int16_t (*accel)[3], int16_t (*gyro)[3], uint8_t maxPackets, uint8_t *packets);
+
+#if ICM_20948_DMP_MODE == 1
+/* DMP functions */
+extern const uint8_t ICM_20948_dmpImage[];		/**< DMP3 firmware image */
+extern const uint16_t ICM_20948_dmpImageSize;	/**< Size of the DMP3 firmware image */
+
+uint32_t ICM_20948_dmpMemWrite(uint16_t memAddr, uint16_t length, const uint8_t *data);
+uint32_t ICM_20948_dmpMemRead(uint16_t memAddr, uint16_t length, uint8_t *data);
+uint32_t ICM_20948_dmpFirmwareLoad(void);
+uint32_t ICM_20948_dmpInit(void);
+uint32_t ICM_20948_dmpEnable(bool enable);
+uint32_t ICM_20948_dmpQuaternionRead(float *quat, int16_t *gyro, uint8_t *frames);
+#endif
+
 /* Magnetometer functions */
 void ICM_20948_set_mag_transfer(bool read);
 void ICM_20948_read_mag_register(uint8_t addr, uint8_t numBytes, uint8_t *data);
@@ -77,6 +134,10 @@ void ICM_20948_write_mag_register(uint8_t addr, uint8_t data);
 uint32_t ICM_20948_set_mag_mode(uint8_t magMode);
 void ICM_20948_magRawDataRead(float *raw_magn);
 void ICM_20948_magDataRead(float *magn);
+void ICM_20948_magCalDataRead(int16_t *magn);
+void ICM_20948_magCountsGet(int16_t *counts);
+uint32_t ICM_20948_magAutoReadEnable(bool enable);
+uint32_t ICM_20948_burstRawDataRead(int16_t *accel, int16_t *gyro, int16_t *magn);
 uint32_t ICM_20948_reset_mag(void);
 
 void ICM_20948_registerWrite(uint16_t addr, uint8_t data);
@@ -91,6 +152,11 @@ uint32_t ICM_20948_accelGyroCalibrate(float *accelBiasScaled, float *gyroBiasSca
 uint32_t ICM_20948_gyroCalibrate( float *gyroBiasScaled );
 uint32_t ICM_20948_min_max_mag( int16_t *minMag, int16_t *maxMag );
 bool ICM_20948_calibrate_mag( float *offset, float *scale );
+void ICM_20948_magCalibrationSet(const float *offset, const float *scale);
+void ICM_20948_magCorrectionSet(const float *offset, const float *matrix);
+void ICM_20948_magCorrectionGet(float *offset, float *matrix);
+uint32_t ICM_20948_offsetRegistersGet(int16_t *accelOffset, int16_t *gyroOffset);
+uint32_t ICM_20948_offsetRegistersSet(const int16_t *accelOffset, const int16_t *gyroOffset);
 
 
 
@@ -38,6 +38,8 @@
 #include <stdbool.h>
 
 #include "uart.h"
+#include "timer.h"
+#include "scheduler.h"
 
 bool ble_Initialized = false;
 
@@ -48,6 +50,22 @@ uint8_t BLE_POWER_ON_RETURN[7] = { 0x02, 0x41, 0x02, 0x00, 0x01, 0x01, 0x41 };
 
 extern bool bleConnected;
 
+#if BLE_BATCH_MODE == 1
+static uint8_t batchPayload[BLE_BATCH_PAYLOAD_MAX];		/**< Count byte + collected samples, room for the battery byte */
+static uint8_t batchFrame[BLE_BATCH_PAYLOAD_MAX + 5];	/**< Batched frame as sent to the UART (header + checksum) */
+static uint8_t batchCount = 0;							/**< Samples in batchPayload */
+#endif
+
+#define BLE_LINK_EVENT_TIMER	0x01					/**< Link timer expired */
+#define BLE_LINK_EVENT_LED		0x02					/**< LED2 changed state */
+
+static RTCDRV_TimerID_t linkTimer;						/**< Power up, connect timeout and backoff timer */
+static bool linkTimerAllocated = false;					/**< linkTimer is a valid RTCDRV timer */
+static volatile uint8_t linkEvents = 0;					/**< BLE_LINK_EVENT_* set from interrupt context */
+static BLE_LinkState_t linkState = BLE_LINK_OFF;		/**< State of the reconnect state machine */
+static uint32_t linkBackoff = BLE_LINK_BACKOFF_MIN;		/**< Next retry interval (ms) */
+static uint32_t linkDownMillis = 0;						/**< millis() when the link went down */
+
 
 /**************************************************************************//**
  * @brief
@@ -158,6 +176,9 @@ void BLE_connect()
 
 		//Connect A -> B
 		const char connect[] = { 0x02, 0x06, 0x06, 0x00, 0xBB, 0x04, 0x20, 0xDA, 0x18, 0x00, 0x5F };
+
+		/* Don't interleave with a queued data frame */
+		uartTxWait();
 		for (int i=0 ; i < sizeof(connect) ; i++ )
 		{
 		  USART_Tx(USART1, connect[i]);
@@ -196,6 +217,9 @@ void BLE_disconnect()
 {
 	  //Disconnect A -> B
 	  const char disconnect[] = { 0x02, 0x07, 0x00, 0x00, 0x05 };
+
+	  /* Don't interleave with a queued data frame */
+	  uartTxWait();
 	  for (int i=0 ; i < sizeof(disconnect) ; i++ )
 	  {
 		  USART_Tx(USART1, disconnect[i]);
@@ -203,6 +227,221 @@ void BLE_disconnect()
 }
 
 
+/**************************************************************************//**
+ * @brief
+ *   RTCDRV callback of the link timer, handled in BLE_linkProcess
+ *
+ *****************************************************************************/
+static void BLE_linkTimeout( RTCDRV_TimerID_t id, void *user )
+{
+	(void) id;
+	(void) user;
+
+	linkEvents |= BLE_LINK_EVENT_TIMER;
+	SCHED_Post(EVT_BLE_LINK);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Send a connect command and wait for LED2 without blocking
+ *
+ *****************************************************************************/
+static void BLE_linkConnect( void )
+{
+	BLE_connect();
+	linkState = BLE_LINK_CONNECTING;
+	RTCDRV_StartTimer( linkTimer, rtcdrvTimerTypeOneshot, BLE_LINK_CONNECT_TIME, BLE_linkTimeout, NULL );
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Init the reconnect state machine
+ *
+ * @details
+ *	 Allocate the link timer, call again after every RTCDRV_Init
+ *	 Configure an interrupt on both edges of LED2 (shares GPIO_EVEN_IRQHandler with the IMU)
+ *
+ * @return
+ *   false when RTCDRV has no free timer, see EMDRV_RTCDRV_NUM_TIMERS
+ *
+ *****************************************************************************/
+bool BLE_linkInit( void )
+{
+	linkTimerAllocated = ( RTCDRV_AllocateTimer( &linkTimer ) == ECODE_EMDRV_RTCDRV_OK );
+	linkState = BLE_LINK_OFF;
+	linkEvents = 0;
+
+	GPIO_ExtIntConfig( BLE_LED2_PORT, BLE_LED2_PIN, BLE_LED2_PIN, true, true, false );
+
+	return linkTimerAllocated;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Power the module and start connecting
+ *
+ * @details
+ *	 Returns immediately, the connect command is sent by BLE_linkProcess
+ *	 once BLE_LINK_POWER_UP_TIME has passed. Does nothing without a link
+ *	 timer, see BLE_linkInit.
+ *
+ *****************************************************************************/
+void BLE_linkStart( void )
+{
+	if ( !linkTimerAllocated ) return;
+
+	BLE_power(true);
+
+	linkBackoff = BLE_LINK_BACKOFF_MIN;
+	linkDownMillis = millis();
+	linkEvents = 0;
+	linkState = BLE_LINK_POWER_UP;
+
+	GPIO_IntClear( 1 << BLE_LED2_PIN );
+	GPIO_IntEnable( 1 << BLE_LED2_PIN );
+
+	RTCDRV_StartTimer( linkTimer, rtcdrvTimerTypeOneshot, BLE_LINK_POWER_UP_TIME, BLE_linkTimeout, NULL );
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Stop reconnecting, before powering down the module
+ *
+ *****************************************************************************/
+void BLE_linkStop( void )
+{
+	GPIO_IntDisable( 1 << BLE_LED2_PIN );
+	RTCDRV_StopTimer( linkTimer );
+
+	linkEvents = 0;
+	linkState = BLE_LINK_OFF;
+	bleConnected = false;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Run the reconnect state machine
+ *
+ * @details
+ *	 Handler of EVT_BLE_LINK, posted when the link timer expired or LED2 changed
+ *	 (not called from interrupt context, connect is sent on the UART)
+ *
+ *	 POWER_UP --timer--> CONNECTING --timer--> BACKOFF --timer--> CONNECTING ...
+ *	 any state --LED2 high--> CONNECTED --LED2 low--> CONNECTING
+ *
+ *	 The backoff doubles after every failed attempt, up to BLE_LINK_BACKOFF_MAX
+ *
+ *****************************************************************************/
+void BLE_linkProcess( void )
+{
+	uint8_t events;
+
+	__disable_irq();
+	events = linkEvents;
+	linkEvents = 0;
+	__enable_irq();
+
+	if( (events == 0) || (linkState == BLE_LINK_OFF) )
+	{
+		return;
+	}
+
+	BLE_check_connect();
+
+	if( bleConnected )
+	{
+		if( linkState != BLE_LINK_CONNECTED )
+		{
+			RTCDRV_StopTimer( linkTimer );
+			linkState = BLE_LINK_CONNECTED;
+			linkBackoff = BLE_LINK_BACKOFF_MIN;
+		}
+		return;
+	}
+
+	switch( linkState )
+	{
+	case BLE_LINK_CONNECTED:
+		/* Link dropped, try again right away */
+		linkDownMillis = millis();
+		BLE_linkConnect();
+		break;
+
+	case BLE_LINK_POWER_UP:
+	case BLE_LINK_BACKOFF:
+		if( events & BLE_LINK_EVENT_TIMER )
+		{
+			BLE_linkConnect();
+		}
+		break;
+
+	case BLE_LINK_CONNECTING:
+		if( events & BLE_LINK_EVENT_TIMER )
+		{
+			linkState = BLE_LINK_BACKOFF;
+			RTCDRV_StartTimer( linkTimer, rtcdrvTimerTypeOneshot, linkBackoff, BLE_linkTimeout, NULL );
+
+			linkBackoff *= 2;
+			if( linkBackoff > BLE_LINK_BACKOFF_MAX )
+			{
+				linkBackoff = BLE_LINK_BACKOFF_MAX;
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   LED2 edge, call from the GPIO interrupt handler
+ *
+ *****************************************************************************/
+void BLE_linkLedIRQ( void )
+{
+	linkEvents |= BLE_LINK_EVENT_LED;
+	SCHED_Post(EVT_BLE_LINK);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Current state of the reconnect state machine
+ *
+ *****************************************************************************/
+BLE_LinkState_t BLE_linkState( void )
+{
+	return linkState;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Time the link is down while the module is powered
+ *
+ * @return
+ *   ms since the link went down, 0 when connected or not started
+ *
+ *****************************************************************************/
+uint32_t BLE_linkDownTime( void )
+{
+	if( (linkState == BLE_LINK_OFF) || (linkState == BLE_LINK_CONNECTED) )
+	{
+		return 0;
+	}
+
+	return millis() - linkDownMillis;
+}
+
+
 /**************************************************************************//**
  * @brief
  *   Test function, not used
@@ -249,13 +488,14 @@ void BLE_sendData4(uint8_t data_in[])
  *
  *
  * @param[in] data
- *   Euler angles
+ *   Euler angles or quaternion, see BLE_PAYLOAD_QUATERNION
  * @param[in] length
- *   packet length
+ *   payload length, data bytes + 1 battery byte
  * @param[in] batt
  *    battery in percentage
  * @param[out] ble_data
- *   return ble_data for debugging purposes
+ *   return ble_data for debugging purposes, with UART_DMA_TX it is sent
+ *   from this buffer, so it is not reused before uartTxBusy() is false
  *
  *****************************************************************************/
 void BLE_sendData( uint8_t *data, uint8_t *batt, uint8_t length, uint8_t *ble_data ) // max packet length: 255
@@ -264,12 +504,18 @@ void BLE_sendData( uint8_t *data, uint8_t *batt, uint8_t length, uint8_t *ble_da
 	// uint8_t ble_data[ble_packet_length];
 	int d = 0;
 
+#if UART_DMA_TX == 1
+	/* ble_data is sent in place, the previous frame must be out */
+	uartTxWait();
+#endif
+
 	ble_data[0] = 0x02;
 	ble_data[1] = 0x04;
 	ble_data[2] = length;
 	ble_data[3] = 0x00;
 
-	while ( d < length)
+	/* Last payload byte is the battery, data has length - 1 bytes */
+	while ( d < length - 1)
 	{
 		ble_data[4+d] = data[d];
 		d++;
@@ -292,13 +538,89 @@ void BLE_sendData( uint8_t *data, uint8_t *batt, uint8_t length, uint8_t *ble_da
 //		  USART_Tx(USART1, ble_data[i]);
 //	}
 
+#if UART_DMA_TX == 1
+	/* Send data with DMA, no copy and one interrupt per frame */
+	uartPutDataDMA( ble_data, ble_packet_length, NULL, NULL );
+#else
 	/* Send data interrupt driven */
 
 	uartPutData( ble_data, ble_packet_length );
+#endif
+
+}
+
+
+#if BLE_BATCH_MODE == 1
+/**************************************************************************//**
+ * @brief
+ *   Add a sample to the batched frame, send the frame when it is full
+ *
+ * @details
+ *	 Payload of a batched frame:
+ *	 @li sample count, BLE_BATCH_QUATERNION set for quaternion samples
+ *	 @li per sample: ms since the previous sample + BLE_SAMPLE_LENGTH orientation bytes
+ *	 @li battery in percentage
+ *
+ *	 Sent with BLE_sendData, header and checksum are added once per
+ *	 BLE_BATCH_SAMPLES samples.
+ *
+ * @param[in] sample
+ *   Euler angles or quaternion, see BLE_PAYLOAD_QUATERNION
+ * @param[in] delta
+ *   ms since the previous sample, saturated at BLE_BATCH_DELTA_MAX
+ * @param[in] batt
+ *    battery in percentage
+ *
+ *****************************************************************************/
+void BLE_batchAdd( uint8_t *sample, uint32_t delta, uint8_t *batt )
+{
+	uint8_t *record = &batchPayload[1 + batchCount * (1 + BLE_SAMPLE_LENGTH)];
+
+	if( delta > BLE_BATCH_DELTA_MAX )
+	{
+		delta = BLE_BATCH_DELTA_MAX;
+	}
+
+	record[0] = (uint8_t) delta;
+	for( int i=0; i<BLE_SAMPLE_LENGTH; i++ )
+	{
+		record[1 + i] = sample[i];
+	}
+	batchCount++;
+
+	if( batchCount < BLE_BATCH_SAMPLES )
+	{
+		return;
+	}
+
+#if BLE_PAYLOAD_QUATERNION == 1
+	batchPayload[0] = batchCount | BLE_BATCH_QUATERNION;
+#else
+	batchPayload[0] = batchCount;
+#endif
+
+	/* Battery byte is appended by BLE_sendData */
+	BLE_sendData( batchPayload, batt, 1 + batchCount * (1 + BLE_SAMPLE_LENGTH) + 1, batchFrame );
 
+	batchCount = 0;
 }
 
 
+/**************************************************************************//**
+ * @brief
+ *   Drop the samples collected for the next batched frame
+ *
+ * @note
+ * 	 Call when the link goes down, old samples are not worth sending
+ *
+ *****************************************************************************/
+void BLE_batchReset( void )
+{
+	batchCount = 0;
+}
+#endif /* BLE_BATCH_MODE */
+
+
 /**************************************************************************//**
  * @brief
  *   Test function, not used
@@ -426,6 +748,77 @@ void float_to_uint8_t_x3( float *in, uint8_t *out ) // Converts euler angles to
 }
 
 
+/**************************************************************************//**
+ * @brief
+ *   Quaternion to uint8_t conversion, smallest three encoding
+ *
+ * @details
+ *	 The largest component is dropped, the receiver restores it from the
+ *	 unit length. The other three lie in [-1/sqrt(2), 1/sqrt(2)] and are
+ *	 sent as 15 bit unsigned values. q and -q are the same rotation, the
+ *	 quaternion is negated when the dropped component is negative.
+ *
+ *	 Packed little endian in 47 bits:
+ *	 bit 45..46 index of the dropped component, then the remaining
+ *	 components in order, the first one in bit 30..44.
+ *
+ * @param[in] quat
+ *   unit quaternion, q0 q1 q2 q3
+ *
+ * @param[out] out
+ *   BLE_QUATERNION_LENGTH x uint8_t's
+ *
+ *****************************************************************************/
+void quaternion_to_uint8_t( float *quat, uint8_t *out )
+{
+	const float scale = ( (1 << BLE_QUATERNION_BITS) - 1 ) * 0.5f;
+	uint64_t packed;
+	uint8_t largest = 0;
+	float max = 0.0f;
+	float sign;
+	int32_t value;
+
+	for( int i=0; i<4; i++ )
+	{
+		float a = (quat[i] < 0.0f) ? -quat[i] : quat[i];
+		if( a > max )
+		{
+			max = a;
+			largest = i;
+		}
+	}
+
+	sign = (quat[largest] < 0.0f) ? -1.0f : 1.0f;
+
+	packed = largest;
+	for( int i=0; i<4; i++ )
+	{
+		if( i == largest )
+		{
+			continue;
+		}
+
+		/* [-1/sqrt(2), 1/sqrt(2)] to [0, 2^15 - 1] */
+		value = (int32_t) ( ( sign * quat[i] * 1.41421356f + 1.0f ) * scale + 0.5f );
+		if( value < 0 )
+		{
+			value = 0;
+		}
+		if( value > ( (1 << BLE_QUATERNION_BITS) - 1 ) )
+		{
+			value = (1 << BLE_QUATERNION_BITS) - 1;
+		}
+
+		packed = (packed << BLE_QUATERNION_BITS) | (uint32_t) value;
+	}
+
+	for( int i=0; i<BLE_QUATERNION_LENGTH; i++ )
+	{
+		out[i] = (uint8_t) (packed >> (8 * i));
+	}
+}
+
+
 /**************************************************************************//**
  * @brief
  *   Set BLE output power
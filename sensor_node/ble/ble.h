@@ -54,6 +54,50 @@ char RX_buffer[BUFFER_SIZE];
 #define BLE_OUTPUT_POWER_N20DB		0xEC
 #define BLE_OUTPUT_POWER_N40DB		0xD8
 
+/** Public definition to select the orientation payload
+ *    @li `1` - Quaternion, smallest three encoded in 6 bytes, Euler angles are computed by the receiver.
+ *    @li `0` - Euler angles, 3 floats. */
+#define BLE_PAYLOAD_QUATERNION	0
+
+#define BLE_QUATERNION_LENGTH	6			/**< 2 bit index of the dropped component + 3 x 15 bit components */
+#define BLE_QUATERNION_BITS		15			/**< Bits per transmitted component */
+
+/** Public definition to select how samples are sent
+ *    @li `1` - BLE_BATCH_SAMPLES samples with a timestamp delta in one frame, see BLE_batchAdd.
+ *    @li `0` - One frame per sample. */
+#define BLE_BATCH_MODE			0
+
+#define BLE_BATCH_SAMPLES		10			/**< Samples per batched frame, < 128 */
+#define BLE_BATCH_PAYLOAD_MAX	243			/**< Payload bytes that fit in one notification (ATT MTU 247), battery included */
+#define BLE_BATCH_QUATERNION	0x80		/**< Flag in the first payload byte, samples are quaternions */
+#define BLE_BATCH_DELTA_MAX		255			/**< Timestamp delta (ms) is saturated, also marks a gap in the data */
+
+#if BLE_PAYLOAD_QUATERNION == 1
+#define BLE_SAMPLE_LENGTH		BLE_QUATERNION_LENGTH		/**< Orientation bytes per sample */
+#else
+#define BLE_SAMPLE_LENGTH		12							/**< Orientation bytes per sample, 3 floats */
+#endif
+
+/* Count byte + samples (delta + orientation) + battery */
+#if (BLE_BATCH_MODE == 1) && ((1 + BLE_BATCH_SAMPLES * (1 + BLE_SAMPLE_LENGTH) + 1) > BLE_BATCH_PAYLOAD_MAX)
+#error "BLE_BATCH_SAMPLES does not fit in BLE_BATCH_PAYLOAD_MAX"
+#endif
+
+/* Link (re)connect timing, see BLE_linkProcess */
+#define BLE_LINK_POWER_UP_TIME	200			/**< ms between powering the module and the first connect command */
+#define BLE_LINK_CONNECT_TIME	1000		/**< ms to wait for LED2 after a connect command */
+#define BLE_LINK_BACKOFF_MIN	500			/**< ms before the first retry */
+#define BLE_LINK_BACKOFF_MAX	8000		/**< Retry interval doubles up to this */
+#define BLE_LINK_SLEEP_TIME		5000		/**< ms without a link before the node goes to sleep */
+
+typedef enum ble_link_states {
+	BLE_LINK_OFF,			/**< Module not powered, no reconnecting */
+	BLE_LINK_POWER_UP,		/**< Waiting for the module to boot */
+	BLE_LINK_CONNECTING,	/**< Connect command sent, waiting for LED2 */
+	BLE_LINK_BACKOFF,		/**< Connect attempt failed, waiting to retry */
+	BLE_LINK_CONNECTED		/**< LED2 high */
+} BLE_LinkState_t;
+
 
 ///////////////////////////////////////////////////////////////////
 
@@ -73,11 +117,24 @@ void BLE_disconnect();
 void BLE_sendData4(uint8_t data_in[]);
 void BLE_sendData( uint8_t *data, uint8_t *batt, uint8_t length, uint8_t *ble_packet );
 void BLE_readData( uint8_t *readData, uint8_t length );
+#if BLE_BATCH_MODE == 1
+void BLE_batchAdd( uint8_t *sample, uint32_t delta, uint8_t *batt );
+void BLE_batchReset( void );
+#endif
+
+bool BLE_linkInit( void );
+void BLE_linkStart( void );
+void BLE_linkStop( void );
+void BLE_linkProcess( void );
+void BLE_linkLedIRQ( void );
+BLE_LinkState_t BLE_linkState( void );
+uint32_t BLE_linkDownTime( void );
 
 void BLE_sendIMUData(uint8_t *gyroData, uint8_t *accelData, uint8_t *magnData);
 
 void float_to_uint8_t( float *input, uint8_t *out );
 void float_to_uint8_t_x3( float *input, uint8_t *out );
+void quaternion_to_uint8_t( float *quat, uint8_t *out );
 
 void BLE_set_output_power( uint8_t power );
 ///////////////////////////////////////////////////////////////////
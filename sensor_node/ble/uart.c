@@ -21,6 +21,7 @@
 #include "ble.h"
 
 #include <stdint.h>
+#include <string.h>
 #include "em_device.h"
 #include "em_chip.h"
 #include "em_emu.h"
@@ -28,23 +29,146 @@
 #include "em_gpio.h"
 #include "em_usart.h"
 #include "bsp.h"
+#if UART_DMA_TX == 1
+#include "em_dma.h"
+#include "dmactrl.h"
+#endif
 
 #include "debug_dbprint.h"
 
-/* Declare a circular buffer structure to use for Rx and Tx queues */
-#define BUFFERSIZE          256
-
-volatile struct circularBuffer
+/* Single producer, single consumer rings for the Rx and Tx queues
+ *
+ * head is only written by the producer, tail only by the consumer. Both run
+ * freely and are masked on access, head - tail is the fill level. 32 bit
+ * loads and stores are atomic on the Cortex-M0+, so thread and ISR can use
+ * a ring without disabling interrupts.
+ *   Rx: producer USART1_RX_IRQHandler, consumer uartGetChar / uartGetData
+ *   Tx: producer uartPutChar / uartPutData, consumer USART1_TX_IRQHandler */
+#define BUFFERSIZE          256						/* Power of two */
+#define BUFFERMASK          (BUFFERSIZE - 1)
+
+#if (BUFFERSIZE & BUFFERMASK) != 0
+#error "BUFFERSIZE must be a power of two"
+#endif
+
+typedef struct
 {
-  uint8_t  data[BUFFERSIZE];  /* data buffer */
-  uint32_t rdI;               /* read index */
-  uint32_t wrI;               /* write index */
-  uint32_t pendingBytes;      /* count of how many bytes are not yet handled */
-  bool     overflow;          /* buffer overflow indicator */
-} rxBuf, txBuf = { {0}, 0, 0, 0, false };
+  uint8_t           data[BUFFERSIZE];  /* data buffer */
+  volatile uint32_t head;              /* write index, free running */
+  volatile uint32_t tail;              /* read index, free running */
+  volatile bool     overflow;          /* buffer overflow indicator */
+} ringBuffer_t;
+
+static ringBuffer_t rxBuf, txBuf;
+static volatile bool txStarted = false;				/* A byte was queued since uart_Init, TXC is 0 until the first one is sent */
+
+#if UART_DMA_TX == 1
+static DMA_CB_TypeDef dmaTxCb;						/* DMA callback, calls uartDmaTxDone */
+static volatile bool dmaTxActive = false;			/* Frame is being sent by DMA */
+static uartTxCallback_t dmaTxCallback = NULL;		/* Completion callback of the running frame */
+static void *dmaTxUser = NULL;						/* Passed to dmaTxCallback */
+#endif
 
 static USART_InitAsync_TypeDef init = USART_INITASYNC_DEFAULT;
 
+
+/****************************************************************************//**
+ * @brief  Bytes in the ring, safe from producer and consumer
+ *
+ *****************************************************************************/
+static inline uint32_t ringUsed(ringBuffer_t *rb)
+{
+  return rb->head - rb->tail;
+}
+
+
+/****************************************************************************//**
+ * @brief  Add a block of bytes, producer side only
+ *
+ * @return false if the block does not fit, nothing is added then
+ *
+ *****************************************************************************/
+static bool ringPut(ringBuffer_t *rb, const uint8_t *dataPtr, uint32_t dataLen)
+{
+  uint32_t head = rb->head;
+  uint32_t first;
+
+  if (dataLen > (BUFFERSIZE - (head - rb->tail)))
+  {
+    return false;
+  }
+
+  /* Copy up to the end of the array, then the rest from the start */
+  first = BUFFERSIZE - (head & BUFFERMASK);
+  if (first > dataLen)
+  {
+    first = dataLen;
+  }
+  memcpy(&rb->data[head & BUFFERMASK], dataPtr, first);
+  memcpy(&rb->data[0], dataPtr + first, dataLen - first);
+
+  /* Data must be in memory before the consumer sees the new head */
+  __DMB();
+  rb->head = head + dataLen;
+
+  return true;
+}
+
+
+/****************************************************************************//**
+ * @brief  Take up to dataLen bytes, consumer side only
+ *
+ * @return number of bytes copied to dataPtr
+ *
+ *****************************************************************************/
+static uint32_t ringGet(ringBuffer_t *rb, uint8_t *dataPtr, uint32_t dataLen)
+{
+  uint32_t tail = rb->tail;
+  uint32_t used = rb->head - tail;
+  uint32_t first;
+
+  if (dataLen > used)
+  {
+    dataLen = used;
+  }
+
+  /* Read the data only after head was read */
+  __DMB();
+
+  first = BUFFERSIZE - (tail & BUFFERMASK);
+  if (first > dataLen)
+  {
+    first = dataLen;
+  }
+  memcpy(dataPtr, &rb->data[tail & BUFFERMASK], first);
+  memcpy(dataPtr + first, &rb->data[0], dataLen - first);
+
+  /* Slots are free for the producer once tail moves */
+  __DMB();
+  rb->tail = tail + dataLen;
+
+  return dataLen;
+}
+
+#if UART_DMA_TX == 1
+/****************************************************************************//**
+ * @brief  DMA callback, the last byte of the frame is in the USART
+ *
+ *****************************************************************************/
+static void uartDmaTxDone(unsigned int channel, bool primary, void *user)
+{
+  uartTxCallback_t callback = dmaTxCallback;
+
+  dmaTxActive = false;
+
+  if (callback != NULL)
+  {
+    callback(dmaTxUser);
+  }
+}
+#endif
+
+
 /**************************************************************************//**
  * @brief
  *   UART init
@@ -68,6 +192,7 @@ void uart_Init()
 
 	// Initialize USART asynchronous mode and route pins
 	USART_InitAsync(BLE_USART, &init);
+	txStarted = false;
 
 	/* Prepare UART Rx and Tx interrupts */
 	USART_IntClear(BLE_USART, _USART_IFC_MASK);
@@ -79,6 +204,34 @@ void uart_Init()
 
 	BLE_USART->ROUTE |= USART_ROUTE_TXPEN | USART_ROUTE_RXPEN | USART_ROUTE_LOCATION_LOC0;
 
+#if UART_DMA_TX == 1
+	/* DMA channel writes TXDATA whenever the USART Tx buffer has room */
+	DMA_Init_TypeDef dmaInit;
+	DMA_CfgChannel_TypeDef chnlCfg;
+	DMA_CfgDescr_TypeDef descrCfg;
+
+	CMU_ClockEnable(cmuClock_DMA, true);
+	dmaInit.hprot = 0;
+	dmaInit.controlBlock = dmaControlBlock;
+	DMA_Init(&dmaInit);
+
+	dmaTxCb.cbFunc = uartDmaTxDone;
+	dmaTxCb.userPtr = NULL;
+
+	chnlCfg.highPri = false;
+	chnlCfg.enableInt = true;
+	chnlCfg.select = DMAREQ_USART1_TXBL;
+	chnlCfg.cb = &dmaTxCb;
+	DMA_CfgChannel(UART_DMA_TX_CHANNEL, &chnlCfg);
+
+	descrCfg.dstInc = dmaDataIncNone;
+	descrCfg.srcInc = dmaDataInc1;
+	descrCfg.size = dmaDataSize1;
+	descrCfg.arbRate = dmaArbitrate1;
+	descrCfg.hprot = 0;
+	DMA_CfgDescr(UART_DMA_TX_CHANNEL, true, &descrCfg);
+#endif
+
 	  /* Enable UART */
 	USART_Enable(BLE_USART, usartEnable);
 }
@@ -95,18 +248,10 @@ uint8_t uartGetChar( )
 {
   uint8_t ch;
 
-  /* Check if there is a byte that is ready to be fetched. If no byte is ready, wait for incoming data */
-  if (rxBuf.pendingBytes < 1)
-  {
-    while (rxBuf.pendingBytes < 1) ;
-  }
-
-  /* Copy data from buffer */
-  ch        = rxBuf.data[rxBuf.rdI];
-  rxBuf.rdI = (rxBuf.rdI + 1) % BUFFERSIZE;
+  /* Wait for incoming data if no byte is ready to be fetched */
+  while (ringUsed(&rxBuf) < 1) ;
 
-  /* Decrement pending byte counter */
-  rxBuf.pendingBytes--;
+  ringGet(&rxBuf, &ch, 1);
 
   return ch;
 }
@@ -120,19 +265,14 @@ uint8_t uartGetChar( )
  *****************************************************************************/
 void uartPutChar(uint8_t ch)
 {
-  /* Check if Tx queue has room for new data */
-  if ((txBuf.pendingBytes + 1) > BUFFERSIZE)
-  {
-    /* Wait until there is room in queue */
-    while ((txBuf.pendingBytes + 1) > BUFFERSIZE) ;
-  }
+#if UART_DMA_TX == 1
+  /* USART is fed by DMA, queue behind the running frame */
+  while (dmaTxActive) ;
+#endif
 
-  /* Copy ch into txBuffer */
-  txBuf.data[txBuf.wrI] = ch;
-  txBuf.wrI             = (txBuf.wrI + 1) % BUFFERSIZE;
-
-  /* Increment pending byte counter */
-  txBuf.pendingBytes++;
+  /* Wait until there is room in queue */
+  while (!ringPut(&txBuf, &ch, 1)) ;
+  txStarted = true;
 
   /* Enable interrupt on USART TX Buffer*/
   USART_IntEnable(BLE_USART, USART_IEN_TXBL);
@@ -147,8 +287,6 @@ void uartPutChar(uint8_t ch)
  *****************************************************************************/
 void uartPutData(uint8_t * dataPtr, uint32_t dataLen)
 {
-  uint32_t i = 0;
-
   /* Check if buffer is large enough for data */
   if (dataLen > BUFFERSIZE)
   {
@@ -156,26 +294,98 @@ void uartPutData(uint8_t * dataPtr, uint32_t dataLen)
     return;
   }
 
-  /* Check if buffer has room for new data */
-  if ((txBuf.pendingBytes + dataLen) > BUFFERSIZE)
+#if UART_DMA_TX == 1
+  /* USART is fed by DMA, queue behind the running frame */
+  while (dmaTxActive) ;
+#endif
+
+  /* Whole frame at once, wait until there is room */
+  while (!ringPut(&txBuf, dataPtr, dataLen)) ;
+  txStarted = true;
+
+  /* Enable interrupt on USART TX Buffer*/
+  USART_IntEnable(BLE_USART, USART_IEN_TXBL);
+}
+
+#if UART_DMA_TX == 1
+/****************************************************************************//**
+ * @brief  uartPutDataDMA function
+ *
+ * @details
+ *   The frame is not copied, dataPtr must stay untouched until callback is
+ *   called or uartTxBusy returns false. Bytes still in the Tx ring are sent
+ *   first.
+ *
+ * @return false if a frame is already being sent or dataLen is out of range
+ *
+ *****************************************************************************/
+bool uartPutDataDMA(uint8_t * dataPtr, uint32_t dataLen, uartTxCallback_t callback, void *user)
+{
+  if ((dataLen == 0) || (dataLen > UART_DMA_TX_MAX) || dmaTxActive)
   {
-    /* Wait until room */
-    while ((txBuf.pendingBytes + dataLen) > BUFFERSIZE) ;
+    return false;
   }
 
-  /* Fill dataPtr[0:dataLen-1] into txBuffer */
-  while (i < dataLen)
+  /* Tx interrupt and DMA can't feed the USART at the same time */
+  while (ringUsed(&txBuf) != 0) ;
+
+  dmaTxCallback = callback;
+  dmaTxUser = user;
+  dmaTxActive = true;
+  txStarted = true;
+
+  DMA_ActivateBasic(UART_DMA_TX_CHANNEL, true, false, (void *) &BLE_USART->TXDATA, dataPtr, dataLen - 1);
+
+  return true;
+}
+#endif
+
+/****************************************************************************//**
+ * @brief  Check if bytes are waiting to be handed to the USART
+ *
+ *****************************************************************************/
+bool uartTxBusy(void)
+{
+#if UART_DMA_TX == 1
+  if (dmaTxActive)
   {
-    txBuf.data[txBuf.wrI] = *(dataPtr + i);
-    txBuf.wrI             = (txBuf.wrI + 1) % BUFFERSIZE;
-    i++;
+    return true;
   }
+#endif
 
-  /* Increment pending byte counter */
-  txBuf.pendingBytes += dataLen;
+  return (ringUsed(&txBuf) != 0);
+}
 
-  /* Enable interrupt on USART TX Buffer*/
-  USART_IntEnable(BLE_USART, USART_IEN_TXBL);
+/****************************************************************************//**
+ * @brief  Check if the USART still needs the HF clock
+ *
+ * @details
+ *   True while bytes are queued and while the last byte is shifted out,
+ *   EM2 stops the USART in the middle of a byte. TXC is 0 from reset until
+ *   the first byte is sent, it is only checked once a byte was queued.
+ *
+ *****************************************************************************/
+bool uartTxActive(void)
+{
+  return uartTxBusy() || (txStarted && !(BLE_USART->STATUS & USART_STATUS_TXC));
+}
+
+/****************************************************************************//**
+ * @brief  Sleep in EM1 until all queued bytes are handed to the USART
+ *
+ *****************************************************************************/
+void uartTxWait(void)
+{
+  /* Interrupts masked between the check and the sleep, a pending
+   * interrupt still wakes the core and is handled after re-enabling */
+  __disable_irq();
+  while (uartTxBusy())
+  {
+    EMU_EnterEM1();
+    __enable_irq();
+    __disable_irq();
+  }
+  __enable_irq();
 }
 
 /****************************************************************************//**
@@ -184,31 +394,16 @@ void uartPutData(uint8_t * dataPtr, uint32_t dataLen)
  *****************************************************************************/
 uint32_t uartGetData(uint8_t * dataPtr, uint32_t dataLen)
 {
-  uint32_t i = 0;
-
   /* Wait until the requested number of bytes are available */
-  if (rxBuf.pendingBytes < dataLen)
-  {
-    while (rxBuf.pendingBytes < dataLen) ;
-  }
+  while (ringUsed(&rxBuf) < dataLen) ;
 
   if (dataLen == 0)
   {
-    dataLen = rxBuf.pendingBytes;
+    dataLen = ringUsed(&rxBuf);
   }
 
   /* Copy data from Rx buffer to dataPtr */
-  while (i < dataLen)
-  {
-    *(dataPtr + i) = rxBuf.data[rxBuf.rdI];
-    rxBuf.rdI      = (rxBuf.rdI + 1) % BUFFERSIZE;
-    i++;
-  }
-
-  /* Decrement pending byte counter */
-  rxBuf.pendingBytes -= dataLen;
-
-  return i;
+  return ringGet(&rxBuf, dataPtr, dataLen);
 }
 
 /**************************************************************************//**
@@ -225,14 +420,9 @@ void USART1_RX_IRQHandler(void)
   /* Check for RX data valid interrupt */
   if (BLE_USART->IF & USART_IF_RXDATAV)
   {
-    /* Copy data into RX Buffer */
+    /* Copy data into RX Buffer, flag and drop it when full */
     uint8_t rxData = USART_Rx(BLE_USART);
-    rxBuf.data[rxBuf.wrI] = rxData;
-    rxBuf.wrI             = (rxBuf.wrI + 1) % BUFFERSIZE;
-    rxBuf.pendingBytes++;
-
-    /* Flag Rx overflow */
-    if (rxBuf.pendingBytes > BUFFERSIZE)
+    if (!ringPut(&rxBuf, &rxData, 1))
     {
       rxBuf.overflow = true;
     }
@@ -252,16 +442,16 @@ void USART1_TX_IRQHandler(void)
   /* Check TX buffer level status */
   if (BLE_USART->IF & USART_IF_TXBL)
   {
-    if (txBuf.pendingBytes > 0)
+    uint8_t txData;
+
+    /* Transmit pending character */
+    if (ringGet(&txBuf, &txData, 1) == 1)
     {
-      /* Transmit pending character */
-      USART_Tx(BLE_USART, txBuf.data[txBuf.rdI]);
-      txBuf.rdI = (txBuf.rdI + 1) % BUFFERSIZE;
-      txBuf.pendingBytes--;
+      USART_Tx(BLE_USART, txData);
     }
 
     /* Disable Tx interrupt if no more bytes in queue */
-    if (txBuf.pendingBytes == 0)
+    if (ringUsed(&txBuf) == 0)
     {
       USART_IntDisable(BLE_USART, USART_IEN_TXBL);
     }
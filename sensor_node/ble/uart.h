@@ -19,12 +19,40 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/**************************************************************************//**
+ * @brief
+ *   Select how frames are transmitted to the BLE module
+ *
+ * @details
+ *   @li 1 - uartPutDataDMA, DMA feeds the USART from the frame buffer, one interrupt per frame
+ *   @li 0 - uartPutData, frame is copied into the Tx ring, one interrupt per byte
+ *
+ * @note
+ *   DMA uses em_dma.c and the dmactrl.c control block of the SDK, both are
+ *   linked in the project. DMA does not run in EM2, check uartTxActive
+ *   before going there.
+ *
+ *****************************************************************************/
+#define UART_DMA_TX				0
+
+#define UART_DMA_TX_CHANNEL		0			/**< DMA channel used for USART1 Tx */
+#define UART_DMA_TX_MAX			1024		/**< Largest frame of one basic DMA transfer */
+
+/* Called from the DMA interrupt when the last byte of a frame is handed to the USART */
+typedef void (*uartTxCallback_t)(void *user);
+
 
 void uart_Init();
 uint8_t uartGetChar( );
 void uartPutChar(uint8_t ch);
 void uartPutData(uint8_t * dataPtr, uint32_t dataLen);
 uint32_t uartGetData(uint8_t * dataPtr, uint32_t dataLen);
+#if UART_DMA_TX == 1
+bool uartPutDataDMA(uint8_t * dataPtr, uint32_t dataLen, uartTxCallback_t callback, void *user);
+#endif
+bool uartTxBusy(void);
+bool uartTxActive(void);
+void uartTxWait(void);
 void UART1_RX_IRQHandler(void);
 void UART1_TX_IRQHandler(void);
 
@@ -0,0 +1,276 @@
+/***************************************************************************//**
+ * @file uart_test.c
+ * @brief Host stress test of the lock-free Rx and Tx rings of uart.c
+ * @details
+ *   Includes uart.c, so the rings and interrupt handlers under test are the
+ *   ones of the node. Every byte carries its sequence number, a lost,
+ *   duplicated or reordered byte is counted as an error.
+ *
+ *   @li threads - producer and consumer thread on one ring, random block
+ *       sizes, on two cores when the host has them. Checks the index
+ *       publication order of ringPut / ringGet.
+ *   @li interrupt - a SIGALRM handler plays the USART and calls
+ *       USART1_TX_IRQHandler and USART1_RX_IRQHandler. It preempts
+ *       uartPutData and uartGetData at arbitrary points, the way an
+ *       interrupt preempts thread code on the Cortex-M0+.
+ *   @li idle - uartTxActive before the first byte, with a byte queued and
+ *       after it was sent.
+ *
+ *   Not part of the node firmware, the file is empty without EMLIB_HOST.
+ *   Build and run on the host, from the sensor_node folder:
+ *
+ *     gcc -O2 -pthread -DEMLIB_HOST=1 -Ihost -Ible -Iinc -Idbprint
+ *         -o uart_test ble/uart_test.c host/emlib_host.c
+ *     ./uart_test
+ *
+ *   Exits with 0 when no byte was lost and the idle checks pass.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#ifdef EMLIB_HOST
+
+#include "uart.c"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#define TEST_THREAD_BYTES		20000000ULL		/**< Bytes through the ring in the thread test */
+#define TEST_ISR_BYTES			3000000ULL		/**< Bytes per direction in the interrupt test */
+#define TEST_ISR_PERIOD_US		5				/**< SIGALRM period, the kernel rounds it up */
+#define TEST_ISR_BYTES_PER_IRQ	8				/**< USART bytes handled per SIGALRM */
+#define TEST_NO_DATA			0x100			/**< TXDATA before a Tx interrupt, USART_Tx did not run when unchanged */
+
+#define TEST_PATTERN(seq)		( (uint8_t) ( (seq) * 31 + ( (seq) >> 8)))	/**< Byte number seq of the stream */
+
+static ringBuffer_t threadBuf;					/**< Ring of the thread test */
+
+static volatile uint64_t isrSeq;				/**< Bytes the interrupt sent or received */
+static volatile uint64_t isrErrors;				/**< Wrong bytes seen by the interrupt */
+static volatile uint64_t isrCalls;				/**< SIGALRMs handled */
+
+
+/**************************************************************************//**
+ * @brief
+ *   Random block length, 1 .. BUFFERSIZE
+ *****************************************************************************/
+static uint32_t blockLength(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+
+	return 1 + (*state >> 16) % BUFFERSIZE;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Thread test, producer side
+ *****************************************************************************/
+static void *threadProducer(void *arg)
+{
+	uint8_t block[BUFFERSIZE];
+	uint64_t seq = 0;
+	uint32_t state = 1, n, i;
+
+	(void) arg;
+
+	while (seq < TEST_THREAD_BYTES) {
+		n = blockLength(&state);
+		if (seq + n > TEST_THREAD_BYTES) n = (uint32_t) (TEST_THREAD_BYTES - seq);
+
+		for (i = 0; i < n; i++) block[i] = TEST_PATTERN(seq + i);
+		while (!ringPut(&threadBuf, block, n)) sched_yield();
+		seq += n;
+	}
+
+	return NULL;
+}
+
+static uint64_t threadTest(void)
+{
+	pthread_t producer;
+	uint8_t block[BUFFERSIZE];
+	uint64_t seq = 0, errors = 0;
+	uint32_t state = 7, n, i;
+
+	pthread_create(&producer, NULL, threadProducer, NULL);
+
+	while (seq < TEST_THREAD_BYTES) {
+		if (ringUsed(&threadBuf) > BUFFERSIZE) errors++;
+
+		n = ringGet(&threadBuf, block, blockLength(&state));
+		if (n == 0) sched_yield();
+		for (i = 0; i < n; i++) {
+			if (block[i] != TEST_PATTERN(seq + i)) errors++;
+		}
+		seq += n;
+	}
+
+	pthread_join(producer, NULL);
+	printf("threads:   %llu bytes, %llu errors\n", (unsigned long long) seq, (unsigned long long) errors);
+
+	return errors;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   USART of the interrupt test, takes bytes from the Tx ring
+ *****************************************************************************/
+static void txInterrupt(int signal)
+{
+	uint8_t i;
+
+	(void) signal;
+
+	for (i = 0; i < TEST_ISR_BYTES_PER_IRQ; i++) {
+		if ( !(BLE_USART->IEN & USART_IEN_TXBL) ) break;
+
+		BLE_USART->IF = USART_IF_TXBL;
+		BLE_USART->TXDATA = TEST_NO_DATA;
+		USART1_TX_IRQHandler();
+		if (BLE_USART->TXDATA != TEST_NO_DATA) {
+			if (BLE_USART->TXDATA != TEST_PATTERN(isrSeq)) isrErrors++;
+			isrSeq++;
+		}
+	}
+	isrCalls++;
+}
+
+/* USART of the interrupt test, puts bytes in the Rx ring, waits while it is full like the BLE module flow control */
+static void rxInterrupt(int signal)
+{
+	uint8_t i;
+
+	(void) signal;
+
+	for (i = 0; i < TEST_ISR_BYTES_PER_IRQ; i++) {
+		if ( (isrSeq == TEST_ISR_BYTES) || (ringUsed(&rxBuf) == BUFFERSIZE) ) break;
+
+		BLE_USART->IF = USART_IF_RXDATAV;
+		BLE_USART->RXDATA = TEST_PATTERN(isrSeq);
+		USART1_RX_IRQHandler();
+		isrSeq++;
+	}
+	isrCalls++;
+}
+
+static void interruptStart(void (*handler)(int))
+{
+	struct itimerval period = { { 0, TEST_ISR_PERIOD_US }, { 0, TEST_ISR_PERIOD_US } };
+
+	isrSeq = 0;
+	isrErrors = 0;
+	isrCalls = 0;
+	signal(SIGALRM, handler);
+	setitimer(ITIMER_REAL, &period, NULL);
+}
+
+static void interruptStop(void)
+{
+	struct itimerval off = { { 0, 0 }, { 0, 0 } };
+
+	setitimer(ITIMER_REAL, &off, NULL);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Interrupt test, frames out through uartPutData, bytes in through uartGetData
+ *****************************************************************************/
+static uint64_t interruptTest(void)
+{
+	uint8_t block[BUFFERSIZE];
+	uint64_t seq = 0, errors;
+	uint32_t state = 1, n, i;
+
+	uart_Init();
+
+	/* Tx, the thread queues frames, the interrupt sends them */
+	interruptStart(txInterrupt);
+	while (seq < TEST_ISR_BYTES) {
+		n = blockLength(&state);
+		if (seq + n > TEST_ISR_BYTES) n = (uint32_t) (TEST_ISR_BYTES - seq);
+
+		for (i = 0; i < n; i++) block[i] = TEST_PATTERN(seq + i);
+		uartPutData(block, n);
+		seq += n;
+	}
+	while (uartTxBusy()) ;
+	interruptStop();
+
+	errors = isrErrors + (isrSeq != TEST_ISR_BYTES);
+	printf("interrupt: Tx %llu bytes, %llu sent, %llu errors, %llu interrupts\n", (unsigned long long) seq,
+			(unsigned long long) isrSeq, (unsigned long long) isrErrors, (unsigned long long) isrCalls);
+
+	/* Rx, the interrupt receives, the thread takes blocks */
+	seq = 0;
+	interruptStart(rxInterrupt);
+	while (seq < TEST_ISR_BYTES) {
+		n = blockLength(&state);
+		if (seq + n > TEST_ISR_BYTES) n = (uint32_t) (TEST_ISR_BYTES - seq);
+
+		n = uartGetData(block, n);
+		for (i = 0; i < n; i++) {
+			if (block[i] != TEST_PATTERN(seq + i)) errors++;
+		}
+		seq += n;
+	}
+	interruptStop();
+
+	errors += rxBuf.overflow;
+	printf("interrupt: Rx %llu bytes, overflow %d, %llu interrupts\n", (unsigned long long) seq,
+			rxBuf.overflow, (unsigned long long) isrCalls);
+
+	return errors;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Idle test, uartTxActive keeps the scheduler out of EM2 only while a byte is on its way
+ *****************************************************************************/
+static uint64_t idleTest(void)
+{
+	uint64_t errors = 0;
+
+	/* TXC is 0 after a reset, nothing was sent */
+	uart_Init();
+	if (uartTxActive()) {
+		printf("idle: Tx active before the first byte\n");
+		errors++;
+	}
+
+	uartPutChar(0x55);
+	if (!uartTxActive()) {
+		printf("idle: Tx not active with a byte queued\n");
+		errors++;
+	}
+
+	BLE_USART->IF = USART_IF_TXBL;
+	USART1_TX_IRQHandler();
+	if (uartTxActive()) {
+		printf("idle: Tx active after the last byte was sent\n");
+		errors++;
+	}
+
+	return errors;
+}
+
+
+int main(void)
+{
+	uint64_t errors;
+
+	errors = idleTest();
+	errors += threadTest();
+	errors += interruptTest();
+	printf("%s\n", errors ? "FAILED" : "PASSED");
+
+	return errors ? 1 : 0;
+}
+
+#endif /* EMLIB_HOST */
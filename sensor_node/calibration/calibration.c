@@ -0,0 +1,406 @@
+/***************************************************************************//**
+ * @file calibration.c
+ * @brief IMU calibration, stored in the user data page of the flash
+ * @details
+ *   The accel and gyro offsets live in IMU registers and the magnetometer
+ *   correction in RAM, both are lost on a reset. A CRC protected record in
+ *   the user data page keeps them, so the node does not need to lie still
+ *   and be waved around at every boot.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#include "calibration.h"
+
+#include "em_device.h"
+#include "em_msc.h"
+#include "em_gpio.h"
+
+#include "ICM20948.h"
+#include "magcal.h"
+#include "delay.h"
+#include "pinout.h"
+
+#if DIY == 0
+#include "bsp.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#define CAL_ADDRESS		(USERDATA_BASE + 4)		/**< Record address, the first word of the page is left to BSP_TraceProfilerSetup */
+
+
+/**************************************************************************//**
+ * @brief
+ *   CRC-32 (IEEE 802.3), bitwise, the record is only checked at boot
+ *
+ *****************************************************************************/
+static uint32_t CAL_crc32(const uint8_t *data, uint32_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for(uint32_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for(uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+
+	return ~crc;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Read the stored calibration
+ *
+ * @param[out] record
+ *   Stored calibration
+ *
+ * @return
+ *   OK if a valid record of this version is stored, ERROR otherwise
+ *
+ *****************************************************************************/
+uint32_t CAL_Load(CAL_Record_t *record)
+{
+	memcpy(record, (const void *) CAL_ADDRESS, sizeof(CAL_Record_t));
+
+	if( (record->magic != CAL_RECORD_MAGIC) ||
+		(record->version != CAL_RECORD_VERSION) ||
+		(record->length != sizeof(CAL_Record_t)) )
+	{
+		return ERROR;
+	}
+
+	if( record->crc != CAL_crc32((const uint8_t *) record, offsetof(CAL_Record_t, crc)) )
+	{
+		return ERROR;
+	}
+
+	return OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Store a calibration in the user data page
+ *
+ * @details
+ *	 Fills in magic, version, length and CRC, erases the page (keeps its first word)
+ *	 and writes the record. Interrupts are disabled during erase and write (~20 ms),
+ *	 the handlers run from flash.
+ *
+ * @param[in,out] record
+ *   Calibration values, header and CRC are filled in
+ *
+ * @return
+ *   OK if the record reads back correctly
+ *
+ *****************************************************************************/
+uint32_t CAL_Save(CAL_Record_t *record)
+{
+	uint32_t firstWord = *(volatile uint32_t *) USERDATA_BASE;
+	MSC_Status_TypeDef status;
+
+	record->magic = CAL_RECORD_MAGIC;
+	record->version = CAL_RECORD_VERSION;
+	record->length = sizeof(CAL_Record_t);
+	record->crc = CAL_crc32((const uint8_t *) record, offsetof(CAL_Record_t, crc));
+
+	MSC_Init();
+	__disable_irq();
+
+	status = MSC_ErasePage((uint32_t *) USERDATA_BASE);
+	if( (status == mscReturnOk) && (firstWord != 0xFFFFFFFF) )
+	{
+		status = MSC_WriteWord((uint32_t *) USERDATA_BASE, &firstWord, sizeof(firstWord));
+	}
+	if( status == mscReturnOk )
+	{
+		status = MSC_WriteWord((uint32_t *) CAL_ADDRESS, record, sizeof(CAL_Record_t));
+	}
+
+	__enable_irq();
+	MSC_Deinit();
+
+	if( (status != mscReturnOk) || (memcmp((const void *) CAL_ADDRESS, record, sizeof(CAL_Record_t)) != 0) )
+	{
+		return ERROR;
+	}
+
+	return OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Check the stored gyro offsets against a short measurement
+ *
+ * @details
+ *	 Only judged when the node lies still (small gyro spread, |accel| close to 1 g),
+ *	 a moving node keeps the stored calibration.
+ *	 The accel offsets and the magnetometer can't be checked without user action.
+ *
+ * @return
+ *   true if the residual gyro bias is larger than CAL_DRIFT_GYRO_MAX
+ *
+ *****************************************************************************/
+static bool CAL_driftDetected(void)
+{
+	float gyro[3], accel[3];
+	float sum[3] = { 0, 0, 0 };
+	float min[3] = { 1e6f, 1e6f, 1e6f };
+	float max[3] = { -1e6f, -1e6f, -1e6f };
+	float accelDev = 0;
+
+	for(uint8_t i = 0; i < CAL_DRIFT_SAMPLES; i++)
+	{
+		/* One sample period at the 50 Hz set by ICM_20948_Init2 */
+		delay(20);
+		ICM_20948_gyroDataRead(gyro);
+		ICM_20948_accelDataRead(accel);
+
+		for(uint8_t axis = 0; axis < 3; axis++)
+		{
+			sum[axis] += gyro[axis];
+			if(gyro[axis] < min[axis]) min[axis] = gyro[axis];
+			if(gyro[axis] > max[axis]) max[axis] = gyro[axis];
+		}
+
+		float dev = fabsf(sqrtf(accel[0]*accel[0] + accel[1]*accel[1] + accel[2]*accel[2]) - 1.0f);
+		if(dev > accelDev) accelDev = dev;
+	}
+
+	if(accelDev > CAL_STILL_ACCEL_DEV)
+	{
+		return false;
+	}
+
+	for(uint8_t axis = 0; axis < 3; axis++)
+	{
+		if( (max[axis] - min[axis]) > CAL_STILL_GYRO_SPREAD )
+		{
+			return false;
+		}
+	}
+
+	for(uint8_t axis = 0; axis < 3; axis++)
+	{
+		if( fabsf(sum[axis] / CAL_DRIFT_SAMPLES) > CAL_DRIFT_GYRO_MAX )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Accel and gyro calibration, node has to lie still
+ *
+ * @details
+ *	 ICM_20948_accelGyroCalibrate changes rates and ranges, Init2 restores them
+ *
+ *****************************************************************************/
+static void CAL_accelGyro(CAL_Record_t *record)
+{
+#if DIY == 0
+	BSP_LedSet(0);
+#endif
+
+	ICM_20948_accelGyroCalibrate(record->accelCal, record->gyroCal);
+	ICM_20948_offsetRegistersGet(record->accelOffset, record->gyroOffset);
+
+#if DIY == 0
+	BSP_LedClear(0);
+#endif
+
+	ICM_20948_Init2();
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Magnetometer calibration
+ *
+ * @details
+ *	 MAGCAL_ONLINE == 1: the applied correction of the online fit is kept,
+ *	 identity until the first fit.
+ *	 MAGCAL_ONLINE == 0: min/max sweep, node has to be moved around.
+ *
+ *****************************************************************************/
+static void CAL_mag(CAL_Record_t *record)
+{
+#if MAGCAL_ONLINE == 1
+	MAGCAL_Get(record->magOffset, record->magMatrix);
+	record->magFitError = MAGCAL_FitError();
+#else
+	uint8_t temp[8];
+	float offset[3], scale[3];
+
+#if DIY == 0
+	BSP_LedSet(1);
+#endif
+#if DIY == 1
+	GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModePushPull, 0);
+	GPIO_PinOutSet(LED_PORT, LED_PIN);
+#endif
+
+	ICM_20948_set_mag_mode(AK09916_MODE_100HZ);
+	delay(100);
+	ICM_20948_read_mag_register(0x31, 1, temp);
+	ICM_20948_read_mag_register(0x11, 8, temp);
+
+	ICM_20948_calibrate_mag(offset, scale);
+	ICM_20948_magCorrectionGet(record->magOffset, record->magMatrix);
+	record->magFitError = 1.0f;
+
+#if DIY == 1
+	GPIO_PinOutClear(LED_PORT, LED_PIN);
+	GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModeDisabled, 0);
+#endif
+#if DIY == 0
+	BSP_LedClear(1);
+#endif
+#endif /* MAGCAL_ONLINE */
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Copy the calibration values to the caller
+ *
+ *****************************************************************************/
+static void CAL_copy(const CAL_Record_t *record, float *accelCal, float *gyroCal, float *magOffset, float *magMatrix)
+{
+	memcpy(accelCal, record->accelCal, sizeof(record->accelCal));
+	memcpy(gyroCal, record->gyroCal, sizeof(record->gyroCal));
+	memcpy(magOffset, record->magOffset, sizeof(record->magOffset));
+	memcpy(magMatrix, record->magMatrix, sizeof(record->magMatrix));
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Calibrate the accel, gyro and magnetometer and store the result
+ *
+ * @details
+ *	 Accel + gyro first (lie still), then the magnetometer, see CAL_mag
+ *
+ * @param[out] accelCal, gyroCal, magOffset
+ *   Calibration values, 3 axes each
+ *
+ * @param[out] magMatrix
+ *   Soft iron correction, 3x3 row major
+ *
+ * @return
+ *   OK if the calibration was stored
+ *
+ *****************************************************************************/
+uint32_t CAL_Calibrate(float *accelCal, float *gyroCal, float *magOffset, float *magMatrix)
+{
+	CAL_Record_t record;
+
+	CAL_accelGyro(&record);
+	CAL_mag(&record);
+
+	CAL_copy(&record, accelCal, gyroCal, magOffset, magMatrix);
+
+	return CAL_Save(&record);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Store a new magnetometer correction, the accel and gyro values are kept
+ *
+ * @details
+ *	 For the online fit, call once it converged: a page erase costs ~20 ms
+ *	 with the interrupts disabled and the flash wears.
+ *
+ * @param[in] magOffset
+ *   Hard iron offset in counts
+ *
+ * @param[in] magMatrix
+ *   Soft iron correction, 3x3 row major
+ *
+ * @param[in] fitError
+ *   Fit error, see MAGCAL_FitError
+ *
+ * @return
+ *   ERROR if there is no valid record to update or the write failed
+ *
+ *****************************************************************************/
+uint32_t CAL_MagSave(const float *magOffset, const float *magMatrix, float fitError)
+{
+	CAL_Record_t record;
+
+	if( CAL_Load(&record) != OK )
+	{
+		return ERROR;
+	}
+
+	memcpy(record.magOffset, magOffset, sizeof(record.magOffset));
+	memcpy(record.magMatrix, magMatrix, sizeof(record.magMatrix));
+	record.magFitError = fitError;
+
+	return CAL_Save(&record);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Boot time calibration, call after ICM_20948_Init
+ *
+ * @details
+ *	 Stored record valid: write the offsets to the IMU and the magnetometer
+ *	 correction to the driver, then check the gyro for drift. Drift repeats
+ *	 only the accel + gyro calibration, the stored magnetometer values are kept.
+ *	 No valid record: full calibration, see CAL_Calibrate.
+ *	 The online magnetometer fit starts from the stored correction.
+ *
+ * @param[out] accelCal, gyroCal, magOffset
+ *   Calibration values, 3 axes each
+ *
+ * @param[out] magMatrix
+ *   Soft iron correction, 3x3 row major
+ *
+ * @return
+ *   true if the stored calibration was used without recalibrating
+ *
+ *****************************************************************************/
+bool CAL_Init(float *accelCal, float *gyroCal, float *magOffset, float *magMatrix)
+{
+	CAL_Record_t record;
+
+	if( CAL_Load(&record) != OK )
+	{
+		CAL_Calibrate(accelCal, gyroCal, magOffset, magMatrix);
+		return false;
+	}
+
+	ICM_20948_offsetRegistersSet(record.accelOffset, record.gyroOffset);
+	ICM_20948_magCorrectionSet(record.magOffset, record.magMatrix);
+#if MAGCAL_ONLINE == 1
+	MAGCAL_Init(record.magOffset, record.magMatrix, record.magFitError);
+#endif
+
+	if( CAL_driftDetected() )
+	{
+		CAL_accelGyro(&record);
+		CAL_Save(&record);
+		CAL_copy(&record, accelCal, gyroCal, magOffset, magMatrix);
+		return false;
+	}
+
+	CAL_copy(&record, accelCal, gyroCal, magOffset, magMatrix);
+	return true;
+}
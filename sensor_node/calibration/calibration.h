@@ -0,0 +1,45 @@
+/***************************************************************************//**
+ * @file calibration.h
+ * @brief IMU calibration, stored in the user data page of the flash
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+
+#ifndef CALIBRATION_CALIBRATION_H_
+#define CALIBRATION_CALIBRATION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CAL_RECORD_MAGIC		0x4C414349	/**< "ICAL" */
+#define CAL_RECORD_VERSION		2			/**< Increment when CAL_Record_t changes, older records are recalibrated */
+
+#define CAL_DRIFT_SAMPLES		10			/**< Gyro samples averaged at boot to check the stored offsets */
+#define CAL_DRIFT_GYRO_MAX		1.0f		/**< dps, larger residual gyro bias means the stored offsets drifted */
+#define CAL_STILL_GYRO_SPREAD	0.5f		/**< dps, max - min of the samples, more means the node moved */
+#define CAL_STILL_ACCEL_DEV		0.05f		/**< g, deviation of |accel| from 1 g, more means the node moved */
+
+/* Calibration record, as stored in flash */
+typedef struct
+{
+	uint32_t magic;				/**< CAL_RECORD_MAGIC */
+	uint16_t version;			/**< CAL_RECORD_VERSION */
+	uint16_t length;			/**< sizeof(CAL_Record_t) */
+	int16_t accelOffset[3];		/**< XA, YA, ZA_OFFSET register values */
+	int16_t gyroOffset[3];		/**< XG, YG, ZG_OFFS_USR register values */
+	float accelCal[3];			/**< Measured accel bias (g) */
+	float gyroCal[3];			/**< Measured gyro bias (dps) */
+	float magOffset[3];			/**< Hard iron offset (counts), see ICM_20948_magCorrectionSet */
+	float magMatrix[9];			/**< Soft iron correction, 3x3 row major */
+	float magFitError;			/**< Fit error of the online calibration, 1 if unknown */
+	uint32_t crc;				/**< CRC-32 of the fields above */
+} CAL_Record_t;
+
+bool CAL_Init(float *accelCal, float *gyroCal, float *magOffset, float *magMatrix);
+uint32_t CAL_Calibrate(float *accelCal, float *gyroCal, float *magOffset, float *magMatrix);
+uint32_t CAL_MagSave(const float *magOffset, const float *magMatrix, float fitError);
+uint32_t CAL_Load(CAL_Record_t *record);
+uint32_t CAL_Save(CAL_Record_t *record);
+
+#endif /* CALIBRATION_CALIBRATION_H_ */
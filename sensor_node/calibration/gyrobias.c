@@ -0,0 +1,214 @@
+/***************************************************************************//**
+ * @file gyrobias.c
+ * @brief Stillness detection and online gyro bias tracking
+ * @details
+ *   The boot calibration leaves a residual gyro bias that changes with
+ *   temperature, the yaw of the sensor fusion drifts with it. A moving mean
+ *   and variance of every gyro and accel axis tell when the node lies still,
+ *   the gyro mean is then the bias. It is tracked slowly and removed from the
+ *   raw counts before the sensor fusion.
+ *   Integer only, on the samples that are read anyway.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#include "gyrobias.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define GBIAS_VAR_SATURATED		(1 << 24)	/**< Variance after a step larger than GBIAS_STEP_MAX */
+#define GBIAS_STEP_MAX			4096		/**< counts, larger difference from the mean is motion */
+
+static int32_t gyroMean[3];					/**< Moving mean, counts Q8 */
+static int32_t accelMean[3];				/**< Moving mean, counts Q8 */
+static int32_t gyroVar[3];					/**< Moving variance, counts^2 */
+static int32_t accelVar[3];					/**< Moving variance, counts^2 */
+static int32_t bias[3] = {0, 0, 0};			/**< Tracked gyro bias, counts Q8 */
+static uint16_t stillCount = 0;				/**< Consecutive samples below the thresholds */
+static bool primed = false;					/**< Means hold a sample */
+
+static int32_t gyroVarMax;					/**< GBIAS_GYRO_STD_MAX in counts^2 */
+static int32_t accelVarMax;					/**< GBIAS_ACCEL_STD_MAX in counts^2 */
+static int32_t biasMax;						/**< GBIAS_BIAS_MAX in counts Q8 */
+static float gyroResolution;				/**< dps per count */
+
+
+/**************************************************************************//**
+ * @brief
+ *   Reset the bias and set the thresholds for the current full scales
+ *
+ * @details
+ *	 Call again after a full scale change or a new boot calibration,
+ *	 the offset registers changed and the tracked bias is no longer valid.
+ *
+ * @param[in] gyroRes
+ *   dps per count, see ICM_20948_gyroResolutionGet
+ *
+ * @param[in] accelRes
+ *   g per count, see ICM_20948_accelResolutionGet
+ *
+ *****************************************************************************/
+void GBIAS_Init(float gyroRes, float accelRes)
+{
+	float gyroStd = GBIAS_GYRO_STD_MAX / gyroRes;
+	float accelStd = GBIAS_ACCEL_STD_MAX / accelRes;
+
+	gyroVarMax = (int32_t) (gyroStd * gyroStd);
+	accelVarMax = (int32_t) (accelStd * accelStd);
+	biasMax = (int32_t) (GBIAS_BIAS_MAX / gyroRes * 256);
+	gyroResolution = gyroRes;
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		bias[i] = 0;
+	}
+	stillCount = 0;
+	primed = false;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Update the moving mean and variance of one axis
+ *
+ * @return
+ *   true if the variance is below varMax
+ *
+ *****************************************************************************/
+static bool GBIAS_window(int32_t *mean, int32_t *var, int16_t sample, int32_t varMax)
+{
+	int32_t d = (int32_t) sample - (*mean / 256);
+
+	*mean += (d * 256) / (1 << GBIAS_WINDOW_SHIFT);
+
+	if( (d > GBIAS_STEP_MAX) || (d < -GBIAS_STEP_MAX) )
+	{
+		*var = GBIAS_VAR_SATURATED;
+	}else{
+		*var += (d * d - *var) / (1 << GBIAS_WINDOW_SHIFT);
+	}
+
+	return *var <= varMax;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Stillness detection and bias tracking, call for every sample
+ *
+ * @details
+ *	 Still when all axes stay below their variance threshold for
+ *	 GBIAS_STILL_SAMPLES samples. While still, the bias follows the gyro mean
+ *	 unless that is larger than GBIAS_BIAS_MAX.
+ *
+ * @param[in] gyro
+ *   Raw gyro counts, bias not removed
+ *
+ * @param[in] accel
+ *   Raw accel counts, NULL to detect stillness on the gyro only
+ *
+ *****************************************************************************/
+void GBIAS_Update(const int16_t *gyro, const int16_t *accel)
+{
+	bool still = true;
+
+	if( !primed )
+	{
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			gyroMean[i] = (int32_t) gyro[i] * 256;
+			gyroVar[i] = GBIAS_VAR_SATURATED;
+			accelMean[i] = (accel != NULL) ? (int32_t) accel[i] * 256 : 0;
+			accelVar[i] = GBIAS_VAR_SATURATED;
+		}
+		primed = true;
+	}
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		still &= GBIAS_window(&gyroMean[i], &gyroVar[i], gyro[i], gyroVarMax);
+		if(accel != NULL)
+		{
+			still &= GBIAS_window(&accelMean[i], &accelVar[i], accel[i], accelVarMax);
+		}
+	}
+
+	if( !still )
+	{
+		stillCount = 0;
+		return;
+	}
+
+	if(stillCount < GBIAS_STILL_SAMPLES)
+	{
+		stillCount++;
+		return;
+	}
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		if( (gyroMean[i] > biasMax) || (gyroMean[i] < -biasMax) )
+		{
+			return;
+		}
+	}
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		bias[i] += (gyroMean[i] - bias[i]) / (1 << GBIAS_RATE_SHIFT);
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Subtract the tracked bias from raw gyro counts
+ *
+ * @param[in,out] gyro
+ *   Raw gyro counts
+ *
+ *****************************************************************************/
+void GBIAS_Remove(int16_t *gyro)
+{
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		int32_t corrected = (int32_t) gyro[i] - (bias[i] + (bias[i] >= 0 ? 128 : -128)) / 256;
+
+		if(corrected > INT16_MAX) corrected = INT16_MAX;
+		if(corrected < INT16_MIN) corrected = INT16_MIN;
+		gyro[i] = (int16_t) corrected;
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Tracked gyro bias
+ *
+ * @param[out] biasDps
+ *   dps per axis
+ *
+ *****************************************************************************/
+void GBIAS_Get(float *biasDps)
+{
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		biasDps[i] = bias[i] * gyroResolution / 256;
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Check if the node lies still
+ *
+ * @return
+ *   true after GBIAS_STILL_SAMPLES samples without motion
+ *
+ *****************************************************************************/
+bool GBIAS_Still(void)
+{
+	return stillCount >= GBIAS_STILL_SAMPLES;
+}
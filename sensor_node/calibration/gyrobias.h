@@ -0,0 +1,28 @@
+/***************************************************************************//**
+ * @file gyrobias.h
+ * @brief Stillness detection and online gyro bias tracking
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+
+#ifndef CALIBRATION_GYROBIAS_H_
+#define CALIBRATION_GYROBIAS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GBIAS_WINDOW_SHIFT		4			/**< Moving mean/variance over ~2^4 samples (0.3 s at 51 Hz) */
+#define GBIAS_RATE_SHIFT		7			/**< Bias follows the still mean over ~2^7 samples (2.5 s) */
+#define GBIAS_STILL_SAMPLES		50			/**< Samples below the thresholds before the node counts as still (1 s) */
+#define GBIAS_GYRO_STD_MAX		0.25f		/**< dps, larger gyro standard deviation is motion */
+#define GBIAS_ACCEL_STD_MAX		0.01f		/**< g, larger accel standard deviation is motion */
+#define GBIAS_BIAS_MAX			3.0f		/**< dps, a larger still mean is a slow rotation, not bias */
+
+void GBIAS_Init(float gyroRes, float accelRes);
+void GBIAS_Update(const int16_t *gyro, const int16_t *accel);
+void GBIAS_Remove(int16_t *gyro);
+void GBIAS_Get(float *biasDps);
+bool GBIAS_Still(void);
+
+#endif /* CALIBRATION_GYROBIAS_H_ */
@@ -0,0 +1,575 @@
+/***************************************************************************//**
+ * @file magcal.c
+ * @brief Online magnetometer calibration, ellipsoid fit
+ * @details
+ *   Hard and soft iron distortion turn the sphere of magnetometer readings into
+ *   an ellipsoid. MAGCAL_Update keeps one sample per direction (MAGCAL_BINS), only
+ *   integer compares per sample. MAGCAL_Solve fits an ellipsoid through the kept
+ *   samples with linear least squares and derives the offset and a full 3x3
+ *   correction matrix, it runs from a low priority scheduler event.
+ *   New samples replace old ones per direction, so the fit follows a changed
+ *   environment.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#include "magcal.h"
+
+#include "ICM20948.h"
+#include "pinout.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define MAGCAL_PARAMS			9			/**< a..f quadratic, g..i linear terms of the ellipsoid */
+
+static int16_t bins[MAGCAL_BINS][3];		/**< Latest sample per direction, counts */
+static uint32_t binUsed = 0;				/**< One bit per bin with a sample */
+static uint8_t binCount = 0;				/**< Bins with a sample */
+static uint8_t binNew = 0;					/**< Bins updated since the last fit */
+static int16_t center[3] = {0, 0, 0};		/**< Ellipsoid center used to choose the bin, counts */
+static int16_t rangeMin[3] = {INT16_MAX, INT16_MAX, INT16_MAX};	/**< Smallest counts per axis, center before the first fit */
+static int16_t rangeMax[3] = {INT16_MIN, INT16_MIN, INT16_MIN};	/**< Largest counts per axis, center before the first fit */
+static bool fitted = false;					/**< center comes from a fit */
+
+static float magOffset[3] = {0, 0, 0};						/**< Applied hard iron offset, counts */
+static float magMatrix[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};	/**< Applied soft iron correction */
+static float magFitError = 1.0f;							/**< Error of the applied correction on the kept samples */
+
+#if MAGCAL_BINS != 24
+#error "MAGCAL_Update maps the directions to 24 bins"
+#endif
+
+
+/**************************************************************************//**
+ * @brief
+ *   Start from a stored correction
+ *
+ * @param[in] offset
+ *   Hard iron offset in counts, as ICM_20948_magCorrectionSet
+ *
+ * @param[in] matrix
+ *   Soft iron correction, 3x3 row major
+ *
+ * @param[in] fitError
+ *   Fit error of the stored correction, 1 if unknown
+ *
+ *****************************************************************************/
+void MAGCAL_Init(const float *offset, const float *matrix, float fitError)
+{
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		magOffset[i] = offset[i];
+		center[i] = (int16_t) lroundf(-offset[i]);
+	}
+	for(uint8_t i = 0; i < 9; i++)
+	{
+		magMatrix[i] = matrix[i];
+	}
+	magFitError = fitError;
+	fitted = (fitError < 1.0f);
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		rangeMin[i] = INT16_MAX;
+		rangeMax[i] = INT16_MIN;
+	}
+
+	binUsed = 0;
+	binCount = 0;
+	binNew = 0;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Keep a magnetometer sample for the fit
+ *
+ * @details
+ *	 The direction from the current center picks the bin: the axis with the
+ *	 largest component and its sign (cube face), the signs of the other two
+ *	 (quadrant). Before the first fit the center of the min/max range is used,
+ *	 the hard iron offset can be larger than the field. A sample that is close
+ *	 to the one already in its bin is skipped, so a node that lies still does
+ *	 not trigger fits.
+ *	 Integer only, a few hundred cycles.
+ *
+ * @param[in] counts
+ *   Uncalibrated magnetometer counts, see ICM_20948_magCountsGet
+ *
+ * @return
+ *   true if a fit is due, post EVT_MAGCAL
+ *
+ *****************************************************************************/
+bool MAGCAL_Update(const int16_t *counts)
+{
+	int32_t d[3];
+	uint8_t axis = 0;
+	uint8_t bin;
+
+	/* Overflow or not read yet */
+	if( (counts[0] == 0) && (counts[1] == 0) && (counts[2] == 0) )
+	{
+		return false;
+	}
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		if( !fitted )
+		{
+			if(counts[i] < rangeMin[i]) rangeMin[i] = counts[i];
+			if(counts[i] > rangeMax[i]) rangeMax[i] = counts[i];
+			center[i] = ((int32_t) rangeMin[i] + rangeMax[i]) / 2;
+		}
+
+		d[i] = (int32_t) counts[i] - center[i];
+		if( abs(d[i]) > abs(d[axis]) )
+		{
+			axis = i;
+		}
+	}
+
+	bin = 8*axis + 4*(d[axis] < 0) + 2*(d[(axis + 1) % 3] < 0) + (d[(axis + 2) % 3] < 0);
+
+	if(binUsed & (1 << bin))
+	{
+		int32_t distance = abs((int32_t) counts[0] - bins[bin][0]) +
+						   abs((int32_t) counts[1] - bins[bin][1]) +
+						   abs((int32_t) counts[2] - bins[bin][2]);
+		if(distance < MAGCAL_BIN_DISTANCE)
+		{
+			return false;
+		}
+	}else{
+		binUsed |= (1 << bin);
+		binCount++;
+	}
+
+	bins[bin][0] = counts[0];
+	bins[bin][1] = counts[1];
+	bins[bin][2] = counts[2];
+
+	if(binNew < 0xFF)
+	{
+		binNew++;
+	}
+
+	return (binCount >= MAGCAL_MIN_BINS) && (binNew >= MAGCAL_SOLVE_NEW);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Relative RMS deviation of the corrected radius over the kept samples
+ *
+ *****************************************************************************/
+static float MAGCAL_error(const float *offset, const float *matrix)
+{
+	float radius[MAGCAL_BINS];
+	float mean = 0, sum = 0;
+	uint8_t n = 0;
+
+	for(uint8_t b = 0; b < MAGCAL_BINS; b++)
+	{
+		if( !(binUsed & (1 << b)) )
+		{
+			continue;
+		}
+
+		float v[3], c[3];
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			v[i] = bins[b][i] + offset[i];
+		}
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			c[i] = matrix[3*i]*v[0] + matrix[3*i + 1]*v[1] + matrix[3*i + 2]*v[2];
+		}
+		radius[n] = sqrtf(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]);
+		mean += radius[n];
+		n++;
+	}
+
+	mean /= n;
+	for(uint8_t i = 0; i < n; i++)
+	{
+		sum += (radius[i] - mean) * (radius[i] - mean);
+	}
+
+	return sqrtf(sum / n) / mean;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Solve N p = r in place, N symmetric positive definite (Cholesky)
+ *
+ * @return
+ *   ERROR if N is not positive definite (samples in a plane)
+ *
+ *****************************************************************************/
+static uint32_t MAGCAL_cholesky(float N[MAGCAL_PARAMS][MAGCAL_PARAMS], float *r)
+{
+	for(uint8_t j = 0; j < MAGCAL_PARAMS; j++)
+	{
+		float diag = N[j][j];
+		for(uint8_t k = 0; k < j; k++)
+		{
+			diag -= N[j][k] * N[j][k];
+		}
+		if(diag <= 1e-12f)
+		{
+			return ERROR;
+		}
+		N[j][j] = sqrtf(diag);
+
+		for(uint8_t i = j + 1; i < MAGCAL_PARAMS; i++)
+		{
+			float sum = N[i][j];
+			for(uint8_t k = 0; k < j; k++)
+			{
+				sum -= N[i][k] * N[j][k];
+			}
+			N[i][j] = sum / N[j][j];
+		}
+	}
+
+	/* L y = r, then L^T p = y */
+	for(uint8_t i = 0; i < MAGCAL_PARAMS; i++)
+	{
+		for(uint8_t k = 0; k < i; k++)
+		{
+			r[i] -= N[i][k] * r[k];
+		}
+		r[i] /= N[i][i];
+	}
+	for(int8_t i = MAGCAL_PARAMS - 1; i >= 0; i--)
+	{
+		for(uint8_t k = i + 1; k < MAGCAL_PARAMS; k++)
+		{
+			r[i] -= N[k][i] * r[k];
+		}
+		r[i] /= N[i][i];
+	}
+
+	return OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Eigenvalues and eigenvectors of a symmetric 3x3 matrix (cyclic Jacobi)
+ *
+ * @param[in,out] A
+ *   Row major, eigenvalues on the diagonal afterwards
+ *
+ * @param[out] V
+ *   Eigenvectors in the columns, row major
+ *
+ *****************************************************************************/
+static void MAGCAL_jacobi(float *A, float *V)
+{
+	for(uint8_t i = 0; i < 9; i++)
+	{
+		V[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+	}
+
+	for(uint8_t sweep = 0; sweep < 10; sweep++)
+	{
+		float off = fabsf(A[1]) + fabsf(A[2]) + fabsf(A[5]);
+		if(off < 1e-9f * (fabsf(A[0]) + fabsf(A[4]) + fabsf(A[8])))
+		{
+			break;
+		}
+
+		for(uint8_t p = 0; p < 2; p++)
+		{
+			for(uint8_t q = p + 1; q < 3; q++)
+			{
+				float apq = A[3*p + q];
+				if(apq == 0.0f)
+				{
+					continue;
+				}
+
+				float theta = (A[3*q + q] - A[3*p + p]) / (2.0f * apq);
+				float t = (theta >= 0 ? 1.0f : -1.0f) / (fabsf(theta) + sqrtf(theta*theta + 1.0f));
+				float c = 1.0f / sqrtf(t*t + 1.0f);
+				float s = t * c;
+
+				/* A = J^T A J, J rotation in the p,q plane */
+				for(uint8_t k = 0; k < 3; k++)
+				{
+					float akp = A[3*k + p];
+					float akq = A[3*k + q];
+					A[3*k + p] = c*akp - s*akq;
+					A[3*k + q] = s*akp + c*akq;
+				}
+				for(uint8_t k = 0; k < 3; k++)
+				{
+					float apk = A[3*p + k];
+					float aqk = A[3*q + k];
+					A[3*p + k] = c*apk - s*aqk;
+					A[3*q + k] = s*apk + c*aqk;
+				}
+				for(uint8_t k = 0; k < 3; k++)
+				{
+					float vkp = V[3*k + p];
+					float vkq = V[3*k + q];
+					V[3*k + p] = c*vkp - s*vkq;
+					V[3*k + q] = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Fit an ellipsoid through the kept samples, apply it if it is better
+ *
+ * @details
+ *	 Samples are centered on their mean and scaled to unit size, then
+ *	 a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1
+ *	 is fitted with the normal equations (9x9, Cholesky).
+ *	 Center xc = -A^-1 [g h i], A/(1 + xc^T A xc) has to be positive definite.
+ *	 The correction is its symmetric square root (no rotation of the reference
+ *	 frame), scaled to determinant 1 so the field keeps its size in counts.
+ *	 The new correction replaces the applied one if its error on the same samples
+ *	 is lower. ~10 ms on the EFM32HG (software floating point), run it from
+ *	 the lowest priority event.
+ *
+ * @return
+ *   OK if a new correction was applied
+ *
+ *****************************************************************************/
+uint32_t MAGCAL_Solve(void)
+{
+	float N[MAGCAL_PARAMS][MAGCAL_PARAMS];
+	float p[MAGCAL_PARAMS];
+	float mean[3] = {0, 0, 0};
+	float size = 0;
+	uint8_t n = 0;
+
+	binNew = 0;
+
+	if(binCount < MAGCAL_MIN_BINS)
+	{
+		return ERROR;
+	}
+
+	/* Center and scale for a well conditioned fit */
+	for(uint8_t b = 0; b < MAGCAL_BINS; b++)
+	{
+		if(binUsed & (1 << b))
+		{
+			mean[0] += bins[b][0];
+			mean[1] += bins[b][1];
+			mean[2] += bins[b][2];
+			n++;
+		}
+	}
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		mean[i] /= n;
+	}
+	for(uint8_t b = 0; b < MAGCAL_BINS; b++)
+	{
+		if(binUsed & (1 << b))
+		{
+			for(uint8_t i = 0; i < 3; i++)
+			{
+				size += (bins[b][i] - mean[i]) * (bins[b][i] - mean[i]);
+			}
+		}
+	}
+	size = sqrtf(size / n);
+	if(size < 1.0f)
+	{
+		return ERROR;
+	}
+
+	/* Normal equations, upper triangle */
+	for(uint8_t i = 0; i < MAGCAL_PARAMS; i++)
+	{
+		p[i] = 0;
+		for(uint8_t j = i; j < MAGCAL_PARAMS; j++)
+		{
+			N[i][j] = 0;
+		}
+	}
+	for(uint8_t b = 0; b < MAGCAL_BINS; b++)
+	{
+		if( !(binUsed & (1 << b)) )
+		{
+			continue;
+		}
+
+		float x = (bins[b][0] - mean[0]) / size;
+		float y = (bins[b][1] - mean[1]) / size;
+		float z = (bins[b][2] - mean[2]) / size;
+		float v[MAGCAL_PARAMS] = { x*x, y*y, z*z, 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z };
+
+		for(uint8_t i = 0; i < MAGCAL_PARAMS; i++)
+		{
+			p[i] += v[i];
+			for(uint8_t j = i; j < MAGCAL_PARAMS; j++)
+			{
+				N[i][j] += v[i] * v[j];
+			}
+		}
+	}
+	for(uint8_t i = 0; i < MAGCAL_PARAMS; i++)
+	{
+		for(uint8_t j = 0; j < i; j++)
+		{
+			N[i][j] = N[j][i];
+		}
+	}
+
+	if(MAGCAL_cholesky(N, p) != OK)
+	{
+		return ERROR;
+	}
+
+	/* Center: A xc = -g, Cramer's rule */
+	float A[9] = { p[0], p[3], p[4],
+				   p[3], p[1], p[5],
+				   p[4], p[5], p[2] };
+	float det = A[0]*(A[4]*A[8] - A[5]*A[7]) - A[1]*(A[3]*A[8] - A[5]*A[6]) + A[2]*(A[3]*A[7] - A[4]*A[6]);
+	if(fabsf(det) < 1e-12f)
+	{
+		return ERROR;
+	}
+	float xc[3];
+	xc[0] = -( p[6]*(A[4]*A[8] - A[5]*A[7]) - A[1]*(p[7]*A[8] - A[5]*p[8]) + A[2]*(p[7]*A[7] - A[4]*p[8]) ) / det;
+	xc[1] = -( A[0]*(p[7]*A[8] - A[5]*p[8]) - p[6]*(A[3]*A[8] - A[5]*A[6]) + A[2]*(A[3]*p[8] - p[7]*A[6]) ) / det;
+	xc[2] = -( A[0]*(A[4]*p[8] - p[7]*A[7]) - A[1]*(A[3]*p[8] - p[7]*A[6]) + p[6]*(A[3]*A[7] - A[4]*A[6]) ) / det;
+
+	/* (x - xc)^T A (x - xc) = k */
+	float k = 1.0f;
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		k += xc[i] * (A[3*i]*xc[0] + A[3*i + 1]*xc[1] + A[3*i + 2]*xc[2]);
+	}
+	if(k <= 0.0f)
+	{
+		return ERROR;
+	}
+
+	float V[9];
+	for(uint8_t i = 0; i < 9; i++)
+	{
+		A[i] /= k;
+	}
+	MAGCAL_jacobi(A, V);
+	if( (A[0] <= 0.0f) || (A[4] <= 0.0f) || (A[8] <= 0.0f) )
+	{
+		return ERROR;
+	}
+
+	/* W = V sqrt(L) V^T, det(W) = 1, field radius in counts */
+	float root[3] = { sqrtf(A[0]), sqrtf(A[4]), sqrtf(A[8]) };
+	float norm = cbrtf(root[0] * root[1] * root[2]);
+	float field = size / norm;
+	if( (field < MAGCAL_FIELD_MIN) || (field > MAGCAL_FIELD_MAX) )
+	{
+		return ERROR;
+	}
+
+	float offset[3], matrix[9];
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		offset[i] = -(mean[i] + size * xc[i]);
+		for(uint8_t j = 0; j < 3; j++)
+		{
+			matrix[3*i + j] = (V[3*i]*root[0]*V[3*j] + V[3*i + 1]*root[1]*V[3*j + 1] + V[3*i + 2]*root[2]*V[3*j + 2]) / norm;
+		}
+	}
+
+	/* Keep the applied correction if it still fits the samples better */
+	float error = MAGCAL_error(offset, matrix);
+	if(error >= MAGCAL_error(magOffset, magMatrix))
+	{
+		return ERROR;
+	}
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		magOffset[i] = offset[i];
+		center[i] = (int16_t) lroundf(-offset[i]);
+	}
+	for(uint8_t i = 0; i < 9; i++)
+	{
+		magMatrix[i] = matrix[i];
+	}
+	magFitError = error;
+	fitted = true;
+
+	ICM_20948_magCorrectionSet(magOffset, magMatrix);
+
+	return OK;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Applied correction, to store it
+ *
+ * @param[out] offset
+ *   Hard iron offset in counts
+ *
+ * @param[out] matrix
+ *   Soft iron correction, 3x3 row major
+ *
+ *****************************************************************************/
+void MAGCAL_Get(float *offset, float *matrix)
+{
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		offset[i] = magOffset[i];
+	}
+	for(uint8_t i = 0; i < 9; i++)
+	{
+		matrix[i] = magMatrix[i];
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Relative RMS radius error of the applied correction, at the last applied fit
+ *
+ *****************************************************************************/
+float MAGCAL_FitError(void)
+{
+	return magFitError;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Directions with a sample, coverage of the fit
+ *
+ *****************************************************************************/
+uint8_t MAGCAL_Bins(void)
+{
+	return binCount;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Check the convergence of the online calibration
+ *
+ * @return
+ *   true if enough directions are covered and the fit error is below MAGCAL_FIT_ERROR_MAX
+ *
+ *****************************************************************************/
+bool MAGCAL_Converged(void)
+{
+	return (binCount >= MAGCAL_MIN_BINS) && (magFitError < MAGCAL_FIT_ERROR_MAX);
+}
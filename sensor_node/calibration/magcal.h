@@ -0,0 +1,36 @@
+/***************************************************************************//**
+ * @file magcal.h
+ * @brief Online magnetometer calibration, ellipsoid fit
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+
+#ifndef CALIBRATION_MAGCAL_H_
+#define CALIBRATION_MAGCAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Public definition to select the magnetometer calibration
+ *    @li `1` - Online ellipsoid fit on the streamed samples (MAGCAL_Update), no figure eight session.
+ *    @li `0` - Blocking min/max sweep of ICM_20948_calibrate_mag during the calibration. */
+#define MAGCAL_ONLINE			1
+
+#define MAGCAL_BINS				24			/**< Sample directions kept for the fit, 6 cube faces x 4 quadrants */
+#define MAGCAL_MIN_BINS			12			/**< Directions with a sample before a fit is tried */
+#define MAGCAL_BIN_DISTANCE		30			/**< counts, a sample closer to the one in its bin is not stored */
+#define MAGCAL_SOLVE_NEW		12			/**< New bin samples between two fits */
+#define MAGCAL_FIT_ERROR_MAX	0.03f		/**< Relative RMS radius error of a converged fit */
+#define MAGCAL_FIELD_MIN		100.0f		/**< counts (15 uT), smaller fitted field is rejected */
+#define MAGCAL_FIELD_MAX		600.0f		/**< counts (90 uT), larger fitted field is rejected */
+
+void MAGCAL_Init(const float *offset, const float *matrix, float fitError);
+bool MAGCAL_Update(const int16_t *counts);
+uint32_t MAGCAL_Solve(void);
+void MAGCAL_Get(float *offset, float *matrix);
+float MAGCAL_FitError(void);
+uint8_t MAGCAL_Bins(void);
+bool MAGCAL_Converged(void);
+
+#endif /* CALIBRATION_MAGCAL_H_ */
@@ -18,6 +18,6 @@
 
 
 #define EMDRV_RTCDRV_WALLCLOCK_CONFIG
-#define EMDRV_RTCDRV_NUM_TIMERS					1
+#define EMDRV_RTCDRV_NUM_TIMERS					3		/* IMU idle check + FIFO drain + BLE link */
 
 #endif /* DELAY_RTCDRV_CONFIG_H_ */
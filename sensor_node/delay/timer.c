@@ -13,7 +13,9 @@
  */
 
 #include <timer.h>
+#include "em_cmu.h"
 #include "em_rtc.h"
+#include "em_timer.h"
 #include "rtcdriver.h"
 #include "rtcdrv_config.h" // voor millis(); config file
 
@@ -48,3 +50,89 @@ uint32_t micros(void)
 {
 	return 1000 * RTCDRV_TicksToMsec(RTCDRV_GetWallClockTicks64());
 }
+
+
+/**************************************************************************//**
+ * @brief
+ *   RTC wall clock ticks, used to timestamp samples
+ *
+ * @note
+ * 	 Can be called from interrupt context, wraps around every 36 hours
+ *
+ * @return
+ *	ticks at RTC_TICK_FREQ
+ *
+ *****************************************************************************/
+uint32_t ticks(void)
+{
+	return RTCDRV_GetWallClockTicks32();
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Start or stop the cycle counter of cycles()
+ *
+ * @details
+ *	 TIMER0 counts HFPERCLK without prescaler, TIMER1 counts the overflows
+ *	 of TIMER0 (cascade), together one 32-bit counter. HFPERCLK is HFCORECLK
+ *	 unless CMU_HFPERCLKDIV is changed. The timers only run in EM0 and EM1.
+ *
+ * @param[in] enable
+ *   @li 'true' - reset and start the counter
+ *   @li 'false' - stop the counter and its clocks
+ *
+ *****************************************************************************/
+void cyclesEnable(bool enable)
+{
+	TIMER_Init_TypeDef init = TIMER_INIT_DEFAULT;
+
+	if(!enable)
+	{
+		TIMER_Enable(TIMER0, false);
+		TIMER_Enable(TIMER1, false);
+		CMU_ClockEnable(cmuClock_TIMER0, false);
+		CMU_ClockEnable(cmuClock_TIMER1, false);
+		return;
+	}
+
+	CMU_ClockEnable(cmuClock_TIMER0, true);
+	CMU_ClockEnable(cmuClock_TIMER1, true);
+
+	init.enable = false;
+	TIMER_Init(TIMER0, &init);
+	init.clkSel = timerClkSelCascade;
+	TIMER_Init(TIMER1, &init);
+	TIMER_CounterSet(TIMER0, 0);
+	TIMER_CounterSet(TIMER1, 0);
+
+	TIMER_Enable(TIMER1, true);
+	TIMER_Enable(TIMER0, true);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   HFPERCLK cycles since cyclesEnable
+ *
+ * @note
+ * 	 Wraps around after 2^32 cycles (3.4 minutes at 21 MHz), the difference
+ * 	 of two calls is right as long as less time passed
+ *
+ * @return
+ *	cycles
+ *
+ *****************************************************************************/
+uint32_t cycles(void)
+{
+	uint32_t high, low;
+
+	/* Read again when TIMER0 overflowed between the two reads */
+	do
+	{
+		high = TIMER_CounterGet(TIMER1);
+		low = TIMER_CounterGet(TIMER0);
+	} while(high != TIMER_CounterGet(TIMER1));
+
+	return (high << 16) | low;
+}
@@ -21,8 +21,13 @@
 #include <stdbool.h>
 #include "stdio.h"
 
+#define RTC_TICK_FREQ	32768		/**< RTC wall clock ticks per second (LFXO, no prescaler) */
+
 uint32_t millis(void);
 uint32_t micros(void);
+uint32_t ticks(void);
+void cyclesEnable(bool enable);
+uint32_t cycles(void);
 
 
 #endif /* DELAY_TIMER_H_ */
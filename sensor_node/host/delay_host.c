@@ -0,0 +1,35 @@
+/***************************************************************************//**
+ * @file delay_host.c
+ * @brief Host stand-ins for delay.h and timer.h on the simulated time of I2C_sim.c
+ * @details
+ *   A delay advances the simulated IMU by the same time instead of sleeping,
+ *   so a host build runs the driver timing in no time.
+ *
+ *   Not part of the node firmware, the file is empty without EMLIB_HOST.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#ifdef EMLIB_HOST
+
+#include "delay.h"
+#include "timer.h"
+#include "I2C_sim.h"
+
+
+void delay(uint32_t msDelay)
+{
+	IIC_SimAdvance(msDelay * 1000);
+}
+
+uint32_t millis(void)
+{
+	return IIC_SimTimeGet() / 1000;
+}
+
+uint32_t micros(void)
+{
+	return IIC_SimTimeGet();
+}
+
+#endif /* EMLIB_HOST */
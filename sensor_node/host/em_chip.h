@@ -0,0 +1,6 @@
+/***************************************************************************//**
+ * @file em_chip.h
+ * @brief Host stand-in, see emlib_host.h
+ * ****************************************************************************/
+
+#include "emlib_host.h"
@@ -0,0 +1,118 @@
+/***************************************************************************//**
+ * @file emlib_host.c
+ * @brief Host stand-ins for the emlib functions
+ * @details
+ *   GPIO, CMU, NVIC and EMU functions do nothing. A USART is a few plain
+ *   registers: USART_Tx writes TXDATA, USART_Rx reads RXDATA and the
+ *   interrupt functions update IF and IEN, a test plays the peripheral.
+ *
+ *   Not part of the node firmware, the file is empty without EMLIB_HOST.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#ifdef EMLIB_HOST
+
+#include "emlib_host.h"
+
+static USART_TypeDef usart0, usart1;		/**< Registers written by the drivers */
+USART_TypeDef *USART0 = &usart0;
+USART_TypeDef *USART1 = &usart1;
+
+
+/**************************************************************************//**
+ * @brief
+ *   Peripherals, nothing to do on the host
+ *****************************************************************************/
+void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+	(void) irq;
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+	(void) irq;
+}
+
+void EMU_EnterEM1(void)
+{
+}
+
+void GPIO_PinModeSet(GPIO_Port_TypeDef port, unsigned int pin, GPIO_Mode_TypeDef mode, unsigned int out)
+{
+	(void) port; (void) pin; (void) mode; (void) out;
+}
+
+void GPIO_PinOutSet(GPIO_Port_TypeDef port, unsigned int pin)
+{
+	(void) port; (void) pin;
+}
+
+void GPIO_PinOutClear(GPIO_Port_TypeDef port, unsigned int pin)
+{
+	(void) port; (void) pin;
+}
+
+void CMU_ClockEnable(CMU_Clock_TypeDef clock, bool enable)
+{
+	(void) clock; (void) enable;
+}
+
+void USART_InitAsync(USART_TypeDef *usart, const USART_InitAsync_TypeDef *init)
+{
+	(void) init;
+	/* TXC is 0 after a reset, until a byte was sent */
+	usart->STATUS = 0;
+}
+
+void USART_InitSync(USART_TypeDef *usart, const USART_InitSync_TypeDef *init)
+{
+	(void) init;
+	/* TXC is 0 after a reset, until a byte was sent */
+	usart->STATUS = 0;
+}
+
+void USART_Enable(USART_TypeDef *usart, USART_Enable_TypeDef enable)
+{
+	(void) usart; (void) enable;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   USART data and interrupt registers
+ *****************************************************************************/
+void USART_IntClear(USART_TypeDef *usart, uint32_t flags)
+{
+	usart->IF &= ~flags;
+}
+
+void USART_IntEnable(USART_TypeDef *usart, uint32_t flags)
+{
+	usart->IEN |= flags;
+}
+
+void USART_IntDisable(USART_TypeDef *usart, uint32_t flags)
+{
+	usart->IEN &= ~flags;
+}
+
+void USART_Tx(USART_TypeDef *usart, uint8_t data)
+{
+	usart->TXDATA = data;
+	/* Sent at once */
+	usart->STATUS |= USART_STATUS_TXC;
+}
+
+uint8_t USART_Rx(USART_TypeDef *usart)
+{
+	return (uint8_t) usart->RXDATA;
+}
+
+uint8_t USART_SpiTransfer(USART_TypeDef *usart, uint8_t data)
+{
+	(void) usart; (void) data;
+	return 0xFF;
+}
+
+#endif /* EMLIB_HOST */
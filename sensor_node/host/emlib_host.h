@@ -0,0 +1,160 @@
+/***************************************************************************//**
+ * @file emlib_host.h
+ * @brief Host stand-ins for the emlib declarations used by the sensor node code
+ * @details
+ *   Only for host builds, -DEMLIB_HOST=1 -Ihost on the gcc command line, see
+ *   I2C_sim_test.c and uart_test.c. The em_*.h, i2cspm.h, rtcdriver.h and
+ *   bsp.h files of this folder all include this file. Peripherals are a few
+ *   plain registers, see emlib_host.c.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#ifndef EMLIB_HOST_H_
+#define EMLIB_HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* CMSIS, an interrupt is modelled with a signal handler, it can not be masked */
+#define __DMB()						__sync_synchronize()
+#define __disable_irq()
+#define __enable_irq()
+
+typedef enum
+{
+	USART1_RX_IRQn, USART1_TX_IRQn
+} IRQn_Type;
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_EnableIRQ(IRQn_Type irq);
+
+/* EMU */
+void EMU_EnterEM1(void);
+
+/* GPIO */
+typedef enum
+{
+	gpioPortA, gpioPortB, gpioPortC, gpioPortD, gpioPortE, gpioPortF
+} GPIO_Port_TypeDef;
+
+typedef enum
+{
+	gpioModeDisabled, gpioModeInput, gpioModeInputPull, gpioModeInputPullFilter, gpioModePushPull, gpioModeWiredAndPullUp
+} GPIO_Mode_TypeDef;
+
+void GPIO_PinModeSet(GPIO_Port_TypeDef port, unsigned int pin, GPIO_Mode_TypeDef mode, unsigned int out);
+void GPIO_PinOutSet(GPIO_Port_TypeDef port, unsigned int pin);
+void GPIO_PinOutClear(GPIO_Port_TypeDef port, unsigned int pin);
+
+/* CMU */
+typedef enum
+{
+	cmuClock_HFPER, cmuClock_GPIO, cmuClock_USART0, cmuClock_USART1, cmuClock_I2C0
+} CMU_Clock_TypeDef;
+
+void CMU_ClockEnable(CMU_Clock_TypeDef clock, bool enable);
+
+/* USART */
+typedef struct
+{
+	volatile uint32_t STATUS;
+	volatile uint32_t IF;
+	volatile uint32_t IEN;
+	volatile uint32_t TXDATA;		/**< Last byte of USART_Tx */
+	volatile uint32_t RXDATA;		/**< Returned by USART_Rx */
+	volatile uint32_t ROUTE;
+} USART_TypeDef;
+
+extern USART_TypeDef *USART0;
+extern USART_TypeDef *USART1;
+
+typedef enum
+{
+	usartDisable, usartEnable
+} USART_Enable_TypeDef;
+
+typedef enum
+{
+	usartDatabits8 = 5
+} USART_Databits_TypeDef;
+
+typedef enum
+{
+	usartClockMode0
+} USART_ClockMode_TypeDef;
+
+typedef struct
+{
+	USART_Enable_TypeDef enable;
+	uint32_t refFreq;
+	uint32_t baudrate;
+	USART_Databits_TypeDef databits;
+} USART_InitAsync_TypeDef;
+
+#define USART_INITASYNC_DEFAULT		{ usartEnable, 0, 115200, usartDatabits8 }
+
+typedef struct
+{
+	USART_Enable_TypeDef enable;
+	uint32_t refFreq;
+	uint32_t baudrate;
+	USART_Databits_TypeDef databits;
+	bool master;
+	bool msbf;
+	USART_ClockMode_TypeDef clockMode;
+	bool autoTx;
+	bool autoCsEnable;
+} USART_InitSync_TypeDef;
+
+#define USART_INITSYNC_DEFAULT		{ usartEnable, 0, 1000000, usartDatabits8, true, false, usartClockMode0, false, false }
+
+#define USART_ROUTE_RXPEN			(0x1UL << 0)
+#define USART_ROUTE_TXPEN			(0x1UL << 1)
+#define USART_ROUTE_CSPEN			(0x1UL << 2)
+#define USART_ROUTE_CLKPEN			(0x1UL << 3)
+#define USART_ROUTE_LOCATION_LOC0	(0x0UL << 8)
+
+#define USART_STATUS_TXC			(0x1UL << 5)
+
+#define USART_IF_TXBL				(0x1UL << 1)
+#define USART_IF_RXDATAV			(0x1UL << 2)
+#define USART_IEN_TXBL				USART_IF_TXBL
+#define USART_IEN_RXDATAV			USART_IF_RXDATAV
+#define _USART_IFC_MASK				0x00001FFFUL
+
+void USART_InitAsync(USART_TypeDef *usart, const USART_InitAsync_TypeDef *init);
+void USART_InitSync(USART_TypeDef *usart, const USART_InitSync_TypeDef *init);
+void USART_Enable(USART_TypeDef *usart, USART_Enable_TypeDef enable);
+void USART_IntClear(USART_TypeDef *usart, uint32_t flags);
+void USART_IntEnable(USART_TypeDef *usart, uint32_t flags);
+void USART_IntDisable(USART_TypeDef *usart, uint32_t flags);
+void USART_Tx(USART_TypeDef *usart, uint8_t data);
+uint8_t USART_Rx(USART_TypeDef *usart);
+uint8_t USART_SpiTransfer(USART_TypeDef *usart, uint8_t data);
+
+/* I2C */
+typedef enum
+{
+	i2cTransferInProgress = 1,
+	i2cTransferDone = 0,
+	i2cTransferNack = -1,
+	i2cTransferBusErr = -2,
+	i2cTransferArbLost = -3,
+	i2cTransferUsageFault = -4,
+	i2cTransferSwFault = -5
+} I2C_TransferReturn_TypeDef;
+
+typedef struct
+{
+	uint16_t addr;
+	uint16_t flags;
+	struct
+	{
+		uint8_t *data;
+		uint16_t len;
+	} buf[2];
+} I2C_TransferSeq_TypeDef;
+
+#endif /* EMLIB_HOST_H_ */
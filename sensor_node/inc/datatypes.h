@@ -20,14 +20,17 @@
 
 #define M_PI		3.14159265358979323846
 
-typedef enum app_states {
-	INIT,
-	SENSORS_READ,
-	BATT_READ,
-	SLEEP,
-	CALLIBRATE,
-	SYS_IDLE
-} APP_State_t;
+/* Scheduler events, lower value = higher priority, see SCHED_Run */
+typedef enum app_events {
+	EVT_SLEEP,				/**< Go to sleep, wake on motion */
+	EVT_SENSORS_READ,		/**< IMU data ready or FIFO drain */
+	EVT_BLE_LINK,			/**< BLE link timer or LED2 edge */
+	EVT_IDLE_CHECK,			/**< Periodic battery and idle check */
+	EVT_BATT_READ,			/**< Battery measurement */
+	EVT_CALLIBRATE,			/**< Accel, gyro and magnetometer calibration */
+	EVT_MAGCAL,				/**< Online magnetometer fit, see MAGCAL_Solve */
+	EVT_COUNT
+} APP_Event_t;
 
 typedef struct
 {
@@ -37,15 +40,23 @@ typedef struct
 	float ICM_20948_magn[3];
 	float ICM_20948_euler_angles[3];
 
+	// IMU raw data and resolution, used by the fixed-point sensor fusion and FIFO mode
+	int16_t ICM_20948_gyroRaw[3];
+	int16_t ICM_20948_accelRaw[3];
+	int16_t ICM_20948_magnRaw[3];
+	float gyroRes;
+	float accelRes;
+
 	// Bluetooth data
 	uint8_t BLE_euler_angles[sizeof(float) * 3];
+	uint8_t BLE_quaternion[6];		// smallest three encoded quaternion, see quaternion_to_uint8_t
 	uint8_t BLE_data[sizeof(float) * 3 + 5];
 
 	// Calibration
 	float accelCal[3];
 	float gyroCal[3];
 	float magOffset[3];
-	float magScale[3];
+	float magMatrix[9];
 
 	// Battery
 	uint8_t batt[1];
@@ -147,6 +147,7 @@
 #define ICM_20948_BIT_INT_ACTL            0x80                        /**< Active low setting bit                                 */
 #define ICM_20948_BIT_INT_OPEN            0x40                        /**< Open collector onfiguration bit                        */
 #define ICM_20948_BIT_INT_LATCH_EN        0x20                        /**< Latch enable bit                                       */
+#define ICM_20948_BIT_BYPASS_EN           0x02                        /**< I2C bypass: auxiliary I2C bus (magnetometer) on the host bus */
 
 #define ICM_20948_REG_INT_ENABLE          (ICM_20948_BANK_0 | 0x10)    /**< Interrupt Enable register                              */
 #define ICM_20948_BIT_WOM_INT_EN          0x08                        /**< Wake-up On Motion enable bit                           */
@@ -216,6 +217,17 @@
 #define ICM_20948_BIT_MULTI_FIFO_CFG      0x01                        /**< Interrupt status for each sensor is required           */
 #define ICM_20948_BIT_SINGLE_FIFO_CFG     0x00                        /**< Interrupt status for only a single sensor is required  */
 
+#define ICM_20948_FIFO_SIZE               4096                        /**< Size of the FIFO in bytes                              */
+#define ICM_20948_FIFO_PACKET_SIZE        12                          /**< Accel + gyro packet in the FIFO (2 sensors x 3 axes x 2 bytes) */
+#define ICM_20948_FIFO_MAX_PACKETS        21                          /**< Packets per burst read, I2C transfer length is max 255 bytes */
+#define ICM_20948_FIFO_MODE_STREAM        0x00                        /**< FIFO overwrites the oldest data when full              */
+#define ICM_20948_FIFO_MODE_SNAPSHOT      0x0F                        /**< FIFO stops accepting data when full                    */
+
+#define ICM_20948_REG_MEM_START_ADDR      (ICM_20948_BANK_0 | 0x7C)    /**< DMP memory address within the memory bank              */
+#define ICM_20948_REG_MEM_R_W             (ICM_20948_BANK_0 | 0x7D)    /**< DMP memory read/write, address auto increments         */
+#define ICM_20948_REG_MEM_BANK_SEL        (ICM_20948_BANK_0 | 0x7E)    /**< DMP memory bank (256 bytes each)                       */
+#define ICM_20948_BIT_DMP_INT1_EN         0x02                        /**< DMP interrupt on INT1 pin, in INT_ENABLE               */
+
 /***********************/
 /* Bank 1 register map */
 /***********************/
@@ -232,6 +244,7 @@
 /* Bank 2 register map */
 /***********************/
 #define ICM_20948_REG_GYRO_SMPLRT_DIV     (ICM_20948_BANK_2 | 0x00)    /**< Gyroscope Sample Rate Divider regiser      */
+#define ICM_20948_REG_PRGM_START_ADDRH   (ICM_20948_BANK_2 | 0x50)    /**< DMP program start address high byte, low byte follows */
 
 #define ICM_20948_REG_GYRO_CONFIG_1       (ICM_20948_BANK_2 | 0x01)    /**< Gyroscope Configuration 1 register         */
 #define ICM_20948_BIT_GYRO_FCHOICE        0x01                        /**< Gyro Digital Low-Pass Filter enable bit    */
@@ -359,6 +372,10 @@
 #define ICM_20948_REG_EXT_SLV_SENS_DATA_00   (ICM_20948_BANK_0 | 0x3B)    /**< First sensor data byte read from external I2C devices through I2C master interface */
 #define ICM_20948_BIT_I2C_SLV_READ           0x80                        /**< I2C Slave Read bit                                 */
 
+#define ICM_20948_BURST_READ_SIZE            23                          /**< Accel (6) + gyro (6) + temp (2) + AK09916 ST1..ST2 (9) from ACCEL_XOUT_H */
+#define ICM_20948_BURST_MAG_OFFSET           14                          /**< Offset of AK09916 ST1 in the burst read            */
+#define AK09916_BURST_READ_SIZE              9                           /**< AK09916 ST1, HXL..HZH, TMPS, ST2                   */
+
 
 
 /*****************************/
@@ -379,6 +396,7 @@
 #define AK09916_REG_HZH                     0x16                        /**< Magnetometer Z-axis data higher byte   */
 
 #define AK09916_REG_STATUS_2                0x18                        /**< Status 2 register                      */
+#define AK09916_BIT_HOFL                    0x08                        /**< Magnetic sensor overflow bit           */
 
 #define AK09916_REG_CONTROL_2               0x31                        /**< Control 2 register                     */
 #define AK09916_BIT_MODE_POWER_DOWN         0x00                        /**< Power-down                             */
@@ -397,6 +415,61 @@
 /**@}*/
 
 
+/*****************************/
+/* DMP memory map            */
+/*****************************/
+#define ICM_20948_DMP_LOAD_START            0x0090                      /**< Firmware image is loaded from this DMP memory address */
+#define ICM_20948_DMP_START_ADDRESS         0x1000                      /**< DMP program counter start value        */
+#define ICM_20948_DMP_MEM_BANK_SIZE         256                         /**< Bytes per DMP memory bank              */
+#define ICM_20948_DMP_MEM_CHUNK             16                          /**< Max bytes per DMP memory transfer      */
+
+#define ICM_20948_DMP_DATA_OUT_CTL1         (4 * 16)                    /**< Header bits of the outputs written to the FIFO */
+#define ICM_20948_DMP_DATA_OUT_CTL2         (4 * 16 + 2)                /**< Header2 bits of the outputs written to the FIFO */
+#define ICM_20948_DMP_DATA_INTR_CTL         (4 * 16 + 12)               /**< Header bits of the outputs that raise the DMP interrupt */
+#define ICM_20948_DMP_MOTION_EVENT_CTL      (4 * 16 + 14)               /**< Motion event enables                   */
+#define ICM_20948_DMP_DATA_RDY_STATUS       (8 * 16 + 10)               /**< Sensors that feed the DMP              */
+#define ICM_20948_DMP_ODR_QUAT6             (10 * 16 + 12)              /**< 6-axis quaternion output divider       */
+#define ICM_20948_DMP_ODR_CNTR_QUAT6        (9 * 16 + 12)               /**< 6-axis quaternion output counter       */
+#define ICM_20948_DMP_ODR_GYRO              (11 * 16 + 10)              /**< Gyro output divider                    */
+#define ICM_20948_DMP_ODR_CNTR_GYRO         (9 * 16 + 10)               /**< Gyro output counter                    */
+#define ICM_20948_DMP_GYRO_SF               (19 * 16)                   /**< Gyro scale factor, depends on rate and PLL */
+#define ICM_20948_DMP_GYRO_FULLSCALE        (72 * 16 + 12)              /**< Gyro full scale, 2^28 = 2000 dps       */
+#define ICM_20948_DMP_ACC_SCALE             (30 * 16)                   /**< Accel scale, 2^26 = 4 g                */
+#define ICM_20948_DMP_ACC_SCALE2            (79 * 16 + 4)               /**< Accel scale 2, 2^18 = 4 g              */
+#define ICM_20948_DMP_ACCEL_ONLY_GAIN       (16 * 16 + 12)              /**< Accel fusion gain, rate dependent      */
+#define ICM_20948_DMP_ACCEL_ALPHA_VAR       (91 * 16)                   /**< Accel low pass filter, rate dependent  */
+#define ICM_20948_DMP_ACCEL_A_VAR           (92 * 16)                   /**< Accel low pass filter, rate dependent  */
+#define ICM_20948_DMP_ACCEL_CAL_RATE        (94 * 16 + 4)               /**< Accel calibration rate                 */
+
+#define ICM_20948_DMP_SENSOR_GYRO           0x0001                      /**< DATA_RDY_STATUS gyro                   */
+#define ICM_20948_DMP_SENSOR_ACCEL          0x0002                      /**< DATA_RDY_STATUS accel                  */
+
+#define ICM_20948_DMP_HEADER_ACCEL          0x8000                      /**< FIFO header: raw accel, 6 bytes        */
+#define ICM_20948_DMP_HEADER_GYRO           0x4000                      /**< FIFO header: raw gyro + bias, 12 bytes */
+#define ICM_20948_DMP_HEADER_COMPASS        0x2000                      /**< FIFO header: raw compass, 6 bytes      */
+#define ICM_20948_DMP_HEADER_ALS            0x1000                      /**< FIFO header: light sensor, 8 bytes     */
+#define ICM_20948_DMP_HEADER_QUAT6          0x0800                      /**< FIFO header: 6-axis quaternion, 12 bytes */
+#define ICM_20948_DMP_HEADER_QUAT9          0x0400                      /**< FIFO header: 9-axis quaternion + accuracy, 14 bytes */
+#define ICM_20948_DMP_HEADER_PQUAT6         0x0200                      /**< FIFO header: 6-axis quaternion Q14, 6 bytes */
+#define ICM_20948_DMP_HEADER_GEOMAG         0x0100                      /**< FIFO header: geomagnetic quaternion, 14 bytes */
+#define ICM_20948_DMP_HEADER_PRESSURE       0x0080                      /**< FIFO header: pressure, 6 bytes         */
+#define ICM_20948_DMP_HEADER_GYRO_CALIBR    0x0040                      /**< FIFO header: calibrated gyro, 12 bytes */
+#define ICM_20948_DMP_HEADER_COMPASS_CALIBR 0x0020                      /**< FIFO header: calibrated compass, 12 bytes */
+#define ICM_20948_DMP_HEADER_STEP_DETECTOR  0x0010                      /**< FIFO header: step detector, 4 bytes    */
+#define ICM_20948_DMP_HEADER_HEADER2        0x0008                      /**< FIFO header: a second header follows   */
+
+#define ICM_20948_DMP_HEADER2_ACCEL_ACCURACY   0x4000                   /**< FIFO header2: 2 bytes                  */
+#define ICM_20948_DMP_HEADER2_GYRO_ACCURACY    0x2000                   /**< FIFO header2: 2 bytes                  */
+#define ICM_20948_DMP_HEADER2_COMPASS_ACCURACY 0x1000                   /**< FIFO header2: 2 bytes                  */
+#define ICM_20948_DMP_HEADER2_FSYNC            0x0800                   /**< FIFO header2: 2 bytes                  */
+#define ICM_20948_DMP_HEADER2_PICKUP           0x0400                   /**< FIFO header2: 2 bytes                  */
+#define ICM_20948_DMP_HEADER2_ACTIVITY         0x0080                   /**< FIFO header2: 6 bytes                  */
+#define ICM_20948_DMP_HEADER2_SECONDARY_ON_OFF 0x0040                   /**< FIFO header2: 2 bytes                  */
+
+#define ICM_20948_DMP_FOOTER_SIZE           2                           /**< Gyro counter at the end of every FIFO frame */
+#define ICM_20948_DMP_FRAME_MAX             160                         /**< Largest FIFO frame with every output enabled */
+
+
 /* Retrun values Magnetometer */
 #define ERROR								0x0001						/**< Error code */
 #define OK									0x0000						/**< OK code */
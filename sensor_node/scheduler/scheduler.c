@@ -0,0 +1,337 @@
+/***************************************************************************//**
+ * @file scheduler.c
+ * @brief Event scheduler, replaces the appState switch in main
+ * @version 1.0
+ * @author Jona Cappelle
+ * *****************************************************************************/
+
+#include "scheduler.h"
+
+#include "em_device.h"
+#include "em_emu.h"
+
+#include "uart.h"
+#include "I2C.h"
+#include "timer.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+static volatile uint32_t pending = 0;				/**< One bit per APP_Event_t */
+static volatile uint32_t coalesced = 0;				/**< Posts of an event that was still pending */
+static uint32_t counted = 0;						/**< One bit per APP_Event_t whose posts are counted, see SCHED_CountedSet */
+static volatile uint8_t counts[EVT_COUNT];			/**< Handler runs still owed to a counted event */
+static SCHED_Handler_t handlers[EVT_COUNT];			/**< Handler per event, NULL = event is ignored */
+
+static uint32_t residencyStart = 0;					/**< ticks() at SCHED_ResidencyReset */
+static uint32_t em1Ticks = 0;						/**< Ticks spent idle in EM1 */
+static uint32_t em2Ticks = 0;						/**< Ticks spent idle in EM2 */
+static uint32_t em1Entries = 0;						/**< Idle periods in EM1 */
+static uint32_t em2Entries = 0;						/**< Idle periods in EM2 */
+
+#if EVT_COUNT > 32
+#error "pending holds at most 32 events"
+#endif
+
+
+/**************************************************************************//**
+ * @brief
+ *   Clear all pending events and handlers
+ *
+ *****************************************************************************/
+void SCHED_Init(void)
+{
+	__disable_irq();
+	pending = 0;
+	coalesced = 0;
+	counted = 0;
+	__enable_irq();
+
+	for(uint8_t i = 0; i < EVT_COUNT; i++)
+	{
+		handlers[i] = NULL;
+		counts[i] = 0;
+	}
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Set the function that is called for an event
+ *
+ * @param[in] event
+ *   Event
+ *
+ * @param[in] handler
+ *   Called from SCHED_Run, NULL to ignore the event
+ *
+ *****************************************************************************/
+void SCHED_HandlerSet(APP_Event_t event, SCHED_Handler_t handler)
+{
+	handlers[event] = handler;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Run the handler of an event once per post
+ *
+ * @details
+ *	 For events that stand for one sample each (data ready), a post while the
+ *	 event is still pending is not folded into the pending one. Up to 255
+ *	 posts are kept, more are counted in SCHED_Coalesced.
+ *
+ * @param[in] event
+ *   Event
+ *
+ * @param[in] count
+ *   true to count the posts, false to fold them (default)
+ *
+ *****************************************************************************/
+void SCHED_CountedSet(APP_Event_t event, bool count)
+{
+	__disable_irq();
+	if(count)
+	{
+		counted |= (1 << event);
+	}else{
+		counted &= ~(1 << event);
+	}
+	counts[event] = (pending & (1 << event)) ? 1 : 0;
+	__enable_irq();
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Post an event, can be called from interrupt context
+ *
+ * @details
+ *	 Events are kept as pending bits, they are never overwritten by other events.
+ *	 Posting an event that is still pending runs its handler once,
+ *	 the handlers read all data that is available (FIFO drain, latest sample).
+ *	 Events set with SCHED_CountedSet run their handler once per post.
+ *
+ * @param[in] event
+ *   Event
+ *
+ *****************************************************************************/
+void SCHED_Post(APP_Event_t event)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if( (counted & (1 << event)) && (counts[event] < UINT8_MAX) )
+	{
+		counts[event]++;
+	}
+	else if(pending & (1 << event))
+	{
+		coalesced++;
+	}
+	pending |= (1 << event);
+	__set_PRIMASK(primask);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Drop a pending event
+ *
+ * @param[in] event
+ *   Event
+ *
+ *****************************************************************************/
+void SCHED_Clear(APP_Event_t event)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	pending &= ~(1 << event);
+	counts[event] = 0;
+	__set_PRIMASK(primask);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Check if an event is pending
+ *
+ * @param[in] event
+ *   Event
+ *
+ * @return
+ *   true if posted and not handled yet
+ *
+ *****************************************************************************/
+bool SCHED_Pending(APP_Event_t event)
+{
+	return (pending & (1 << event)) != 0;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Number of posts that found their event still pending
+ *
+ *****************************************************************************/
+uint32_t SCHED_Coalesced(void)
+{
+	return coalesced;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Restart the energy mode bookkeeping
+ *
+ * @note
+ *	 Uses the RTCDRV wall clock, call again after every RTCDRV_Init.
+ *
+ *****************************************************************************/
+void SCHED_ResidencyReset(void)
+{
+	__disable_irq();
+	residencyStart = ticks();
+	em1Ticks = 0;
+	em2Ticks = 0;
+	em1Entries = 0;
+	em2Entries = 0;
+	__enable_irq();
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Count EM2 time that was spent outside the idle path
+ *
+ * @details
+ *	 For a handler that sleeps itself, like the wake on motion wait of
+ *	 sleep_enter. Without this that time would show up as EM0.
+ *
+ * @param[in] ticks
+ *   Ticks spent in EM2, RTC_TICK_FREQ
+ *
+ * @param[in] entries
+ *   Times EM2 was entered
+ *
+ *****************************************************************************/
+void SCHED_ResidencyEM2Add(uint32_t ticks, uint32_t entries)
+{
+	__disable_irq();
+	em2Ticks += ticks;
+	em2Entries += entries;
+	__enable_irq();
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Time spent per energy mode since SCHED_ResidencyReset
+ *
+ * @param[out] residency
+ *   Ticks and entries per mode, EM0 is the time that was not spent idle
+ *
+ *****************************************************************************/
+void SCHED_ResidencyGet(SCHED_Residency_t *residency)
+{
+	__disable_irq();
+	residency->em1Ticks = em1Ticks;
+	residency->em2Ticks = em2Ticks;
+	residency->em1Entries = em1Entries;
+	residency->em2Entries = em2Entries;
+	residency->em0Ticks = ticks() - residencyStart - em1Ticks - em2Ticks;
+	__enable_irq();
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Sleep until an interrupt, called with interrupts disabled
+ *
+ * @details
+ *	 EM1 while the UART or I2C still needs the HF clock, EM2 otherwise.
+ *	 RTCDRV timers and GPIO interrupts wake the MCU from EM2, nothing else
+ *	 runs periodically: SysTick is only enabled during delay().
+ *	 WFI also returns on an interrupt that is pending while they are disabled,
+ *	 so an event posted after the check in SCHED_Run is not missed.
+ *
+ * @return
+ *   true if EM2 was used, false for EM1
+ *
+ *****************************************************************************/
+static bool SCHED_Idle(void)
+{
+	if(uartTxActive() || IIC_TransferBusy())
+	{
+		EMU_EnterEM1();
+		return false;
+	}
+
+	/* HFXO is restored before the interrupt handler runs */
+	EMU_EnterEM2(true);
+	return true;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Run the event loop, never returns
+ *
+ * @details
+ *	 Handles the pending event with the highest priority (lowest APP_Event_t),
+ *	 then checks again, so a burst of samples can not starve a sleep request
+ *	 and a low priority event is still handled once the others are done.
+ *	 Sleeps when no event is pending and keeps track of the time per energy mode,
+ *	 see SCHED_ResidencyGet.
+ *
+ *****************************************************************************/
+void SCHED_Run(void)
+{
+	while(1)
+	{
+		uint8_t event;
+
+		__disable_irq();
+		if(pending == 0)
+		{
+			uint32_t start = ticks();
+			bool em2 = SCHED_Idle();
+
+			/* Wake-up interrupt runs here, its time is counted as idle */
+			__enable_irq();
+
+			__disable_irq();
+			if(em2)
+			{
+				em2Ticks += ticks() - start;
+				em2Entries++;
+			}else{
+				em1Ticks += ticks() - start;
+				em1Entries++;
+			}
+			__enable_irq();
+			continue;
+		}
+
+		for(event = 0; event < EVT_COUNT; event++)
+		{
+			if(pending & (1 << event))
+			{
+				break;
+			}
+		}
+		/* A counted event stays pending until every post is handled */
+		if( (counts[event] == 0) || (--counts[event] == 0) )
+		{
+			pending &= ~(1 << event);
+		}
+		__enable_irq();
+
+		if(handlers[event] != NULL)
+		{
+			handlers[event]();
+		}
+	}
+}
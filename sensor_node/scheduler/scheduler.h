@@ -0,0 +1,42 @@
+/***************************************************************************//**
+ * @file scheduler.h
+ * @brief Event scheduler, replaces the appState switch in main
+ * @version 1.0
+ * @author Jona Cappelle
+ * *****************************************************************************/
+
+
+#ifndef SCHEDULER_SCHEDULER_H_
+#define SCHEDULER_SCHEDULER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "datatypes.h"
+
+/* Event handler, runs in thread context */
+typedef void (*SCHED_Handler_t)(void);
+
+/* Time spent per energy mode since SCHED_ResidencyReset, in RTC ticks (RTC_TICK_FREQ) */
+typedef struct
+{
+	uint32_t em0Ticks;			/**< Running handlers (everything that is not idle) */
+	uint32_t em1Ticks;			/**< Idle, UART or I2C transfer in flight */
+	uint32_t em2Ticks;			/**< Idle, only RTC and GPIO wake-up */
+	uint32_t em1Entries;		/**< Times the idle path entered EM1 */
+	uint32_t em2Entries;		/**< Times the idle path entered EM2 */
+} SCHED_Residency_t;
+
+void SCHED_Init(void);
+void SCHED_HandlerSet(APP_Event_t event, SCHED_Handler_t handler);
+void SCHED_CountedSet(APP_Event_t event, bool count);
+void SCHED_Post(APP_Event_t event);
+void SCHED_Clear(APP_Event_t event);
+bool SCHED_Pending(APP_Event_t event);
+uint32_t SCHED_Coalesced(void);
+void SCHED_ResidencyReset(void);
+void SCHED_ResidencyEM2Add(uint32_t ticks, uint32_t entries);
+void SCHED_ResidencyGet(SCHED_Residency_t *residency);
+void SCHED_Run(void);
+
+#endif /* SCHEDULER_SCHEDULER_H_ */
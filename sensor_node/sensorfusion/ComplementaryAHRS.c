@@ -0,0 +1,237 @@
+/***************************************************************************//**
+ * @file ComplementaryAHRS.c
+ * @brief Sensor fusion, complementary filter
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+
+
+//=====================================================================================================
+// ComplementaryAHRS.c
+//=====================================================================================================
+//
+// The gyro is integrated, the accel and the magn only pull the quaternion back with a
+// proportional correction of the gyro rate. The accel corrects the tilt, the magn only the
+// heading: the error of the horizontal field is turned about the estimated gravity, so a
+// magnetic disturbance can not tilt the node. The field is not normalised, the heading
+// error is already a ratio of its horizontal components.
+// Cheaper than the Madgwick step: no gradient and no field reference.
+// No integral, the gyro bias is removed by GBIAS_Remove before the fusion.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ComplementaryAHRS.h"
+#include <math.h>
+#include <stdint.h>
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+float invSqrt(float x);										/**< Calculate inverse sqrt, MadgwickAHRS.c */
+
+//====================================================================================================
+// Functions
+
+
+/**************************************************************************//**
+ * @brief
+ *   Initialise a complementary filter state
+ *
+ * @details
+ *	 Identity quaternion, start gain COMPLEMENTARY_KP_START
+ *
+ * @param[out] filter
+ *   Filter state to initialise
+ *
+ *****************************************************************************/
+void ComplementaryAHRSinit(ComplementaryAHRS_t *filter) {
+	filter->q0 = 1.0f;
+	filter->q1 = 0.0f;
+	filter->q2 = 0.0f;
+	filter->q3 = 0.0f;
+	filter->gain = COMPLEMENTARY_KP_START;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Integrate the corrected gyro rate
+ *
+ * @details
+ *	 Shared end of the 9 DoF and the 6 DoF update
+ *
+ * @param[in,out] filter
+ *   Filter state
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s, correction included
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+static void ComplementaryAHRSintegrate(ComplementaryAHRS_t *filter, float gx, float gy, float gz, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;	// local copy of the state
+	float recipNorm;
+
+	if(filter->gain > 1.0f) {
+		filter->gain *= COMPLEMENTARY_KP_DECAY;
+		if(filter->gain < 1.0f) {
+			filter->gain = 1.0f;
+		}
+	}
+
+	// Integrate rate of change of quaternion
+	gx *= (0.5f * dt);		// pre-multiply common factors
+	gy *= (0.5f * dt);
+	gz *= (0.5f * dt);
+	filter->q0 = q0 + (-q1 * gx - q2 * gy - q3 * gz);
+	filter->q1 = q1 + (q0 * gx + q2 * gz - q3 * gy);
+	filter->q2 = q2 + (q0 * gy - q1 * gz + q3 * gx);
+	filter->q3 = q3 + (q0 * gz + q1 * gy - q2 * gx);
+
+	// Normalise quaternion
+	recipNorm = invSqrt(filter->q0 * filter->q0 + filter->q1 * filter->q1 + filter->q2 * filter->q2 + filter->q3 * filter->q3);
+	filter->q0 *= recipNorm;
+	filter->q1 *= recipNorm;
+	filter->q2 *= recipNorm;
+	filter->q3 *= recipNorm;
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+
+
+/**************************************************************************//**
+ * @brief
+ *   Complementary filter
+ *
+ * @details
+ *	 9 DoF sensor fusion
+ *
+ * @note
+ * 	 Gyro + Accel + Magn fusion, the magn only corrects the heading
+ *
+ * @param[in,out] filter
+ *   Filter state
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s
+ * @param[in] ax, ay, az
+ *   Accel, any unit
+ * @param[in] mx, my, mz
+ *   Magn, any unit
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+void ComplementaryAHRSupdateFilter(ComplementaryAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;
+	float recipNorm;
+	float q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+	float vx, vy, vz, hx, hy;
+	float kpAccel, kpMagn;
+
+	// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in the heading error)
+	if((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+		ComplementaryAHRSupdateIMUFilter(filter, gx, gy, gz, ax, ay, az, dt);
+		return;
+	}
+
+	// Auxiliary variables to avoid repeated arithmetic
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q0q3 = q0 * q3;
+	q1q1 = q1 * q1;
+	q1q2 = q1 * q2;
+	q1q3 = q1 * q3;
+	q2q2 = q2 * q2;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+
+	// Estimated direction of gravity, also the vertical axis in the sensor frame
+	vx = 2.0f * (q1q3 - q0q2);
+	vy = 2.0f * (q0q1 + q2q3);
+	vz = 1.0f - 2.0f * (q1q1 + q2q2);
+
+	kpAccel = COMPLEMENTARY_KP_ACCEL * filter->gain;
+	kpMagn = COMPLEMENTARY_KP_MAGN * filter->gain;
+
+	// Tilt: cross product between measured and estimated direction of gravity
+	if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+		recipNorm = kpAccel * invSqrt(ax * ax + ay * ay + az * az);
+		gx += (ay * vz - az * vy) * recipNorm;
+		gy += (az * vx - ax * vz) * recipNorm;
+		gz += (ax * vy - ay * vx) * recipNorm;
+	}
+
+	// Horizontal magnetic field in the earth frame, the reference is along x
+	hx = mx * (1.0f - 2.0f * (q2q2 + q3q3)) + my * 2.0f * (q1q2 - q0q3) + mz * 2.0f * (q1q3 + q0q2);
+	hy = mx * 2.0f * (q1q2 + q0q3) + my * (1.0f - 2.0f * (q1q1 + q3q3)) + mz * 2.0f * (q2q3 - q0q1);
+
+	// Heading: sine of the angle between the field and x, about the vertical axis,
+	// full correction beyond 90 degrees where the sine decreases again
+	recipNorm = hx * hx + hy * hy;
+	if(recipNorm > 0.0f) {
+		if(hx >= 0.0f) {
+			recipNorm = -hy * kpMagn * invSqrt(recipNorm);
+		}
+		else {
+			recipNorm = (hy > 0.0f) ? -kpMagn : kpMagn;
+		}
+		gx += vx * recipNorm;
+		gy += vy * recipNorm;
+		gz += vz * recipNorm;
+	}
+
+	ComplementaryAHRSintegrate(filter, gx, gy, gz, dt);
+}
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+
+
+/**************************************************************************//**
+ * @brief
+ *   Complementary filter
+ *
+ * @details
+ *	 6 DoF sensor fusion
+ *
+ * @note
+ * 	 Gyro + Accel fusion, the heading drifts with the gyro
+ *
+ * @param[in,out] filter
+ *   Filter state
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s
+ * @param[in] ax, ay, az
+ *   Accel, any unit
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+void ComplementaryAHRSupdateIMUFilter(ComplementaryAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;
+	float recipNorm;
+	float vx, vy, vz;
+
+	// Tilt: cross product between measured and estimated direction of gravity
+	if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+		vx = 2.0f * (q1 * q3 - q0 * q2);
+		vy = 2.0f * (q0 * q1 + q2 * q3);
+		vz = 1.0f - 2.0f * (q1 * q1 + q2 * q2);
+
+		recipNorm = COMPLEMENTARY_KP_ACCEL * filter->gain * invSqrt(ax * ax + ay * ay + az * az);
+		gx += (ay * vz - az * vy) * recipNorm;
+		gy += (az * vx - ax * vz) * recipNorm;
+		gz += (ax * vy - ay * vx) * recipNorm;
+	}
+
+	ComplementaryAHRSintegrate(filter, gx, gy, gz, dt);
+}
+
+//====================================================================================================
+// END OF CODE
+//====================================================================================================
@@ -0,0 +1,38 @@
+/***************************************************************************//**
+ * @file ComplementaryAHRS.h
+ * @brief Sensor fusion, complementary filter
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+#ifndef ComplementaryAHRS_h
+#define ComplementaryAHRS_h
+
+//----------------------------------------------------------------------------------------------------
+// Definitions
+
+#define COMPLEMENTARY_KP_ACCEL		0.2f		/**< Tilt correction gain, 1/s */
+#define COMPLEMENTARY_KP_MAGN		0.2f		/**< Heading correction gain, 1/s */
+#define COMPLEMENTARY_KP_START		20.0f		/**< Gain multiplier right after ComplementaryAHRSinit, converges from any orientation */
+#define COMPLEMENTARY_KP_DECAY		0.99f		/**< Start multiplier decays to 1 per update (~6 s at 51 Hz) */
+
+//----------------------------------------------------------------------------------------------------
+// Filter state
+
+typedef struct
+{
+	float q0, q1, q2, q3;		// quaternion of sensor frame relative to auxiliary frame
+	float gain;					// multiplier of both gains, decays from COMPLEMENTARY_KP_START to 1
+} ComplementaryAHRS_t;
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+void ComplementaryAHRSinit(ComplementaryAHRS_t *filter);
+void ComplementaryAHRSupdateFilter(ComplementaryAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+void ComplementaryAHRSupdateIMUFilter(ComplementaryAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float dt);
+
+#endif
+//=====================================================================================================
+// End of file
+//=====================================================================================================
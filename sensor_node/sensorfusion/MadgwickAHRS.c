@@ -25,14 +25,16 @@
 // Header files
 
 #include "MadgwickAHRS.h"
+#include "MadgwickGain.h"
+#include "MadgwickMagGate.h"
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 //---------------------------------------------------------------------------------------------------
 // Definitions
 
-#define sampleFreq	51.136f		/**< sample frequency in Hz */
 //#define betaDef	0.1f		/**< 2 * proportional gain */
 
 
@@ -41,9 +43,11 @@
 //---------------------------------------------------------------------------------------------------
 // Variable definitions
 
-//volatile float beta = betaDef;								// 2 * proportional gain (Kp)
+volatile float beta = 1.0f;									/**< 2 * proportional gain (Kp), changed at runtime by main */
 volatile float q0 = 1.0f, q1 = 0.0f, q2 = 0.0f, q3 = 0.0f;	/**< quaternion of sensor frame relative to auxiliary frame */
 volatile float yaw =0.0f, pitch=0.0f, roll=0.0f;			/**< Yaw, pith, roll result */
+MadgwickGain_t gainSchedule = { MADGWICK_BETA_MAX, 0 };		/**< Schedule of the global beta, see MadgwickGainReset */
+MadgwickMagGate_t magGate = { 0.0f, 0.0f, 0, MADGWICK_MAG_HOLD, 0 };	/**< Magn gate of the global state, see MadgwickMagGateReset */
 
 //---------------------------------------------------------------------------------------------------
 // Function declarations
@@ -53,6 +57,39 @@ float invSqrt(float x);										/**< Calculate inverse sqrt */
 //====================================================================================================
 // Functions
 
+//---------------------------------------------------------------------------------------------------
+// Filter state
+
+
+/**************************************************************************//**
+ * @brief
+ *   Initialise a Madgwick filter state
+ *
+ * @details
+ *	 Identity quaternion, Euler angles zero. With MADGWICK_ADAPTIVE_BETA the
+ *	 gain schedule starts converging, clear filter->adaptive to keep beta.
+ *	 The magn gate learns a new reference.
+ *
+ * @param[out] filter
+ *   Filter state to initialise
+ * @param[in] gain
+ *   Algorithm gain beta (2 * proportional gain)
+ *
+ *****************************************************************************/
+void MadgwickAHRSinit(MadgwickAHRS_t *filter, float gain) {
+	filter->q0 = 1.0f;
+	filter->q1 = 0.0f;
+	filter->q2 = 0.0f;
+	filter->q3 = 0.0f;
+	filter->beta = gain;
+	filter->roll = 0.0f;
+	filter->pitch = 0.0f;
+	filter->yaw = 0.0f;
+	filter->adaptive = (MADGWICK_ADAPTIVE_BETA == 1);
+	MadgwickGainReset(&filter->schedule);
+	MadgwickMagGateReset(&filter->magGate);
+}
+
 //---------------------------------------------------------------------------------------------------
 // AHRS algorithm update
 
@@ -68,6 +105,8 @@ float invSqrt(float x);										/**< Calculate inverse sqrt */
  * @note
  * 	 Gyro + Accel + Magn fusion
  *
+ * @param[in,out] filter
+ *   Filter state
  * @param[in] gx
  *   Gyro x
  * @param[in] gy
@@ -86,11 +125,20 @@ float invSqrt(float x);										/**< Calculate inverse sqrt */
  *   Magn y
  * @param[in] mz
  *   Magn a
+ * @param[in] dt
+ *   Time since the previous sample in seconds
  *
  *
  *****************************************************************************/
-void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz) {
+void MadgwickAHRSupdateFilter(MadgwickAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;	// local copy of the state, no volatile access in the update
 	float recipNorm;
+#if MADGWICK_ADAPTIVE_BETA == 1
+	float accelNorm, stepOrtho;
+#endif
+#if MADGWICK_MAG_GATE == 1
+	float axRaw = ax, ayRaw = ay, azRaw = az;	// accel for the 6 DoF update of a disturbed sample, it normalises itself
+#endif
 	float s0, s1, s2, s3;
 	float qDot1, qDot2, qDot3, qDot4;
 	float hx, hy;
@@ -98,7 +146,7 @@ void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float
 
 	// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
 	if((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
-		MadgwickAHRSupdateIMU(gx, gy, gz, ax, ay, az);
+		MadgwickAHRSupdateIMUFilter(filter, gx, gy, gz, ax, ay, az, dt);
 		return;
 	}
 
@@ -113,12 +161,22 @@ void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float
 
 		// Normalise accelerometer measurement
 		recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+#if MADGWICK_ADAPTIVE_BETA == 1
+		accelNorm = 1.0f / recipNorm;
+#endif
 		ax *= recipNorm;
 		ay *= recipNorm;
 		az *= recipNorm;   
 
 		// Normalise magnetometer measurement
 		recipNorm = invSqrt(mx * mx + my * my + mz * mz);
+#if MADGWICK_MAG_GATE == 1
+		// Use IMU algorithm if the magnetometer is disturbed, skips the magnetometer terms of the step
+		if(!MadgwickMagGate(&filter->magGate, 1.0f / recipNorm, (2.0f * (q1 * q3 - q0 * q2) * mx + 2.0f * (q0 * q1 + q2 * q3) * my + (q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3) * mz) * recipNorm)) {
+			MadgwickAHRSupdateIMUFilter(filter, gx, gy, gz, axRaw, ayRaw, azRaw, dt);
+			return;
+		}
+#endif
 		mx *= recipNorm;
 		my *= recipNorm;
 		mz *= recipNorm;
@@ -164,18 +222,28 @@ void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float
 		s2 *= recipNorm;
 		s3 *= recipNorm;
 
+#if MADGWICK_ADAPTIVE_BETA == 1
+		// Gain for this update, from the step magnitude before normalisation. Only the part
+		// orthogonal to q is an orientation error, the part along q only corrects |q| != 1.
+		stepOrtho = s0 * q0 + s1 * q1 + s2 * q2 + s3 * q3;
+		stepOrtho = 1.0f - stepOrtho * stepOrtho / (q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+		if(filter->adaptive) {
+			filter->beta = MadgwickGainSchedule(&filter->schedule, sqrtf(gx * gx + gy * gy + gz * gz), accelNorm, sqrtf(stepOrtho > 0.0f ? stepOrtho : 0.0f) / recipNorm);
+		}
+#endif
+
 		// Apply feedback step
-		qDot1 -= beta * s0;
-		qDot2 -= beta * s1;
-		qDot3 -= beta * s2;
-		qDot4 -= beta * s3;
+		qDot1 -= filter->beta * s0;
+		qDot2 -= filter->beta * s1;
+		qDot3 -= filter->beta * s2;
+		qDot4 -= filter->beta * s3;
 	}
 
 	// Integrate rate of change of quaternion to yield quaternion
-	q0 += qDot1 * (1.0f / sampleFreq);
-	q1 += qDot2 * (1.0f / sampleFreq);
-	q2 += qDot3 * (1.0f / sampleFreq);
-	q3 += qDot4 * (1.0f / sampleFreq);
+	q0 += qDot1 * dt;
+	q1 += qDot2 * dt;
+	q2 += qDot3 * dt;
+	q3 += qDot4 * dt;
 
 	// Normalise quaternion
 	recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
@@ -183,6 +251,12 @@ void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float
 	q1 *= recipNorm;
 	q2 *= recipNorm;
 	q3 *= recipNorm;
+
+	// Store state
+	filter->q0 = q0;
+	filter->q1 = q1;
+	filter->q2 = q2;
+	filter->q3 = q3;
 }
 
 //---------------------------------------------------------------------------------------------------
@@ -199,6 +273,8 @@ void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float
  * @note
  * 	 Gyro + Accel fusion
  *
+ * @param[in,out] filter
+ *   Filter state
  * @param[in] gx
  *   Gyro x
  * @param[in] gy
@@ -211,11 +287,17 @@ void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float
  *   Accel y
  * @param[in] az
  *   Accel a
+ * @param[in] dt
+ *   Time since the previous sample in seconds
  *
  *
  *****************************************************************************/
-void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+void MadgwickAHRSupdateIMUFilter(MadgwickAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;	// local copy of the state, no volatile access in the update
 	float recipNorm;
+#if MADGWICK_ADAPTIVE_BETA == 1
+	float accelNorm, stepOrtho;
+#endif
 	float s0, s1, s2, s3;
 	float qDot1, qDot2, qDot3, qDot4;
 	float _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2 ,_8q1, _8q2, q0q0, q1q1, q2q2, q3q3;
@@ -231,6 +313,9 @@ void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, flo
 
 		// Normalise accelerometer measurement
 		recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+#if MADGWICK_ADAPTIVE_BETA == 1
+		accelNorm = 1.0f / recipNorm;
+#endif
 		ax *= recipNorm;
 		ay *= recipNorm;
 		az *= recipNorm;   
@@ -261,18 +346,28 @@ void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, flo
 		s2 *= recipNorm;
 		s3 *= recipNorm;
 
+#if MADGWICK_ADAPTIVE_BETA == 1
+		// Gain for this update, from the step magnitude before normalisation. Only the part
+		// orthogonal to q is an orientation error, the part along q only corrects |q| != 1.
+		stepOrtho = s0 * q0 + s1 * q1 + s2 * q2 + s3 * q3;
+		stepOrtho = 1.0f - stepOrtho * stepOrtho / (q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+		if(filter->adaptive) {
+			filter->beta = MadgwickGainSchedule(&filter->schedule, sqrtf(gx * gx + gy * gy + gz * gz), accelNorm, sqrtf(stepOrtho > 0.0f ? stepOrtho : 0.0f) / recipNorm);
+		}
+#endif
+
 		// Apply feedback step
-		qDot1 -= beta * s0;
-		qDot2 -= beta * s1;
-		qDot3 -= beta * s2;
-		qDot4 -= beta * s3;
+		qDot1 -= filter->beta * s0;
+		qDot2 -= filter->beta * s1;
+		qDot3 -= filter->beta * s2;
+		qDot4 -= filter->beta * s3;
 	}
 
 	// Integrate rate of change of quaternion to yield quaternion
-	q0 += qDot1 * (1.0f / sampleFreq);
-	q1 += qDot2 * (1.0f / sampleFreq);
-	q2 += qDot3 * (1.0f / sampleFreq);
-	q3 += qDot4 * (1.0f / sampleFreq);
+	q0 += qDot1 * dt;
+	q1 += qDot2 * dt;
+	q2 += qDot3 * dt;
+	q3 += qDot4 * dt;
 
 	// Normalise quaternion
 	recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
@@ -280,6 +375,63 @@ void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, flo
 	q1 *= recipNorm;
 	q2 *= recipNorm;
 	q3 *= recipNorm;
+
+	// Store state
+	filter->q0 = q0;
+	filter->q1 = q1;
+	filter->q2 = q2;
+	filter->q3 = q3;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Wrappers around the global filter state (q0..q3, beta)
+
+
+/**************************************************************************//**
+ * @brief
+ *   Madgwick algorithm on the global filter state
+ *
+ * @details
+ *	 9 DoF sensor fusion, see MadgwickAHRSupdateFilter
+ *
+ *****************************************************************************/
+void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt) {
+	MadgwickAHRS_t filter = { .q0 = q0, .q1 = q1, .q2 = q2, .q3 = q3, .beta = beta,
+			.adaptive = (MADGWICK_ADAPTIVE_BETA == 1), .schedule = gainSchedule, .magGate = magGate };
+
+	MadgwickAHRSupdateFilter(&filter, gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+
+	q0 = filter.q0;
+	q1 = filter.q1;
+	q2 = filter.q2;
+	q3 = filter.q3;
+	beta = filter.beta;
+	gainSchedule = filter.schedule;
+	magGate = filter.magGate;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Madgwick algorithm on the global filter state
+ *
+ * @details
+ *	 6 DoF sensor fusion, see MadgwickAHRSupdateIMUFilter
+ *
+ *****************************************************************************/
+void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az, float dt) {
+	MadgwickAHRS_t filter = { .q0 = q0, .q1 = q1, .q2 = q2, .q3 = q3, .beta = beta,
+			.adaptive = (MADGWICK_ADAPTIVE_BETA == 1), .schedule = gainSchedule, .magGate = magGate };
+
+	MadgwickAHRSupdateIMUFilter(&filter, gx, gy, gz, ax, ay, az, dt);
+
+	q0 = filter.q0;
+	q1 = filter.q1;
+	q2 = filter.q2;
+	q3 = filter.q3;
+	beta = filter.beta;
+	gainSchedule = filter.schedule;
+	magGate = filter.magGate;
 }
 
 //---------------------------------------------------------------------------------------------------
@@ -288,10 +440,10 @@ void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, flo
 
 float invSqrt(float x) {
 	float halfx = 0.5f * x;
-	float y = x;
-	long i = *(long*)&y;
-	i = 0x5f3759df - (i>>1);
-	y = *(float*)&i;
+	union { float f; int32_t i; } conv = { x };	// 32 bit reinterpretation, also correct on 64 bit hosts
+	float y;
+	conv.i = 0x5f3759df - (conv.i>>1);
+	y = conv.f;
 	y = y * (1.5f - (halfx * y * y));
 	return y;
 }
@@ -344,37 +496,59 @@ float invSqrt(float x) {
  * 	 Euler angles are less accurate and suffer from Gimbal Lock
  *
  *
+ * @param[in,out] filter
+ *   Filter state, roll, pitch and yaw are updated
  * @param[out] euler_angles
  *   pointer to location of euler angles storage
  *
  *****************************************************************************/
-void QuaternionsToEulerAngles( float *euler_angles )
+void QuaternionsToEulerAnglesFilter( MadgwickAHRS_t *filter, float *euler_angles )
 {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;
 
 	// roll (x-axis rotation)
 	double sinr_cosp = 2 * (q0 * q1 + q2 * q3);
 	double cosr_cosp = 1 - 2 * (q1 * q1 + q2 * q2);
-	roll = atan2(sinr_cosp, cosr_cosp);
+	filter->roll = atan2(sinr_cosp, cosr_cosp);
 
 	// pitch (y-axis rotation)
 	double sinp = 2 * (q0 * q2 - q3 * q1);
-	if (abs(sinp) >= 1)
-		pitch = copysign(M_PI/ 2, sinp); // use 90 degrees if out of range
+	if (fabs(sinp) >= 1)
+		filter->pitch = copysign(M_PI/ 2, sinp); // use 90 degrees if out of range
 	else
-		pitch = asin(sinp);
+		filter->pitch = asin(sinp);
 
 	// yaw (z-axis rotation)
 	double siny_cosp = 2 * (q0 * q3 + q1 * q2);
 	double cosy_cosp = 1 - 2 * (q2 * q2 + q3 * q3);
-	yaw = atan2(siny_cosp, cosy_cosp);
+	filter->yaw = atan2(siny_cosp, cosy_cosp);
 
 /* Pass pointers through to main file */
-	euler_angles[0] = roll;
-	euler_angles[1] = pitch;
-	euler_angles[2] = yaw;
+	euler_angles[0] = filter->roll;
+	euler_angles[1] = filter->pitch;
+	euler_angles[2] = filter->yaw;
 
 }
 
 
+/**************************************************************************//**
+ * @brief
+ *   Convert the global quaternion to euler angles
+ *
+ * @details
+ *	 Also updates the global roll, pitch and yaw
+ *
+ * @param[out] euler_angles
+ *   pointer to location of euler angles storage
+ *
+ *****************************************************************************/
+void QuaternionsToEulerAngles( float *euler_angles )
+{
+	MadgwickAHRS_t filter = { .q0 = q0, .q1 = q1, .q2 = q2, .q3 = q3, .beta = beta };
 
+	QuaternionsToEulerAnglesFilter(&filter, euler_angles);
 
+	roll = filter.roll;
+	pitch = filter.pitch;
+	yaw = filter.yaw;
+}
@@ -21,18 +21,66 @@
 #ifndef MadgwickAHRS_h
 #define MadgwickAHRS_h
 
+#include "MadgwickGain.h"
+#include "MadgwickMagGate.h"
+#include <stdbool.h>
+
+//----------------------------------------------------------------------------------------------------
+// Definitions
+
+/** Public definition to select which sensor fusion kernel to use
+ *    @li `1` - Use the fixed-point kernel (MadgwickAHRSFixed.c) on the raw sensor values.
+ *    @li `0` - Use the floating-point kernel. */
+#define MADGWICK_FIXED_POINT 0
+
+/** Public definition to select how the algorithm gain beta is set
+ *    @li `1` - Every update, from the gyro rate, the accel deviation from 1 g and the gradient step, see MadgwickGainSchedule.
+ *              Converges in 14 to 17 s after a wake-up from a large heading error (fusion_bench gain), not in under a second.
+ *    @li `0` - Global beta, set by the application (CheckIMUidle). */
+#ifndef MADGWICK_ADAPTIVE_BETA
+#define MADGWICK_ADAPTIVE_BETA 0
+#endif
+
+/** Public definition to select which magnetometer samples are fused
+ *    @li `1` - Only samples with the field magnitude and dip of the learned reference, disturbed samples use the 6 DoF update, see MadgwickMagGate.
+ *    @li `0` - Every non-zero sample. */
+#ifndef MADGWICK_MAG_GATE
+#define MADGWICK_MAG_GATE 1
+#endif
+
+//----------------------------------------------------------------------------------------------------
+// Filter state
+
+typedef struct
+{
+	float q0, q1, q2, q3;		// quaternion of sensor frame relative to auxiliary frame
+	float beta;					// algorithm gain
+	float roll, pitch, yaw;		// result of the last QuaternionsToEulerAnglesFilter call
+	bool adaptive;				// beta from MadgwickGainSchedule, false: beta is set by the application
+	MadgwickGain_t schedule;	// state of MadgwickGainSchedule
+	MadgwickMagGate_t magGate;	// state of MadgwickMagGate
+} MadgwickAHRS_t;
+
 //----------------------------------------------------------------------------------------------------
 // Variable declaration
 
 extern volatile float beta;				// algorithm gain
 extern volatile float q0, q1, q2, q3;	// quaternion of sensor frame relative to auxiliary frame
+extern MadgwickGain_t gainSchedule;		// schedule of the global beta, see MADGWICK_ADAPTIVE_BETA
+extern MadgwickMagGate_t magGate;		// magn gate of the global state, see MADGWICK_MAG_GATE
 
 
 //---------------------------------------------------------------------------------------------------
 // Function declarations
 
-void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
-void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az);
+void MadgwickAHRSinit(MadgwickAHRS_t *filter, float gain);
+void MadgwickAHRSupdateFilter(MadgwickAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+void MadgwickAHRSupdateIMUFilter(MadgwickAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float dt);
+void QuaternionsToEulerAnglesFilter( MadgwickAHRS_t *filter, float *euler_angles );
+
+// Same algorithms on the global state q0..q3 and beta
+void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az, float dt);
 
 
 void QuaternionsToEulerAngles( float *euler_angles );
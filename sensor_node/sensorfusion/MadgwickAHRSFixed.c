@@ -0,0 +1,523 @@
+/***************************************************************************//**
+ * @file MadgwickAHRSFixed.c
+ * @brief Sensor fusion, fixed-point implementation
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+
+
+//=====================================================================================================
+// MadgwickAHRSFixed.c
+//=====================================================================================================
+//
+// Fixed-point implementation of Madgwick's IMU and AHRS algorithms.
+// See: http://www.x-io.co.uk/node/8#open_source_ahrs_and_imu_algorithms
+//
+// The EFM32HG has no FPU, every float operation is a soft-float library call.
+// This version only uses 32 bit integer multiplies in the gradient step and
+// a handful of 64 bit multiplies to integrate the quaternion.
+//
+// Number formats:
+//	quaternion state				Q1.30
+//	gradient descent step			Q12 (1.0 = 4096), all terms stay below 128
+//	normalised step direction		Q14
+//	accel / magn					raw int16 register values, normalised to Q12
+//	gyro							raw int16 register values, scaled with MadgwickAHRSsetGyroScaleFixed()
+//	dt								seconds, Q16
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "MadgwickAHRSFixed.h"
+#include "MadgwickAHRS.h"
+#include "MadgwickGain.h"
+#include "MadgwickMagGate.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+//---------------------------------------------------------------------------------------------------
+// Definitions
+
+#define Q12_ONE		4096L						/**< 1.0 in Q12 format */
+#define Q12_HALF	2048L						/**< 0.5 in Q12 format */
+#define QMUL(a, b)	( ( (a) * (b) ) >> 12 )		/**< Multiply two Q12 values */
+
+//---------------------------------------------------------------------------------------------------
+// Variable definitions
+
+int32_t q0Fixed = Q30_ONE, q1Fixed = 0, q2Fixed = 0, q3Fixed = 0;	/**< quaternion of sensor frame relative to auxiliary frame (Q1.30) */
+MadgwickGain_t gainScheduleFixed = { MADGWICK_BETA_MAX, 0 };		/**< Schedule of beta, see MadgwickGainReset */
+MadgwickMagGate_t magGateFixed = { 0.0f, 0.0f, 0, MADGWICK_MAG_HOLD, 0 };	/**< Magn gate, see MadgwickMagGateReset */
+
+static int64_t gyroRate = 0;				/**< 0.5 * gyro resolution [rad/s per LSB], in Q0.32 */
+static int64_t betaRate = 0;				/**< beta, in Q0.32 */
+static float betaCached = -1.0f;			/**< beta value betaRate was calculated for */
+#if MADGWICK_ADAPTIVE_BETA == 1
+static float gyroResolution = 0.0f;			/**< gyro resolution [rad/s per LSB], input of MadgwickGainSchedule */
+static float accelResolution = 0.0f;		/**< accel resolution [g per LSB], input of MadgwickGainSchedule */
+#endif
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+static uint32_t isqrt(uint32_t x);
+static uint32_t normaliseQ12(int32_t *v);
+static void integrateFixed(int32_t gx, int32_t gy, int32_t gz, int32_t *s, uint32_t accelNorm, uint32_t dt);
+
+//====================================================================================================
+// Functions
+
+
+/**************************************************************************//**
+ * @brief
+ *   Set gyroscope resolution used by the fixed-point filter
+ *
+ * @details
+ *	 Must be called again when the gyro full scale range changes
+ *
+ * @param[in] gyroRes
+ *   gyro resolution in rad/s per LSB
+ *
+ *****************************************************************************/
+void MadgwickAHRSsetGyroScaleFixed(float gyroRes)
+{
+	gyroRate = (int64_t) (0.5f * gyroRes * 4294967296.0f);
+#if MADGWICK_ADAPTIVE_BETA == 1
+	gyroResolution = gyroRes;
+#endif
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Set accelerometer resolution used by the gain scheduling
+ *
+ * @details
+ *	 Must be called again when the accel full scale range changes,
+ *	 only used with MADGWICK_ADAPTIVE_BETA
+ *
+ * @param[in] accelRes
+ *   accel resolution in g per LSB
+ *
+ *****************************************************************************/
+void MadgwickAHRSsetAccelScaleFixed(float accelRes)
+{
+#if MADGWICK_ADAPTIVE_BETA == 1
+	accelResolution = accelRes;
+#else
+	(void) accelRes;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+
+
+/**************************************************************************//**
+ * @brief
+ *   Madgwick algorithm, fixed-point
+ *
+ * @details
+ *	 9 DoF sensor fusion
+ *
+ * @note
+ * 	 Gyro + Accel + Magn fusion, inputs are raw register values
+ *
+ * @param[in] gx
+ *   Gyro x
+ * @param[in] gy
+ *   Gyro y
+ * @param[in] gz
+ *   Gyro a
+ * @param[in] ax
+ *   Accel x
+ * @param[in] ay
+ *   Accel y
+ * @param[in] az
+ *   Accel a
+ * @param[in] mx
+ *   Magn x
+ * @param[in] my
+ *   Magn y
+ * @param[in] mz
+ *   Magn a
+ * @param[in] dt
+ *   Time since the previous sample in seconds, Q16
+ *
+ *
+ *****************************************************************************/
+void MadgwickAHRSupdateFixed(int16_t gx, int16_t gy, int16_t gz, int16_t ax, int16_t ay, int16_t az, int16_t mx, int16_t my, int16_t mz, uint32_t dt)
+{
+	int32_t a[3], m[3], s[4];
+	uint32_t accelNorm;
+#if MADGWICK_MAG_GATE == 1
+	uint32_t magNorm;
+#endif
+	int32_t q0, q1, q2, q3;
+	int32_t f1, f2, f3, f4, f5, f6;
+	int32_t hx, hy, _2bx, _2bz;
+	int32_t _2bxq0, _2bxq1, _2bxq2, _2bxq3, _2bzq0, _2bzq1, _2bzq2, _2bzq3;
+	int32_t q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+
+	// Use IMU algorithm if magnetometer measurement invalid (avoids division by zero in magnetometer normalisation)
+	if((mx == 0) && (my == 0) && (mz == 0)) {
+		MadgwickAHRSupdateIMUFixed(gx, gy, gz, ax, ay, az, dt);
+		return;
+	}
+
+	// Compute feedback only if accelerometer measurement valid
+	a[0] = ax; a[1] = ay; a[2] = az;
+	accelNorm = normaliseQ12(a);
+	if(accelNorm == 0) {
+		integrateFixed(gx, gy, gz, 0, 0, dt);
+		return;
+	}
+
+	// Normalise magnetometer measurement
+	m[0] = mx; m[1] = my; m[2] = mz;
+#if MADGWICK_MAG_GATE == 1
+	magNorm = normaliseQ12(m);
+#else
+	normaliseQ12(m);
+#endif
+
+	// Quaternion in Q12
+	q0 = q0Fixed >> 18;
+	q1 = q1Fixed >> 18;
+	q2 = q2Fixed >> 18;
+	q3 = q3Fixed >> 18;
+
+	// Auxiliary variables to avoid repeated arithmetic
+	q0q0 = QMUL(q0, q0);
+	q0q1 = QMUL(q0, q1);
+	q0q2 = QMUL(q0, q2);
+	q0q3 = QMUL(q0, q3);
+	q1q1 = QMUL(q1, q1);
+	q1q2 = QMUL(q1, q2);
+	q1q3 = QMUL(q1, q3);
+	q2q2 = QMUL(q2, q2);
+	q2q3 = QMUL(q2, q3);
+	q3q3 = QMUL(q3, q3);
+
+#if MADGWICK_MAG_GATE == 1
+	// Use IMU algorithm if the magnetometer is disturbed, skips the magnetometer terms of the step
+	if(!MadgwickMagGate(&magGateFixed, (float) magNorm, ldexpf( (float) (2 * (q1q3 - q0q2) * m[0] + 2 * (q0q1 + q2q3) * m[1] + (q0q0 - q1q1 - q2q2 + q3q3) * m[2]), -24 ) )) {
+		MadgwickAHRSupdateIMUFixed(gx, gy, gz, ax, ay, az, dt);
+		return;
+	}
+#endif
+
+	// Reference direction of Earth's magnetic field
+	hx = QMUL(m[0], q0q0 + q1q1 - q2q2 - q3q3) + 2 * QMUL(m[1], q1q2 - q0q3) + 2 * QMUL(m[2], q0q2 + q1q3);
+	hy = 2 * QMUL(m[0], q0q3 + q1q2) + QMUL(m[1], q0q0 - q1q1 + q2q2 - q3q3) + 2 * QMUL(m[2], q2q3 - q0q1);
+	_2bx = isqrt( (uint32_t) (hx * hx + hy * hy) );
+	_2bz = 2 * QMUL(m[0], q1q3 - q0q2) + 2 * QMUL(m[1], q0q1 + q2q3) + QMUL(m[2], q0q0 - q1q1 - q2q2 + q3q3);
+
+	_2bxq0 = QMUL(_2bx, q0);
+	_2bxq1 = QMUL(_2bx, q1);
+	_2bxq2 = QMUL(_2bx, q2);
+	_2bxq3 = QMUL(_2bx, q3);
+	_2bzq0 = QMUL(_2bz, q0);
+	_2bzq1 = QMUL(_2bz, q1);
+	_2bzq2 = QMUL(_2bz, q2);
+	_2bzq3 = QMUL(_2bz, q3);
+
+	// Objective function: estimated minus measured direction of gravity and magnetic field
+	f1 = 2 * (q1q3 - q0q2) - a[0];
+	f2 = 2 * (q0q1 + q2q3) - a[1];
+	f3 = Q12_ONE - 2 * (q1q1 + q2q2) - a[2];
+	f4 = QMUL(_2bx, Q12_HALF - q2q2 - q3q3) + QMUL(_2bz, q1q3 - q0q2) - m[0];
+	f5 = QMUL(_2bx, q1q2 - q0q3) + QMUL(_2bz, q0q1 + q2q3) - m[1];
+	f6 = QMUL(_2bx, q0q2 + q1q3) + QMUL(_2bz, Q12_HALF - q1q1 - q2q2) - m[2];
+
+	// Gradient decent algorithm corrective step (Jacobian transposed times objective function)
+	s[0] = QMUL(-2 * q2, f1) + QMUL(2 * q1, f2) - QMUL(_2bzq2, f4) + QMUL(_2bzq1 - _2bxq3, f5) + QMUL(_2bxq2, f6);
+	s[1] = QMUL(2 * q3, f1) + QMUL(2 * q0, f2) - QMUL(4 * q1, f3) + QMUL(_2bzq3, f4) + QMUL(_2bxq2 + _2bzq0, f5) + QMUL(_2bxq3 - 2 * _2bzq1, f6);
+	s[2] = QMUL(-2 * q0, f1) + QMUL(2 * q3, f2) - QMUL(4 * q2, f3) + QMUL(-2 * _2bxq2 - _2bzq0, f4) + QMUL(_2bxq1 + _2bzq3, f5) + QMUL(_2bxq0 - 2 * _2bzq2, f6);
+	s[3] = QMUL(2 * q1, f1) + QMUL(2 * q2, f2) + QMUL(_2bzq1 - 2 * _2bxq3, f4) + QMUL(_2bzq2 - _2bxq0, f5) + QMUL(_2bxq1, f6);
+
+	integrateFixed(gx, gy, gz, s, accelNorm, dt);
+}
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+
+
+/**************************************************************************//**
+ * @brief
+ *   Madgwick algorithm, fixed-point
+ *
+ * @details
+ *	 6 DoF sensor fusion
+ *
+ * @note
+ * 	 Gyro + Accel fusion, inputs are raw register values
+ *
+ * @param[in] gx
+ *   Gyro x
+ * @param[in] gy
+ *   Gyro y
+ * @param[in] gz
+ *   Gyro a
+ * @param[in] ax
+ *   Accel x
+ * @param[in] ay
+ *   Accel y
+ * @param[in] az
+ *   Accel a
+ * @param[in] dt
+ *   Time since the previous sample in seconds, Q16
+ *
+ *
+ *****************************************************************************/
+void MadgwickAHRSupdateIMUFixed(int16_t gx, int16_t gy, int16_t gz, int16_t ax, int16_t ay, int16_t az, uint32_t dt)
+{
+	int32_t a[3], s[4];
+	uint32_t accelNorm;
+	int32_t q0, q1, q2, q3;
+	int32_t f1, f2, f3;
+
+	// Compute feedback only if accelerometer measurement valid
+	a[0] = ax; a[1] = ay; a[2] = az;
+	accelNorm = normaliseQ12(a);
+	if(accelNorm == 0) {
+		integrateFixed(gx, gy, gz, 0, 0, dt);
+		return;
+	}
+
+	// Quaternion in Q12
+	q0 = q0Fixed >> 18;
+	q1 = q1Fixed >> 18;
+	q2 = q2Fixed >> 18;
+	q3 = q3Fixed >> 18;
+
+	// Objective function: estimated minus measured direction of gravity
+	f1 = 2 * (QMUL(q1, q3) - QMUL(q0, q2)) - a[0];
+	f2 = 2 * (QMUL(q0, q1) + QMUL(q2, q3)) - a[1];
+	f3 = Q12_ONE - 2 * (QMUL(q1, q1) + QMUL(q2, q2)) - a[2];
+
+	// Gradient decent algorithm corrective step (Jacobian transposed times objective function)
+	s[0] = QMUL(-2 * q2, f1) + QMUL(2 * q1, f2);
+	s[1] = QMUL(2 * q3, f1) + QMUL(2 * q0, f2) - QMUL(4 * q1, f3);
+	s[2] = QMUL(-2 * q0, f1) + QMUL(2 * q3, f2) - QMUL(4 * q2, f3);
+	s[3] = QMUL(2 * q1, f1) + QMUL(2 * q2, f2);
+
+	integrateFixed(gx, gy, gz, s, accelNorm, dt);
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Integrate rate of change of quaternion, apply feedback and normalise
+ *
+ * @param[in] gx
+ *   Gyro x
+ * @param[in] gy
+ *   Gyro y
+ * @param[in] gz
+ *   Gyro z
+ * @param[in] s
+ *   Gradient decent step in Q12, 0 if no feedback is applied
+ *
+ * @param[in] accelNorm
+ *   Norm of the raw accel values, input of the gain scheduling
+ *
+ * @param[in] dt
+ *   Time step in seconds, Q16
+ *
+ *****************************************************************************/
+static void integrateFixed(int32_t gx, int32_t gy, int32_t gz, int32_t *s, uint32_t accelNorm, uint32_t dt)
+{
+	int32_t q0, q1, q2, q3;
+	int32_t d0, d1, d2, d3;
+	int32_t gyroGain;
+	int64_t betaGain;
+	int32_t maxS;
+	int8_t shift = 0;
+	uint32_t norm, recipNorm;
+#if MADGWICK_ADAPTIVE_BETA == 1
+	int32_t stepAlongQ;
+	int64_t ortho;
+#endif
+	uint8_t i;
+
+	// Quaternion in Q14, keeps the products with the gyro values inside 32 bit
+	q0 = q0Fixed >> 16;
+	q1 = q1Fixed >> 16;
+	q2 = q2Fixed >> 16;
+	q3 = q3Fixed >> 16;
+
+	// Gyro gain for this time step, Q0.32
+	gyroGain = (int32_t) ( ( gyroRate * dt ) >> 16 );
+
+	// Rate of change of quaternion from gyroscope
+	d0 = -q1 * gx - q2 * gy - q3 * gz;
+	d1 = q0 * gx + q2 * gz - q3 * gy;
+	d2 = q0 * gy - q1 * gz + q3 * gx;
+	d3 = q0 * gz + q1 * gy - q2 * gx;
+
+	q0Fixed += (int32_t) ( ( (int64_t) d0 * gyroGain ) >> 16 );
+	q1Fixed += (int32_t) ( ( (int64_t) d1 * gyroGain ) >> 16 );
+	q2Fixed += (int32_t) ( ( (int64_t) d2 * gyroGain ) >> 16 );
+	q3Fixed += (int32_t) ( ( (int64_t) d3 * gyroGain ) >> 16 );
+
+	if(s != 0) {
+		// Scale step in range [2^13, 2^14[ so the sum of squares fits in 32 bit
+		maxS = 0;
+		for(i = 0; i < 4; i++) {
+			if(s[i] > maxS) maxS = s[i];
+			if(-s[i] > maxS) maxS = -s[i];
+		}
+
+		if(maxS != 0) {
+			while(maxS >= (1L << 14)) {
+				maxS >>= 1;
+				shift++;
+				for(i = 0; i < 4; i++) s[i] >>= 1;
+			}
+			while(maxS < (1L << 13)) {
+				maxS <<= 1;
+				shift--;
+				for(i = 0; i < 4; i++) s[i] *= 2;
+			}
+
+			// Normalise step magnitude (Q14)
+			norm = isqrt( (uint32_t) (s[0] * s[0] + s[1] * s[1] + s[2] * s[2] + s[3] * s[3]) );
+			recipNorm = (1UL << 28) / norm;
+
+#if MADGWICK_ADAPTIVE_BETA == 1
+			// Gain for this update, step magnitude is ortho * 2^shift in Q12. Only the part
+			// orthogonal to q is an orientation error, the part along q only corrects |q| != 1.
+			stepAlongQ = s[0] * q0 + s[1] * q1 + s[2] * q2 + s[3] * q3;
+			ortho = (int64_t) norm * norm - (int64_t) stepAlongQ * stepAlongQ / ( q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3 );
+			beta = MadgwickGainSchedule(&gainScheduleFixed, isqrt( (uint32_t) (gx * gx) + (uint32_t) (gy * gy) + (uint32_t) (gz * gz) ) * gyroResolution,
+					accelNorm * accelResolution, ldexpf( (float) isqrt( ortho > 0 ? (uint32_t) ortho : 0 ), shift - 12 ));
+#else
+			(void) accelNorm;
+			(void) shift;
+#endif
+			// Refresh beta rate when beta changed
+			if(beta != betaCached) {
+				betaCached = beta;
+				betaRate = (int64_t) (betaCached * 4294967296.0f);
+			}
+			betaGain = ( betaRate * dt ) >> 16;
+
+			// Apply feedback step
+			q0Fixed -= (int32_t) ( ( (int64_t) ( (s[0] * (int32_t) recipNorm) >> 14 ) * betaGain ) >> 16 );
+			q1Fixed -= (int32_t) ( ( (int64_t) ( (s[1] * (int32_t) recipNorm) >> 14 ) * betaGain ) >> 16 );
+			q2Fixed -= (int32_t) ( ( (int64_t) ( (s[2] * (int32_t) recipNorm) >> 14 ) * betaGain ) >> 16 );
+			q3Fixed -= (int32_t) ( ( (int64_t) ( (s[3] * (int32_t) recipNorm) >> 14 ) * betaGain ) >> 16 );
+		}
+	}
+
+	// Normalise quaternion, norm in Q15
+	q0 = (q0Fixed + (1L << 14)) >> 15;
+	q1 = (q1Fixed + (1L << 14)) >> 15;
+	q2 = (q2Fixed + (1L << 14)) >> 15;
+	q3 = (q3Fixed + (1L << 14)) >> 15;
+	norm = isqrt( (uint32_t) (q0 * q0) + (uint32_t) (q1 * q1) + (uint32_t) (q2 * q2) + (uint32_t) (q3 * q3) );
+	recipNorm = (1UL << 30) / norm;
+
+	q0Fixed = (int32_t) ( ( (int64_t) q0Fixed * recipNorm ) >> 15 );
+	q1Fixed = (int32_t) ( ( (int64_t) q1Fixed * recipNorm ) >> 15 );
+	q2Fixed = (int32_t) ( ( (int64_t) q2Fixed * recipNorm ) >> 15 );
+	q3Fixed = (int32_t) ( ( (int64_t) q3Fixed * recipNorm ) >> 15 );
+}
+
+//---------------------------------------------------------------------------------------------------
+// Vector normalisation
+
+/**************************************************************************//**
+ * @brief
+ *   Normalise a 3D vector of raw register values to Q12
+ *
+ * @param[in/out] v
+ *   3 values, at most 16 bit each
+ *
+ * @return
+ * 	norm of the input vector, 0 if the vector is zero
+ *
+ *****************************************************************************/
+static uint32_t normaliseQ12(int32_t *v)
+{
+	uint32_t norm, recipNorm;
+
+	norm = isqrt( (uint32_t) (v[0] * v[0]) + (uint32_t) (v[1] * v[1]) + (uint32_t) (v[2] * v[2]) );
+	if(norm == 0) {
+		return 0;
+	}
+
+	// |v[i]| <= norm, so v[i] * recipNorm never exceeds 2^28
+	recipNorm = (1UL << 28) / norm;
+	v[0] = (v[0] * (int32_t) recipNorm) >> 16;
+	v[1] = (v[1] * (int32_t) recipNorm) >> 16;
+	v[2] = (v[2] * (int32_t) recipNorm) >> 16;
+
+	return norm;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Integer square-root
+
+/**************************************************************************//**
+ * @brief
+ *   Integer square root, bit by bit
+ *
+ * @param[in] x
+ *   input
+ *
+ * @return
+ * 	floor(sqrt(x))
+ *
+ *****************************************************************************/
+static uint32_t isqrt(uint32_t x)
+{
+	uint32_t res = 0;
+	uint32_t bit = 1UL << 30;
+
+	while(bit > x) {
+		bit >>= 2;
+	}
+
+	while(bit != 0) {
+		if(x >= res + bit) {
+			x -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return res;
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Convert fixed-point quaternions to euler angles
+ *
+ * @details
+ *	 Copies the Q1.30 state to the float quaternion and reuses QuaternionsToEulerAngles()
+ *
+ * @param[out] euler_angles
+ *   pointer to location of euler angles storage
+ *
+ *****************************************************************************/
+void QuaternionsToEulerAnglesFixed( float *euler_angles )
+{
+	q0 = (float) q0Fixed * (1.0f / Q30_ONE);
+	q1 = (float) q1Fixed * (1.0f / Q30_ONE);
+	q2 = (float) q2Fixed * (1.0f / Q30_ONE);
+	q3 = (float) q3Fixed * (1.0f / Q30_ONE);
+
+	QuaternionsToEulerAngles(euler_angles);
+}
+
+//====================================================================================================
+// END OF CODE
+//====================================================================================================
@@ -0,0 +1,52 @@
+/***************************************************************************//**
+ * @file MadgwickAHRSFixed.h
+ * @brief Sensor fusion, fixed-point implementation
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+
+//=====================================================================================================
+// MadgwickAHRSFixed.h
+//=====================================================================================================
+//
+// Fixed-point implementation of Madgwick's IMU and AHRS algorithms for cores without FPU.
+// Quaternion state is kept in Q1.30, sensor inputs are the raw int16 register values.
+//
+//=====================================================================================================
+#ifndef MadgwickAHRSFixed_h
+#define MadgwickAHRSFixed_h
+
+#include "MadgwickGain.h"
+#include "MadgwickMagGate.h"
+#include <stdint.h>
+
+//----------------------------------------------------------------------------------------------------
+// Definitions
+
+#define Q30_ONE		(1L << 30)		/**< 1.0 in Q1.30 format */
+#define Q16_ONE		(1UL << 16)		/**< 1.0 in Q16 format, unit of the dt parameter */
+
+//----------------------------------------------------------------------------------------------------
+// Variable declaration
+
+extern int32_t q0Fixed, q1Fixed, q2Fixed, q3Fixed;	// quaternion of sensor frame relative to auxiliary frame (Q1.30)
+extern MadgwickGain_t gainScheduleFixed;			// schedule of beta, see MADGWICK_ADAPTIVE_BETA
+extern MadgwickMagGate_t magGateFixed;				// magn gate, see MADGWICK_MAG_GATE
+
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+void MadgwickAHRSsetGyroScaleFixed(float gyroRes);
+void MadgwickAHRSsetAccelScaleFixed(float accelRes);
+void MadgwickAHRSupdateFixed(int16_t gx, int16_t gy, int16_t gz, int16_t ax, int16_t ay, int16_t az, int16_t mx, int16_t my, int16_t mz, uint32_t dt);
+void MadgwickAHRSupdateIMUFixed(int16_t gx, int16_t gy, int16_t gz, int16_t ax, int16_t ay, int16_t az, uint32_t dt);
+
+
+void QuaternionsToEulerAnglesFixed( float *euler_angles );
+
+#endif
+//=====================================================================================================
+// End of file
+//=====================================================================================================
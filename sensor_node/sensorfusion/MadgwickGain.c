@@ -0,0 +1,121 @@
+/***************************************************************************//**
+ * @file MadgwickGain.c
+ * @brief Sensor fusion, gain scheduling of beta
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+
+
+//=====================================================================================================
+// MadgwickGain.c
+//=====================================================================================================
+//
+// A fixed beta is a compromise: large for a fast convergence, small for a low noise.
+// After start-up or wake-up beta starts at MADGWICK_BETA_MAX and decays every update to
+// MADGWICK_BETA_MIN.
+// A step norm above MADGWICK_STEP_HIGH for MADGWICK_STEP_HOLD updates (orientation lost)
+// starts the convergence again, the hold time keeps short linear accelerations out.
+// A step norm alone does not set beta: the heading gradient of the magn is weak, a
+// large heading error has the step norm of a small tilt disturbance.
+// The gain is scaled down when the accel does not only measure gravity: |accel| away
+// from 1 g (linear acceleration) or a fast rotation (centripetal acceleration).
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "MadgwickGain.h"
+#include <math.h>
+#include <stdint.h>
+
+//====================================================================================================
+// Functions
+
+
+/**************************************************************************//**
+ * @brief
+ *   Limit a value to [0, 1]
+ *
+ *****************************************************************************/
+static float clamp01(float x)
+{
+	if(x < 0.0f) return 0.0f;
+	if(x > 1.0f) return 1.0f;
+	return x;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Converge again from the next update on
+ *
+ * @details
+ *	 Call after start-up and wake-up, the orientation may have changed
+ *	 while the sensor fusion was not running.
+ *
+ * @param[out] gain
+ *   Schedule state of the filter
+ *
+ *****************************************************************************/
+void MadgwickGainReset(MadgwickGain_t *gain)
+{
+	gain->betaConverge = MADGWICK_BETA_MAX;
+	gain->stepHighCount = 0;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Algorithm gain beta for one update
+ *
+ * @details
+ *	 beta = betaConverge * trust
+ *	 betaConverge decays from MADGWICK_BETA_MAX to MADGWICK_BETA_MIN,
+ *	 trust is the product of the accel and gyro factors, both fall linearly to 0
+ *	 at MADGWICK_ACCEL_DEV_MAX and MADGWICK_GYRO_FAST.
+ *
+ * @param[in,out] gain
+ *   Schedule state of the filter
+ * @param[in] gyroNorm
+ *   Angular rate in rad/s
+ * @param[in] accelNorm
+ *   Acceleration in g
+ * @param[in] stepNorm
+ *   Norm of the gradient descent step orthogonal to q, before normalisation
+ *
+ * @return
+ * 	beta
+ *
+ *****************************************************************************/
+float MadgwickGainSchedule(MadgwickGain_t *gain, float gyroNorm, float accelNorm, float stepNorm)
+{
+	float trust = clamp01( 1.0f - fabsf(accelNorm - 1.0f) * (1.0f / MADGWICK_ACCEL_DEV_MAX) ) *
+				  clamp01( 1.0f - gyroNorm * (1.0f / MADGWICK_GYRO_FAST) );
+
+	if(gain->betaConverge > MADGWICK_BETA_MIN)
+	{
+		/* Converging */
+		gain->betaConverge *= MADGWICK_BETA_DECAY;
+		if(gain->betaConverge < MADGWICK_BETA_MIN)
+		{
+			gain->betaConverge = MADGWICK_BETA_MIN;
+		}
+	}else if(stepNorm > MADGWICK_STEP_HIGH)
+	{
+		/* Orientation lost when the step stays large */
+		if(++gain->stepHighCount >= MADGWICK_STEP_HOLD)
+		{
+			MadgwickGainReset(gain);
+		}
+	}else{
+		gain->stepHighCount = 0;
+	}
+
+	return gain->betaConverge * trust;
+}
+
+//====================================================================================================
+// END OF CODE
+//====================================================================================================
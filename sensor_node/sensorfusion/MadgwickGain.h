@@ -0,0 +1,42 @@
+/***************************************************************************//**
+ * @file MadgwickGain.h
+ * @brief Sensor fusion, gain scheduling of beta
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+#ifndef MadgwickGain_h
+#define MadgwickGain_h
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------------------------------------
+// Definitions
+
+#define MADGWICK_BETA_MIN		0.02f		/**< Converged, low noise during slow movements */
+#define MADGWICK_BETA_MAX		5.0f		/**< Start of the convergence, after start-up or wake-up */
+#define MADGWICK_BETA_DECAY		0.995f		/**< Convergence beta factor per update (MAX to MIN in ~20 s at 51 Hz) */
+#define MADGWICK_STEP_HIGH		0.3f		/**< Gradient step norm from which the orientation is lost (~10 deg tilt) */
+#define MADGWICK_STEP_HOLD		25			/**< Updates above MADGWICK_STEP_HIGH before converging again (0.5 s at 51 Hz) */
+#define MADGWICK_ACCEL_DEV_MAX	0.2f		/**< g, deviation of |accel| from 1 g from which the accel is not trusted */
+#define MADGWICK_GYRO_FAST		3.5f		/**< rad/s (200 dps), rate from which the accel is not trusted */
+
+//----------------------------------------------------------------------------------------------------
+// Schedule state, one per filter
+
+typedef struct
+{
+	float betaConverge;			// beta before the trust factors, decays to MADGWICK_BETA_MIN
+	uint8_t stepHighCount;		// consecutive updates with the step norm above MADGWICK_STEP_HIGH
+} MadgwickGain_t;
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+void MadgwickGainReset(MadgwickGain_t *gain);
+float MadgwickGainSchedule(MadgwickGain_t *gain, float gyroNorm, float accelNorm, float stepNorm);
+
+#endif
+//=====================================================================================================
+// End of file
+//=====================================================================================================
@@ -0,0 +1,121 @@
+/***************************************************************************//**
+ * @file MadgwickMagGate.c
+ * @brief Sensor fusion, magnetic disturbance rejection
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+
+
+//=====================================================================================================
+// MadgwickMagGate.c
+//=====================================================================================================
+//
+// Near therapy equipment and metal furniture the magn measures more than the earth field,
+// the heading of the 9 DoF update follows the disturbance. A disturbance changes the field
+// magnitude or the angle between the field and gravity (dip), the undisturbed earth field
+// has a constant magnitude and dip wherever the node is pointed.
+// Both are compared to a reference learned from the first MADGWICK_MAG_LEARN samples, a
+// disturbed sample is fused with the 6 DoF update. The dip uses the gravity direction of
+// the filter, the accel itself tilts with every linear acceleration of the arm.
+// The reference follows the accepted samples slowly and is learned again when the field
+// stays different for MADGWICK_MAG_REJECT_MAX samples, the node is then in another place.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "MadgwickMagGate.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//====================================================================================================
+// Functions
+
+
+/**************************************************************************//**
+ * @brief
+ *   Learn a new reference from the next samples on
+ *
+ * @details
+ *	 Call after a new magn calibration, the field magnitude changed.
+ *
+ * @param[out] gate
+ *   Gate state of the filter
+ *
+ *****************************************************************************/
+void MadgwickMagGateReset(MadgwickMagGate_t *gate)
+{
+	gate->learnCount = 0;
+	gate->holdCount = MADGWICK_MAG_HOLD;
+	gate->rejectCount = 0;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Check if a magn sample only measures the earth field
+ *
+ * @details
+ *	 Disturbed when |magn| deviates more than MADGWICK_MAG_FIELD_TOL from the
+ *	 reference or cos(gravity, magn) more than MADGWICK_MAG_DIP_TOL. After a
+ *	 disturbance the magn is used again after MADGWICK_MAG_HOLD undisturbed
+ *	 samples, the edge of a disturbance stays below the tolerances.
+ *
+ * @param[in,out] gate
+ *   Gate state of the filter
+ * @param[in] magNorm
+ *   |magn|, any unit as long as it does not change
+ * @param[in] dipCos
+ *   Dot product of the normalised magn and the gravity direction of the filter,
+ *   unlike the accel it does not follow linear accelerations
+ *
+ * @return
+ * 	'true' if the sample can be used for the heading
+ *
+ *****************************************************************************/
+bool MadgwickMagGate(MadgwickMagGate_t *gate, float magNorm, float dipCos)
+{
+	float rate;
+
+	if(gate->learnCount < MADGWICK_MAG_LEARN)
+	{
+		/* Fast moving mean, forgets the samples before the tilt of the filter converged */
+		rate = (gate->learnCount == 0) ? 1.0f : MADGWICK_MAG_LEARN_RATE;
+		gate->learnCount++;
+		gate->fieldRef += (magNorm - gate->fieldRef) * rate;
+		gate->dipRef += (dipCos - gate->dipRef) * rate;
+		return true;
+	}
+
+	if( (fabsf(magNorm - gate->fieldRef) > MADGWICK_MAG_FIELD_TOL * gate->fieldRef) ||
+		(fabsf(dipCos - gate->dipRef) > MADGWICK_MAG_DIP_TOL) )
+	{
+		gate->holdCount = 0;
+		if(++gate->rejectCount >= MADGWICK_MAG_REJECT_MAX)
+		{
+			/* Not a disturbance, the field is different here */
+			MadgwickMagGateReset(gate);
+		}
+		return false;
+	}
+
+	gate->rejectCount = 0;
+	if(gate->holdCount < MADGWICK_MAG_HOLD)
+	{
+		gate->holdCount++;
+		return false;
+	}
+
+	/* Follow slow changes, e.g. temperature */
+	gate->fieldRef += (magNorm - gate->fieldRef) * MADGWICK_MAG_REF_RATE;
+	gate->dipRef += (dipCos - gate->dipRef) * MADGWICK_MAG_REF_RATE;
+
+	return true;
+}
+
+//====================================================================================================
+// END OF CODE
+//====================================================================================================
@@ -0,0 +1,46 @@
+/***************************************************************************//**
+ * @file MadgwickMagGate.h
+ * @brief Sensor fusion, magnetic disturbance rejection
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+#ifndef MadgwickMagGate_h
+#define MadgwickMagGate_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//----------------------------------------------------------------------------------------------------
+// Definitions
+
+#define MADGWICK_MAG_FIELD_TOL		0.1f		/**< Relative deviation of |magn| from the reference from which the sample is disturbed */
+#define MADGWICK_MAG_DIP_TOL		0.05f		/**< Deviation of cos(gravity, magn) from the reference from which the sample is disturbed (~7 deg at 66 deg dip) */
+#define MADGWICK_MAG_REF_RATE		0.005f		/**< Reference follows the accepted samples over ~1/rate samples (4 s at 51 Hz) */
+#define MADGWICK_MAG_LEARN			100			/**< Samples averaged into a new reference, all accepted (2 s at 51 Hz) */
+#define MADGWICK_MAG_LEARN_RATE		0.0625f		/**< Moving mean rate while learning, over ~16 samples */
+#define MADGWICK_MAG_HOLD			25			/**< Undisturbed samples after a disturbance before the magn is used again (0.5 s at 51 Hz) */
+#define MADGWICK_MAG_REJECT_MAX		500			/**< Disturbed samples in a row after which the reference is learned again (10 s at 51 Hz) */
+
+//----------------------------------------------------------------------------------------------------
+// Gate state, one per filter
+
+typedef struct
+{
+	float fieldRef;				// |magn| of the undisturbed field, in the unit of the caller
+	float dipRef;				// cos(gravity, magn) of the undisturbed field
+	uint8_t learnCount;			// samples in the reference, learning below MADGWICK_MAG_LEARN
+	uint8_t holdCount;			// undisturbed samples since the last disturbance
+	uint16_t rejectCount;		// disturbed samples in a row
+} MadgwickMagGate_t;
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+void MadgwickMagGateReset(MadgwickMagGate_t *gate);
+bool MadgwickMagGate(MadgwickMagGate_t *gate, float magNorm, float dipCos);
+
+#endif
+//=====================================================================================================
+// End of file
+//=====================================================================================================
@@ -0,0 +1,279 @@
+/***************************************************************************//**
+ * @file MahonyAHRS.c
+ * @brief Sensor fusion, Mahony filter
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+
+
+//=====================================================================================================
+// MahonyAHRS.c
+//=====================================================================================================
+//
+// Madgwick's implementation of Mahony's AHRS algorithm.
+// See: http://www.x-io.co.uk/node/8#open_source_ahrs_and_imu_algorithms
+//
+// Date			Author			Notes
+// 29/09/2011	SOH Madgwick    Initial release
+// 02/10/2011	SOH Madgwick	Optimised for reduced CPU load
+//
+// The error between the measured and the estimated gravity and field directions is fed back
+// into the gyro rate with a PI controller, no gradient and no second normalisation of a step.
+// The proportional gain starts high and decays, like the Madgwick gain schedule after a
+// restart, the integral only runs at the steady gain.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "MahonyAHRS.h"
+#include <math.h>
+#include <stdint.h>
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+float invSqrt(float x);										/**< Calculate inverse sqrt, MadgwickAHRS.c */
+
+//====================================================================================================
+// Functions
+
+
+/**************************************************************************//**
+ * @brief
+ *   Initialise a Mahony filter state
+ *
+ * @details
+ *	 Identity quaternion, no integral error, start gain MAHONY_TWO_KP_START
+ *
+ * @param[out] filter
+ *   Filter state to initialise
+ *
+ *****************************************************************************/
+void MahonyAHRSinit(MahonyAHRS_t *filter) {
+	filter->q0 = 1.0f;
+	filter->q1 = 0.0f;
+	filter->q2 = 0.0f;
+	filter->q3 = 0.0f;
+	filter->integralFBx = 0.0f;
+	filter->integralFBy = 0.0f;
+	filter->integralFBz = 0.0f;
+	filter->twoKp = MAHONY_TWO_KP_START;
+	filter->twoKi = MAHONY_TWO_KI;
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Apply the PI feedback of the error and integrate the quaternion
+ *
+ * @details
+ *	 Shared end of the 9 DoF and the 6 DoF update
+ *
+ * @param[in,out] filter
+ *   Filter state
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s
+ * @param[in] halfex, halfey, halfez
+ *   Half the error between the measured and the estimated directions, zero without feedback
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+static void MahonyAHRSintegrate(MahonyAHRS_t *filter, float gx, float gy, float gz, float halfex, float halfey, float halfez, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;	// local copy of the state
+	float recipNorm;
+	float qa, qb, qc;
+
+	if(filter->twoKp > MAHONY_TWO_KP) {
+		// Converging, no integral: the large error would wind it up
+		filter->twoKp *= MAHONY_KP_DECAY;
+		if(filter->twoKp < MAHONY_TWO_KP) {
+			filter->twoKp = MAHONY_TWO_KP;
+		}
+	}
+	else if(filter->twoKi > 0.0f) {
+		// Compute and apply integral feedback
+		filter->integralFBx += filter->twoKi * halfex * dt;	// integral error scaled by Ki
+		filter->integralFBy += filter->twoKi * halfey * dt;
+		filter->integralFBz += filter->twoKi * halfez * dt;
+		gx += filter->integralFBx;
+		gy += filter->integralFBy;
+		gz += filter->integralFBz;
+	}
+
+	// Apply proportional feedback
+	gx += filter->twoKp * halfex;
+	gy += filter->twoKp * halfey;
+	gz += filter->twoKp * halfez;
+
+	// Integrate rate of change of quaternion
+	gx *= (0.5f * dt);		// pre-multiply common factors
+	gy *= (0.5f * dt);
+	gz *= (0.5f * dt);
+	qa = q0;
+	qb = q1;
+	qc = q2;
+	q0 += (-qb * gx - qc * gy - q3 * gz);
+	q1 += (qa * gx + qc * gz - q3 * gy);
+	q2 += (qa * gy - qb * gz + q3 * gx);
+	q3 += (qa * gz + qb * gy - qc * gx);
+
+	// Normalise quaternion
+	recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	filter->q0 = q0 * recipNorm;
+	filter->q1 = q1 * recipNorm;
+	filter->q2 = q2 * recipNorm;
+	filter->q3 = q3 * recipNorm;
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+
+
+/**************************************************************************//**
+ * @brief
+ *   Mahony algorithm
+ *
+ * @details
+ *	 9 DoF sensor fusion
+ *
+ * @note
+ * 	 Gyro + Accel + Magn fusion
+ *
+ * @param[in,out] filter
+ *   Filter state
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s
+ * @param[in] ax, ay, az
+ *   Accel, any unit
+ * @param[in] mx, my, mz
+ *   Magn, any unit
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+void MahonyAHRSupdateFilter(MahonyAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;
+	float recipNorm;
+	float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+	float hx, hy, bx, bz;
+	float halfvx, halfvy, halfvz, halfwx, halfwy, halfwz;
+	float halfex, halfey, halfez;
+
+	// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
+	if((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+		MahonyAHRSupdateIMUFilter(filter, gx, gy, gz, ax, ay, az, dt);
+		return;
+	}
+
+	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
+	if((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) {
+		MahonyAHRSintegrate(filter, gx, gy, gz, 0.0f, 0.0f, 0.0f, dt);
+		return;
+	}
+
+	// Normalise accelerometer measurement
+	recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+
+	// Normalise magnetometer measurement
+	recipNorm = invSqrt(mx * mx + my * my + mz * mz);
+	mx *= recipNorm;
+	my *= recipNorm;
+	mz *= recipNorm;
+
+	// Auxiliary variables to avoid repeated arithmetic
+	q0q0 = q0 * q0;
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q0q3 = q0 * q3;
+	q1q1 = q1 * q1;
+	q1q2 = q1 * q2;
+	q1q3 = q1 * q3;
+	q2q2 = q2 * q2;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+
+	// Reference direction of Earth's magnetic field
+	hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+	hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+	bx = sqrtf(hx * hx + hy * hy);
+	bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+	// Estimated direction of gravity and magnetic field
+	halfvx = q1q3 - q0q2;
+	halfvy = q0q1 + q2q3;
+	halfvz = q0q0 - 0.5f + q3q3;
+	halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+	halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+	halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+	// Error is sum of cross product between estimated direction and measured direction of field vectors
+	halfex = (ay * halfvz - az * halfvy) + (my * halfwz - mz * halfwy);
+	halfey = (az * halfvx - ax * halfvz) + (mz * halfwx - mx * halfwz);
+	halfez = (ax * halfvy - ay * halfvx) + (mx * halfwy - my * halfwx);
+
+	MahonyAHRSintegrate(filter, gx, gy, gz, halfex, halfey, halfez, dt);
+}
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+
+
+/**************************************************************************//**
+ * @brief
+ *   Mahony algorithm
+ *
+ * @details
+ *	 6 DoF sensor fusion
+ *
+ * @note
+ * 	 Gyro + Accel fusion, the heading drifts with the gyro
+ *
+ * @param[in,out] filter
+ *   Filter state
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s
+ * @param[in] ax, ay, az
+ *   Accel, any unit
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+void MahonyAHRSupdateIMUFilter(MahonyAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float dt) {
+	float q0 = filter->q0, q1 = filter->q1, q2 = filter->q2, q3 = filter->q3;
+	float recipNorm;
+	float halfvx, halfvy, halfvz;
+
+	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
+	if((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) {
+		MahonyAHRSintegrate(filter, gx, gy, gz, 0.0f, 0.0f, 0.0f, dt);
+		return;
+	}
+
+	// Normalise accelerometer measurement
+	recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+
+	// Estimated direction of gravity
+	halfvx = q1 * q3 - q0 * q2;
+	halfvy = q0 * q1 + q2 * q3;
+	halfvz = q0 * q0 - 0.5f + q3 * q3;
+
+	// Error is cross product between estimated and measured direction of gravity
+	MahonyAHRSintegrate(filter, gx, gy, gz,
+			ay * halfvz - az * halfvy,
+			az * halfvx - ax * halfvz,
+			ax * halfvy - ay * halfvx, dt);
+}
+
+//====================================================================================================
+// END OF CODE
+//====================================================================================================
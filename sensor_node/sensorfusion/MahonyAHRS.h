@@ -0,0 +1,53 @@
+/***************************************************************************//**
+ * @file MahonyAHRS.h
+ * @brief Sensor fusion, Mahony filter
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+
+//=====================================================================================================
+// MahonyAHRS.h
+//=====================================================================================================
+//
+// Madgwick's implementation of Mahony's AHRS algorithm.
+// See: http://www.x-io.co.uk/node/8#open_source_ahrs_and_imu_algorithms
+//
+// Date			Author			Notes
+// 29/09/2011	SOH Madgwick    Initial release
+// 02/10/2011	SOH Madgwick	Optimised for reduced CPU load
+//
+//=====================================================================================================
+#ifndef MahonyAHRS_h
+#define MahonyAHRS_h
+
+//----------------------------------------------------------------------------------------------------
+// Definitions
+
+#define MAHONY_TWO_KP		(2.0f * 0.5f)	/**< 2 * proportional gain (Kp) */
+#define MAHONY_TWO_KI		(2.0f * 0.0f)	/**< 2 * integral gain (Ki), off: GBIAS_Remove already removes the gyro bias */
+#define MAHONY_TWO_KP_START	(2.0f * 20.0f)	/**< 2 * proportional gain right after MahonyAHRSinit, converges from any orientation */
+#define MAHONY_KP_DECAY		0.997f			/**< Start gain decays to MAHONY_TWO_KP per update (~24 s at 51 Hz), the heading converges slowly */
+
+//----------------------------------------------------------------------------------------------------
+// Filter state
+
+typedef struct
+{
+	float q0, q1, q2, q3;						// quaternion of sensor frame relative to auxiliary frame
+	float integralFBx, integralFBy, integralFBz;	// integral error terms scaled by Ki
+	float twoKp;								// 2 * proportional gain, decays from MAHONY_TWO_KP_START
+	float twoKi;								// 2 * integral gain
+} MahonyAHRS_t;
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+void MahonyAHRSinit(MahonyAHRS_t *filter);
+void MahonyAHRSupdateFilter(MahonyAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+void MahonyAHRSupdateIMUFilter(MahonyAHRS_t *filter, float gx, float gy, float gz, float ax, float ay, float az, float dt);
+
+#endif
+//=====================================================================================================
+// End of file
+//=====================================================================================================
@@ -0,0 +1,171 @@
+/***************************************************************************//**
+ * @file fusion.c
+ * @brief Sensor fusion, engine selected at compile time
+ * @details
+ *   One interface for the floating-point fusion engines, FUSION_ENGINE picks
+ *   the engine. Every function resolves to a direct call of that engine, the
+ *   others are not referenced and no function pointer is followed per sample.
+ *   The Madgwick engine keeps using the global state of MadgwickAHRS.c, the
+ *   other engines keep their state here.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#include "fusion.h"
+
+#include "MadgwickAHRS.h"
+#include "MadgwickAHRSFixed.h"
+#include "MadgwickGain.h"
+#include "MadgwickMagGate.h"
+#include "MahonyAHRS.h"
+#include "ComplementaryAHRS.h"
+
+#include <stdint.h>
+
+#if FUSION_ENGINE == FUSION_ENGINE_MAHONY
+static MahonyAHRS_t mahony = { 1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, MAHONY_TWO_KP_START, MAHONY_TWO_KI };			/**< Mahony filter state, see MahonyAHRSinit */
+#elif FUSION_ENGINE == FUSION_ENGINE_COMPLEMENTARY
+static ComplementaryAHRS_t complementary = { 1.0f, 0.0f, 0.0f, 0.0f,
+		COMPLEMENTARY_KP_START };										/**< Complementary filter state, see ComplementaryAHRSinit */
+#endif
+
+
+/**************************************************************************//**
+ * @brief
+ *   Converge fast again from the current orientation
+ *
+ * @details
+ *	 Call before sleep, the node can be moved while asleep. Restarts the
+ *	 decaying start gain of the engine, the quaternion is kept. Madgwick
+ *	 also learns the magn reference again, the dip test of MadgwickMagGate
+ *	 uses the gravity of the filter, which is off after a turn in sleep.
+ *
+ *****************************************************************************/
+void FUSION_Reconverge(void)
+{
+#if FUSION_ENGINE == FUSION_ENGINE_MAHONY
+	mahony.twoKp = MAHONY_TWO_KP_START;
+#elif FUSION_ENGINE == FUSION_ENGINE_COMPLEMENTARY
+	complementary.gain = COMPLEMENTARY_KP_START;
+#elif MADGWICK_FIXED_POINT == 1
+#if MADGWICK_ADAPTIVE_BETA == 1
+	MadgwickGainReset(&gainScheduleFixed);
+#endif
+	MadgwickMagGateReset(&magGateFixed);
+#else
+#if MADGWICK_ADAPTIVE_BETA == 1
+	MadgwickGainReset(&gainSchedule);
+#endif
+	MadgwickMagGateReset(&magGate);
+#endif
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   9 DoF sensor fusion with the engine of FUSION_ENGINE
+ *
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s
+ * @param[in] ax, ay, az
+ *   Accel, any unit
+ * @param[in] mx, my, mz
+ *   Magn, any unit, all zero uses the 6 DoF update
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+void FUSION_Update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt)
+{
+#if FUSION_ENGINE == FUSION_ENGINE_MAHONY
+	MahonyAHRSupdateFilter(&mahony, gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+#elif FUSION_ENGINE == FUSION_ENGINE_COMPLEMENTARY
+	ComplementaryAHRSupdateFilter(&complementary, gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+#else
+	MadgwickAHRSupdate(gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+#endif
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   6 DoF sensor fusion with the engine of FUSION_ENGINE
+ *
+ * @param[in] gx, gy, gz
+ *   Gyro in rad/s
+ * @param[in] ax, ay, az
+ *   Accel, any unit
+ * @param[in] dt
+ *   Time since the previous sample in seconds
+ *
+ *****************************************************************************/
+void FUSION_UpdateIMU(float gx, float gy, float gz, float ax, float ay, float az, float dt)
+{
+#if FUSION_ENGINE == FUSION_ENGINE_MAHONY
+	MahonyAHRSupdateIMUFilter(&mahony, gx, gy, gz, ax, ay, az, dt);
+#elif FUSION_ENGINE == FUSION_ENGINE_COMPLEMENTARY
+	ComplementaryAHRSupdateIMUFilter(&complementary, gx, gy, gz, ax, ay, az, dt);
+#else
+	MadgwickAHRSupdateIMU(gx, gy, gz, ax, ay, az, dt);
+#endif
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Latest quaternion of the engine
+ *
+ * @param[out] quat
+ *   q0 (w), q1, q2, q3
+ *
+ *****************************************************************************/
+void FUSION_Quaternion(float *quat)
+{
+#if FUSION_ENGINE == FUSION_ENGINE_MAHONY
+	quat[0] = mahony.q0;
+	quat[1] = mahony.q1;
+	quat[2] = mahony.q2;
+	quat[3] = mahony.q3;
+#elif FUSION_ENGINE == FUSION_ENGINE_COMPLEMENTARY
+	quat[0] = complementary.q0;
+	quat[1] = complementary.q1;
+	quat[2] = complementary.q2;
+	quat[3] = complementary.q3;
+#else
+	quat[0] = q0;
+	quat[1] = q1;
+	quat[2] = q2;
+	quat[3] = q3;
+#endif
+}
+
+
+/**************************************************************************//**
+ * @brief
+ *   Latest orientation of the engine as euler angles
+ *
+ * @note
+ * 	 Euler angles are less accurate and suffer from Gimbal Lock
+ *
+ * @param[out] euler_angles
+ *   roll, pitch, yaw in rad
+ *
+ *****************************************************************************/
+void FUSION_EulerAngles(float *euler_angles)
+{
+#if FUSION_ENGINE == FUSION_ENGINE_MADGWICK
+	QuaternionsToEulerAngles(euler_angles);
+#else
+	MadgwickAHRS_t orientation;
+	float quat[4];
+
+	/* Only the quaternion of the state is used by the conversion */
+	FUSION_Quaternion(quat);
+	orientation.q0 = quat[0];
+	orientation.q1 = quat[1];
+	orientation.q2 = quat[2];
+	orientation.q3 = quat[3];
+	QuaternionsToEulerAnglesFilter(&orientation, euler_angles);
+#endif
+}
@@ -0,0 +1,39 @@
+/***************************************************************************//**
+ * @file fusion.h
+ * @brief Sensor fusion, engine selected at compile time
+ * @version 1.0
+ * @author Jona Cappelle
+ ******************************************************************************/
+
+#ifndef FUSION_H_
+#define FUSION_H_
+
+#include "MadgwickAHRS.h"
+
+//----------------------------------------------------------------------------------------------------
+// Definitions
+
+#define FUSION_ENGINE_MADGWICK			0		/**< Gradient descent, MadgwickAHRS.c */
+#define FUSION_ENGINE_MAHONY			1		/**< PI feedback of the direction errors, MahonyAHRS.c */
+#define FUSION_ENGINE_COMPLEMENTARY		2		/**< Proportional feedback, heading only from the magn, ComplementaryAHRS.c */
+
+/** Public definition to select the floating-point sensor fusion engine, see fusion_bench.c for the cost and accuracy of each
+ *    @li `FUSION_ENGINE_MADGWICK` - Madgwick filter, with MADGWICK_ADAPTIVE_BETA and MADGWICK_MAG_GATE.
+ *    @li `FUSION_ENGINE_MAHONY` - Mahony filter, fixed gains.
+ *    @li `FUSION_ENGINE_COMPLEMENTARY` - Complementary filter, fixed gains, a magnetic disturbance can not tilt the node. */
+#define FUSION_ENGINE FUSION_ENGINE_MADGWICK
+
+#if (MADGWICK_FIXED_POINT == 1) && (FUSION_ENGINE != FUSION_ENGINE_MADGWICK)
+#error "MADGWICK_FIXED_POINT only exists for FUSION_ENGINE_MADGWICK"
+#endif
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+void FUSION_Reconverge(void);
+void FUSION_Update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+void FUSION_UpdateIMU(float gx, float gy, float gz, float ax, float ay, float az, float dt);
+void FUSION_Quaternion(float *quat);
+void FUSION_EulerAngles(float *euler_angles);
+
+#endif /* FUSION_H_ */
@@ -0,0 +1,709 @@
+/***************************************************************************//**
+ * @file fusion_bench.c
+ * @brief Host benchmark of the sensor fusion engines
+ * @details
+ *   Runs every engine of fusion.h and the fixed-point Madgwick kernel over the
+ *   same simulated trajectories and reports the time per update and the
+ *   orientation error, to pick the cheapest FUSION_ENGINE that is accurate
+ *   enough. The fixed-point kernel is also compared sample by sample with the
+ *   float kernel it replaces. The trajectories are deterministic, the noise comes from a fixed
+ *   seed, so two runs and two hosts give the same errors.
+ *
+ *   The host has an FPU, the node does not: the time per update only ranks
+ *   the float engines against each other and overrates the fixed-point
+ *   kernel. The cycles per update on the node are printed by
+ *   fusion_cost_log in main.c with DEBUG_DBPRINT.
+ *
+ *   Not part of the node firmware, the file is empty without FUSION_BENCH.
+ *   Build and run on the host, from the sensor_node folder:
+ *
+ *     gcc -O2 -DFUSION_BENCH=1 -Isensorfusion -o fusion_bench sensorfusion/fusion_bench.c
+ *         sensorfusion/MadgwickAHRS.c sensorfusion/MadgwickAHRSFixed.c sensorfusion/MadgwickGain.c
+ *         sensorfusion/MadgwickMagGate.c sensorfusion/MahonyAHRS.c sensorfusion/ComplementaryAHRS.c -lm
+ *     ./fusion_bench
+ *     ./fusion_bench gain
+ *
+ *   The gain mode compares the gain schedule of MadgwickGain.c with a fixed
+ *   beta and with the beta of CheckIMUidle (1.0 for 20 s after start-up or
+ *   wake-up, 0.05 after that), also for a node that is turned while asleep.
+ *   The schedule is off by default, build the gain mode with
+ *   -DMADGWICK_ADAPTIVE_BETA=1 added.
+ *
+ *   MADGWICK_ADAPTIVE_BETA and MADGWICK_MAG_GATE of MadgwickAHRS.h apply,
+ *   both can be set on the command line.
+ *   Without the schedule the Madgwick kernels run with the beta of
+ *   CheckIMUidle, as on the node.
+ * @version 1.0
+ * @author Jona Cappelle
+ * ****************************************************************************/
+
+#include "fusion.h"
+
+#ifdef FUSION_BENCH
+
+#include "MadgwickAHRS.h"
+#include "MadgwickAHRSFixed.h"
+#include "MadgwickGain.h"
+#include "MadgwickMagGate.h"
+#include "MahonyAHRS.h"
+#include "ComplementaryAHRS.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define BENCH_PI			3.14159265358979323846
+#define BENCH_DT			(22.0 / 1125.0)		/**< s, nominal IMU output rate of the node */
+#define BENCH_DURATION		120.0				/**< s per trajectory */
+#define BENCH_SAMPLES		6200				/**< >= BENCH_DURATION / BENCH_DT */
+#define BENCH_SETTLE		40.0				/**< s, errors are taken from here on, convergence before */
+#define BENCH_CONVERGED		2.0					/**< deg, error below which an engine has converged */
+#define BENCH_REPEAT		50					/**< Timed runs per engine and trajectory, the fastest counts */
+
+#define BENCH_GYRO_RES		(2000.0 / 32768.0)	/**< dps per count, full scale of the node */
+#define BENCH_ACCEL_RES		(4.0 / 32768.0)		/**< g per count, full scale of the node */
+#define BENCH_MAGN_COUNTS	333.0				/**< Counts of the earth field after the magn calibration (0.15 uT/LSB) */
+
+#define BENCH_NOISE_GYRO	0.0017				/**< rad/s standard deviation */
+#define BENCH_NOISE_ACCEL	0.003				/**< g standard deviation */
+#define BENCH_NOISE_MAGN	0.008				/**< Standard deviation relative to the earth field */
+
+#define BENCH_DIST_START	50.0				/**< s, magnetic disturbance of trajectory 3 */
+#define BENCH_DIST_END		58.0				/**< s */
+#define BENCH_WAKE			60.0				/**< s, wake-up of trajectory 4, the node was turned while asleep */
+
+#define BENCH_BETA_FIXED	0.1f				/**< beta of the fixed gain in the gain mode */
+#define BENCH_HACK_BETA		1.0f				/**< beta of CheckIMUidle after start-up or wake-up */
+#define BENCH_HACK_PERIOD	20.0				/**< s, 10 idle checks of 2 s */
+#define BENCH_HACK_BETA_END	0.05f				/**< beta of CheckIMUidle after BENCH_HACK_PERIOD */
+
+/** Samples of one trajectory */
+typedef struct
+{
+	float gyro[3];								/**< rad/s */
+	float accel[3];								/**< g */
+	float magn[3];								/**< Earth field is ~1 */
+	int16_t gyroRaw[3];							/**< The same samples as register values */
+	int16_t accelRaw[3];
+	int16_t magnRaw[3];
+	double truth[4];							/**< Quaternion of the simulated node */
+} BenchSample_t;
+
+/** Engine under test, the bench calls every engine the same way */
+typedef struct
+{
+	const char *name;
+	void (*reset)(void);
+	void (*wake)(void);							/**< Converge again after sleep, NULL when the gain does not change */
+	void (*update)(const BenchSample_t *sample);
+	void (*quaternion)(float *quat);
+} BenchEngine_t;
+
+static BenchSample_t samples[BENCH_SAMPLES];	/**< Current trajectory */
+static uint32_t samplesCount;					/**< Samples in the current trajectory */
+static float estimates[BENCH_SAMPLES][4];		/**< Quaternion after every update */
+static float reference[BENCH_SAMPLES][4];		/**< Quaternion of the float Madgwick kernel, see kernelCompare */
+static uint32_t rngState;						/**< xorshift32 state */
+
+//====================================================================================================
+// Engines
+
+static MadgwickAHRS_t madgwick;
+static MahonyAHRS_t mahony;
+static ComplementaryAHRS_t complementary;
+static uint32_t hackTicks;						/**< Updates since start-up or wake-up, see madgwickHackUpdate */
+#if MADGWICK_ADAPTIVE_BETA == 0
+static uint32_t hackTicksFixed;					/**< Updates since start-up or wake-up, see madgwickFixedHackUpdate */
+#endif
+
+static void madgwickReset(void)
+{
+	MadgwickAHRSinit(&madgwick, BENCH_BETA_FIXED);
+}
+
+static void madgwickWake(void)
+{
+	MadgwickGainReset(&madgwick.schedule);
+	MadgwickMagGateReset(&madgwick.magGate);
+}
+
+static void madgwickUpdate(const BenchSample_t *s)
+{
+	MadgwickAHRSupdateFilter(&madgwick, s->gyro[0], s->gyro[1], s->gyro[2], s->accel[0], s->accel[1], s->accel[2],
+			s->magn[0], s->magn[1], s->magn[2], (float) BENCH_DT);
+}
+
+static void madgwickQuaternion(float *quat)
+{
+	quat[0] = madgwick.q0;
+	quat[1] = madgwick.q1;
+	quat[2] = madgwick.q2;
+	quat[3] = madgwick.q3;
+}
+
+static void madgwickFixedReset(void)
+{
+	q0Fixed = Q30_ONE;
+	q1Fixed = 0;
+	q2Fixed = 0;
+	q3Fixed = 0;
+	beta = 0.1f;
+	MadgwickAHRSsetGyroScaleFixed((float) (BENCH_GYRO_RES * BENCH_PI / 180.0));
+	MadgwickAHRSsetAccelScaleFixed((float) BENCH_ACCEL_RES);
+	MadgwickGainReset(&gainScheduleFixed);
+	MadgwickMagGateReset(&magGateFixed);
+}
+
+static void madgwickFixedWake(void)
+{
+	MadgwickGainReset(&gainScheduleFixed);
+	MadgwickMagGateReset(&magGateFixed);
+}
+
+static void madgwickFixedUpdate(const BenchSample_t *s)
+{
+	MadgwickAHRSupdateFixed(s->gyroRaw[0], s->gyroRaw[1], s->gyroRaw[2], s->accelRaw[0], s->accelRaw[1], s->accelRaw[2],
+			s->magnRaw[0], s->magnRaw[1], s->magnRaw[2], (uint32_t) (BENCH_DT * Q16_ONE + 0.5));
+}
+
+static void madgwickFixedQuaternion(float *quat)
+{
+	quat[0] = (float) q0Fixed * (1.0f / Q30_ONE);
+	quat[1] = (float) q1Fixed * (1.0f / Q30_ONE);
+	quat[2] = (float) q2Fixed * (1.0f / Q30_ONE);
+	quat[3] = (float) q3Fixed * (1.0f / Q30_ONE);
+}
+
+/* Float kernel with a constant beta */
+static void madgwickBetaReset(void)
+{
+	madgwickReset();
+	madgwick.adaptive = false;
+}
+
+/* Float kernel with the beta of CheckIMUidle */
+static void madgwickHackWake(void)
+{
+	hackTicks = 0;
+	madgwick.beta = BENCH_HACK_BETA;
+	MadgwickMagGateReset(&madgwick.magGate);
+}
+
+static void madgwickHackReset(void)
+{
+	madgwickBetaReset();
+	madgwickHackWake();
+}
+
+static void madgwickHackUpdate(const BenchSample_t *s)
+{
+	if(++hackTicks > (uint32_t) (BENCH_HACK_PERIOD / BENCH_DT))
+	{
+		madgwick.beta = BENCH_HACK_BETA_END;
+	}
+	madgwickUpdate(s);
+}
+
+#if MADGWICK_ADAPTIVE_BETA == 0
+/* Fixed-point kernel with the beta of CheckIMUidle */
+static void madgwickFixedHackWake(void)
+{
+	hackTicksFixed = 0;
+	beta = BENCH_HACK_BETA;
+	MadgwickMagGateReset(&magGateFixed);
+}
+
+static void madgwickFixedHackReset(void)
+{
+	madgwickFixedReset();
+	madgwickFixedHackWake();
+}
+
+static void madgwickFixedHackUpdate(const BenchSample_t *s)
+{
+	if(++hackTicksFixed > (uint32_t) (BENCH_HACK_PERIOD / BENCH_DT))
+	{
+		beta = BENCH_HACK_BETA_END;
+	}
+	madgwickFixedUpdate(s);
+}
+#endif
+
+static void mahonyReset(void)
+{
+	MahonyAHRSinit(&mahony);
+}
+
+static void mahonyWake(void)
+{
+	mahony.twoKp = MAHONY_TWO_KP_START;
+}
+
+static void mahonyUpdate(const BenchSample_t *s)
+{
+	MahonyAHRSupdateFilter(&mahony, s->gyro[0], s->gyro[1], s->gyro[2], s->accel[0], s->accel[1], s->accel[2],
+			s->magn[0], s->magn[1], s->magn[2], (float) BENCH_DT);
+}
+
+static void mahonyQuaternion(float *quat)
+{
+	quat[0] = mahony.q0;
+	quat[1] = mahony.q1;
+	quat[2] = mahony.q2;
+	quat[3] = mahony.q3;
+}
+
+static void complementaryReset(void)
+{
+	ComplementaryAHRSinit(&complementary);
+}
+
+static void complementaryWake(void)
+{
+	complementary.gain = COMPLEMENTARY_KP_START;
+}
+
+static void complementaryUpdate(const BenchSample_t *s)
+{
+	ComplementaryAHRSupdateFilter(&complementary, s->gyro[0], s->gyro[1], s->gyro[2], s->accel[0], s->accel[1], s->accel[2],
+			s->magn[0], s->magn[1], s->magn[2], (float) BENCH_DT);
+}
+
+static void complementaryQuaternion(float *quat)
+{
+	quat[0] = complementary.q0;
+	quat[1] = complementary.q1;
+	quat[2] = complementary.q2;
+	quat[3] = complementary.q3;
+}
+
+#define BENCH_ENGINE_MADGWICK		0			/**< Index of the float Madgwick kernel in engines[] */
+#define BENCH_ENGINE_MADGWICK_FIXED	1			/**< Index of the fixed-point Madgwick kernel in engines[] */
+
+static const BenchEngine_t engines[] =
+{
+#if MADGWICK_ADAPTIVE_BETA == 1
+	{ "Madgwick",			madgwickReset,		madgwickWake,		madgwickUpdate,			madgwickQuaternion },
+	{ "Madgwick fixed",		madgwickFixedReset,	madgwickFixedWake,	madgwickFixedUpdate,	madgwickFixedQuaternion },
+#else
+	/* The node sets beta in CheckIMUidle */
+	{ "Madgwick",			madgwickHackReset,		madgwickHackWake,		madgwickHackUpdate,			madgwickQuaternion },
+	{ "Madgwick fixed",		madgwickFixedHackReset,	madgwickFixedHackWake,	madgwickFixedHackUpdate,	madgwickFixedQuaternion },
+#endif
+	{ "Mahony",				mahonyReset,		mahonyWake,			mahonyUpdate,			mahonyQuaternion },
+	{ "Complementary",		complementaryReset,	complementaryWake,	complementaryUpdate,	complementaryQuaternion },
+};
+
+/** Madgwick gains of the gain mode */
+static const BenchEngine_t gainEngines[] =
+{
+	{ "schedule",			madgwickReset,		madgwickWake,		madgwickUpdate,			madgwickQuaternion },
+	{ "schedule fixed",		madgwickFixedReset,	madgwickFixedWake,	madgwickFixedUpdate,	madgwickFixedQuaternion },
+	{ "beta 0.1",			madgwickBetaReset,	NULL,				madgwickUpdate,			madgwickQuaternion },
+	{ "beta 1.0/0.05",		madgwickHackReset,	madgwickHackWake,	madgwickHackUpdate,		madgwickQuaternion },
+};
+
+//====================================================================================================
+// Trajectories
+
+static double noise(void)
+{
+	double sum = 0.0;
+	int i;
+
+	/* Sum of 12 uniform samples, standard deviation 1 */
+	for(i = 0; i < 12; i++)
+	{
+		rngState ^= rngState << 13;
+		rngState ^= rngState >> 17;
+		rngState ^= rngState << 5;
+		sum += rngState * (1.0 / 4294967296.0);
+	}
+	return sum - 6.0;
+}
+
+static void quatMultiply(const double *a, const double *b, double *r)
+{
+	double t[4];
+
+	t[0] = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+	t[1] = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+	t[2] = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+	t[3] = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+	r[0] = t[0];
+	r[1] = t[1];
+	r[2] = t[2];
+	r[3] = t[3];
+}
+
+/* Earth frame vector in the sensor frame of q */
+static void quatRotateInverse(const double *q, const double *v, double *r)
+{
+	double p[4] = { 0.0, v[0], v[1], v[2] };
+	double qc[4] = { q[0], -q[1], -q[2], -q[3] };
+
+	quatMultiply(qc, p, p);
+	quatMultiply(p, q, p);
+	r[0] = p[1];
+	r[1] = p[2];
+	r[2] = p[3];
+}
+
+static int16_t toCounts(double v)
+{
+	long counts = lround(v);
+
+	if(counts > 32767) counts = 32767;
+	if(counts < -32768) counts = -32768;
+	return (int16_t) counts;
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Simulate one trajectory into samples[]
+ *
+ * @details
+ *	 Start orientation 131 deg away from the identity of the engines.
+ *	 @li 0: lies still after power up
+ *	 @li 1: still for 10 s, then slow rehab movement
+ *	 @li 2: rehab movement from power up on
+ *	 @li 3: rehab movement, from 50 to 58 s the field turns 56 deg and weakens 18 %
+ *	 @li 4: lies still, turned 90 deg about x while asleep before BENCH_WAKE
+ *
+ * @param[in] trajectory
+ *   Trajectory number
+ *
+ *****************************************************************************/
+static void trajectoryMake(int trajectory)
+{
+	const double magnEarth[3] = { 0.45, 0.0, -0.85 };	/* 62 deg dip */
+	const double disturbance[3] = { -0.25, 0.3, 0.15 };	/* Iron nearby, see trajectory 3 */
+	const double turn[4] = { 0.7071, 0.7071, 0.0, 0.0 };	/* 90 deg about x, see trajectory 4 */
+	double q[4] = { 0.4113, 0.3097, 0.2101, 0.8311 };	/* roll 40, pitch -20, yaw 120 deg */
+	double accelEarth[3], magn[3], accel[3], dq[4], w[3], norm, t, phase, ramp;
+	uint32_t k;
+	int axis;
+
+	rngState = 2463534242u;
+	samplesCount = (uint32_t) (BENCH_DURATION / BENCH_DT);
+
+	for(k = 0; k < samplesCount; k++)
+	{
+		t = k * BENCH_DT;
+
+		/* Slow arm movement: < 25 deg/s, < 0.1 g linear acceleration */
+		w[0] = w[1] = w[2] = 0.0;
+		accelEarth[0] = accelEarth[1] = 0.0;
+		accelEarth[2] = 1.0;
+		if( (trajectory >= 2) || ((trajectory == 1) && (t > 10.0)) )
+		{
+			phase = 2.0 * BENCH_PI * 0.25 * t;
+			w[0] = 0.35 * sin(phase);
+			w[1] = 0.2 * cos(phase * 0.7);
+			w[2] = 0.1 * sin(phase * 1.3);
+			accelEarth[0] = 0.08 * cos(phase);
+			accelEarth[1] = 0.05 * sin(phase * 0.7);
+			accelEarth[2] += 0.03 * sin(phase * 1.3);
+		}
+
+		if( (trajectory == 4) && (k == (uint32_t) (BENCH_WAKE / BENCH_DT)) )
+		{
+			quatMultiply(q, turn, q);
+		}
+
+		dq[0] = 1.0;
+		dq[1] = 0.5 * w[0] * BENCH_DT;
+		dq[2] = 0.5 * w[1] * BENCH_DT;
+		dq[3] = 0.5 * w[2] * BENCH_DT;
+		quatMultiply(q, dq, q);
+		norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		q[0] /= norm;
+		q[1] /= norm;
+		q[2] /= norm;
+		q[3] /= norm;
+
+		/* Disturbance with 1 s edges */
+		ramp = 0.0;
+		if( (trajectory == 3) && (t > BENCH_DIST_START) && (t < BENCH_DIST_END) )
+		{
+			ramp = fmin(1.0, fmin(t - BENCH_DIST_START, BENCH_DIST_END - t));
+		}
+		for(axis = 0; axis < 3; axis++)
+		{
+			magn[axis] = magnEarth[axis] + ramp * disturbance[axis];
+		}
+
+		quatRotateInverse(q, accelEarth, accel);
+		quatRotateInverse(q, magn, magn);
+
+		for(axis = 0; axis < 3; axis++)
+		{
+			samples[k].gyro[axis] = (float) (w[axis] + BENCH_NOISE_GYRO * noise());
+			samples[k].accel[axis] = (float) (accel[axis] + BENCH_NOISE_ACCEL * noise());
+			samples[k].magn[axis] = (float) (magn[axis] + BENCH_NOISE_MAGN * noise());
+			samples[k].gyroRaw[axis] = toCounts(samples[k].gyro[axis] * 180.0 / BENCH_PI / BENCH_GYRO_RES);
+			samples[k].accelRaw[axis] = toCounts(samples[k].accel[axis] / BENCH_ACCEL_RES);
+			samples[k].magnRaw[axis] = toCounts(samples[k].magn[axis] * BENCH_MAGN_COUNTS);
+		}
+		samples[k].truth[0] = q[0];
+		samples[k].truth[1] = q[1];
+		samples[k].truth[2] = q[2];
+		samples[k].truth[3] = q[3];
+	}
+}
+
+//====================================================================================================
+// Bench
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Angle between the simulated and the estimated orientation in deg */
+static double orientationError(const double *truth, const float *quat)
+{
+	double dot = fabs(truth[0] * quat[0] + truth[1] * quat[1] + truth[2] * quat[2] + truth[3] * quat[3]);
+
+	dot /= sqrt((double) quat[0] * quat[0] + quat[1] * quat[1] + quat[2] * quat[2] + quat[3] * quat[3]);
+	return 2.0 * acos(fmin(dot, 1.0)) * 180.0 / BENCH_PI;
+}
+
+/* Angle between two estimated orientations in deg */
+static double estimateAngle(const float *a, const float *b)
+{
+	double dot = fabs((double) a[0] * b[0] + (double) a[1] * b[1] + (double) a[2] * b[2] + (double) a[3] * b[3]);
+
+	dot /= sqrt((double) a[0] * a[0] + a[1] * a[1] + a[2] * a[2] + a[3] * a[3]);
+	dot /= sqrt((double) b[0] * b[0] + b[1] * b[1] + b[2] * b[2] + b[3] * b[3]);
+	return 2.0 * acos(fmin(dot, 1.0)) * 180.0 / BENCH_PI;
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Compare the fixed-point with the float Madgwick kernel on the current trajectory
+ *
+ * @details
+ *	 The float kernel gets the float samples, the fixed-point kernel the same
+ *	 samples as register values. The difference of the two quaternions is the
+ *	 error of the Q-format arithmetic and the input quantisation, independent
+ *	 of how well the filter itself follows the trajectory.
+ *
+ * @param[out] rms
+ *   RMS difference over the whole trajectory, deg
+ * @param[out] max
+ *   Maximum difference, deg
+ *
+ *****************************************************************************/
+static void kernelCompare(double *rms, double *max)
+{
+	const BenchEngine_t *floatKernel = &engines[BENCH_ENGINE_MADGWICK];
+	const BenchEngine_t *fixedKernel = &engines[BENCH_ENGINE_MADGWICK_FIXED];
+	double angle, sum = 0.0;
+	uint32_t k;
+
+	floatKernel->reset();
+	for(k = 0; k < samplesCount; k++)
+	{
+		floatKernel->update(&samples[k]);
+		floatKernel->quaternion(reference[k]);
+	}
+
+	*max = 0.0;
+	fixedKernel->reset();
+	for(k = 0; k < samplesCount; k++)
+	{
+		fixedKernel->update(&samples[k]);
+		fixedKernel->quaternion(estimates[k]);
+		angle = estimateAngle(reference[k], estimates[k]);
+		sum += angle * angle;
+		if(angle > *max)
+		{
+			*max = angle;
+		}
+	}
+	*rms = sqrt(sum / samplesCount);
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Run one engine over the current trajectory
+ *
+ * @param[in] engine
+ *   Engine under test
+ * @param[in] wake
+ *   Sample of the wake-up, engine->wake is called before it, 0 for none.
+ *   Convergence and errors are taken from here on.
+ * @param[out] converged
+ *   s after wake after which the error stays below BENCH_CONVERGED until BENCH_SETTLE, negative when it does not
+ * @param[out] rms
+ *   RMS error from BENCH_SETTLE after wake on, deg
+ * @param[out] max
+ *   Maximum error from BENCH_SETTLE on, deg
+ *
+ * @return
+ *   Fastest time per update in ns
+ *
+ *****************************************************************************/
+static double engineRun(const BenchEngine_t *engine, uint32_t wake, double *converged, double *rms, double *max)
+{
+	double best = 1e9, start, t, error, sum = 0.0;
+	uint32_t k, count = 0;
+	int repeat;
+
+	for(repeat = 0; repeat < BENCH_REPEAT; repeat++)
+	{
+		engine->reset();
+		start = now();
+		for(k = 0; k < samplesCount; k++)
+		{
+			if( (k == wake) && (k > 0) && (engine->wake != NULL) )
+			{
+				engine->wake();
+			}
+			engine->update(&samples[k]);
+			engine->quaternion(estimates[k]);
+		}
+		t = (now() - start) / samplesCount * 1e9;
+		if(t < best)
+		{
+			best = t;
+		}
+	}
+
+	*converged = 0.0;
+	*max = 0.0;
+	for(k = wake; k < samplesCount; k++)
+	{
+		t = (k - wake) * BENCH_DT;
+		error = orientationError(samples[k].truth, estimates[k]);
+		if(t < BENCH_SETTLE)
+		{
+			if(error >= BENCH_CONVERGED)
+			{
+				*converged = t + BENCH_DT;
+			}
+		}
+		else
+		{
+			sum += error * error;
+			count++;
+			if(error > *max)
+			{
+				*max = error;
+			}
+		}
+	}
+	if(*converged >= BENCH_SETTLE)
+	{
+		*converged = -1.0;
+	}
+	*rms = sqrt(sum / count);
+
+	return best;
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Gain mode, the Madgwick gains over every trajectory
+ *
+ * @details
+ *	 The time of "wake rotated" counts from the wake-up, the filter had
+ *	 converged to the orientation before sleep.
+ *
+ *****************************************************************************/
+static int gainBench(void)
+{
+	const char *trajectories[] = { "still", "rehab", "wake moving", "magn disturbed", "wake rotated" };
+	const int trajectoryCount = sizeof(trajectories) / sizeof(trajectories[0]);
+	const int engineCount = sizeof(gainEngines) / sizeof(gainEngines[0]);
+	double converged, rms, max;
+	uint32_t wake;
+	int e, j;
+
+#if MADGWICK_ADAPTIVE_BETA == 0
+	printf("The gain mode needs -DMADGWICK_ADAPTIVE_BETA=1\n");
+	return 1;
+#endif
+
+	printf("%-16s %-15s %9s %9s %9s\n", "gain", "trajectory", "conv [s]", "rms [deg]", "max [deg]");
+	for(j = 0; j < trajectoryCount; j++)
+	{
+		trajectoryMake(j);
+		wake = (j == 4) ? (uint32_t) (BENCH_WAKE / BENCH_DT) : 0;
+		for(e = 0; e < engineCount; e++)
+		{
+			engineRun(&gainEngines[e], wake, &converged, &rms, &max);
+			if(converged < 0.0)
+			{
+				printf("%-16s %-15s %9s %9.2f %9.2f\n", gainEngines[e].name, trajectories[j], "-", rms, max);
+			}
+			else
+			{
+				printf("%-16s %-15s %9.1f %9.2f %9.2f\n", gainEngines[e].name, trajectories[j], converged, rms, max);
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *trajectories[] = { "still", "rehab", "wake moving", "magn disturbed" };
+	const int trajectoryCount = sizeof(trajectories) / sizeof(trajectories[0]);
+	const int engineCount = sizeof(engines) / sizeof(engines[0]);
+	double ns[sizeof(engines) / sizeof(engines[0])] = { 0.0 };
+	double kernelRms[sizeof(trajectories) / sizeof(trajectories[0])];
+	double kernelMax[sizeof(trajectories) / sizeof(trajectories[0])];
+	double converged, rms, max;
+	int e, j;
+
+	if( (argc > 1) && (strcmp(argv[1], "gain") == 0) )
+	{
+		return gainBench();
+	}
+
+	printf("%-16s %-15s %9s %9s %9s %11s\n", "engine", "trajectory", "conv [s]", "rms [deg]", "max [deg]", "ns/update");
+	for(j = 0; j < trajectoryCount; j++)
+	{
+		trajectoryMake(j);
+		for(e = 0; e < engineCount; e++)
+		{
+			double t = engineRun(&engines[e], 0, &converged, &rms, &max);
+
+			ns[e] += t / trajectoryCount;
+			if(converged < 0.0)
+			{
+				printf("%-16s %-15s %9s %9.2f %9.2f %11.1f\n", engines[e].name, trajectories[j], "-", rms, max, t);
+			}
+			else
+			{
+				printf("%-16s %-15s %9.1f %9.2f %9.2f %11.1f\n", engines[e].name, trajectories[j], converged, rms, max, t);
+			}
+		}
+		kernelCompare(&kernelRms[j], &kernelMax[j]);
+	}
+
+	printf("\nFixed-point vs float Madgwick kernel, same samples\n");
+	printf("%-15s %9s %9s\n", "trajectory", "rms [deg]", "max [deg]");
+	for(j = 0; j < trajectoryCount; j++)
+	{
+		printf("%-15s %9.2f %9.2f\n", trajectories[j], kernelRms[j], kernelMax[j]);
+	}
+
+	printf("\nMean time per update on this host, relative to Madgwick\n");
+	for(e = 0; e < engineCount; e++)
+	{
+		printf("%-16s %7.1f ns  %5.2f\n", engines[e].name, ns[e], ns[e] / ns[0]);
+	}
+
+	return 0;
+}
+
+#endif /* FUSION_BENCH */
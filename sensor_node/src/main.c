@@ -79,6 +79,10 @@
 #include "timer.h"
 #include "datatypes.h"
 #include "util.h"
+#include "scheduler.h"
+#include "calibration.h"
+#include "magcal.h"
+#include "gyrobias.h"
 
 /* Need to make a separate file called "rtcdrv_config.h" and place:
  *
@@ -102,6 +106,9 @@
 
 /* Sensor fusion */
 #include "MadgwickAHRS.h"
+#include "MadgwickAHRSFixed.h"
+#include "MadgwickMagGate.h"
+#include "fusion.h"
 #include "math.h"
 
 /* LED's */
@@ -115,8 +122,22 @@
 
 #define DIY				1							/**< Variable to change between pinout of sensor node and pinout of development board */
 
-/* The use of switch - cases makes the code more user friendly */
-static volatile APP_State_t appState;				/**< Struct to keep track of the appState */
+#define SAMPLE_DT_NOMINAL	((RTC_TICK_FREQ * 22 + 1125 / 2) / 1125)	/**< RTC ticks between samples at the nominal IMU output rate (1125 / 22 Hz) */
+#define SAMPLE_DT_MAX		(RTC_TICK_FREQ / 4)			/**< Larger gaps (first sample, wake-up from sleep) use the nominal period */
+
+/** Public definition to select how the IMU samples are acquired
+ *    @li `1` - Accel + gyro stream into the IMU FIFO, drained in batches of FIFO_BATCH_SAMPLES.
+ *    @li `0` - Data ready interrupt for every sample. */
+#define IMU_FIFO_MODE		0
+
+/** Public definition to select how the magnetometer is read in data ready mode
+ *    @li `1` - IMU I2C master copies the magnetometer, accel + gyro + magn in one burst read.
+ *    @li `0` - Separate reads, magnetometer through I2C bypass. */
+#define IMU_BURST_READ		0
+
+#define FIFO_BATCH_SAMPLES	10											/**< Samples per FIFO drain, max ICM_20948_FIFO_MAX_PACKETS */
+#define FIFO_BATCH_PERIOD	((FIFO_BATCH_SAMPLES * 1000 * 22) / 1125)	/**< ms between FIFO drains at the nominal IMU output rate */
+
 
 /* Keep the measurement data */
 MeasurementData_t data;								/**< Struct to store al the measured data and calibration values */
@@ -125,16 +146,45 @@ MeasurementData_t data;								/**< Struct to store al the measured data and cal
 bool bleConnected = false;							/**< Keep track of the state of the BLE module */
 bool IMU_MEASURING = false;							/**< Keep track of the state of the IMU */
 bool IDLE = false;									/**< Variable to keep track if the system is IDLE of the IDLE state, not used at the moment */
-bool _sleep = false;								/**< Variable to fix some problems with IMU generating interrupt and thus waking up the system when trying to go to sleep */
+volatile bool _sleep = false;								/**< Variable to fix some problems with IMU generating interrupt and thus waking up the system when trying to go to sleep */
+
+static volatile bool womWait = false;				/**< Waiting in EM2 for the wake on motion interrupt */
+static bool magcalStored = false;					/**< Online magnetometer fit stored in flash since boot */
+static ICM_20948_WakeState_t imuWakeState;			/**< IMU registers changed by wake on motion, restored when waking up */
 
 uint8_t idle_count = 0;								/**< Seconds that the IMU is idle */
-uint8_t ble_sec_not_connected = 0;					/**< 200 ms that the BLE is not connected */
 
 uint32_t interruptStatus[1];						/**< Not used at the moment */
 
+#define SAMPLE_TICKS_QUEUE	8							/**< Data ready timestamps kept for a late EVT_SENSORS_READ, power of two, also the max queued runs */
+
+volatile uint32_t sampleTicks[SAMPLE_TICKS_QUEUE];	/**< RTC ticks at the data ready interrupts, one per EVT_SENSORS_READ post */
+volatile uint32_t sampleTicksHead = 0;				/**< Timestamps written by the data ready interrupt */
+uint32_t sampleTicksTail = 0;						/**< Timestamps used by measure_send */
+uint32_t lastSampleTicks = 0;						/**< RTC ticks of the sample used in the previous filter update */
+
+#if BLE_BATCH_MODE == 1
+uint32_t lastSendMillis = 0;						/**< millis() of the previous sample added to the BLE batch */
+#endif
+
 /* Timer for IMU idle checking */
 RTCDRV_TimerID_t IMU_Idle_Timer;					/**< Timer used for checking variables every second */
 
+#if ICM_20948_DMP_MODE == 1
+MadgwickAHRS_t dmpOrientation;						/**< Latest DMP quaternion, only used for the Euler angle conversion */
+#endif
+
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
+static uint32_t fusionCycles = 0;					/**< HFPERCLK cycles spent in the sensor fusion since the previous fusion_cost_log */
+static uint32_t fusionUpdates = 0;					/**< Sensor fusion updates since the previous fusion_cost_log */
+#endif /* DEBUG_DBPRINT */
+
+#if IMU_FIFO_MODE == 1
+RTCDRV_TimerID_t IMU_Fifo_Timer;					/**< Timer used to drain the IMU FIFO */
+int16_t fifoAccel[ICM_20948_FIFO_MAX_PACKETS][3];	/**< Raw accelerometer values of one FIFO batch */
+int16_t fifoGyro[ICM_20948_FIFO_MAX_PACKETS][3];	/**< Raw gyroscope values of one FIFO batch */
+#endif
+
 /* Test pin to check frequency of execution */
 
 bool helft = false;									/**< Not used at the moment */
@@ -142,21 +192,78 @@ bool helft = false;									/**< Not used at the moment */
 uint8_t teller = 0;									/**< Not used at the moment */
 uint8_t teller_accuracy = 0;						/**< Counter to keep track when to enter accuracy mode on Madgwick filter */
 
-volatile float beta = 1.0f;							/**< Beta parameter of Madgwick filter */
-
 
 /*************************************************/
 /*************************************************/
 
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
 /**************************************************************************//**
  * @brief
- *   Function called by RTC timer every second
+ *   Print the share of EM0, EM1 and EM2 since the previous call in per mille
+ *
+ *****************************************************************************/
+static void residency_log( void )
+{
+	SCHED_Residency_t res;
+	uint32_t total;
+
+	SCHED_ResidencyGet(&res);
+	SCHED_ResidencyReset();
+
+	total = res.em0Ticks + res.em1Ticks + res.em2Ticks;
+	if(total == 0)
+	{
+		return;
+	}
+
+	dbprint("EM0 ");
+	dbprintInt((int32_t) (((uint64_t) res.em0Ticks * 1000) / total));
+	dbprint(" EM1 ");
+	dbprintInt((int32_t) (((uint64_t) res.em1Ticks * 1000) / total));
+	dbprint(" EM2 ");
+	dbprintInt((int32_t) (((uint64_t) res.em2Ticks * 1000) / total));
+	dbprint(" wakeups ");
+	dbprintlnInt((int32_t) (res.em1Entries + res.em2Entries));
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Print the mean core clock cycles per sensor fusion update since the previous call
+ *
+ * @details
+ *	 Measured cost of the FUSION_ENGINE on the node, fusion_bench.c only ranks
+ *	 the engines on the host. Every update is timed with cycles() (TIMER0 +
+ *	 TIMER1 on HFPERCLK), scaled to HFCORECLK in case HFPERCLK is divided.
+ *
+ * @note
+ * 	 Only the updates of measure_send without IMU_FIFO_MODE are timed
+ *
+ *****************************************************************************/
+static void fusion_cost_log( void )
+{
+	if(fusionUpdates == 0)
+	{
+		return;
+	}
+
+	dbprint("fusion cycles ");
+	dbprintlnInt((int32_t) (((uint64_t) fusionCycles * CMU_ClockFreqGet(cmuClock_CORE)) / ((uint64_t) CMU_ClockFreqGet(cmuClock_HFPER) * fusionUpdates)));
+
+	fusionCycles = 0;
+	fusionUpdates = 0;
+}
+#endif /* DEBUG_DBPRINT */
+
+/**************************************************************************//**
+ * @brief
+ *   Handler of EVT_IDLE_CHECK, posted by the RTC timer every 2 seconds
  *
  * @details
  *	 Check batt
- *	 Check gyro idle
+ *	 Check idle, stillness detection of GBIAS_Update
  *	 Check BLE connected
- *	 Dynamically set Madgwick beta parameter
+ *	 Dynamically set Madgwick beta parameter (MADGWICK_ADAPTIVE_BETA 0), restart the fusion convergence before sleep
+ *	 Log the time per energy mode and the cycles per fusion update (DEBUG_DBPRINT)
  *
  *
  *****************************************************************************/
@@ -166,10 +273,8 @@ void CheckIMUidle( void )
 	/* Read battery in percent */
 	ADC_get_batt(data.batt);
 
-	float mean_gyro = (uint8_t) ( data.ICM_20948_gyro[0] + data.ICM_20948_gyro[1] + data.ICM_20948_gyro[2] ) / 3;
-
-	/* Add 1 sec to the count of idle seconds */
-	if( mean_gyro < 0.1 )
+	/* Stillness from the gyro and accel variance, see GBIAS_Update */
+	if( GBIAS_Still() )
 	{
 		idle_count++;
 	}else{ /* If there is movement, reset idle seconds */
@@ -177,30 +282,37 @@ void CheckIMUidle( void )
 	}
 
 
-	if( (idle_count > 60) || (ble_sec_not_connected > 5*5)) // 5sec * 75Hz
+	if( (idle_count > 60) || (BLE_linkDownTime() > BLE_LINK_SLEEP_TIME) )
 	{
 		idle_count = 0;
-		ble_sec_not_connected = 0;
+#if MADGWICK_ADAPTIVE_BETA == 0
 		teller_accuracy = 0;
 		beta = 1.0f;
+#endif
+		/* The node can be moved while asleep, converge again after the wake-up */
+		FUSION_Reconverge();
 		/* Dont't check idle state in sleep */
 		RTCDRV_StopTimer( IMU_Idle_Timer );
+#if IMU_FIFO_MODE == 1
+		RTCDRV_StopTimer( IMU_Fifo_Timer );
+#endif
 		/* Stop generating interrupts */
 		ICM_20948_interruptEnable(false, false);
-		appState = SLEEP;
 		_sleep = true;
-	}
-	// Reset timer is BLE is connected
-	if(bleConnected)
-	{
-		ble_sec_not_connected = 0;
+		SCHED_Post(EVT_SLEEP);
 	}
 
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
+	residency_log();
+	fusion_cost_log();
+#endif /* DEBUG_DBPRINT */
+
 /* For visual representation where in the code */
 #if DIY == 0
 	BSP_LedToggle(1);
 #endif
 
+#if MADGWICK_ADAPTIVE_BETA == 0
 	if(teller_accuracy < 10)
 	{
 		teller_accuracy++;
@@ -210,7 +322,111 @@ void CheckIMUidle( void )
 	{
 		beta = 0.05f;
 	}
+#endif
+
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Function called by RTC timer every 2 seconds, the check runs outside interrupt context
+ *
+ *****************************************************************************/
+void IdleTimer( void )
+{
+	SCHED_Post(EVT_IDLE_CHECK);
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Function called by RTC timer every FIFO_BATCH_PERIOD ms
+ *
+ * @details
+ *	 The ICM-20948 only has a FIFO watermark level when the DMP is used,
+ *	 the timer takes over the role of the watermark interrupt
+ *
+ *****************************************************************************/
+void FifoWatermark( void )
+{
+	if(!_sleep)
+	{
+		SCHED_Post(EVT_SENSORS_READ);
+	}
+}
 
+/**************************************************************************//**
+ * @brief
+ *   Start acquisition of IMU samples
+ *
+ * @details
+ *	 DMP interrupt, data ready interrupt or FIFO + drain timer,
+ *	 see ICM_20948_DMP_MODE and IMU_FIFO_MODE
+ *
+ *****************************************************************************/
+void acquisition_start( void )
+{
+	IMU_MEASURING = true;
+
+#if ICM_20948_DMP_MODE == 1
+	/* DMP raises the interrupt for every quaternion */
+	if( ICM_20948_dmpInit() == ICM_20948_OK )
+	{
+		ICM_20948_dmpEnable(true);
+	}
+#elif IMU_FIFO_MODE == 1
+	ICM_20948_fifoStreamEnable(true);
+	RTCDRV_StartTimer( IMU_Fifo_Timer, rtcdrvTimerTypePeriodic, FIFO_BATCH_PERIOD, (RTCDRV_Callback_t)FifoWatermark, NULL);
+#else
+#if IMU_BURST_READ == 1
+	ICM_20948_magAutoReadEnable(true);
+#endif
+	/* Set interrupt to trigger every 100ms when the data is ready */
+	ICM_20948_interruptEnable(true, false);
+#endif
+}
+
+/**************************************************************************//**
+ * @brief
+ *   Prepare the orientation payload
+ *
+ * @details
+ *	 Quaternion of the DMP, the fixed-point or the floating-point filter,
+ *	 see ICM_20948_DMP_MODE and MADGWICK_FIXED_POINT
+ *	 @li BLE_PAYLOAD_QUATERNION 1: smallest three encoding, no Euler angles on the node
+ *	 @li BLE_PAYLOAD_QUATERNION 0: Euler angles as 3 floats
+ *
+ *****************************************************************************/
+static void orientation_pack( void )
+{
+#if BLE_PAYLOAD_QUATERNION == 1
+	float quat[4];
+
+#if ICM_20948_DMP_MODE == 1
+	quat[0] = dmpOrientation.q0;
+	quat[1] = dmpOrientation.q1;
+	quat[2] = dmpOrientation.q2;
+	quat[3] = dmpOrientation.q3;
+#elif MADGWICK_FIXED_POINT == 1
+	quat[0] = (float) q0Fixed * (1.0f / Q30_ONE);
+	quat[1] = (float) q1Fixed * (1.0f / Q30_ONE);
+	quat[2] = (float) q2Fixed * (1.0f / Q30_ONE);
+	quat[3] = (float) q3Fixed * (1.0f / Q30_ONE);
+#else
+	FUSION_Quaternion(quat);
+#endif
+
+	quaternion_to_uint8_t(quat, data.BLE_quaternion);
+#else
+#if ICM_20948_DMP_MODE == 1
+	QuaternionsToEulerAnglesFilter(&dmpOrientation, data.ICM_20948_euler_angles);
+#elif MADGWICK_FIXED_POINT == 1
+	QuaternionsToEulerAnglesFixed(data.ICM_20948_euler_angles);
+#else
+	FUSION_EulerAngles(data.ICM_20948_euler_angles);
+#endif
+
+	float_to_uint8_t_x3(data.ICM_20948_euler_angles,
+			data.BLE_euler_angles);
+#endif /* BLE_PAYLOAD_QUATERNION */
 }
 
 /**************************************************************************//**
@@ -219,9 +435,8 @@ void CheckIMUidle( void )
  *
  * @details
  *	 Measure Gyro + Accel + Magn
- *	 Sensor fusion with Madgwick filter
- *	 Convert quaternions to Euler angles
- *	 Convert floats to uint8_t for transmission
+ *	 Sensor fusion with the FUSION_ENGINE or the fixed-point Madgwick filter
+ *	 Convert the quaternion or the Euler angles to uint8_t for transmission
  *	 Send data via UART to BLE module (interrupt based)
  *	 Toggle pin to check speed
  *
@@ -234,43 +449,184 @@ void CheckIMUidle( void )
 void measure_send( void )
 {
 
-	/* Check connection */
-#if DEBUG_DBPRINT == 0 /* DEBUG_DBPRINT */
-	BLE_check_connect();
-	if (!bleConnected)
+	/* Connection is handled by BLE_linkProcess, see EVT_BLE_LINK */
+
+#if ICM_20948_DMP_MODE == 1
+	/* Orientation is computed by the DMP, only read the quaternion */
+	uint8_t frames;
+	float quat[4];
+	ICM_20948_dmpQuaternionRead(quat, data.ICM_20948_gyroRaw, &frames);
+	if(frames == 0)
 	{
-		ble_sec_not_connected++;
-		BLE_power(true);
-		delay(200);
-		BLE_connect();
+		return;
 	}
 
-#endif /* DEBUG_DBPRINT */
+	/* Stillness only, the DMP removes the gyro bias itself */
+	GBIAS_Update(data.ICM_20948_gyroRaw, NULL);
+
+	dmpOrientation.q0 = quat[0];
+	dmpOrientation.q1 = quat[1];
+	dmpOrientation.q2 = quat[2];
+	dmpOrientation.q3 = quat[3];
+#elif IMU_FIFO_MODE == 1
+	/* Drain the FIFO, packets are one sample period apart */
+	uint8_t packets, i;
+	ICM_20948_fifoRead(fifoAccel, fifoGyro, ICM_20948_FIFO_MAX_PACKETS, &packets);
+	if(packets == 0)
+	{
+		return;
+	}
+
+#if MADGWICK_FIXED_POINT == 1
+	/* Magnetometer once per batch */
+	ICM_20948_magCalDataRead(data.ICM_20948_magnRaw);
 
-	/* Read all sensors */
-	ICM_20948_gyroDataRead(data.ICM_20948_gyro);
-	ICM_20948_accelDataRead(data.ICM_20948_accel);
+	/* Sensor fusion, fixed-point */
+	for(i = 0; i < packets; i++)
+	{
+		GBIAS_Update(fifoGyro[i], fifoAccel[i]);
+		GBIAS_Remove(fifoGyro[i]);
+		MadgwickAHRSupdateFixed(fifoGyro[i][0], fifoGyro[i][1], fifoGyro[i][2],
+				fifoAccel[i][0], fifoAccel[i][1], fifoAccel[i][2],
+				data.ICM_20948_magnRaw[0], data.ICM_20948_magnRaw[1], data.ICM_20948_magnRaw[2],
+				SAMPLE_DT_NOMINAL * (Q16_ONE / RTC_TICK_FREQ));
+	}
+	data.ICM_20948_gyroRaw[0] = fifoGyro[packets - 1][0];
+	data.ICM_20948_gyroRaw[1] = fifoGyro[packets - 1][1];
+	data.ICM_20948_gyroRaw[2] = fifoGyro[packets - 1][2];
+#else
+	/* Magnetometer once per batch */
 	ICM_20948_magDataRead(data.ICM_20948_magn);
 
-	// TODO: embedded ICM_20948_magn_to_angle( ICM_20948_magn, ICM_20948_magn_angle );
+	/* Sensor fusion */
+	for(i = 0; i < packets; i++)
+	{
+		GBIAS_Update(fifoGyro[i], fifoAccel[i]);
+		GBIAS_Remove(fifoGyro[i]);
+		data.ICM_20948_gyro[0] = fifoGyro[i][0] * data.gyroRes;
+		data.ICM_20948_gyro[1] = fifoGyro[i][1] * data.gyroRes;
+		data.ICM_20948_gyro[2] = fifoGyro[i][2] * data.gyroRes;
+		data.ICM_20948_accel[0] = fifoAccel[i][0] * data.accelRes;
+		data.ICM_20948_accel[1] = fifoAccel[i][1] * data.accelRes;
+		data.ICM_20948_accel[2] = fifoAccel[i][2] * data.accelRes;
+
+		FUSION_Update(data.ICM_20948_gyro[0] * M_PI / 180.0f,
+				data.ICM_20948_gyro[1] * M_PI / 180.0f,
+				data.ICM_20948_gyro[2] * M_PI / 180.0f,
+				data.ICM_20948_accel[0], data.ICM_20948_accel[1],
+				data.ICM_20948_accel[2], data.ICM_20948_magn[0], data.ICM_20948_magn[1], data.ICM_20948_magn[2],
+				SAMPLE_DT_NOMINAL * (1.0f / RTC_TICK_FREQ));
+	}
+#endif
+#else
+	/* Time since the previous sample, from the data ready interrupt timestamps.
+	 * EVT_SENSORS_READ is counted, every queued timestamp has its own run,
+	 * a late run still reads the newest sample in the data registers.
+	 * The interrupt only posts with a timestamp queued, the tail never passes the head. */
+	uint32_t now;
+	if(sampleTicksTail != sampleTicksHead)
+	{
+		now = sampleTicks[sampleTicksTail++ & (SAMPLE_TICKS_QUEUE - 1)];
+	}else{
+		now = sampleTicks[(sampleTicksHead - 1) & (SAMPLE_TICKS_QUEUE - 1)];
+	}
+	uint32_t dt = now - lastSampleTicks;
+	lastSampleTicks = now;
+	if( (dt == 0) || (dt > SAMPLE_DT_MAX) )
+	{
+		dt = SAMPLE_DT_NOMINAL;
+	}
 
-//	uint32_t start = millis();
+#if IMU_BURST_READ == 1
+	/* Read all sensors in one transfer */
+	ICM_20948_burstRawDataRead(data.ICM_20948_accelRaw, data.ICM_20948_gyroRaw, data.ICM_20948_magnRaw);
+	GBIAS_Update(data.ICM_20948_gyroRaw, data.ICM_20948_accelRaw);
+	GBIAS_Remove(data.ICM_20948_gyroRaw);
+#if MADGWICK_FIXED_POINT == 0
+	data.ICM_20948_gyro[0] = data.ICM_20948_gyroRaw[0] * data.gyroRes;
+	data.ICM_20948_gyro[1] = data.ICM_20948_gyroRaw[1] * data.gyroRes;
+	data.ICM_20948_gyro[2] = data.ICM_20948_gyroRaw[2] * data.gyroRes;
+	data.ICM_20948_accel[0] = data.ICM_20948_accelRaw[0] * data.accelRes;
+	data.ICM_20948_accel[1] = data.ICM_20948_accelRaw[1] * data.accelRes;
+	data.ICM_20948_accel[2] = data.ICM_20948_accelRaw[2] * data.accelRes;
+	/* Only the direction of the magnetic field is used, counts are fine */
+	data.ICM_20948_magn[0] = data.ICM_20948_magnRaw[0];
+	data.ICM_20948_magn[1] = data.ICM_20948_magnRaw[1];
+	data.ICM_20948_magn[2] = data.ICM_20948_magnRaw[2];
+#endif
+#endif
 
-	/* Sensor fusion */
-	MadgwickAHRSupdate(data.ICM_20948_gyro[0] * M_PI / 180.0f,
+#if MADGWICK_FIXED_POINT == 1
+#if IMU_BURST_READ == 0
+	/* Read all sensors, raw values */
+	ICM_20948_gyroRawDataRead(data.ICM_20948_gyroRaw);
+	ICM_20948_accelRawDataRead(data.ICM_20948_accelRaw);
+	ICM_20948_magCalDataRead(data.ICM_20948_magnRaw);
+	GBIAS_Update(data.ICM_20948_gyroRaw, data.ICM_20948_accelRaw);
+	GBIAS_Remove(data.ICM_20948_gyroRaw);
+#endif
+
+	/* Sensor fusion, fixed-point */
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
+	uint32_t fusionStart = cycles();
+#endif /* DEBUG_DBPRINT */
+	MadgwickAHRSupdateFixed(data.ICM_20948_gyroRaw[0], data.ICM_20948_gyroRaw[1], data.ICM_20948_gyroRaw[2],
+			data.ICM_20948_accelRaw[0], data.ICM_20948_accelRaw[1], data.ICM_20948_accelRaw[2],
+			data.ICM_20948_magnRaw[0], data.ICM_20948_magnRaw[1], data.ICM_20948_magnRaw[2],
+			dt * (Q16_ONE / RTC_TICK_FREQ));
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
+	fusionCycles += cycles() - fusionStart;
+	fusionUpdates++;
+#endif /* DEBUG_DBPRINT */
+#else
+#if IMU_BURST_READ == 0
+	/* Read all sensors, raw gyro and accel for the bias tracking */
+	ICM_20948_gyroRawDataRead(data.ICM_20948_gyroRaw);
+	ICM_20948_accelRawDataRead(data.ICM_20948_accelRaw);
+	ICM_20948_magDataRead(data.ICM_20948_magn);
+	GBIAS_Update(data.ICM_20948_gyroRaw, data.ICM_20948_accelRaw);
+	GBIAS_Remove(data.ICM_20948_gyroRaw);
+	data.ICM_20948_gyro[0] = data.ICM_20948_gyroRaw[0] * data.gyroRes;
+	data.ICM_20948_gyro[1] = data.ICM_20948_gyroRaw[1] * data.gyroRes;
+	data.ICM_20948_gyro[2] = data.ICM_20948_gyroRaw[2] * data.gyroRes;
+	data.ICM_20948_accel[0] = data.ICM_20948_accelRaw[0] * data.accelRes;
+	data.ICM_20948_accel[1] = data.ICM_20948_accelRaw[1] * data.accelRes;
+	data.ICM_20948_accel[2] = data.ICM_20948_accelRaw[2] * data.accelRes;
+#endif
+
+	// TODO: embedded ICM_20948_magn_to_angle( ICM_20948_magn, ICM_20948_magn_angle );
+
+	/* Sensor fusion, engine of FUSION_ENGINE */
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
+	uint32_t fusionStart = cycles();
+#endif /* DEBUG_DBPRINT */
+	FUSION_Update(data.ICM_20948_gyro[0] * M_PI / 180.0f,
 			data.ICM_20948_gyro[1] * M_PI / 180.0f,
 			data.ICM_20948_gyro[2] * M_PI / 180.0f,
 			data.ICM_20948_accel[0], data.ICM_20948_accel[1],
-			data.ICM_20948_accel[2], data.ICM_20948_magn[0], data.ICM_20948_magn[1], data.ICM_20948_magn[2]);
-	QuaternionsToEulerAngles(data.ICM_20948_euler_angles);
+			data.ICM_20948_accel[2], data.ICM_20948_magn[0], data.ICM_20948_magn[1], data.ICM_20948_magn[2],
+			dt * (1.0f / RTC_TICK_FREQ));
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
+	fusionCycles += cycles() - fusionStart;
+	fusionUpdates++;
+#endif /* DEBUG_DBPRINT */
+#endif
+#endif /* ICM_20948_DMP_MODE, IMU_FIFO_MODE */
 
+#if (MAGCAL_ONLINE == 1) && (ICM_20948_DMP_MODE == 0)
+	/* Online magnetometer calibration, the fit runs from EVT_MAGCAL */
+	int16_t magCounts[3];
+	ICM_20948_magCountsGet(magCounts);
+	if(MAGCAL_Update(magCounts))
+	{
+		SCHED_Post(EVT_MAGCAL);
+	}
+#endif
 
 
-//	uint32_t duration = millis() - start;
 
-	/* Convert float's to uint8_t arrays for transmission over BLE */
-	float_to_uint8_t_x3(data.ICM_20948_euler_angles,
-			data.BLE_euler_angles);
+	/* Convert the orientation to uint8_t arrays for transmission over BLE */
+	orientation_pack();
 
 //	helft = !helft;
 
@@ -281,7 +637,20 @@ void measure_send( void )
 
 //	if(teller < 3)
 //	{
+#if BLE_BATCH_MODE == 1
+	/* Frame is sent every BLE_BATCH_SAMPLES samples */
+	uint32_t sendMillis = millis();
+#if BLE_PAYLOAD_QUATERNION == 1
+	BLE_batchAdd(data.BLE_quaternion, sendMillis - lastSendMillis, data.batt);
+#else
+	BLE_batchAdd(data.BLE_euler_angles, sendMillis - lastSendMillis, data.batt);
+#endif
+	lastSendMillis = sendMillis;
+#elif BLE_PAYLOAD_QUATERNION == 1
+	BLE_sendData(data.BLE_quaternion, data.batt, BLE_QUATERNION_LENGTH + 1, data.BLE_data);
+#else
 	BLE_sendData(data.BLE_euler_angles, data.batt, 13, data.BLE_data);
+#endif
 	/* Test frequency */
 	GPIO_PinOutSet(gpioPortE, 11);
 	GPIO_PinOutClear(gpioPortE, 11);
@@ -304,305 +673,411 @@ void measure_send( void )
 
 /**************************************************************************//**
  * @brief
- *   Main function
- *
- * @details
- *	State diagram
- *	BATT_READ and CALLIBRATE will never be reached
- *	Future update: calibrate when receiving special BLE packet
- *
+ *   Initialize clocks, IMU, ADC and BLE, start acquisition
  *
  *****************************************************************************/
-int main(void)
+static void app_init( void )
 {
+	/* Chip errata */
+	CHIP_Init();
 
-	/* Start with initialization */
-	appState = INIT;
 
-	/* Infinite loop */
-	while (1)
-	{
-		switch (appState)
-		{
-		/***************************/
-		case SYS_IDLE:
-		{
-			/* Wait in EM2 */
-//			EMU_EnterEM2(true);
+	/* ENABLE CODE CORRELATION --  uses SWO */
+	/* If first word of user data page is non-zero, enable eA Profiler trace */
+//	BSP_TraceProfilerSetup();
 
-		}
-			break;
-		/***************************/
-		case INIT:
-		{
-			/* Chip errata */
-			CHIP_Init();
+	/* FULL SPEED */
+	CMU_ClockSelectSet(cmuClock_HF, cmuSelect_HFXO);
+//	CMU_OscillatorEnable(cmuOsc_HFRCO, false, false);
 
+	CMU_ClockEnable(cmuClock_HFPER, true);
+	CMU_ClockEnable(cmuClock_GPIO, true);
 
-			/* ENABLE CODE CORRELATION --  uses SWO */
-			/* If first word of user data page is non-zero, enable eA Profiler trace */
-//			BSP_TraceProfilerSetup();
+	/* Set output pin to check frequency of execution */
 
-			/* FULL SPEED */
-			CMU_ClockSelectSet(cmuClock_HF, cmuSelect_HFXO);
-//			CMU_OscillatorEnable(cmuOsc_HFRCO, false, false);
-
-			CMU_ClockEnable(cmuClock_HFPER, true);
-			CMU_ClockEnable(cmuClock_GPIO, true);
-
-			/* Set output pin to check frequency of execution */
-
-			GPIO_PinModeSet(gpioPortE, 11, gpioModePushPull, 0);
+	GPIO_PinModeSet(gpioPortE, 11, gpioModePushPull, 0);
 
 #if DIY == 1
-			GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModePushPull, 1);
-			delay(1000);
-			GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModeDisabled, 0);
+	GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModePushPull, 1);
+	delay(1000);
+	GPIO_PinModeSet(LED_PORT, LED_PIN, gpioModeDisabled, 0);
 
-			blink(3);
+	blink(3);
 #endif
 
-			/* Leds on development board */
+	/* Leds on development board */
 #if DIY == 0
-			BSP_LedsInit();
+	BSP_LedsInit();
 #endif
 
-			/* Setup printing to virtual COM port, w */
+	/* Setup printing to virtual COM port, w */
 #if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
-			dbprint_INIT(USART1, 4, true, false);
+	dbprint_INIT(USART1, 4, true, false);
+	/* Cycle counter of fusion_cost_log */
+	cyclesEnable(true);
 #endif /* DEBUG_DBPRINT */
 
-			/* Timer init */
-			RTCDRV_Init();
-			RTCDRV_AllocateTimer(&IMU_Idle_Timer);
+	/* Timer init */
+	RTCDRV_Init();
+	RTCDRV_AllocateTimer(&IMU_Idle_Timer);
+#if IMU_FIFO_MODE == 1
+	RTCDRV_AllocateTimer(&IMU_Fifo_Timer);
+#endif
+	SCHED_ResidencyReset();
 
 
-			/* Initialize ICM_20948 + SPI interface */
-			ICM_20948_Init();
-			//ICM_20948_Init_SPI();
+	/* Initialize ICM_20948 + SPI interface */
+	ICM_20948_Init();
+	//ICM_20948_Init_SPI();
 
-			/* Initialize GPIO interrupts on port C 2 */
-			initGPIO_interrupt();
+	/* Stored calibration, full calibration if there is none or the gyro drifted */
+	CAL_Init(data.accelCal, data.gyroCal, data.magOffset, data.magMatrix);
 
-			/* Initialize ADC to read battery voltage */
-			initADC();
-//			ADC_get_batt(data.batt);
+	/* Full scale is known now, keep the resolutions for the raw data paths */
+	ICM_20948_gyroResolutionGet(&data.gyroRes);
+	ICM_20948_accelResolutionGet(&data.accelRes);
+	MadgwickAHRSsetGyroScaleFixed(data.gyroRes * M_PI / 180.0f);
+	MadgwickAHRSsetAccelScaleFixed(data.accelRes);
+	GBIAS_Init(data.gyroRes, data.accelRes);
+
+	/* Initialize GPIO interrupts on port C 2 */
+	initGPIO_interrupt();
+
+	/* Initialize ADC to read battery voltage */
+	initADC();
+//	ADC_get_batt(data.batt);
 
 
 
 #if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
-			dbprintln("INIT");
+	dbprintln("INIT");
 #endif /* DEBUG_DBPRINT */
 
-			/* Bluetooth */
+	/* Bluetooth */
 #if DEBUG_DBPRINT == 0 /* DEBUG_DBPRINT */
-			BLE_Init();
+	BLE_Init();
 #endif /* DEBUG_DBPRINT */
 
-			delay(200);
-			/* Set output power */
-//			BLE_set_output_power(BLE_OUTPUT_POWER_0DB);
-//			delay(100);
+	delay(200);
+	/* Set output power */
+//	BLE_set_output_power(BLE_OUTPUT_POWER_0DB);
+//	delay(100);
 
-			// TODO Temporary
-			/* Check connection */
+	/* Connect in the background, see BLE_linkProcess */
 #if DEBUG_DBPRINT == 0 /* DEBUG_DBPRINT */
-			BLE_check_connect();
-			if (!bleConnected)
-			{
-				BLE_power(true);
-				delay(1000);
-				BLE_connect();
-			}
+	if ( BLE_linkInit() )
+	{
+		BLE_linkStart();
+	}
 #endif /* DEBUG_DBPRINT */
 
-			/* Set interrupt to trigger every 100ms when the data is ready */
-			IMU_MEASURING = true;
-			ICM_20948_interruptEnable(true, false);
+	/* Start reading samples */
+	acquisition_start();
 
-			/* Fancy LED's */
+	/* Fancy LED's */
 #if DIY == 0
-			for(uint8_t i=0; i<8; i++)
-			{
-				BSP_LedSet(0);
-				BSP_LedSet(1);
-				delay(100);
-				BSP_LedClear(0);
-				BSP_LedClear(1);
-				delay(100);
-			}
+	for(uint8_t i=0; i<8; i++)
+	{
+		BSP_LedSet(0);
+		BSP_LedSet(1);
+		delay(100);
+		BSP_LedClear(0);
+		BSP_LedClear(1);
+		delay(100);
+	}
 #endif
 
-			/* Timer for checking if IMU is idle */
-			  RTCDRV_StartTimer( IMU_Idle_Timer, rtcdrvTimerTypePeriodic, 2000, (RTCDRV_Callback_t)CheckIMUidle, NULL);
-
-
-
-			appState = SYS_IDLE;
-
+	/* Timer for checking if IMU is idle */
+	  RTCDRV_StartTimer( IMU_Idle_Timer, rtcdrvTimerTypePeriodic, 2000, (RTCDRV_Callback_t)IdleTimer, NULL);
+}
 
-		}
-			break;
-			/***************************/
-		case SENSORS_READ:
-		{
+/**************************************************************************//**
+ * @brief
+ *   Handler of EVT_SENSORS_READ
+ *
+ *****************************************************************************/
+static void sensors_read( void )
+{
 
 #if DEBUG_DBPRINTs == 1 /* DEBUG_DBPRINT */
-			dbprintln("SENSORS_READ");
+	dbprintln("SENSORS_READ");
 #endif /* DEBUG_DBPRINT */
 
-			measure_send();
+	measure_send();
 
 #if DEBUG_DBPRINTs == 1 /* DEBUG_DBPRINT */
-			dbprintInt((int) ( data.ICM_20948_gyro[0]*100) );
-			dbprint(",");
-			dbprintInt((int) (data.ICM_20948_gyro[1] *100) );
-			dbprint(",");
-			dbprintInt((int) (data.ICM_20948_gyro[2] *100) );
-			dbprint(",");
-			dbprintInt((int) ( data.ICM_20948_accel[0]*100) );
-			dbprint(",");
-			dbprintInt((int) (data.ICM_20948_accel[1] *100) );
-			dbprint(",");
-			dbprintlnInt((int) (data.ICM_20948_accel[2] *100) );
+	dbprintInt((int) ( data.ICM_20948_gyro[0]*100) );
+	dbprint(",");
+	dbprintInt((int) (data.ICM_20948_gyro[1] *100) );
+	dbprint(",");
+	dbprintInt((int) (data.ICM_20948_gyro[2] *100) );
+	dbprint(",");
+	dbprintInt((int) ( data.ICM_20948_accel[0]*100) );
+	dbprint(",");
+	dbprintInt((int) (data.ICM_20948_accel[1] *100) );
+	dbprint(",");
+	dbprintlnInt((int) (data.ICM_20948_accel[2] *100) );
 #endif /* DEBUG_DBPRINT */
 
 #if DEBUG_DBPRINTs == 1 /* DEBUG_DBPRINT */
-			//dbprint("	roll: ");
-			dbprintInt((int) (ICM_20948_euler_angles[0] *100) );
-			//dbprint("	pitch: ");
-			dbprint("\t");
-			dbprintInt((int) (ICM_20948_euler_angles[1] *100) );
-			//dbprint("	yaw: ");
-			dbprint("\t");
-			dbprintlnInt((int) (ICM_20948_euler_angles[2] *100) );
+	//dbprint("	roll: ");
+	dbprintInt((int) (ICM_20948_euler_angles[0] *100) );
+	//dbprint("	pitch: ");
+	dbprint("\t");
+	dbprintInt((int) (ICM_20948_euler_angles[1] *100) );
+	//dbprint("	yaw: ");
+	dbprint("\t");
+	dbprintlnInt((int) (ICM_20948_euler_angles[2] *100) );
 #endif /* DEBUG_DBPRINT */
 
 #if DEBUG_DBPRINTs == 1 /* DEBUG_DBPRINT */
-			dbprintInt((int) ICM_20948_magn[0] );
-			dbprint(",");
-			dbprintInt((int) ICM_20948_magn[1] );
-			dbprint(",");
-			dbprintlnInt((int) ICM_20948_magn[2] );
+	dbprintInt((int) ICM_20948_magn[0] );
+	dbprint(",");
+	dbprintInt((int) ICM_20948_magn[1] );
+	dbprint(",");
+	dbprintlnInt((int) ICM_20948_magn[2] );
 #endif /* DEBUG_DBPRINT */
+}
 
-
-			/* If imu is idle, give it the chance to go to sleep */
-			if(!_sleep)
-			{
-				appState = SYS_IDLE;
-			}
-		}
-			break;
-			/***************************/
-		case BATT_READ:
-		{
-			ADC_Batt_Read();
-			ADC_get_batt(data.batt);
+/**************************************************************************//**
+ * @brief
+ *   Handler of EVT_BATT_READ
+ *
+ *****************************************************************************/
+static void batt_read( void )
+{
+	ADC_Batt_Read();
+	ADC_get_batt(data.batt);
 
 #if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
-			dbprintln("BATT_READ");
+	dbprintln("BATT_READ");
 #endif /* DEBUG_DBPRINT */
+}
 
-			appState = SYS_IDLE;
-		}
-			break;
-			/***************************/
-		case SLEEP:
-		{
-			//RTCDRV_StartTimer( IMU_Idle_Timer, rtcdrvTimerTypeOneshot, 2000, test, NULL);
+/**************************************************************************//**
+ * @brief
+ *   Handler of EVT_SLEEP, wait in EM2 for wake on motion and resume
+ *
+ *****************************************************************************/
+static void sleep_enter( void )
+{
+	uint32_t womStart;
+	uint32_t womEntries;
+
+	//RTCDRV_StartTimer( IMU_Idle_Timer, rtcdrvTimerTypeOneshot, 2000, test, NULL);
+
+	RTCDRV_StopTimer( IMU_Idle_Timer );
+#if ICM_20948_DMP_MODE == 1
+	ICM_20948_dmpEnable(false);
+#elif IMU_FIFO_MODE == 1
+	RTCDRV_StopTimer( IMU_Fifo_Timer );
+	ICM_20948_fifoStreamEnable(false);
+#endif
+#if DEBUG_DBPRINT == 0 /* DEBUG_DBPRINT */
+	/* No reconnecting while asleep */
+	BLE_linkStop();
+#endif /* DEBUG_DBPRINT */
+	/* RTCDRV keeps running: timers stay allocated and millis() continues */
 
-			RTCDRV_StopTimer( IMU_Idle_Timer );
-			RTCDRV_DeInit();
+#if BLE_BATCH_MODE == 1
+	/* Incomplete batch is outdated after sleep */
+	BLE_batchReset();
+#endif
+	BLE_disconnect();
+	delay(100);
+	BLE_power( false);
+	BLE_rxtx_enable( false );
 
-			BLE_disconnect();
-			delay(100);
-			BLE_power( false);
-			BLE_rxtx_enable( false );
+	bleConnected = false;
 
-			bleConnected = false;
+	CMU_ClockEnable(cmuClock_ADC0, false);
+//	GPIO_PinModeSet(gpioPortD, 4, gpioModeDisabled, 0);
 
-			CMU_ClockEnable(cmuClock_ADC0, false);
-//			GPIO_PinModeSet(gpioPortD, 4, gpioModeDisabled, 0);
+	GPIO_PinModeSet(gpioPortE, 11, gpioModeDisabled, 0);
 
-			GPIO_PinModeSet(gpioPortE, 11, gpioModeDisabled, 0);
 
+#if IMU_BURST_READ == 1
+	/* Back to bypass, magnetometer is accessed directly below */
+	ICM_20948_magAutoReadEnable(false);
+#endif
 
-			/* Shut down magnetometer */
-		    ICM_20948_set_mag_mode(AK09916_BIT_MODE_POWER_DOWN);
-		    delay(100);
+	/* IMU stays powered, only wake on motion changes need to be undone */
+	ICM_20948_wakeStateSave(&imuWakeState);
 
-		    uint8_t temp1[8];
-			ICM_20948_read_mag_register(0x31, 1, temp1);
-			/* Update data by reading through till ST2 register */
-			ICM_20948_read_mag_register(0x11, 8, temp1);
+	/* Shut down magnetometer */
+    ICM_20948_set_mag_mode(AK09916_BIT_MODE_POWER_DOWN);
+    delay(100);
 
+    uint8_t temp1[8];
+	ICM_20948_read_mag_register(0x31, 1, temp1);
+	/* Update data by reading through till ST2 register */
+	ICM_20948_read_mag_register(0x11, 8, temp1);
 
-			/* Wake on motion: 50 mg's (0.05 G) */
-			ICM_20948_wakeOnMotionITEnable(true, 20, 2.2);
-//			ICM_20948_sleepModeEnable(true);
-			delay(400);
 
-			IIC_Enable(false);
+	/* Wake on motion: 50 mg's (0.05 G) */
+	ICM_20948_wakeOnMotionITEnable(true, 20, 2.2);
+//	ICM_20948_sleepModeEnable(true);
+	delay(400);
 
+	IIC_Enable(false);
 
-			/* Disable Systicks before going to sleep */
-			EMU_EnterEM2(true);
 
+	/* Sleep until the wake on motion interrupt, other interrupts (RTC wall clock overflow) don't end it */
+	GPIO_IntClear(1 << ICM_20948_INTERRUPT_PIN);
+	womWait = true;
+	womStart = ticks();
+	womEntries = 0;
+	__disable_irq();
+	while(womWait)
+	{
+		EMU_EnterEM2(true);
+		womEntries++;
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+	/* RTCDRV kept running, the wait is EM2 in the residency log */
+	SCHED_ResidencyEM2Add(ticks() - womStart, womEntries);
 
-			///////////////////////////////////////////
-			/* When waking up, initialize everything */
-			///////////////////////////////////////////
 
-			CMU_ClockSelectSet(cmuClock_HF, cmuSelect_HFXO);
+	///////////////////////////////////////////
+	/* When waking up, restore what sleep changed */
+	///////////////////////////////////////////
 
-			IIC_Enable(true);
-			BLE_power(true);
-			BLE_rxtx_enable( true );
-			CMU_ClockEnable(cmuClock_ADC0, true);
+	CMU_ClockSelectSet(cmuClock_HF, cmuSelect_HFXO);
 
-			_sleep = false;
+	IIC_Enable(true);
+	ICM_20948_bankInvalidate();
+	BLE_rxtx_enable( true );
+	CMU_ClockEnable(cmuClock_ADC0, true);
 
-			/* Setup IMU */
-			ICM_20948_lowPowerModeEnter(false, false, false);
-			ICM_20948_Init2();
+	_sleep = false;
 
+	/* Setup IMU, no full init: full scales, calibration and filter state are unchanged */
+	ICM_20948_wakeStateRestore(&imuWakeState);
 
-			/* Timer for checking if IMU is idle */
-			RTCDRV_Init();
-			RTCDRV_AllocateTimer(&IMU_Idle_Timer);
-			RTCDRV_StartTimer( IMU_Idle_Timer, rtcdrvTimerTypePeriodic, 2000, (RTCDRV_Callback_t)CheckIMUidle, NULL);
+	/* Timer for checking if IMU is idle */
+	RTCDRV_StartTimer( IMU_Idle_Timer, rtcdrvTimerTypePeriodic, 2000, (RTCDRV_Callback_t)IdleTimer, NULL);
 
-			/* Set interrupt to trigger every 100ms when the data is ready */
-			IMU_MEASURING = true;
-			ICM_20948_interruptEnable(true, false);
+	/* Power BLE and connect in the background */
+#if DEBUG_DBPRINT == 0 /* DEBUG_DBPRINT */
+	BLE_linkStart();
+#endif /* DEBUG_DBPRINT */
 
-			GPIO_PinModeSet(gpioPortE, 11, gpioModePushPull, 0);
+	/* Start reading samples */
+	acquisition_start();
 
-			appState = SYS_IDLE;
+	GPIO_PinModeSet(gpioPortE, 11, gpioModePushPull, 0);
+#if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
+	dbprintln("SLEEP");
+#endif /* DEBUG_DBPRINT */
+}
 
+/**************************************************************************//**
+ * @brief
+ *   Handler of EVT_CALLIBRATE
+ *
+ *****************************************************************************/
+static void callibrate( void )
+{
 #if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
-			dbprintln("SLEEP");
+	dbprintln("CALLIBRATE");
 #endif /* DEBUG_DBPRINT */
-		}
-			break;
-			/***************************/
-		case CALLIBRATE:
-		{
+
+#if ICM_20948_DMP_MODE == 1
+	/* Calibration uses the FIFO */
+	ICM_20948_dmpEnable(false);
+#elif IMU_BURST_READ == 1
+	ICM_20948_magAutoReadEnable(false);
+#endif
+	CAL_Calibrate(data.accelCal, data.gyroCal, data.magOffset, data.magMatrix);
+	/* Offset registers changed, restart the bias tracking */
+	GBIAS_Init(data.gyroRes, data.accelRes);
+	/* New magn correction, learn the undisturbed field again */
+#if MADGWICK_FIXED_POINT == 1
+	MadgwickMagGateReset(&magGateFixed);
+#else
+	MadgwickMagGateReset(&magGate);
+#endif
+#if ICM_20948_DMP_MODE == 1
+	acquisition_start();
+#elif (IMU_BURST_READ == 1) && (IMU_FIFO_MODE == 0)
+	ICM_20948_magAutoReadEnable(true);
+#endif
+}
+
+#if MAGCAL_ONLINE == 1
+/**************************************************************************//**
+ * @brief
+ *   Handler of EVT_MAGCAL
+ *
+ * @details
+ *	 Lowest priority, the fit (~10 ms) runs when no samples are waiting.
+ *	 The first converged fit of this boot is stored, see CAL_MagSave.
+ *
+ *****************************************************************************/
+static void magcal_solve( void )
+{
+	if(MAGCAL_Solve() != OK)
+	{
+		return;
+	}
+
+	MAGCAL_Get(data.magOffset, data.magMatrix);
+	/* New magn correction, learn the undisturbed field again */
+#if MADGWICK_FIXED_POINT == 1
+	MadgwickMagGateReset(&magGateFixed);
+#else
+	MadgwickMagGateReset(&magGate);
+#endif
+
+	if( !magcalStored && MAGCAL_Converged() )
+	{
+		magcalStored = (CAL_MagSave(data.magOffset, data.magMatrix, MAGCAL_FitError()) == OK);
+
 #if DEBUG_DBPRINT == 1 /* DEBUG_DBPRINT */
-			dbprintln("CALLIBRATE");
+		dbprint("MAGCAL fit error (per mille): ");
+		dbprintlnInt((int) (MAGCAL_FitError() * 1000));
 #endif /* DEBUG_DBPRINT */
+	}
+}
+#endif /* MAGCAL_ONLINE */
 
-			ICM_20948_accelGyroCalibrate(data.accelCal, data.gyroCal);
-			ICM_20948_calibrate_mag(data.magOffset, data.magScale);
+/**************************************************************************//**
+ * @brief
+ *   Main function
+ *
+ * @details
+ *	Initialize, then handle events posted by the interrupts and RTC timers, see SCHED_Run
+ *	EVT_BATT_READ and EVT_CALLIBRATE are never posted
+ *	Future update: calibrate when receiving special BLE packet
+ *
+ *
+ *****************************************************************************/
+int main(void)
+{
+	SCHED_Init();
+	SCHED_HandlerSet(EVT_SLEEP, sleep_enter);
+	SCHED_HandlerSet(EVT_SENSORS_READ, sensors_read);
+#if (ICM_20948_DMP_MODE == 0) && (IMU_FIFO_MODE == 0)
+	/* One sensors_read per data ready interrupt, a busy loop must not merge samples.
+	 * At most SAMPLE_TICKS_QUEUE runs are queued, GPIO_EVEN_IRQHandler stops posting when its queue is full. */
+	SCHED_CountedSet(EVT_SENSORS_READ, true);
+#endif
+#if DEBUG_DBPRINT == 0 /* DEBUG_DBPRINT */
+	SCHED_HandlerSet(EVT_BLE_LINK, BLE_linkProcess);
+#endif /* DEBUG_DBPRINT */
+	SCHED_HandlerSet(EVT_IDLE_CHECK, CheckIMUidle);
+	SCHED_HandlerSet(EVT_BATT_READ, batt_read);
+	SCHED_HandlerSet(EVT_CALLIBRATE, callibrate);
+#if MAGCAL_ONLINE == 1
+	SCHED_HandlerSet(EVT_MAGCAL, magcal_solve);
+#endif
 
-			appState = SYS_IDLE;
-		}
-			break;
-			/***************************/
-		} //switch
+	app_init();
 
-	} //while
+	/* Sleep between events */
+	SCHED_Run();
 } //main
 
 
@@ -613,12 +1088,35 @@ int main(void)
 
 
 /**************************************************************************//**
- * @brief GPIO Even IRQ for pushbuttons on even-numbered pins
+ * @brief GPIO Even IRQ, IMU data ready (C2) and BLE LED2 (A10)
  *****************************************************************************/
 void GPIO_EVEN_IRQHandler(void)
 {
+	uint32_t flags = GPIO_IntGet() & 0x5555;
+
 	// Clear all even pin interrupt flags
 	GPIO_IntClear(0x5555);
+
+	/* BLE link up or down */
+	if( flags & (1 << BLE_LED2_PIN) )
+	{
+		BLE_linkLedIRQ();
+	}
+
+	if( !(flags & (1 << ICM_20948_INTERRUPT_PIN)) )
+	{
+		return;
+	}
+
+	/* Wake on motion, sleep_enter resumes */
+	if(womWait)
+	{
+		womWait = false;
+		return;
+	}
+
+	/* Timestamp of the sample that is ready in the IMU */
+	uint32_t now = ticks();
 #if DEBUG_DBPRINTs == 1 /* DEBUG_DBPRINT */
 	dbprint("Interrupt fired! 1");
 #endif /* DEBUG_DBPRINT */
@@ -630,15 +1128,23 @@ void GPIO_EVEN_IRQHandler(void)
 //	/* AND with mask to check only bit 4 of byte 1 */
 //	if( (interruptStatus[0] & 8) == 8 ) /* If interrupt is bit WOM interrupt */
 //	{
-//		appState = SLEEP;
+//		SCHED_Post(EVT_SLEEP);
 //	}else{
 
 	/* If sensor is not trying to sleep, read sensors
 	 * Otherwise bug when trying to sleep but still last interrupts occurring, sensor won't go to sleep
 	 */
-	if(appState != SLEEP)
+	if(!_sleep)
 	{
-		appState = SENSORS_READ;
+		/* Queue full: no extra run, the newest run spans the missed interrupts */
+		if(sampleTicksHead - sampleTicksTail < SAMPLE_TICKS_QUEUE)
+		{
+			sampleTicks[sampleTicksHead & (SAMPLE_TICKS_QUEUE - 1)] = now;
+			sampleTicksHead++;
+			SCHED_Post(EVT_SENSORS_READ);
+		}else{
+			sampleTicks[(sampleTicksHead - 1) & (SAMPLE_TICKS_QUEUE - 1)] = now;
+		}
 	}
 
 
@@ -657,7 +1163,7 @@ void GPIO_ODD_IRQHandler(void)
 	dbprint("Interrupt fired! 2");
 #endif /* DEBUG_DBPRINT */
 
-//	appState = SENSORS_READ;
+//	SCHED_Post(EVT_SENSORS_READ);
 }
 
 